@@ -556,24 +556,71 @@ static struct enet_statistics *get_stats(struct device *dev)
 }
 
 #ifdef HAVE_MULTICAST
+/* The ethernet CRC, most significant bit first as the 8390 computes it. */
+static unsigned long ether_crc(unsigned char *data, int length)
+{
+    unsigned long crc = 0xffffffff;
+    unsigned char octet;
+    int bit;
+
+    while (--length >= 0) {
+		octet = *data++;
+		for (bit = 0; bit < 8; bit++, octet >>= 1)
+			crc = (crc << 1) ^
+				(((crc >> 31) ^ (octet & 1)) ? 0x04c11db7 : 0);
+    }
+    return crc;
+}
+
+/* Write the hash filter into the MAR registers, which live on page 1. */
+static void load_mcfilter(struct device *dev)
+{
+    int e8390_base = dev->base_addr;
+    unsigned long flags;
+    int i, cmd;
+
+    save_flags(flags);
+    cli();
+    cmd = inb_p(e8390_base + E8390_CMD) & (E8390_STOP | E8390_START);
+    outb_p(E8390_NODMA + E8390_PAGE1 + cmd, e8390_base + E8390_CMD);
+    for(i = 0; i < 8; i++)
+		outb_p(ei_status.mcfilter[i], e8390_base + EN1_MULT + i);
+    outb_p(E8390_NODMA + E8390_PAGE0 + cmd, e8390_base + E8390_CMD);
+    restore_flags(flags);
+}
+
 /* Set or clear the multicast filter for this adaptor.
    num_addrs == -1	Promiscuous mode, receive all packets
    num_addrs == 0	Normal mode, clear multicast list
-   num_addrs > 0	Multicast mode, receive normal and MC packets, and do
-   .   				best-effort filtering.
+   num_addrs > 0	Multicast mode, receive normal and MC packets, and let
+   .			the hash filter pick out the groups in addrs.
+   A multicast frame is taken if the MAR bit indexed by the top six bits
+   of the CRC of its destination address is set.
    */
 static void set_multicast_list(struct device *dev, int num_addrs, void *addrs)
 {
     short ioaddr = dev->base_addr;
+    unsigned char *addr = addrs;
+    unsigned long crc;
+    int i;
     
-    if (num_addrs > 0) {
-		/* The multicast-accept list is initialized to accept-all, and we
-		   rely on higher-level filtering for now. */
-		outb_p(E8390_RXCONFIG | 0x08, ioaddr + EN0_RXCR);
-    } else if (num_addrs < 0)
-		outb_p(E8390_RXCONFIG | 0x10, ioaddr + EN0_RXCR);
+    memset(ei_status.mcfilter, 0, 8);
+    if (num_addrs < 0 || (dev->flags & IFF_ALLMULTI)) {
+		memset(ei_status.mcfilter, 0xff, 8);
+    } else {
+		for (i = 0; i < num_addrs; i++, addr += ETH_ALEN) {
+			crc = ether_crc(addr, ETH_ALEN);
+			ei_status.mcfilter[crc >> 29] |= 1 << ((crc >> 26) & 7);
+		}
+    }
+    if (num_addrs < 0)
+		ei_status.rxcr = 0x18;
+    else if (num_addrs > 0 || (dev->flags & IFF_ALLMULTI))
+		ei_status.rxcr = 0x08;
     else
-		outb_p(E8390_RXCONFIG, ioaddr + EN0_RXCR);
+		ei_status.rxcr = 0;
+    load_mcfilter(dev);
+    outb_p(E8390_RXCONFIG | ei_status.rxcr, ioaddr + EN0_RXCR);
 }
 #endif
 
@@ -665,16 +712,14 @@ void NS8390_init(struct device *dev, int startp)
     outb_p(0x00,  e8390_base + EN0_IMR);
     
     /* Copy the station address into the DS8390 registers,
-       and set the multicast hash bitmap to receive all multicasts. */
+       and put back the multicast hash bitmap we were last given. */
     cli();
     outb_p(E8390_NODMA + E8390_PAGE1 + E8390_STOP, e8390_base); /* 0x61 */
     for(i = 0; i < 6; i++) {
 		outb_p(dev->dev_addr[i], e8390_base + EN1_PHYS + i);
     }
-    /* Initialize the multicast list to accept-all.  If we enable multicast
-       the higher levels can do the filtering. */
     for(i = 0; i < 8; i++)
-		outb_p(0xff, e8390_base + EN1_MULT + i);
+		outb_p(ei_local->mcfilter[i], e8390_base + EN1_MULT + i);
     
     outb_p(ei_local->rx_start_page,	 e8390_base + EN1_CURPAG);
     outb_p(E8390_NODMA+E8390_PAGE0+E8390_STOP, e8390_base);
@@ -689,7 +734,7 @@ void NS8390_init(struct device *dev, int startp)
 		outb_p(E8390_NODMA+E8390_PAGE0+E8390_START, e8390_base);
 		outb_p(E8390_TXCONFIG, e8390_base + EN0_TXCR); /* xmit on. */
 		/* 3c503 TechMan says rxconfig only after the NIC is started. */
-		outb_p(E8390_RXCONFIG,	e8390_base + EN0_RXCR); /* rx on,  */
+		outb_p(E8390_RXCONFIG | ei_local->rxcr, e8390_base + EN0_RXCR); /* rx on,  */
     }
     return;
 }
@@ -57,6 +57,8 @@ struct ei_device {
   unsigned char reg0;		/* Register '0' in a WD8013 */
   unsigned char reg5;		/* Register '5' in a WD8013 */
   unsigned char saved_irq;	/* Original dev->irq value. */
+  unsigned char rxcr;		/* EN0_RXCR mode bits beyond E8390_RXCONFIG */
+  unsigned char mcfilter[8];	/* Multicast hash filter, EN1_MULT */
   /* The new statistics table. */
   struct enet_statistics stat;
 };
@@ -586,6 +586,7 @@ depca_probe1(struct device *dev, short ioaddr)
 	/* The DEPCA-specific entries in the device structure. */
 	dev->open = &depca_open;
 	dev->hard_start_xmit = &depca_start_xmit;
+	dev->gather = 1;
 	dev->stop = &depca_close;
 	dev->get_stats = &depca_get_stats;
 #ifdef HAVE_MULTICAST
@@ -834,8 +835,9 @@ depca_start_xmit(struct sk_buff *skb, struct device *dev)
       /* Clears various error flags */
       lp->tx_ring[entry].misc = 0x0000;
 
-      /* copy the data from the socket buffer to the net memory */
-      memcpy((unsigned char *)(buf), skb->data, len);
+      /* copy the data from the socket buffer to the net memory,
+         gathering it from the fraglist if it has one */
+      skb_copy_bits(skb, 0, (unsigned char *)(buf), len);
 
       /* Hand over buffer ownership to the LANCE */
       if (skbL <= 0) lp->tx_ring[entry].base |= (T_ENP);
@@ -871,7 +873,7 @@ depca_start_xmit(struct sk_buff *skb, struct device *dev)
 	lp->tx_ring[entry].misc = 0x0000;
 
 	/* copy the data from the socket buffer to the net memory */
-	memcpy((unsigned char *)(buf + PKT_HDR_LEN), (unsigned char *)p, len);
+	skb_copy_bits(skb, p - (char *)skb->data, (unsigned char *)(buf + PKT_HDR_LEN), len);
 
 	/* Hand over buffer ownership to the LANCE */
 	if (skbL <= 0) lp->tx_ring[entry].base |= T_ENP;
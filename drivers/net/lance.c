@@ -182,7 +182,7 @@ struct lance_tx_head {
 struct lance_init_block {
     unsigned short mode;	/* Pre-set mode (reg. 15) */
     unsigned char phys_addr[6];	/* Physical ethernet address */
-    unsigned filter[2];		/* Multicast filter (unused). */
+    unsigned filter[2];		/* Multicast filter. */
     /* Receive and transmit ring base, along with extra bits. */
     unsigned rx_ring;		/* Tx and Rx ring base pointers */
     unsigned tx_ring;
@@ -357,6 +357,7 @@ unsigned long lance_probe1(short ioaddr, unsigned long mem_start)
     /* The LANCE-specific entries in the device structure. */
     dev->open = &lance_open;
     dev->hard_start_xmit = &lance_start_xmit;
+    dev->gather = 1;
     dev->stop = &lance_close;
     dev->get_stats = &lance_get_stats;
 #ifdef HAVE_MULTICAST
@@ -458,8 +459,7 @@ lance_init_ring(struct device *dev)
     lp->init_block.mode = 0x0000;
     for (i = 0; i < 6; i++)
 	lp->init_block.phys_addr[i] = dev->dev_addr[i];
-    lp->init_block.filter[0] = 0x00000000;
-    lp->init_block.filter[1] = 0x00000000;
+    /* The multicast filter is left as set_multicast_list() last set it. */
     lp->init_block.rx_ring = (int)lp->rx_ring | RX_RING_LEN_BITS;
     lp->init_block.tx_ring = (int)lp->tx_ring | TX_RING_LEN_BITS;
 }
@@ -552,12 +552,12 @@ lance_start_xmit(struct sk_buff *skb, struct device *dev)
     lp->tx_ring[entry].misc = 0x0000;
 
     /* If any part of this buffer is >16M we must copy it to a low-memory
-       buffer. */
-    if ((int)(skb->data) + skb->len > 0x01000000) {
+       buffer.  A fraglisted buffer is gathered into one the same way. */
+    if (skb->fraglist != NULL || (int)(skb->data) + skb->len > 0x01000000) {
 	if (lance_debug > 5)
 	    printk("%s: bouncing a high-memory packet (%#x).\n",
 		   dev->name, (int)(skb->data));
-	memcpy(&lp->tx_bounce_buffs[entry], skb->data, skb->len);
+	skb_copy_bits(skb, 0, (unsigned char *)&lp->tx_bounce_buffs[entry], skb->len);
 	lp->tx_ring[entry].base =
 	    (int)(lp->tx_bounce_buffs + entry) | 0x83000000;
 	if (skb->free)
@@ -809,33 +809,61 @@ lance_get_stats(struct device *dev)
 }
 
 #ifdef HAVE_MULTICAST
+/* The ethernet CRC, least significant bit first as the LANCE computes it. */
+static unsigned long
+ether_crc_le(unsigned char *data, int length)
+{
+    unsigned long crc = 0xffffffff;
+    unsigned char octet;
+    int bit;
+
+    while (--length >= 0) {
+	octet = *data++;
+	for (bit = 0; bit < 8; bit++, octet >>= 1)
+	    crc = (crc >> 1) ^ (((crc ^ octet) & 1) ? 0xedb88320 : 0);
+    }
+    return crc;
+}
+
 /* Set or clear the multicast filter for this adaptor.
    num_addrs == -1	Promiscuous mode, receive all packets
    num_addrs == 0	Normal mode, clear multicast list
-   num_addrs > 0	Multicast mode, receive normal and MC packets, and do
-   			best-effort filtering.
+   num_addrs > 0	Multicast mode, receive normal and MC packets, and let
+   			the logical address filter pick out the groups in addrs.
+   The top six bits of a destination's CRC index the 64 bit filter.  It is
+   kept in the init block too, so a re-init of the chip doesn't lose it.
  */
 static void
 set_multicast_list(struct device *dev, int num_addrs, void *addrs)
 {
+    struct lance_private *lp = (struct lance_private *)dev->priv;
+    unsigned short *multicast_table = (unsigned short *)lp->init_block.filter;
+    unsigned char *addr = addrs;
     short ioaddr = dev->base_addr;
+    unsigned long crc;
+    int i;
 
-    /* We take the simple way out and always enable promiscuous mode. */
     outw(0, ioaddr+LANCE_ADDR);
     outw(0x0004, ioaddr+LANCE_DATA); /* Temporarily stop the lance.  */
 
-    outw(15, ioaddr+LANCE_ADDR);
     if (num_addrs >= 0) {
-	short multicast_table[4];
-	int i;
-	/* We don't use the multicast table, but rely on upper-layer filtering. */
-	memset(multicast_table, (num_addrs == 0) ? 0 : -1, sizeof(multicast_table));
+	if (dev->flags & IFF_ALLMULTI)
+	    memset(multicast_table, 0xff, 8);
+	else {
+	    memset(multicast_table, 0, 8);
+	    for (i = 0; i < num_addrs; i++, addr += ETH_ALEN) {
+		crc = ether_crc_le(addr, ETH_ALEN) >> 26;
+		multicast_table[crc >> 4] |= 1 << (crc & 0xf);
+	    }
+	}
 	for (i = 0; i < 4; i++) {
 	    outw(8 + i, ioaddr+LANCE_ADDR);
 	    outw(multicast_table[i], ioaddr+LANCE_DATA);
 	}
+	outw(15, ioaddr+LANCE_ADDR);
 	outw(0x0000, ioaddr+LANCE_DATA); /* Unset promiscuous mode */
     } else {
+	outw(15, ioaddr+LANCE_ADDR);
 	outw(0x8000, ioaddr+LANCE_DATA); /* Set promiscuous mode */
     }
 
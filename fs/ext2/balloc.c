@@ -42,80 +42,6 @@
 
 #define in_range(b, first, len)		((b) >= (first) && (b) <= (first) + (len) - 1)
 
-static inline int find_first_zero_bit (unsigned long * addr, unsigned size)
-{
-	int res;
-
-	if (!size)
-		return 0;
-	__asm__("
-		cld
-		movl $-1,%%eax
-		repe; scasl
-		je 1f
-		subl $4,%%edi
-		movl (%%edi),%%eax
-		notl %%eax
-		bsfl %%eax,%%edx
-		jmp 2f
-1:		xorl %%edx,%%edx
-2:		subl %%ebx,%%edi
-		shll $3,%%edi
-		addl %%edi,%%edx"
-		:"=d" (res)
-		:"c" ((size + 31) >> 5), "D" (addr), "b" (addr)
-		:"ax", "bx", "cx", "di");
-	return res;
-}
-
-static inline int find_next_zero_bit (unsigned long * addr, int size,
-				      int offset)
-{
-	unsigned long * p = ((unsigned long *) addr) + (offset >> 5);
-	int set = 0, bit = offset & 31, res;
-	
-	if (bit) {
-		/*
-		 * Look for zero in first byte
-		 */
-		__asm__("
-			bsfl %1,%0
-			jne 1f
-			movl $32, %0
-1:			"
-			: "=r" (set)
-			: "r" (~(*p >> bit)));
-		if (set < (32 - bit))
-			return set + offset;
-		set = 32 - bit;
-		p++;
-	}
-	/*
-	 * No zero yet, search remaining full bytes for a zero
-	 */
-	res = find_first_zero_bit (p, size - 32 * (p - addr));
-	return (offset + set + res);
-}
-
-static inline char * find_first_zero_byte (char * addr, int size)
-{
-	char *res;
-
-	if (!size)
-		return 0;
-	__asm__("
-		cld
-		mov $0,%%eax
-		repnz; scasb
-		jnz 1f
-		dec %%edi
-1:		"
-		: "=D" (res)
-		: "0" (addr), "c" (size)
-		: "ax");
-	return res;
-}
-
 static struct ext2_group_desc * get_group_desc (struct super_block * sb,
 						unsigned int block_group,
 						struct buffer_head ** bh)
@@ -144,106 +70,33 @@ static struct ext2_group_desc * get_group_desc (struct super_block * sb,
 	return gdp + desc;
 }
 
-static void read_block_bitmap (struct super_block * sb,
-			       unsigned int block_group,
-			       unsigned long bitmap_nr)
-{
-	struct ext2_group_desc * gdp;
-	struct buffer_head * bh;
-	
-	gdp = get_group_desc (sb, block_group, NULL);
-	bh = bread (sb->s_dev, gdp->bg_block_bitmap, sb->s_blocksize);
-	if (!bh)
-		ext2_panic (sb, "read_block_bitmap",
-			    "Cannot read block bitmap\n"
-			    "block_group = %d, block_bitmap = %lu",
-			    block_group, gdp->bg_block_bitmap);
-	sb->u.ext2_sb.s_block_bitmap_number[bitmap_nr] = block_group;
-	sb->u.ext2_sb.s_block_bitmap[bitmap_nr] = bh;
-}
-
 /*
- * load_block_bitmap loads the block bitmap for a blocks group
- *
- * It maintains a cache for the last bitmaps loaded.  This cache is managed
- * with a LRU algorithm.
- *
- * Notes:
- * 1/ There is one cache per mounted file system.
- * 2/ If the file system contains less than EXT2_MAX_GROUP_LOADED groups,
- *    this function reads the bitmap without maintaining a LRU cache.
+ * load_block_bitmap returns the block bitmap of a blocks group, reading it
+ * into the file system's bitmap cache if it isn't there already.
  */
-static int load__block_bitmap (struct super_block * sb,
-			       unsigned int block_group)
+static struct buffer_head * load_block_bitmap (struct super_block * sb,
+					       unsigned int block_group)
 {
-	int i, j;
-	unsigned long block_bitmap_number;
-	struct buffer_head * block_bitmap;
+	struct ext2_group_desc * gdp;
+	struct buffer_head * bh;
 
 	if (block_group >= sb->u.ext2_sb.s_groups_count)
 		ext2_panic (sb, "load_block_bitmap",
 			    "block_group >= groups_count\n"
 			    "block_group = %d, groups_count = %lu",
 			    block_group, sb->u.ext2_sb.s_groups_count);
-
-	if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED) {
-		if (sb->u.ext2_sb.s_block_bitmap[block_group]) {
-			if (sb->u.ext2_sb.s_block_bitmap_number[block_group] !=
-			    block_group)
-				ext2_panic (sb, "load_block_bitmap",
-					    "block_group != block_bitmap_number");
-			else
-				return block_group;
-		} else {
-			read_block_bitmap (sb, block_group, block_group);
-			return block_group;
-		}
-	}
-
-	for (i = 0; i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-		    sb->u.ext2_sb.s_block_bitmap_number[i] != block_group; i++)
-		;
-	if (i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-  	    sb->u.ext2_sb.s_block_bitmap_number[i] == block_group) {
-		block_bitmap_number = sb->u.ext2_sb.s_block_bitmap_number[i];
-		block_bitmap = sb->u.ext2_sb.s_block_bitmap[i];
-		for (j = i; j > 0; j--) {
-			sb->u.ext2_sb.s_block_bitmap_number[j] =
-				sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_block_bitmap[j] =
-				sb->u.ext2_sb.s_block_bitmap[j - 1];
-		}
-		sb->u.ext2_sb.s_block_bitmap_number[0] = block_bitmap_number;
-		sb->u.ext2_sb.s_block_bitmap[0] = block_bitmap;
-	} else {
-		if (sb->u.ext2_sb.s_loaded_block_bitmaps < EXT2_MAX_GROUP_LOADED)
-			sb->u.ext2_sb.s_loaded_block_bitmaps++;
-		else
-			brelse (sb->u.ext2_sb.s_block_bitmap[EXT2_MAX_GROUP_LOADED - 1]);
-		for (j = sb->u.ext2_sb.s_loaded_block_bitmaps - 1; j > 0;  j--) {
-			sb->u.ext2_sb.s_block_bitmap_number[j] =
-				sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_block_bitmap[j] =
-				sb->u.ext2_sb.s_block_bitmap[j - 1];
-		}
-		read_block_bitmap (sb, block_group, 0);
-	}
-	return 0;
-}
-
-static inline int load_block_bitmap (struct super_block * sb,
-				     unsigned int block_group)
-{
-	if (sb->u.ext2_sb.s_loaded_block_bitmaps > 0 &&
-	    sb->u.ext2_sb.s_block_bitmap_number[0] == block_group)
-		return 0;
-	
-	if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED && 
-	    sb->u.ext2_sb.s_block_bitmap_number[block_group] == block_group &&
-	    sb->u.ext2_sb.s_block_bitmap[block_group]) 
-		return block_group;
-
-	return load__block_bitmap (sb, block_group);
+	bh = ext2_bitmap_lookup (&sb->u.ext2_sb.s_block_bitmaps, block_group);
+	if (bh)
+		return bh;
+	gdp = get_group_desc (sb, block_group, NULL);
+	bh = bread (sb->s_dev, gdp->bg_block_bitmap, sb->s_blocksize);
+	if (!bh)
+		ext2_panic (sb, "load_block_bitmap",
+			    "Cannot read block bitmap\n"
+			    "block_group = %d, block_bitmap = %lu",
+			    block_group, gdp->bg_block_bitmap);
+	ext2_bitmap_insert (&sb->u.ext2_sb.s_block_bitmaps, block_group, bh);
+	return bh;
 }
 
 void ext2_free_blocks (struct super_block * sb, unsigned long block,
@@ -254,7 +107,6 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
 	unsigned long block_group;
 	unsigned long bit;
 	unsigned long i;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
 	struct ext2_super_block * es;
 
@@ -283,8 +135,7 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
 			    "Freeing blocks across group boundary\n"
 			    "Block = %lu, count = %lu",
 			    block, count);
-	bitmap_nr = load_block_bitmap (sb, block_group);
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+	bh = load_block_bitmap (sb, block_group);
 	gdp = get_group_desc (sb, block_group, &bh2);
 
 	if (test_opt (sb, CHECK_STRICT) &&
@@ -300,6 +151,7 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
 			    block, count);
 
 	for (i = 0; i < count; i++) {
+		ext2_journal_revoke (sb, block + i);
 		if (!clear_bit (bit + i, bh->b_data))
 			ext2_warning (sb, "ext2_free_blocks",
 				      "bit already cleared for block %lu", 
@@ -310,10 +162,10 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
 		}
 	}
 	
-	bh2->b_dirt = 1;
+	ext2_journal_dirty (sb, bh2);
 	sb->u.ext2_sb.s_sbh->b_dirt = 1;
 
-	bh->b_dirt = 1;
+	ext2_journal_dirty (sb, bh);
 	if (sb->s_flags & MS_SYNC) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -329,6 +181,11 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ *
+ * On entry *prealloc_count is how many blocks past this one the caller
+ * would like reserved, 0 meaning EXT2_DEFAULT_PREALLOC; on return it is
+ * how many were.  When more than the default is asked for, a free run that
+ * long is looked for before settling for the blocks near the goal.
  */
 int ext2_new_block (struct super_block * sb, unsigned long goal,
 		    unsigned long * prealloc_count,
@@ -338,14 +195,19 @@ int ext2_new_block (struct super_block * sb, unsigned long goal,
 	struct buffer_head * bh2;
 	char * p, * r;
 	int i, j, k, tmp;
+	int want = EXT2_DEFAULT_PREALLOC;
 	unsigned long lmap;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
 	struct ext2_super_block * es;
 
 #ifdef EXT2FS_DEBUG
 	static int goal_hits = 0, goal_attempts = 0;
 #endif
+	if (prealloc_block) {
+		if (*prealloc_count)
+			want = *prealloc_count;
+		*prealloc_count = 0;
+	}
 	if (!sb) {
 		printk ("ext2_new_block: nonexistent device");
 		return 0;
@@ -373,8 +235,7 @@ repeat:
 		if (j)
 			goal_attempts++;
 #endif
-		bitmap_nr = load_block_bitmap (sb, i);
-		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+		bh = load_block_bitmap (sb, i);
 
 		ext2_debug ("goal is at %d:%d.\n", i, j);
 
@@ -385,6 +246,15 @@ repeat:
 #endif
 			goto got_block;
 		}
+		if (prealloc_block && want > EXT2_DEFAULT_PREALLOC) {
+			k = find_zero_run (bh->b_data,
+					   EXT2_BLOCKS_PER_GROUP(sb), j,
+					   want + 1);
+			if (k < EXT2_BLOCKS_PER_GROUP(sb)) {
+				j = k;
+				goto got_block;
+			}
+		}
 		if (j) {
 			/*
 			 * The goal was occupied; search forward for a free 
@@ -455,8 +325,13 @@ repeat:
 		unlock_super (sb);
 		return 0;
 	}
-	bitmap_nr = load_block_bitmap (sb, i);
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+	bh = load_block_bitmap (sb, i);
+	if (prealloc_block && want > EXT2_DEFAULT_PREALLOC) {
+		j = find_zero_run (bh->b_data, EXT2_BLOCKS_PER_GROUP(sb), 0,
+				   want + 1);
+		if (j < EXT2_BLOCKS_PER_GROUP(sb))
+			goto got_block;
+	}
 	r = find_first_zero_byte (bh->b_data, 
 				  EXT2_BLOCKS_PER_GROUP(sb) >> 3);
 	j = (r - bh->b_data) << 3;
@@ -507,10 +382,9 @@ got_block:
 	 */
 #ifdef EXT2_PREALLOCATE
 	if (prealloc_block) {
-		*prealloc_count = 0;
 		*prealloc_block = tmp + 1;
 		for (k = 1;
-		     k < 8 && (j + k) < EXT2_BLOCKS_PER_GROUP(sb); k++) {
+		     k <= want && (j + k) < EXT2_BLOCKS_PER_GROUP(sb); k++) {
 			if (set_bit (j + k, bh->b_data))
 				break;
 			(*prealloc_count)++;
@@ -524,7 +398,7 @@ got_block:
 
 	j = tmp;
 
-	bh->b_dirt = 1;
+	ext2_journal_dirty (sb, bh);
 	if (sb->s_flags & MS_SYNC) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -551,7 +425,7 @@ got_block:
 		    "Goal hits %d of %d.\n", j, goal_hits, goal_attempts);
 
 	gdp->bg_free_blocks_count--;
-	bh2->b_dirt = 1;
+	ext2_journal_dirty (sb, bh2);
 	es->s_free_blocks_count--;
 	sb->u.ext2_sb.s_sbh->b_dirt = 1;
 	sb->s_dirt = 1;
@@ -563,8 +437,8 @@ unsigned long ext2_count_free_blocks (struct super_block * sb)
 {
 #ifdef EXT2FS_DEBUG
 	struct ext2_super_block * es;
+	struct ext2_bitmap_scan scan;
 	unsigned long desc_count, bitmap_count, x;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
 	int i;
 	
@@ -573,16 +447,16 @@ unsigned long ext2_count_free_blocks (struct super_block * sb)
 	desc_count = 0;
 	bitmap_count = 0;
 	gdp = NULL;
+	ext2_scan_start (&scan, sb, 0);
 	for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++) {
 		gdp = get_group_desc (sb, i, NULL);
 		desc_count += gdp->bg_free_blocks_count;
-		bitmap_nr = load_block_bitmap (sb, i);
-		x = ext2_count_free (sb->u.ext2_sb.s_block_bitmap[bitmap_nr],
-				     sb->s_blocksize);
+		x = ext2_count_free (ext2_scan_next (&scan), sb->s_blocksize);
 		printk ("group %d: stored = %d, counted = %lu\n",
 			i, gdp->bg_free_blocks_count, x);
 		bitmap_count += x;
 	}
+	ext2_scan_end (&scan);
 	printk("ext2_count_free_blocks: stored = %lu, computed = %lu, %lu\n",
 	       es->s_free_blocks_count, desc_count, bitmap_count);
 	unlock_super (sb);
@@ -603,10 +477,10 @@ static inline int block_in_use (unsigned long block,
 void ext2_check_blocks_bitmap (struct super_block * sb)
 {
 	struct buffer_head * bh;
+	struct ext2_bitmap_scan scan;
 	struct ext2_super_block * es;
 	unsigned long desc_count, bitmap_count, x;
 	unsigned long desc_blocks;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
 	int i, j;
 
@@ -617,11 +491,15 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 	gdp = NULL;
 	desc_blocks = (sb->u.ext2_sb.s_groups_count + EXT2_DESC_PER_BLOCK(sb) - 1) /
 		      EXT2_DESC_PER_BLOCK(sb);
+	ext2_scan_start (&scan, sb, 0);
 	for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++) {
 		gdp = get_group_desc (sb, i, NULL);
 		desc_count += gdp->bg_free_blocks_count;
-		bitmap_nr = load_block_bitmap (sb, i);
-		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+		if (!(bh = ext2_scan_next (&scan))) {
+			ext2_error (sb, "ext2_check_blocks_bitmap",
+				    "Cannot read block bitmap for group %d", i);
+			continue;
+		}
 
 		if (!test_bit (0, bh->b_data))
 			ext2_error (sb, "ext2_check_blocks_bitmap",
@@ -657,6 +535,7 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 				    gdp->bg_free_blocks_count, x);
 		bitmap_count += x;
 	}
+	ext2_scan_end (&scan);
 	if (es->s_free_blocks_count != bitmap_count)
 		ext2_error (sb, "ext2_check_blocks_bitmap",
 			    "Wrong free blocks count in super block, "
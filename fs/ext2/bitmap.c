@@ -8,18 +8,198 @@
 
 #include <linux/fs.h>
 #include <linux/ext2_fs.h>
+#include <linux/sched.h>
+#include <linux/locks.h>
+#include <linux/malloc.h>
+#include <linux/mm.h>
 
-static int nibblemap[] = {4, 3, 3, 2, 3, 2, 2, 1, 3, 2, 2, 1, 2, 1, 1, 0};
+#include <asm/bitops.h>
 
 unsigned long ext2_count_free (struct buffer_head * map, unsigned int numchars)
 {
-	unsigned int i;
-	unsigned long sum = 0;
-	
 	if (!map) 
 		return (0);
-	for (i = 0; i < numchars; i++)
-		sum += nibblemap[map->b_data[i] & 0xf] +
-			nibblemap[(map->b_data[i] >> 4) & 0xf];
-	return (sum);
+	return (numchars * 8 - count_set_bits (map->b_data, numchars * 8));
+}
+
+/*
+ * The bitmap caches.  They are only changed with the super block locked.
+ */
+int ext2_bitmap_cache_init (struct super_block * sb,
+			    struct ext2_bitmap_cache * bc)
+{
+	unsigned long size, hash_size;
+	int i;
+
+	size = (high_memory >> EXT2_BITMAP_MEM_SHIFT) / sb->s_blocksize;
+	if (size < EXT2_MIN_BITMAP_CACHE)
+		size = EXT2_MIN_BITMAP_CACHE;
+	if (size > EXT2_MAX_BITMAP_CACHE)
+		size = EXT2_MAX_BITMAP_CACHE;
+	if (size > sb->u.ext2_sb.s_groups_count)
+		size = sb->u.ext2_sb.s_groups_count;
+	for (hash_size = 1; hash_size < size; hash_size <<= 1)
+		;
+	bc->bc_slot = (struct ext2_bitmap_slot *)
+		kmalloc (size * sizeof (struct ext2_bitmap_slot) +
+			 hash_size * sizeof (short), GFP_KERNEL);
+	if (!bc->bc_slot)
+		return 0;
+	bc->bc_hash = (short *) (bc->bc_slot + size);
+	for (i = 0; i < hash_size; i++)
+		bc->bc_hash[i] = -1;
+	bc->bc_size = size;
+	bc->bc_loaded = 0;
+	bc->bc_hand = 0;
+	bc->bc_hash_mask = hash_size - 1;
+	return 1;
+}
+
+void ext2_bitmap_cache_release (struct ext2_bitmap_cache * bc)
+{
+	int i;
+
+	if (!bc->bc_slot)
+		return;
+	for (i = 0; i < bc->bc_loaded; i++)
+		brelse (bc->bc_slot[i].bs_bh);
+	kfree_s (bc->bc_slot, bc->bc_size * sizeof (struct ext2_bitmap_slot) +
+		 (bc->bc_hash_mask + 1) * sizeof (short));
+	bc->bc_slot = NULL;
+	bc->bc_loaded = 0;
+}
+
+struct buffer_head * ext2_bitmap_lookup (struct ext2_bitmap_cache * bc,
+					 unsigned long group)
+{
+	struct ext2_bitmap_slot * s;
+	int i;
+
+	for (i = bc->bc_hash[group & bc->bc_hash_mask]; i >= 0;
+	     i = s->bs_next) {
+		s = bc->bc_slot + i;
+		if (s->bs_group == group) {
+			s->bs_ref = 1;
+			return s->bs_bh;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Enter a freshly read bitmap, releasing the least recently used one
+ * (as near as the clock can tell) if the cache is full.
+ */
+void ext2_bitmap_insert (struct ext2_bitmap_cache * bc, unsigned long group,
+			 struct buffer_head * bh)
+{
+	struct ext2_bitmap_slot * s;
+	short * p;
+	int i;
+
+	if (bc->bc_loaded < bc->bc_size)
+		i = bc->bc_loaded++;
+	else {
+		while (bc->bc_slot[bc->bc_hand].bs_ref) {
+			bc->bc_slot[bc->bc_hand].bs_ref = 0;
+			if (++bc->bc_hand >= bc->bc_size)
+				bc->bc_hand = 0;
+		}
+		i = bc->bc_hand;
+		if (++bc->bc_hand >= bc->bc_size)
+			bc->bc_hand = 0;
+		s = bc->bc_slot + i;
+		for (p = bc->bc_hash + (s->bs_group & bc->bc_hash_mask);
+		     *p != i; p = &bc->bc_slot[*p].bs_next)
+			;
+		*p = s->bs_next;
+		brelse (s->bs_bh);
+	}
+	s = bc->bc_slot + i;
+	s->bs_group = group;
+	s->bs_bh = bh;
+	s->bs_ref = 1;
+	p = bc->bc_hash + (group & bc->bc_hash_mask);
+	s->bs_next = *p;
+	*p = i;
+}
+
+/*
+ * Passes over all the bitmaps, for the checks done at mount time.  The
+ * bitmaps are requested ahead in group order, which is disk order, many
+ * at a time, so that the disk streams through them while the ones
+ * already read are checked.
+ */
+static void scan_request (struct ext2_bitmap_scan * scan)
+{
+	struct super_block * sb = scan->bs_sb;
+	struct buffer_head * req[EXT2_SCAN_AHEAD];
+	struct ext2_group_desc * gdp;
+	struct buffer_head * bh;
+	int n = 0;
+
+	while (scan->bs_count < EXT2_SCAN_AHEAD &&
+	       scan->bs_next < sb->u.ext2_sb.s_groups_count) {
+		gdp = (struct ext2_group_desc *) sb->u.ext2_sb.s_group_desc
+			[scan->bs_next / EXT2_DESC_PER_BLOCK(sb)]->b_data +
+			scan->bs_next % EXT2_DESC_PER_BLOCK(sb);
+		bh = getblk (sb->s_dev, scan->bs_inodes ?
+			     gdp->bg_inode_bitmap : gdp->bg_block_bitmap,
+			     sb->s_blocksize);
+		scan->bs_bh[(scan->bs_head + scan->bs_count++) %
+			    EXT2_SCAN_AHEAD] = bh;
+		scan->bs_next++;
+		if (!bh->b_uptodate)
+			req[n++] = bh;
+	}
+	if (n)
+		ll_rw_block (READ, n, req);
+}
+
+void ext2_scan_start (struct ext2_bitmap_scan * scan, struct super_block * sb,
+		      int inodes)
+{
+	scan->bs_sb = sb;
+	scan->bs_inodes = inodes;
+	scan->bs_next = 0;
+	scan->bs_head = 0;
+	scan->bs_count = 0;
+	scan->bs_last = NULL;
+	scan_request (scan);
+}
+
+/*
+ * Returns the bitmap of the next group, or NULL if it can't be read.  It
+ * is valid until the next call.
+ */
+struct buffer_head * ext2_scan_next (struct ext2_bitmap_scan * scan)
+{
+	struct buffer_head * bh;
+
+	brelse (scan->bs_last);
+	scan->bs_last = NULL;
+	if (!scan->bs_count)
+		return NULL;
+	if (scan->bs_count <= EXT2_SCAN_AHEAD / 2)
+		scan_request (scan);
+	bh = scan->bs_bh[scan->bs_head];
+	scan->bs_head = (scan->bs_head + 1) % EXT2_SCAN_AHEAD;
+	scan->bs_count--;
+	wait_on_buffer (bh);
+	if (!bh->b_uptodate) {
+		brelse (bh);
+		return NULL;
+	}
+	return scan->bs_last = bh;
+}
+
+void ext2_scan_end (struct ext2_bitmap_scan * scan)
+{
+	brelse (scan->bs_last);
+	scan->bs_last = NULL;
+	while (scan->bs_count) {
+		brelse (scan->bs_bh[scan->bs_head]);
+		scan->bs_head = (scan->bs_head + 1) % EXT2_SCAN_AHEAD;
+		scan->bs_count--;
+	}
 }
@@ -129,6 +129,26 @@ static int ext2_readdir (struct inode * inode, struct file * filp,
 			}
 		}
 		
+		/*
+		 * Splitting a block of an indexed directory closes up the
+		 * entries left in it, so find an entry boundary again.
+		 * Entries are returned in block order, not hash order: an
+		 * entry that a split moves into a later block while the
+		 * directory is being read may be returned twice, and one
+		 * moved within this block may be skipped.
+		 */
+		if (offset && (inode->u.ext2_i.i_flags & EXT2_INDEX_FL)) {
+			for (i = 0; i < sb->s_blocksize && i < offset; ) {
+				de = (struct ext2_dir_entry *) (bh->b_data + i);
+				if (de->rec_len < EXT2_DIR_REC_LEN(1))
+					break;
+				i += de->rec_len;
+			}
+			offset = i;
+			filp->f_pos = (filp->f_pos & ~(sb->s_blocksize - 1)) |
+				      offset;
+		}
+
 		de = (struct ext2_dir_entry *) (offset + bh->b_data);
 		while (offset < sb->s_blocksize && filp->f_pos < inode->i_size) {
 			if (!ext2_check_dir_entry ("ext2_readdir", inode, de,
@@ -151,10 +171,7 @@ static int ext2_readdir (struct inode * inode, struct file * filp,
 #endif
 				i = de->name_len;
 				brelse (bh);
-				if (!IS_RDONLY(inode)) {
-					inode->i_atime = CURRENT_TIME;
-					inode->i_dirt = 1;
-				}
+				ext2_update_atime (inode);
 				return i;
 			}
 			de = (struct ext2_dir_entry *) ((char *) de +
@@ -162,9 +179,6 @@ static int ext2_readdir (struct inode * inode, struct file * filp,
 		}
 		brelse (bh);
 	}
-	if (!IS_RDONLY(inode)) {
-		inode->i_atime = CURRENT_TIME;
-		inode->i_dirt = 1;
-	}
+	ext2_update_atime (inode);
 	return 0;
 }
@@ -208,10 +208,7 @@ static int ext2_file_read (struct inode * inode, struct file * filp,
 	if (!read)
 		return -EIO;
 	filp->f_reada = 1;
-	if (!IS_RDONLY(inode)) {
-		inode->i_atime = CURRENT_TIME;
-		inode->i_dirt = 1;
-	}
+	ext2_update_atime (inode);
 	return read;
 }
 
@@ -241,6 +238,8 @@ static int ext2_file_write (struct inode * inode, struct file * filp,
 			      inode->i_mode);
 		return -EINVAL;
 	}
+	if (ext2_journal_file (inode))
+		return -EPERM;
 	down(&inode->i_sem);
 	if (filp->f_flags & O_APPEND)
 		pos = inode->i_size;
@@ -248,7 +247,14 @@ static int ext2_file_write (struct inode * inode, struct file * filp,
 		pos = filp->f_pos;
 	written = 0;
 	while (written < count) {
+		/* How many blocks, this one included, are still to come */
+		inode->u.ext2_i.i_alloc_hint = (pos % sb->s_blocksize +
+						count - written +
+						sb->s_blocksize - 1) /
+					       sb->s_blocksize;
+		ext2_journal_start (sb);
 		bh = ext2_getblk (inode, pos / sb->s_blocksize, 1, &err);
+		ext2_journal_stop (sb, 0);
 		if (!bh) {
 			if (!written)
 				written = err;
@@ -280,10 +286,13 @@ static int ext2_file_write (struct inode * inode, struct file * filp,
 		bh->b_dirt = 1;
 		brelse (bh);
 	}
+	inode->u.ext2_i.i_alloc_hint = 0;
 	up(&inode->i_sem);
 	inode->i_ctime = inode->i_mtime = CURRENT_TIME;
 	filp->f_pos = pos;
 	inode->i_dirt = 1;
+	if (IS_SYNC(inode))
+		ext2_journal_force (sb);
 	return written;
 }
 
@@ -294,6 +303,9 @@ static int ext2_file_write (struct inode * inode, struct file * filp,
  */
 static void ext2_release_file (struct inode * inode, struct file * filp)
 {
-	if (filp->f_mode & 2)
+	if (filp->f_mode & 2) {
+		ext2_journal_start (inode->i_sb);
 		ext2_discard_prealloc (inode);
+		ext2_journal_stop (inode->i_sb, 0);
+	}
 }
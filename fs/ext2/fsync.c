@@ -194,5 +194,6 @@ int ext2_sync_file (struct inode * inode, struct file * file)
 	}
 skip:
 	err |= ext2_sync_inode (inode);
+	ext2_journal_force (inode->i_sb);
 	return (err < 0) ? -EIO : 0;
 }
@@ -35,14 +35,32 @@
 
 void ext2_put_inode (struct inode * inode)
 {
-	ext2_discard_prealloc (inode);
+	struct super_block * sb = inode->i_sb;
+	unsigned long ino = inode->i_ino;
+
 	if (inode->i_nlink || inode->i_ino == EXT2_ACL_IDX_INO ||
-	    inode->i_ino == EXT2_ACL_DATA_INO)
+	    inode->i_ino == EXT2_ACL_DATA_INO) {
+		ext2_journal_start (sb);
+		ext2_discard_prealloc (inode);
+		ext2_journal_stop (sb, 0);
+		return;
+	}
+	/*
+	 * The truncate may take several transactions: not in the middle
+	 * of an operation, and recorded so that a crash doesn't lose the
+	 * inode half deleted
+	 */
+	if (ext2_journal_defer (inode))
 		return;
+	ext2_journal_orphan (sb, ino, 1);
 	inode->i_size = 0;
 	if (inode->i_blocks)
 		ext2_truncate (inode);
+	ext2_journal_start (sb);
+	ext2_discard_prealloc (inode);
 	ext2_free_inode (inode);
+	ext2_journal_orphan (sb, ino, 0);
+	ext2_journal_stop (sb, 0);
 }
 
 #define inode_bmap(inode, nr) ((inode)->u.ext2_i.i_data[(nr)])
@@ -58,6 +76,37 @@ static int block_bmap (struct buffer_head * bh, int nr)
 	return tmp;
 }
 
+/*
+ * Looks up entry nr of an array of n block numbers, which maps the
+ * logical block block, and remembers the run of blocks contiguous on the
+ * disk that starts there.  bh, if given, holds the array and is released.
+ */
+static int map_run (struct inode * inode, struct buffer_head * bh,
+		    unsigned long * p, int nr, int n, int block)
+{
+	int tmp, len;
+
+	tmp = p[nr];
+	if (tmp) {
+		for (len = 1; nr + len < n && p[nr + len] == tmp + len; len++)
+			;
+		inode->u.ext2_i.i_map_block = block;
+		inode->u.ext2_i.i_map_start = tmp;
+		inode->u.ext2_i.i_map_len = len;
+	}
+	brelse (bh);
+	return tmp;
+}
+
+static int block_map_run (struct inode * inode, struct buffer_head * bh,
+			  int nr, int block)
+{
+	if (!bh)
+		return 0;
+	return map_run (inode, bh, (unsigned long *) bh->b_data, nr,
+			EXT2_ADDR_PER_BLOCK(inode->i_sb), block);
+}
+
 /* 
  * ext2_discard_prealloc and ext2_alloc_block are atomic wrt. the
  * superblock in the same manner as are ext2_free_blocks and
@@ -115,12 +164,22 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal)
 		ext2_discard_prealloc (inode);
 		ext2_debug ("preallocation miss (%lu/%lu).\n",
 			    alloc_hits, ++alloc_attempts);
-		if (S_ISREG(inode->i_mode))
+		if (S_ISREG(inode->i_mode)) {
+			/*
+			 * Ask for as much as the write in progress still
+			 * needs, so that it gets one run of blocks
+			 */
+			if (inode->u.ext2_i.i_alloc_hint > EXT2_MAX_PREALLOC)
+				inode->u.ext2_i.i_prealloc_count =
+					EXT2_MAX_PREALLOC;
+			else if (inode->u.ext2_i.i_alloc_hint > 1)
+				inode->u.ext2_i.i_prealloc_count =
+					inode->u.ext2_i.i_alloc_hint - 1;
 			result = ext2_new_block
 				(inode->i_sb, goal,
 				 &inode->u.ext2_i.i_prealloc_count,
 				 &inode->u.ext2_i.i_prealloc_block);
-		else
+		} else
 			result = ext2_new_block (inode->i_sb, goal, 0, 0);
 	}
 #else
@@ -133,7 +192,7 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal)
 
 int ext2_bmap (struct inode * inode, int block)
 {
-	int i;
+	int i, b = block;
 	int addr_per_block = EXT2_ADDR_PER_BLOCK(inode->i_sb);
 
 	if (block < 0) {
@@ -146,15 +205,22 @@ int ext2_bmap (struct inode * inode, int block)
 		ext2_warning (inode->i_sb, "ext2_bmap", "block > big");
 		return 0;
 	}
+	/*
+	 * Sequential accesses usually fall in the run found last time
+	 */
+	if (block - inode->u.ext2_i.i_map_block < inode->u.ext2_i.i_map_len)
+		return inode->u.ext2_i.i_map_start +
+		       (block - inode->u.ext2_i.i_map_block);
 	if (block < EXT2_NDIR_BLOCKS)
-		return inode_bmap (inode, block);
+		return map_run (inode, NULL, inode->u.ext2_i.i_data, block,
+				EXT2_NDIR_BLOCKS, b);
 	block -= EXT2_NDIR_BLOCKS;
 	if (block < addr_per_block) {
 		i = inode_bmap (inode, EXT2_IND_BLOCK);
 		if (!i)
 			return 0;
-		return block_bmap (bread (inode->i_dev, i,
-					  inode->i_sb->s_blocksize), block);
+		return block_map_run (inode, bread (inode->i_dev, i,
+					 inode->i_sb->s_blocksize), block, b);
 	}
 	block -= addr_per_block;
 	if (block < addr_per_block * addr_per_block) {
@@ -166,9 +232,9 @@ int ext2_bmap (struct inode * inode, int block)
 				block / addr_per_block);
 		if (!i)
 			return 0;
-		return block_bmap (bread (inode->i_dev, i,
-					  inode->i_sb->s_blocksize),
-				   block & (addr_per_block - 1));
+		return block_map_run (inode, bread (inode->i_dev, i,
+					 inode->i_sb->s_blocksize),
+				      block & (addr_per_block - 1), b);
 	}
 	block -= addr_per_block * addr_per_block;
 	i = inode_bmap (inode, EXT2_TIND_BLOCK);
@@ -182,8 +248,9 @@ int ext2_bmap (struct inode * inode, int block)
 			(block / addr_per_block) & (addr_per_block - 1));
 	if (!i)
 		return 0;
-	return block_bmap (bread (inode->i_dev, i, inode->i_sb->s_blocksize),
-			   block & (addr_per_block - 1));
+	return block_map_run (inode, bread (inode->i_dev, i,
+				 inode->i_sb->s_blocksize),
+			      block & (addr_per_block - 1), b);
 }
 
 static struct buffer_head * inode_getblk (struct inode * inode, int nr,
@@ -314,7 +381,7 @@ repeat:
 		goto repeat;
 	}
 	*p = tmp;
-	bh->b_dirt = 1;
+	ext2_journal_dirty (inode->i_sb, bh);
 	if (IS_SYNC(inode)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -361,6 +428,16 @@ struct buffer_head * ext2_getblk (struct inode * inode, long block,
 		inode->u.ext2_i.i_next_alloc_goal++;
 	}
 
+	/*
+	 * Lookups go through ext2_bmap, which maps whole runs at once
+	 */
+	if (!create) {
+		if (!(b = ext2_bmap (inode, block))) {
+			*err = -EFBIG;
+			return NULL;
+		}
+		return getblk (inode->i_dev, b, inode->i_sb->s_blocksize);
+	}
 	*err = -ENOSPC;
 	b = block;
 	if (block < EXT2_NDIR_BLOCKS)
@@ -464,6 +541,8 @@ void ext2_read_inode (struct inode * inode)
 	inode->u.ext2_i.i_block_group = block_group;
 	inode->u.ext2_i.i_next_alloc_block = 0;
 	inode->u.ext2_i.i_next_alloc_goal = 0;
+	inode->u.ext2_i.i_alloc_hint = 0;
+	inode->u.ext2_i.i_map_len = 0;
 	if (inode->u.ext2_i.i_prealloc_count)
 		ext2_error (inode->i_sb, "ext2_read_inode",
 			    "New inode has non-zero prealloc count!");
@@ -492,6 +571,62 @@ void ext2_read_inode (struct inode * inode)
 		inode->i_flags |= MS_SYNC;
 }
 
+static void copy_inode (struct ext2_inode * raw_inode, struct inode * inode)
+{
+	int block;
+
+	raw_inode->i_mode = inode->i_mode;
+	raw_inode->i_uid = inode->i_uid;
+	raw_inode->i_gid = inode->i_gid;
+	raw_inode->i_links_count = inode->i_nlink;
+	raw_inode->i_size = inode->i_size;
+	raw_inode->i_atime = inode->i_atime;
+	raw_inode->i_ctime = inode->i_ctime;
+	raw_inode->i_mtime = inode->i_mtime;
+	raw_inode->i_blocks = inode->i_blocks;
+	raw_inode->i_dtime = inode->u.ext2_i.i_dtime;
+	raw_inode->i_flags = inode->u.ext2_i.i_flags;
+	raw_inode->i_faddr = inode->u.ext2_i.i_faddr;
+	raw_inode->i_frag = inode->u.ext2_i.i_frag;
+	raw_inode->i_fsize = inode->u.ext2_i.i_fsize;
+	raw_inode->i_file_acl = inode->u.ext2_i.i_file_acl;
+	raw_inode->i_dir_acl = inode->u.ext2_i.i_dir_acl;
+	raw_inode->i_version = inode->u.ext2_i.i_version;
+	if (S_ISCHR(inode->i_mode) || S_ISBLK(inode->i_mode))
+		raw_inode->i_block[0] = inode->i_rdev;
+	else for (block = 0; block < EXT2_N_BLOCKS; block++)
+		raw_inode->i_block[block] = inode->u.ext2_i.i_data[block];
+}
+
+/*
+ * Copies the other dirty inodes of the inode table block bh, which holds
+ * inode, into it too.  sync then finds them clean, and the block is
+ * updated once instead of once per inode.
+ */
+static void update_neighbours (struct inode * inode, struct buffer_head * bh)
+{
+	struct super_block * sb = inode->i_sb;
+	struct inode * other;
+	unsigned long first, ino;
+	int i;
+
+	first = inode->i_ino - (inode->i_ino - 1) % EXT2_INODES_PER_BLOCK(sb);
+	for (i = 0; i < EXT2_INODES_PER_BLOCK(sb); i++) {
+		ino = first + i;
+		if (ino == inode->i_ino ||
+		    (ino != EXT2_ROOT_INO && ino < EXT2_FIRST_INO) ||
+		    ino > sb->u.ext2_sb.s_es->s_inodes_count)
+			continue;
+		other = find_inode (inode->i_dev, ino);
+		if (!other || !other->i_dirt || other->i_lock ||
+		    other->i_sb != sb)
+			continue;
+		copy_inode ((struct ext2_inode *) bh->b_data + i, other);
+		other->i_dirt = 0;
+		sb->u.ext2_sb.s_inodes_batched++;
+	}
+}
+
 static struct buffer_head * ext2_update_inode (struct inode * inode)
 {
 	struct buffer_head * bh;
@@ -528,36 +663,42 @@ static struct buffer_head * ext2_update_inode (struct inode * inode)
 			    "inode=%lu, block=%lu", inode->i_ino, block);
 	raw_inode = ((struct ext2_inode *)bh->b_data) +
 		(inode->i_ino - 1) % EXT2_INODES_PER_BLOCK(inode->i_sb);
-	raw_inode->i_mode = inode->i_mode;
-	raw_inode->i_uid = inode->i_uid;
-	raw_inode->i_gid = inode->i_gid;
-	raw_inode->i_links_count = inode->i_nlink;
-	raw_inode->i_size = inode->i_size;
-	raw_inode->i_atime = inode->i_atime;
-	raw_inode->i_ctime = inode->i_ctime;
-	raw_inode->i_mtime = inode->i_mtime;
-	raw_inode->i_blocks = inode->i_blocks;
-	raw_inode->i_dtime = inode->u.ext2_i.i_dtime;
-	raw_inode->i_flags = inode->u.ext2_i.i_flags;
-	raw_inode->i_faddr = inode->u.ext2_i.i_faddr;
-	raw_inode->i_frag = inode->u.ext2_i.i_frag;
-	raw_inode->i_fsize = inode->u.ext2_i.i_fsize;
-	raw_inode->i_file_acl = inode->u.ext2_i.i_file_acl;
-	raw_inode->i_dir_acl = inode->u.ext2_i.i_dir_acl;
-	raw_inode->i_version = inode->u.ext2_i.i_version;
-	if (S_ISCHR(inode->i_mode) || S_ISBLK(inode->i_mode))
-		raw_inode->i_block[0] = inode->i_rdev;
-	else for (block = 0; block < EXT2_N_BLOCKS; block++)
-		raw_inode->i_block[block] = inode->u.ext2_i.i_data[block];
-	bh->b_dirt = 1;
+	copy_inode (raw_inode, inode);
 	inode->i_dirt = 0;
+	inode->i_sb->u.ext2_sb.s_inode_writes++;
+	if (test_opt (inode->i_sb, BATCH_INODES))
+		update_neighbours (inode, bh);
+	ext2_journal_dirty (inode->i_sb, bh);
 	return bh;
 }
 
+/*
+ * Called on each read access.  With lazyatime, the access time is only
+ * updated when it is older than the last change or than EXT2_ATIME_DELAY,
+ * so that reads don't keep rewriting the inode table.
+ */
+void ext2_update_atime (struct inode * inode)
+{
+	if (IS_RDONLY(inode) || inode->i_atime == CURRENT_TIME)
+		return;
+	if (test_opt (inode->i_sb, LAZY_ATIME) &&
+	    inode->i_atime > inode->i_mtime &&
+	    inode->i_atime > inode->i_ctime &&
+	    CURRENT_TIME - inode->i_atime < EXT2_ATIME_DELAY) {
+		inode->i_sb->u.ext2_sb.s_atime_skipped++;
+		return;
+	}
+	inode->i_atime = CURRENT_TIME;
+	inode->i_dirt = 1;
+}
+
 void ext2_write_inode (struct inode * inode)
 {
 	struct buffer_head * bh;
+
+	ext2_journal_start_inode (inode);
 	bh = ext2_update_inode (inode);
+	ext2_journal_stop (inode->i_sb, 0);
 	brelse (bh);
 }
 
@@ -566,7 +707,9 @@ int ext2_sync_inode (struct inode *inode)
 	int err = 0;
 	struct buffer_head *bh;
 
+	ext2_journal_start (inode->i_sb);
 	bh = ext2_update_inode (inode);
+	ext2_journal_stop (inode->i_sb, 0);
 	if (bh && bh->b_dirt)
 	{
 		ll_rw_block (WRITE, 1, &bh);
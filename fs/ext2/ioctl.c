@@ -14,6 +14,27 @@
 #include <linux/ioctl.h>
 #include <linux/sched.h>
 
+/*
+ * Count the runs of blocks of the file that are contiguous on the disk
+ * too, holes left out: 1 for a file laid out in one piece, and more the
+ * more fragmented it is.
+ */
+static long ext2_count_extents (struct inode * inode)
+{
+	int block, blocks, tmp, last = 0;
+	long extents = 0;
+
+	blocks = (inode->i_size + inode->i_sb->s_blocksize - 1) >>
+		 EXT2_BLOCK_SIZE_BITS(inode->i_sb);
+	for (block = 0; block < blocks; block++) {
+		tmp = ext2_bmap (inode, block);
+		if (tmp && tmp != last + 1)
+			extents++;
+		last = tmp;
+	}
+	return extents;
+}
+
 int ext2_ioctl (struct inode * inode, struct file * filp, unsigned int cmd,
 		unsigned long arg)
 {
@@ -32,10 +53,19 @@ int ext2_ioctl (struct inode * inode, struct file * filp, unsigned int cmd,
 			return -EPERM;
 		if (IS_RDONLY(inode))
 			return -EROFS;
-		inode->u.ext2_i.i_flags = get_fs_long ((long *) arg);
+		/* Only the file system knows whether a directory is indexed */
+		inode->u.ext2_i.i_flags = (get_fs_long ((long *) arg) &
+					   ~EXT2_INDEX_FL) |
+					  (inode->u.ext2_i.i_flags &
+					   EXT2_INDEX_FL);
 		inode->i_ctime = CURRENT_TIME;
 		inode->i_dirt = 1;
 		return 0;
+	case EXT2_IOC_GETEXTENTS:
+		if ((err = verify_area (VERIFY_WRITE, (long *) arg, sizeof(long))))
+			return err;
+		put_fs_long (ext2_count_extents (inode), (long *) arg);
+		return 0;
 	case EXT2_IOC_GETVERSION:
 		if ((err = verify_area (VERIFY_WRITE, (long *) arg, sizeof(long))))
 			return err;
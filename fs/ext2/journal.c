@@ -0,0 +1,1182 @@
+/*
+ *  linux/fs/ext2/journal.c
+ *
+ *  Write-ahead journal for the metadata of the second extended file system
+ */
+
+/*
+ * Every operation that changes metadata runs between ext2_journal_start
+ * and ext2_journal_stop.  The buffers it changes are handed to
+ * ext2_journal_dirty instead of being marked dirty: they join the running
+ * transaction, which holds them clean so that nothing reaches its home
+ * location before it is in the log.
+ *
+ * A transaction is committed when no operation is in progress: the dirty
+ * inodes are written into it, the blocks are copied to the log and waited
+ * for, and only then is the commit block written.  After that the buffers
+ * are marked dirty and go home in the usual way.  Commits are batched:
+ * they happen on sync, on fsync and when a transaction gets half full.
+ *
+ * An operation reserves room for what it may change when it starts, and
+ * waits for a commit if the running transaction cannot hold it: so no
+ * operation is ever split between two transactions.  Those that may take
+ * more, like truncating a big file, end and start again on the way, and
+ * deleting a file is put off until the operation that dropped its last
+ * link is over.  The inodes whose deletion is under way are listed in
+ * each commit block, so that recovery can finish it.
+ *
+ * The log is not reused until it is nearly full.  Then every block
+ * committed since the last checkpoint is forced home, and the journal
+ * super block is marked empty.  At mount time, the committed transactions
+ * still in the log are written home again, unless the log was written by
+ * another mount than the one the super block last saw.
+ *
+ * A block that is freed after it was logged is revoked, so that recovery
+ * doesn't write the old metadata over whatever the block holds by then.
+ */
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/ext2_fs.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/locks.h>
+#include <linux/malloc.h>
+#include <linux/mm.h>
+
+#include <asm/bitops.h>
+
+#define JOURNAL_BATCH		32	/* Log blocks written at a time */
+#define JOURNAL_CHECKPOINT	(PAGE_SIZE / sizeof (unsigned long))
+#define JOURNAL_REVOKES		(PAGE_SIZE / (2 * sizeof (unsigned long)))
+#define JOURNAL_OP_BLOCKS	16	/* Reserved by an operation */
+
+#define jhash(block)		((block) & (EXT2_JOURNAL_HASH - 1))
+#define jlogged(block)		((block) & (EXT2_JOURNAL_LOGGED - 1))
+
+/*
+ * Maps a block of the journal file to the disk
+ */
+static unsigned long journal_bmap (struct ext2_journal * j, unsigned long n)
+{
+	struct ext2_journal_run * r;
+
+	for (r = j->j_runs; n >= r->r_len; r++)
+		n -= r->r_len;
+	return r->r_block + n;
+}
+
+static struct buffer_head * journal_bread (struct super_block * sb,
+					   struct ext2_journal * j,
+					   unsigned long n)
+{
+	return bread (sb->s_dev, journal_bmap (j, n), sb->s_blocksize);
+}
+
+/*
+ * Gets a log block to be filled in, with a header of the given type
+ */
+static struct buffer_head * journal_header (struct super_block * sb,
+					    struct ext2_journal * j,
+					    unsigned long n, int type,
+					    unsigned long count)
+{
+	struct buffer_head * bh;
+	struct ext2_journal_header * h;
+
+	bh = getblk (sb->s_dev, journal_bmap (j, n), sb->s_blocksize);
+	if (!bh)
+		return NULL;
+	memset (bh->b_data, 0, sb->s_blocksize);
+	h = (struct ext2_journal_header *) bh->b_data;
+	h->h_magic = EXT2_JOURNAL_MAGIC;
+	h->h_type = type;
+	h->h_sequence = j->j_sequence;
+	h->h_count = count;
+	return bh;
+}
+
+/*
+ * Writes buffers and waits for them.  Returns non-zero on an I/O error.
+ */
+static int journal_write_wait (struct buffer_head * bh[], int n)
+{
+	int i, err = 0;
+
+	for (i = 0; i < n; i++) {
+		bh[i]->b_uptodate = 1;
+		bh[i]->b_dirt = 1;
+	}
+	ll_rw_block (WRITE, n, bh);
+	for (i = 0; i < n; i++) {
+		wait_on_buffer (bh[i]);
+		if (!bh[i]->b_uptodate)
+			err = 1;
+	}
+	return err;
+}
+
+static void journal_brelse (struct buffer_head * bh[], int n)
+{
+	while (n > 0)
+		brelse (bh[--n]);
+}
+
+static int journal_find (struct ext2_journal * j, unsigned long block)
+{
+	int i;
+
+	for (i = j->j_hash[jhash(block)]; i >= 0; i = j->j_next[i])
+		if (j->j_running[i] && j->j_running[i]->b_blocknr == block)
+			return i;
+	return -1;
+}
+
+static void journal_clear_running (struct ext2_journal * j)
+{
+	int i;
+
+	for (i = 0; i < EXT2_JOURNAL_HASH; i++)
+		j->j_hash[i] = -1;
+	j->j_nr_running = 0;
+	j->j_nr_revoked = 0;
+}
+
+/*
+ * Forces home every block committed since the last checkpoint, then
+ * empties the log.
+ */
+static void journal_checkpoint (struct super_block * sb,
+				struct ext2_journal * j)
+{
+	struct ext2_journal_super * js;
+	struct buffer_head * bh[JOURNAL_BATCH];
+	int i, n = 0;
+
+	for (i = 0; i < j->j_nr_checkpoint; i++) {
+		/*
+		 * A block that is no longer cached went home before it
+		 * was released, and get_hash_table waits for a write in
+		 * progress.
+		 */
+		bh[n] = get_hash_table (sb->s_dev, j->j_checkpoint[i],
+					sb->s_blocksize);
+		if (!bh[n])
+			continue;
+		if (!bh[n]->b_dirt) {
+			brelse (bh[n]);
+			continue;
+		}
+		if (++n == JOURNAL_BATCH) {
+			if (journal_write_wait (bh, n))
+				ext2_error (sb, "journal_checkpoint",
+					    "I/O error writing metadata home");
+			journal_brelse (bh, n);
+			n = 0;
+		}
+	}
+	if (n) {
+		if (journal_write_wait (bh, n))
+			ext2_error (sb, "journal_checkpoint",
+				    "I/O error writing metadata home");
+		journal_brelse (bh, n);
+	}
+	js = (struct ext2_journal_super *) j->j_sbh->b_data;
+	js->js_start = 0;
+	js->js_sequence = j->j_sequence;
+	js->js_nr_orphans = j->j_nr_orphans;
+	memcpy (js->js_orphans, j->j_orphans,
+		j->j_nr_orphans * sizeof (unsigned long));
+	if (journal_write_wait (&j->j_sbh, 1))
+		ext2_error (sb, "journal_checkpoint",
+			    "I/O error writing the journal super block");
+	j->j_head = 1;
+	j->j_nr_checkpoint = 0;
+	memset (j->j_logged, 0, sizeof (j->j_logged));
+}
+
+/*
+ * Writes the running transaction to the log.  The caller has made sure
+ * that no operation is in progress and that none can start.
+ */
+static void journal_write_transaction (struct super_block * sb,
+				       struct ext2_journal * j)
+{
+	struct ext2_journal_super * js;
+	struct buffer_head * log[JOURNAL_BATCH];
+	struct buffer_head * bh;
+	unsigned long * blocks;
+	int i, n = 0, count = 0, err = 0;
+
+	for (i = 0; i < j->j_nr_running; i++)
+		if (j->j_running[i])
+			count++;
+	js = (struct ext2_journal_super *) j->j_sbh->b_data;
+	if (!js->js_start) {
+		js->js_start = j->j_head;
+		js->js_sequence = j->j_sequence;
+		if ((err = journal_write_wait (&j->j_sbh, 1)))
+			goto done;
+	}
+	if (j->j_nr_revoked) {
+		bh = journal_header (sb, j, j->j_head++, EXT2_JOURNAL_REVOKE,
+				     j->j_nr_revoked);
+		if (!bh) {
+			err = 1;
+			goto done;
+		}
+		memcpy (bh->b_data + sizeof (struct ext2_journal_header),
+			j->j_revoked, j->j_nr_revoked * sizeof (unsigned long));
+		log[n++] = bh;
+	}
+	bh = journal_header (sb, j, j->j_head++, EXT2_JOURNAL_DESC, count);
+	if (!bh) {
+		err = 1;
+		goto done;
+	}
+	blocks = (unsigned long *) (bh->b_data +
+				    sizeof (struct ext2_journal_header));
+	for (i = 0; i < j->j_nr_running; i++)
+		if (j->j_running[i])
+			*blocks++ = j->j_running[i]->b_blocknr;
+	log[n++] = bh;
+	for (i = 0; i < j->j_nr_running; i++) {
+		if (!j->j_running[i])
+			continue;
+		if (n == JOURNAL_BATCH) {
+			err |= journal_write_wait (log, n);
+			journal_brelse (log, n);
+			n = 0;
+		}
+		bh = getblk (sb->s_dev, journal_bmap (j, j->j_head++),
+			     sb->s_blocksize);
+		if (!bh) {
+			err = 1;
+			break;
+		}
+		memcpy (bh->b_data, j->j_running[i]->b_data, sb->s_blocksize);
+		log[n++] = bh;
+	}
+	if (n) {
+		err |= journal_write_wait (log, n);
+		journal_brelse (log, n);
+	}
+	if (err)
+		goto done;
+	/*
+	 * Everything else is on the disk: now the commit block
+	 */
+	if (!(bh = journal_header (sb, j, j->j_head++, EXT2_JOURNAL_COMMIT,
+				   j->j_nr_orphans))) {
+		err = 1;
+		goto done;
+	}
+	memcpy (bh->b_data + sizeof (struct ext2_journal_header),
+		j->j_orphans, j->j_nr_orphans * sizeof (unsigned long));
+	err = journal_write_wait (&bh, 1);
+	brelse (bh);
+
+done:
+	if (err)
+		ext2_error (sb, "journal_write_transaction",
+			    "cannot write transaction %lu to the journal",
+			    j->j_sequence);
+	/*
+	 * Whatever happened, the buffers may go home now
+	 */
+	for (i = 0; i < j->j_nr_running; i++) {
+		if (!(bh = j->j_running[i]))
+			continue;
+		bh->b_dirt = 1;
+		set_bit (jlogged(bh->b_blocknr), j->j_logged);
+		j->j_checkpoint[j->j_nr_checkpoint++] = bh->b_blocknr;
+		brelse (bh);
+	}
+	journal_clear_running (j);
+	j->j_sequence++;
+	if (j->j_head + j->j_max_blocks + 3 > j->j_maxlen ||
+	    j->j_nr_checkpoint + j->j_max_blocks > JOURNAL_CHECKPOINT)
+		journal_checkpoint (sb, j);
+}
+
+/*
+ * The running transaction has no room left for a block or revoke record.
+ * Commit it now: nothing may go home without passing through the log, and
+ * operations changing buffers meanwhile wait in ext2_journal_dirty.  Only
+ * inode writes, which change a single block, get here when all goes well.
+ */
+static void journal_commit_full (struct super_block * sb,
+				 struct ext2_journal * j)
+{
+	j->j_committing = 1;
+	journal_write_transaction (sb, j);
+	j->j_committing = 0;
+	wake_up (&j->j_wait);
+}
+
+/*
+ * Commits the running transaction, unless an operation is in progress:
+ * then the last one to finish does it.
+ */
+void ext2_journal_commit (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	unsigned long ops;
+	int tries;
+
+	if (!j)
+		return;
+	if (j->j_handles || j->j_flushing || j->j_committing) {
+		j->j_commit_wanted = 1;
+		return;
+	}
+	/*
+	 * The inodes changed go into the transaction too.  Writing them may
+	 * sleep, so do it again if an operation ran meanwhile.
+	 */
+	j->j_flushing = 1;
+	j->j_flusher = current;
+	for (tries = 0; ; tries++) {
+		ops = j->j_nr_ops;
+		sync_inodes (sb->s_dev);
+		if (j->j_handles || ops == j->j_nr_ops || tries >= 3)
+			break;
+	}
+	j->j_flushing = 0;
+	j->j_flusher = NULL;
+	if (j->j_handles || ops != j->j_nr_ops) {
+		j->j_commit_wanted = 1;
+		wake_up (&j->j_wait);
+		return;
+	}
+	j->j_commit_wanted = 0;
+	if (j->j_nr_running || j->j_nr_revoked) {
+		j->j_committing = 1;
+		journal_write_transaction (sb, j);
+		j->j_committing = 0;
+	}
+	wake_up (&j->j_wait);
+}
+
+/*
+ * Commits the running transaction and waits for it to be on the disk.
+ * Must not be called in the middle of an operation.
+ */
+void ext2_journal_force (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	unsigned long sequence;
+
+	if (!j)
+		return;
+	sequence = j->j_sequence;
+	j->j_commit_wanted = 1;
+	while (j->j_sequence == sequence) {
+		if (!j->j_nr_running && !j->j_nr_revoked &&
+		    !j->j_committing && !j->j_handles && !j->j_flushing) {
+			/*
+			 * Only the inodes may be left to write
+			 */
+			ext2_journal_commit (sb);
+			if (!j->j_nr_running && !j->j_commit_wanted)
+				break;
+			continue;
+		}
+		if (!j->j_handles && !j->j_committing && !j->j_flushing)
+			ext2_journal_commit (sb);
+		else
+			sleep_on (&j->j_wait);
+	}
+}
+
+/*
+ * Room left in the running transaction once the operations in progress
+ * have what they reserved.  One operation's worth is kept back, for the
+ * inodes written at commit time.
+ */
+static int journal_room (struct ext2_journal * j)
+{
+	int room;
+
+	room = j->j_max_blocks - j->j_nr_running;
+	if (room > j->j_max_blocks - j->j_nr_revoked)
+		room = j->j_max_blocks - j->j_nr_revoked;
+	return room - j->j_op_blocks - j->j_reserved;
+}
+
+/*
+ * The slot of the current task if it is in an operation, else -1
+ */
+static int journal_owner (struct ext2_journal * j)
+{
+	int i;
+
+	if (j->j_nr_owners)
+		for (i = 0; i < EXT2_JOURNAL_OWNERS; i++)
+			if (j->j_owner[i] == current)
+				return i;
+	return -1;
+}
+
+/*
+ * Begins an operation changing up to credits blocks.  Operations nest, and
+ * only the outermost one reserves room: until it has it, it waits for the
+ * running transaction to be committed, and commits it itself when nothing
+ * else is in progress.  Inode writes take a single block and no slot.
+ *
+ * inode is held locked by the caller: as a commit writes the inodes, it
+ * is unlocked while waiting.
+ */
+static void journal_begin (struct super_block * sb, int credits,
+			   struct inode * inode)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int i;
+
+	if (!j)
+		return;
+	if (j->j_flusher == current) {
+		j->j_handles++;
+		return;
+	}
+	if ((i = journal_owner (j)) >= 0) {
+		j->j_depth[i]++;
+		j->j_handles++;
+		return;
+	}
+	while (j->j_committing || journal_room (j) < credits ||
+	       (credits > 1 && (j->j_flushing ||
+				j->j_nr_owners == EXT2_JOURNAL_OWNERS))) {
+		j->j_commit_wanted = 1;
+		if (inode) {
+			inode->i_lock = 0;
+			wake_up (&inode->i_wait);
+		}
+		if (!j->j_handles && !j->j_committing && !j->j_flushing)
+			ext2_journal_commit (sb);
+		else
+			sleep_on (&j->j_wait);
+		if (inode) {
+			while (inode->i_lock)
+				sleep_on (&inode->i_wait);
+			inode->i_lock = 1;
+		}
+	}
+	if (credits > 1) {
+		for (i = 0; j->j_owner[i]; i++)
+			;
+		j->j_owner[i] = current;
+		j->j_depth[i] = 1;
+		j->j_nr_owners++;
+	}
+	j->j_reserved += credits;
+	j->j_handles++;
+	j->j_nr_ops++;
+}
+
+void ext2_journal_start (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+
+	if (j)
+		journal_begin (sb, j->j_op_blocks, NULL);
+}
+
+/*
+ * Begins writing an inode, which the VFS has locked
+ */
+void ext2_journal_start_inode (struct inode * inode)
+{
+	journal_begin (inode->i_sb, 1, inode);
+}
+
+/*
+ * Deletes the inodes put off by ext2_journal_defer.  The current task
+ * is in no operation, so each one is done in operations of its own.
+ */
+static void journal_reap (struct super_block * sb, struct ext2_journal * j)
+{
+	if (j->j_reaping)
+		return;
+	j->j_reaping = 1;
+	while (j->j_nr_deferred)
+		iput (j->j_deferred[--j->j_nr_deferred]);
+	j->j_reaping = 0;
+	wake_up (&j->j_wait);
+}
+
+/*
+ * Ends an operation.  sync is only given by the outermost callers, which
+ * then wait for the transaction to commit.
+ */
+void ext2_journal_stop (struct super_block * sb, int sync)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int i, done = 0;
+
+	if (!j)
+		return;
+	if (j->j_handles <= 0) {
+		ext2_warning (sb, "ext2_journal_stop", "no operation to end");
+		return;
+	}
+	j->j_handles--;
+	if (j->j_flusher != current) {
+		if ((i = journal_owner (j)) < 0)
+			j->j_reserved--;
+		else if (!--j->j_depth[i]) {
+			j->j_owner[i] = NULL;
+			j->j_nr_owners--;
+			j->j_reserved -= j->j_op_blocks;
+			done = 1;
+		}
+	}
+	wake_up (&j->j_wait);
+	if (sync)
+		ext2_journal_force (sb);
+	else if (!j->j_handles && j->j_commit_wanted && !j->j_flushing)
+		ext2_journal_commit (sb);
+	if (done)
+		journal_reap (sb, j);
+}
+
+/*
+ * Room the current operation may still use.  Only the outermost level of
+ * an operation can end and start again to get more, so nested ones are
+ * told there is plenty.
+ */
+int ext2_journal_room (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int i;
+
+	if (!j || (i = journal_owner (j)) < 0 || j->j_depth[i] > 1)
+		return 0x7fffffff;
+	return journal_room (j) + j->j_op_blocks;
+}
+
+/*
+ * Deleting an inode may take several transactions, which an operation in
+ * progress cannot end: then the inode is kept, with its count, until the
+ * outermost operation of the current task is over.  Returns 1 if so.
+ */
+int ext2_journal_defer (struct inode * inode)
+{
+	struct ext2_journal * j = inode->i_sb->u.ext2_sb.s_journal;
+
+	if (!j || journal_owner (j) < 0 ||
+	    j->j_nr_deferred == EXT2_JOURNAL_DEFERRED)
+		return 0;
+	j->j_deferred[j->j_nr_deferred++] = inode;
+	return 1;
+}
+
+/*
+ * Adds an inode to the orphans, or removes it when its deletion is over
+ */
+void ext2_journal_orphan (struct super_block * sb, unsigned long ino,
+			  int orphan)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int i;
+
+	if (!j)
+		return;
+	for (i = 0; i < j->j_nr_orphans; i++)
+		if (j->j_orphans[i] == ino) {
+			if (!orphan)
+				j->j_orphans[i] =
+					j->j_orphans[--j->j_nr_orphans];
+			return;
+		}
+	if (!orphan)
+		return;
+	if (j->j_nr_orphans == EXT2_JOURNAL_ORPHANS) {
+		ext2_warning (sb, "ext2_journal_orphan",
+			      "too many orphans, inode %lu is not recorded",
+			      ino);
+		return;
+	}
+	j->j_orphans[j->j_nr_orphans++] = ino;
+}
+
+/*
+ * Puts a buffer changed by the current operation into the running
+ * transaction.  Without a journal it is simply marked dirty.
+ */
+void ext2_journal_dirty (struct super_block * sb, struct buffer_head * bh)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int i;
+
+	if (!j) {
+		bh->b_dirt = 1;
+		return;
+	}
+	/*
+	 * A commit copies the buffers: changes made meanwhile must join
+	 * the next transaction.
+	 */
+	while (j->j_committing)
+		sleep_on (&j->j_wait);
+	if (journal_find (j, bh->b_blocknr) >= 0)
+		return;
+	if (j->j_nr_running >= j->j_max_blocks) {
+		if (j->j_nr_owners)
+			ext2_error (sb, "ext2_journal_dirty",
+				    "operation too big for a transaction");
+		journal_commit_full (sb, j);
+	}
+	/*
+	 * Logging the block again makes its revoke record useless
+	 */
+	for (i = 0; i < j->j_nr_revoked; i++)
+		if (j->j_revoked[i] == bh->b_blocknr) {
+			j->j_revoked[i] = j->j_revoked[--j->j_nr_revoked];
+			break;
+		}
+	bh->b_count++;
+	bh->b_dirt = 0;
+	i = j->j_nr_running++;
+	j->j_running[i] = bh;
+	j->j_next[i] = j->j_hash[jhash(bh->b_blocknr)];
+	j->j_hash[jhash(bh->b_blocknr)] = i;
+	if (j->j_nr_running >= j->j_max_blocks / 2)
+		j->j_commit_wanted = 1;
+	sb->s_dirt = 1;
+}
+
+/*
+ * A block is being freed: drop it from the running transaction, and
+ * revoke it if it may have been logged before.
+ */
+void ext2_journal_revoke (struct super_block * sb, unsigned long block)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int i;
+
+	if (!j)
+		return;
+	while (j->j_committing)
+		sleep_on (&j->j_wait);
+	if ((i = journal_find (j, block)) >= 0) {
+		brelse (j->j_running[i]);
+		j->j_running[i] = NULL;
+	}
+	if (!test_bit (jlogged(block), j->j_logged))
+		return;
+	for (i = 0; i < j->j_nr_revoked; i++)
+		if (j->j_revoked[i] == block)
+			return;
+	if (j->j_nr_revoked >= j->j_max_blocks) {
+		if (j->j_nr_owners)
+			ext2_error (sb, "ext2_journal_revoke",
+				    "operation too big for a transaction");
+		journal_commit_full (sb, j);
+	}
+	j->j_revoked[j->j_nr_revoked++] = block;
+	j->j_commit_wanted = 1;
+	sb->s_dirt = 1;
+}
+
+/*
+ * Is a buffer used by someone else than the caller and the journal?
+ */
+int ext2_journal_busy (struct super_block * sb, struct buffer_head * bh)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+
+	if (j && journal_find (j, bh->b_blocknr) >= 0)
+		return bh->b_count != 2;
+	return bh->b_count != 1;
+}
+
+/*
+ * Is this the journal file of a mounted fs?  Its blocks are written to
+ * behind its back, so it may not be written, truncated or unlinked.
+ */
+int ext2_journal_file (struct inode * inode)
+{
+	struct ext2_journal * j = inode->i_sb->u.ext2_sb.s_journal;
+
+	return j && inode->i_ino == j->j_ino;
+}
+
+/*
+ * Reads the header of a log block.  Returns the buffer if it belongs to
+ * the given transaction.
+ */
+static struct buffer_head * journal_read_header (struct super_block * sb,
+						 struct ext2_journal * j,
+						 unsigned long n,
+						 unsigned long sequence,
+						 struct ext2_journal_header ** h)
+{
+	struct buffer_head * bh;
+
+	if (n >= j->j_maxlen || !(bh = journal_bread (sb, j, n)))
+		return NULL;
+	*h = (struct ext2_journal_header *) bh->b_data;
+	if ((*h)->h_magic != EXT2_JOURNAL_MAGIC ||
+	    (*h)->h_sequence != sequence ||
+	    (*h)->h_count > EXT2_JOURNAL_ENTRIES(sb)) {
+		brelse (bh);
+		return NULL;
+	}
+	return bh;
+}
+
+/*
+ * Finds where transaction sequence, which starts at block n, ends.
+ * Returns the block after its commit block, or 0 if it wasn't committed.
+ * The revoke records it holds are added to revokes, and its orphans
+ * replace those in j_orphans, if revokes is given.
+ */
+static unsigned long journal_scan (struct super_block * sb,
+				   struct ext2_journal * j, unsigned long n,
+				   unsigned long sequence,
+				   unsigned long * revokes, int * nr_revokes)
+{
+	struct buffer_head * bh, * rbh = NULL;
+	struct ext2_journal_header * h;
+	unsigned long * r;
+	unsigned long end;
+	int i;
+
+	if (!(bh = journal_read_header (sb, j, n, sequence, &h)))
+		return 0;
+	if (h->h_type == EXT2_JOURNAL_REVOKE) {
+		rbh = bh;
+		if (!(bh = journal_read_header (sb, j, ++n, sequence, &h))) {
+			brelse (rbh);
+			return 0;
+		}
+	}
+	if (h->h_type != EXT2_JOURNAL_DESC) {
+		brelse (bh);
+		brelse (rbh);
+		return 0;
+	}
+	end = n + 1 + h->h_count;
+	brelse (bh);
+	if (!(bh = journal_read_header (sb, j, end, sequence, &h)) ||
+	    h->h_type != EXT2_JOURNAL_COMMIT) {
+		brelse (bh);
+		brelse (rbh);
+		return 0;
+	}
+	if (revokes) {
+		j->j_nr_orphans = h->h_count;
+		if (j->j_nr_orphans > EXT2_JOURNAL_ORPHANS)
+			j->j_nr_orphans = EXT2_JOURNAL_ORPHANS;
+		memcpy (j->j_orphans, h + 1,
+			j->j_nr_orphans * sizeof (unsigned long));
+	}
+	brelse (bh);
+	if (rbh && revokes) {
+		h = (struct ext2_journal_header *) rbh->b_data;
+		r = (unsigned long *) (h + 1);
+		for (i = 0; i < h->h_count; i++) {
+			if (*nr_revokes >= JOURNAL_REVOKES) {
+				printk ("EXT2-fs: too many revoked blocks in "
+					"the journal\n");
+				break;
+			}
+			revokes[2 * *nr_revokes] = r[i];
+			revokes[2 * *nr_revokes + 1] = sequence;
+			(*nr_revokes)++;
+		}
+	}
+	brelse (rbh);
+	return end + 1;
+}
+
+/*
+ * Is block revoked by transaction sequence or a later one?
+ */
+static int journal_revoked (unsigned long * revokes, int nr_revokes,
+			    unsigned long block, unsigned long sequence)
+{
+	int i;
+
+	for (i = 0; i < nr_revokes; i++)
+		if (revokes[2 * i] == block &&
+		    (long) (revokes[2 * i + 1] - sequence) >= 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Writes transaction sequence, starting at block n, home again
+ */
+static int journal_replay (struct super_block * sb, struct ext2_journal * j,
+			   unsigned long n, unsigned long sequence,
+			   unsigned long * revokes, int nr_revokes)
+{
+	struct buffer_head * dbh, * lbh, * bh;
+	struct ext2_journal_header * h;
+	unsigned long * blocks;
+	int i, err = 0;
+
+	if (!(dbh = journal_read_header (sb, j, n, sequence, &h)))
+		return 1;
+	if (h->h_type == EXT2_JOURNAL_REVOKE) {
+		brelse (dbh);
+		if (!(dbh = journal_read_header (sb, j, ++n, sequence, &h)))
+			return 1;
+	}
+	blocks = (unsigned long *) (h + 1);
+	for (i = 0; i < h->h_count && !err; i++) {
+		if (journal_revoked (revokes, nr_revokes, blocks[i], sequence))
+			continue;
+		if (!(lbh = journal_bread (sb, j, n + 1 + i))) {
+			err = 1;
+			break;
+		}
+		if (!(bh = getblk (sb->s_dev, blocks[i], sb->s_blocksize))) {
+			brelse (lbh);
+			err = 1;
+			break;
+		}
+		memcpy (bh->b_data, lbh->b_data, sb->s_blocksize);
+		err = journal_write_wait (&bh, 1);
+		brelse (bh);
+		brelse (lbh);
+	}
+	brelse (dbh);
+	return err;
+}
+
+/*
+ * Writes home the transactions committed but not checkpointed when the
+ * file system went down.  Inodes read before are out of date then, so
+ * this is only allowed when nothing but the journal inode was read, and
+ * that one is dropped.  Returns 0 if it couldn't.
+ */
+static int journal_recover (struct super_block * sb, struct ext2_journal * j,
+			    int replay)
+{
+	struct ext2_journal_super * js;
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct ext2_group_desc * gdp;
+	unsigned long * revokes;
+	unsigned long n, next, sequence, end;
+	unsigned long free_blocks, free_inodes;
+	int nr_revokes = 0;
+	int i;
+
+	js = (struct ext2_journal_super *) j->j_sbh->b_data;
+	j->j_sequence = js->js_sequence;
+	/*
+	 * If the fs was mounted or checked without the journal since, the
+	 * log is older than what is on the disk
+	 */
+	if (js->js_mnt_count != es->s_mnt_count ||
+	    js->js_mtime != es->s_mtime) {
+		if (!js->js_start)
+			return 1;
+		printk ("EXT2-fs: the journal is older than the file system, "
+			"not replayed\n");
+		js->js_start = 0;
+		js->js_nr_orphans = 0;
+		return !journal_write_wait (&j->j_sbh, 1);
+	}
+	j->j_nr_orphans = js->js_nr_orphans;
+	if (j->j_nr_orphans > EXT2_JOURNAL_ORPHANS)
+		j->j_nr_orphans = EXT2_JOURNAL_ORPHANS;
+	memcpy (j->j_orphans, js->js_orphans,
+		j->j_nr_orphans * sizeof (unsigned long));
+	if (!js->js_start)
+		goto valid;
+	if (!replay) {
+		printk ("EXT2-fs: the journal needs recovery, mount the fs "
+			"again\n");
+		return 0;
+	}
+	if (!(revokes = (unsigned long *) __get_free_page (GFP_KERNEL)))
+		return 0;
+	/*
+	 * First find the committed transactions and what they revoked,
+	 * then write them home in order.
+	 */
+	for (n = js->js_start, sequence = js->js_sequence;
+	     (next = journal_scan (sb, j, n, sequence, revokes, &nr_revokes));
+	     n = next, sequence++)
+		;
+	end = sequence;
+	for (n = js->js_start, sequence = js->js_sequence; sequence != end;
+	     sequence++) {
+		next = journal_scan (sb, j, n, sequence, NULL, NULL);
+		if (journal_replay (sb, j, n, sequence, revokes, nr_revokes)) {
+			free_page ((unsigned long) revokes);
+			printk ("EXT2-fs: I/O error replaying the journal\n");
+			return 0;
+		}
+		n = next;
+	}
+	free_page ((unsigned long) revokes);
+	if (end != js->js_sequence) {
+		printk ("EXT2-fs: recovered %lu transaction%s from the "
+			"journal\n", end - js->js_sequence,
+			end - js->js_sequence == 1 ? "" : "s");
+		invalidate_inodes (sb->s_dev);
+	}
+	j->j_sequence = end;
+	js->js_start = 0;
+	js->js_sequence = end;
+	js->js_nr_orphans = j->j_nr_orphans;
+	memcpy (js->js_orphans, j->j_orphans,
+		j->j_nr_orphans * sizeof (unsigned long));
+	if (journal_write_wait (&j->j_sbh, 1))
+		return 0;
+	/*
+	 * The super block isn't journaled: count again
+	 */
+	free_blocks = free_inodes = 0;
+	for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++) {
+		gdp = (struct ext2_group_desc *) sb->u.ext2_sb.s_group_desc
+			[i / EXT2_DESC_PER_BLOCK(sb)]->b_data +
+			i % EXT2_DESC_PER_BLOCK(sb);
+		free_blocks += gdp->bg_free_blocks_count;
+		free_inodes += gdp->bg_free_inodes_count;
+	}
+	es->s_free_blocks_count = free_blocks;
+	es->s_free_inodes_count = free_inodes;
+	sb->u.ext2_sb.s_sbh->b_dirt = 1;
+valid:
+	/*
+	 * The log was written by the last mount and nothing is left in it:
+	 * the fs is as consistent as a cleanly unmounted one, unless errors
+	 * were seen
+	 */
+	if (!(sb->u.ext2_sb.s_mount_state & EXT2_ERROR_FS) &&
+	    !(es->s_state & EXT2_ERROR_FS)) {
+		sb->u.ext2_sb.s_mount_state |= EXT2_VALID_FS;
+		es->s_state |= EXT2_VALID_FS;
+		sb->u.ext2_sb.s_sbh->b_dirt = 1;
+	}
+	return 1;
+}
+
+static void journal_free (struct ext2_journal * j)
+{
+	if (j->j_runs)
+		kfree_s (j->j_runs, EXT2_JOURNAL_MAX_RUNS *
+			 sizeof (struct ext2_journal_run));
+	if (j->j_running)
+		kfree_s (j->j_running,
+			 j->j_max_blocks * sizeof (struct buffer_head *));
+	if (j->j_next)
+		kfree_s (j->j_next, j->j_max_blocks * sizeof (short));
+	if (j->j_revoked)
+		kfree_s (j->j_revoked, j->j_max_blocks * sizeof (unsigned long));
+	if (j->j_checkpoint)
+		free_page ((unsigned long) j->j_checkpoint);
+	if (j->j_sbh)
+		brelse (j->j_sbh);
+	kfree_s (j, sizeof (struct ext2_journal));
+}
+
+/*
+ * Maps the journal file, recovers it if needed and starts using it.
+ * Called at mount time before the root inode is read; replay is 0 when
+ * other inodes may be in use, and a log to replay is then an error.
+ * Returns 0 on failure.
+ */
+int ext2_journal_load (struct super_block * sb, unsigned long ino, int replay)
+{
+	struct ext2_journal * j;
+	struct ext2_journal_super * js;
+	struct inode * inode;
+	unsigned long n, block, maxlen;
+	int err = 0;
+
+	if (!(inode = iget (sb, ino))) {
+		printk ("EXT2-fs: cannot read journal inode %lu\n", ino);
+		return 0;
+	}
+	if (!S_ISREG(inode->i_mode) ||
+	    (maxlen = inode->i_size / sb->s_blocksize) <
+	    EXT2_JOURNAL_MIN_BLOCKS) {
+		printk ("EXT2-fs: journal inode %lu is not a file of at least "
+			"%d blocks\n", ino, EXT2_JOURNAL_MIN_BLOCKS);
+		iput (inode);
+		return 0;
+	}
+	j = (struct ext2_journal *) kmalloc (sizeof (struct ext2_journal),
+					     GFP_KERNEL);
+	if (!j) {
+		iput (inode);
+		return 0;
+	}
+	memset (j, 0, sizeof (struct ext2_journal));
+	j->j_ino = ino;
+	j->j_size = inode->i_size;
+	j->j_maxlen = maxlen;
+	j->j_max_blocks = EXT2_JOURNAL_ENTRIES(sb);
+	if (j->j_max_blocks > (maxlen - 1) / 4 - 3)
+		j->j_max_blocks = (maxlen - 1) / 4 - 3;
+	if (j->j_max_blocks > 4080 / sizeof (struct buffer_head *))
+		j->j_max_blocks = 4080 / sizeof (struct buffer_head *);
+	j->j_op_blocks = j->j_max_blocks / 3;
+	if (j->j_op_blocks > JOURNAL_OP_BLOCKS)
+		j->j_op_blocks = JOURNAL_OP_BLOCKS;
+	j->j_runs = (struct ext2_journal_run *)
+		kmalloc (EXT2_JOURNAL_MAX_RUNS *
+			 sizeof (struct ext2_journal_run), GFP_KERNEL);
+	j->j_running = (struct buffer_head **)
+		kmalloc (j->j_max_blocks * sizeof (struct buffer_head *),
+			 GFP_KERNEL);
+	j->j_next = (short *) kmalloc (j->j_max_blocks * sizeof (short),
+				       GFP_KERNEL);
+	j->j_revoked = (unsigned long *)
+		kmalloc (j->j_max_blocks * sizeof (unsigned long), GFP_KERNEL);
+	j->j_checkpoint = (unsigned long *) __get_free_page (GFP_KERNEL);
+	if (!j->j_runs || !j->j_running || !j->j_next || !j->j_revoked ||
+	    !j->j_checkpoint) {
+		printk ("EXT2-fs: no memory for the journal\n");
+		iput (inode);
+		journal_free (j);
+		return 0;
+	}
+	/*
+	 * The file is not kept open, as that would keep the fs from being
+	 * unmounted: its blocks are mapped once, in runs, and
+	 * ext2_journal_file keeps anybody from changing them meanwhile
+	 */
+	for (n = 0; n < maxlen; n++) {
+		if (!(block = ext2_bmap (inode, n))) {
+			printk ("EXT2-fs: the journal has a hole at block "
+				"%lu\n", n);
+			err = 1;
+			break;
+		}
+		if (j->j_nr_runs &&
+		    block == j->j_runs[j->j_nr_runs - 1].r_block +
+			     j->j_runs[j->j_nr_runs - 1].r_len) {
+			j->j_runs[j->j_nr_runs - 1].r_len++;
+			continue;
+		}
+		if (j->j_nr_runs == EXT2_JOURNAL_MAX_RUNS) {
+			printk ("EXT2-fs: the journal is too fragmented\n");
+			err = 1;
+			break;
+		}
+		j->j_runs[j->j_nr_runs].r_block = block;
+		j->j_runs[j->j_nr_runs++].r_len = 1;
+	}
+	iput (inode);
+	if (err || !(j->j_sbh = journal_bread (sb, j, 0))) {
+		journal_free (j);
+		return 0;
+	}
+	js = (struct ext2_journal_super *) j->j_sbh->b_data;
+	if (js->js_header.h_magic != EXT2_JOURNAL_MAGIC) {
+		/*
+		 * A new journal
+		 */
+		memset (js, 0, sb->s_blocksize);
+		js->js_header.h_magic = EXT2_JOURNAL_MAGIC;
+		js->js_header.h_type = EXT2_JOURNAL_SUPER;
+		js->js_blocksize = sb->s_blocksize;
+		js->js_maxlen = maxlen;
+		js->js_sequence = 1;
+		js->js_start = 0;
+		if (journal_write_wait (&j->j_sbh, 1)) {
+			journal_free (j);
+			return 0;
+		}
+		printk ("EXT2-fs: created a journal of %lu blocks\n", maxlen);
+	}
+	if (js->js_header.h_type != EXT2_JOURNAL_SUPER ||
+	    js->js_blocksize != sb->s_blocksize || js->js_maxlen > maxlen) {
+		printk ("EXT2-fs: bad journal super block\n");
+		journal_free (j);
+		return 0;
+	}
+	j->j_maxlen = js->js_maxlen;
+	j->j_head = 1;
+	journal_clear_running (j);
+	if (!journal_recover (sb, j, replay)) {
+		journal_free (j);
+		return 0;
+	}
+	sb->u.ext2_sb.s_journal = j;
+	return 1;
+}
+
+/*
+ * Records the mount in the journal super block, once the super block that
+ * says which mount it is has reached the disk
+ */
+void ext2_journal_stamp (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct ext2_journal_super * js;
+
+	if (!j)
+		return;
+	if (journal_write_wait (&sb->u.ext2_sb.s_sbh, 1))
+		ext2_error (sb, "ext2_journal_stamp",
+			    "I/O error writing the super block");
+	js = (struct ext2_journal_super *) j->j_sbh->b_data;
+	js->js_mnt_count = es->s_mnt_count;
+	js->js_mtime = es->s_mtime;
+	if (journal_write_wait (&j->j_sbh, 1))
+		ext2_error (sb, "ext2_journal_stamp",
+			    "I/O error writing the journal super block");
+}
+
+/*
+ * Finishes deleting the inodes a crash left orphans.  Called once the fs
+ * is mounted read-write and the mount is recorded in the journal.
+ */
+void ext2_journal_orphans (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	unsigned long orphans[EXT2_JOURNAL_ORPHANS];
+	struct inode * inode;
+	int i, n, deleted = 0;
+
+	if (!j || !(n = j->j_nr_orphans))
+		return;
+	memcpy (orphans, j->j_orphans, n * sizeof (unsigned long));
+	for (i = 0; i < n; i++) {
+		if (orphans[i] < EXT2_FIRST_INO ||
+		    orphans[i] > sb->u.ext2_sb.s_es->s_inodes_count ||
+		    !(inode = iget (sb, orphans[i]))) {
+			ext2_journal_orphan (sb, orphans[i], 0);
+			continue;
+		}
+		if (inode->i_nlink || !inode->i_mode)
+			ext2_journal_orphan (sb, orphans[i], 0);
+		else
+			deleted++;
+		iput (inode);
+	}
+	if (deleted)
+		printk ("EXT2-fs: deleted %d orphan inode%s\n", deleted,
+			deleted == 1 ? "" : "s");
+}
+
+/*
+ * Commits and checkpoints everything, and stops using the journal
+ */
+void ext2_journal_release (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+
+	if (!j)
+		return;
+	while (j->j_handles || j->j_committing || j->j_flushing ||
+	       j->j_reaping)
+		sleep_on (&j->j_wait);
+	journal_reap (sb, j);
+	ext2_journal_commit (sb);
+	journal_checkpoint (sb, j);
+	sb->u.ext2_sb.s_journal = NULL;
+	journal_free (j);
+}
@@ -64,6 +64,232 @@ static int ext2_match (int len, const char * const name,
 	return (int) same;
 }
 
+/*
+ * Hashed directory index: see the layout in <linux/ext2_fs.h>.
+ */
+struct dx_frame {
+	struct buffer_head * bh;
+	struct ext2_dx_entry * entries;
+	struct ext2_dx_entry * at;
+};
+
+#define dx_count(e)	(((struct ext2_dx_countlimit *) (e))->count)
+#define dx_limit(e)	(((struct ext2_dx_countlimit *) (e))->limit)
+
+#define dx_root_info(bh) ((struct ext2_dx_root_info *) ((bh)->b_data + \
+			  EXT2_DIR_REC_LEN(1) + EXT2_DIR_REC_LEN(2)))
+#define dx_root_limit(sb) (((sb)->s_blocksize - EXT2_DIR_REC_LEN(1) - \
+			   EXT2_DIR_REC_LEN(2) - \
+			   sizeof (struct ext2_dx_root_info)) / \
+			   sizeof (struct ext2_dx_entry))
+#define dx_node_limit(sb) (((sb)->s_blocksize - EXT2_DIR_REC_LEN(0)) / \
+			   sizeof (struct ext2_dx_entry))
+
+/*
+ * "." and ".." always live in block 0, ahead of the index.
+ */
+static inline int dx_dot_name (const char * name, int len)
+{
+	return len == 0 || (name[0] == '.' &&
+			    (len == 1 || (len == 2 && name[1] == '.')));
+}
+
+static unsigned long ext2_dx_hash (const char * name, int len)
+{
+	const unsigned char * p = (const unsigned char *) name;
+	unsigned long hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+	while (len--) {
+		hash = hash1 + (hash0 ^ (*p++ * 7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+static void dx_release (struct dx_frame * frames, struct dx_frame * frame)
+{
+	for (; frame >= frames; frame--)
+		brelse (frame->bh);
+}
+
+/*
+ * The index is no good: say so, and let the directory be searched and
+ * extended linearly from now on.
+ */
+static void dx_bad_index (struct inode * dir, const char * reason)
+{
+	ext2_warning (dir->i_sb, "dx_probe", "bad index in directory %lu: %s",
+		      dir->i_ino, reason);
+	dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+	dir->i_dirt = 1;
+}
+
+/*
+ * Walk down the index to the leaf that should hold the hash.  Returns
+ * the deepest frame, with the buffers of all frames held, or NULL.  On
+ * NULL, *err is 0 when the index was found to be bad and has been
+ * dropped, so the caller should go on as for an unindexed directory.
+ */
+static struct dx_frame * dx_probe (struct inode * dir, unsigned long hash,
+				   struct dx_frame * frames, int * err)
+{
+	struct super_block * sb = dir->i_sb;
+	unsigned long nblocks = dir->i_size >> EXT2_BLOCK_SIZE_BITS(sb);
+	struct dx_frame * frame = frames;
+	struct buffer_head * bh;
+	struct ext2_dir_entry * de;
+	struct ext2_dx_root_info * info;
+	struct ext2_dx_entry * entries, * p, * q, * m;
+	int levels;
+
+	if (!(bh = ext2_bread (dir, 0, 0, err)))
+		return NULL;
+	de = (struct ext2_dir_entry *) (bh->b_data + EXT2_DIR_REC_LEN(1));
+	info = dx_root_info(bh);
+	if (de->rec_len != sb->s_blocksize - EXT2_DIR_REC_LEN(1) ||
+	    info->reserved_zero || info->info_length != sizeof (*info) ||
+	    info->hash_version != EXT2_DX_HASH_LEGACY ||
+	    info->indirect_levels >= EXT2_DX_MAX_LEVELS) {
+		brelse (bh);
+		dx_bad_index (dir, "bad root");
+		*err = 0;
+		return NULL;
+	}
+	levels = info->indirect_levels;
+	entries = (struct ext2_dx_entry *) ((char *) info + info->info_length);
+	if (dx_limit(entries) != dx_root_limit(sb))
+		goto bad;
+	while (1) {
+		if (!dx_count(entries) || dx_count(entries) > dx_limit(entries))
+			goto bad;
+		/* The last entry whose hash is not above ours */
+		p = entries + 1;
+		q = entries + dx_count(entries) - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (m->hash > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		frame->bh = bh;
+		frame->entries = entries;
+		frame->at = p - 1;
+		if (!frame->at->block || frame->at->block >= nblocks) {
+			dx_release (frames, frame);
+			dx_bad_index (dir, "block out of range");
+			*err = 0;
+			return NULL;
+		}
+		if (!levels--)
+			return frame;
+		if (!(bh = ext2_bread (dir, frame->at->block, 0, err))) {
+			dx_release (frames, frame);
+			return NULL;
+		}
+		frame++;
+		de = (struct ext2_dir_entry *) bh->b_data;
+		entries = (struct ext2_dx_entry *) (bh->b_data +
+						    EXT2_DIR_REC_LEN(0));
+		if (de->inode || de->rec_len != sb->s_blocksize ||
+		    dx_limit(entries) != dx_node_limit(sb))
+			goto bad;
+	}
+bad:
+	brelse (bh);
+	dx_release (frames, frame - 1);
+	dx_bad_index (dir, "bad index block");
+	*err = 0;
+	return NULL;
+}
+
+/*
+ * Step the frames on to the next leaf if it continues the run of the
+ * hash.  Returns 1 if it did, 0 if there is nothing more to look at, or
+ * a negative error.
+ */
+static int dx_next_block (struct inode * dir, unsigned long hash,
+			  struct dx_frame * frames, struct dx_frame * frame)
+{
+	struct dx_frame * p = frame;
+	struct buffer_head * bh;
+	int err, num = 0;
+
+	while (++p->at >= p->entries + dx_count(p->entries)) {
+		if (p == frames)
+			return 0;
+		num++;
+		p--;
+	}
+	if ((p->at->hash & ~1) != hash)
+		return 0;
+	while (num--) {
+		if (!(bh = ext2_bread (dir, p->at->block, 0, &err)))
+			return err;
+		p++;
+		brelse (p->bh);
+		p->bh = bh;
+		p->entries = p->at = (struct ext2_dx_entry *)
+					(bh->b_data + EXT2_DIR_REC_LEN(0));
+	}
+	return 1;
+}
+
+/*
+ * ext2_find_entry() for an indexed directory.  It returns NULL with *err
+ * set to 1 when the index can't be used and the directory must be
+ * searched linearly.
+ */
+static struct buffer_head * ext2_dx_find_entry (struct inode * dir,
+						const char * const name,
+						int namelen,
+						struct ext2_dir_entry ** res_dir,
+						int * err)
+{
+	struct super_block * sb = dir->i_sb;
+	struct dx_frame frames[EXT2_DX_MAX_LEVELS], * frame;
+	struct buffer_head * bh;
+	struct ext2_dir_entry * de;
+	unsigned long hash, offset;
+	char * dlimit;
+
+	hash = ext2_dx_hash (name, namelen);
+	if (!(frame = dx_probe (dir, hash, frames, err))) {
+		if (!*err)
+			*err = 1;
+		return NULL;
+	}
+	do {
+		bh = ext2_bread (dir, frame->at->block, 0, err);
+		if (!bh)
+			break;
+		offset = frame->at->block << EXT2_BLOCK_SIZE_BITS(sb);
+		de = (struct ext2_dir_entry *) bh->b_data;
+		dlimit = bh->b_data + sb->s_blocksize;
+		while ((char *) de < dlimit) {
+			if (!ext2_check_dir_entry ("ext2_dx_find_entry", dir,
+						   de, bh, offset))
+				break;
+			if (de->inode != 0 && ext2_match (namelen, name, de)) {
+				dx_release (frames, frame);
+				*res_dir = de;
+				*err = 0;
+				return bh;
+			}
+			offset += de->rec_len;
+			de = (struct ext2_dir_entry *)
+				((char *) de + de->rec_len);
+		}
+		brelse (bh);
+		*err = dx_next_block (dir, hash, frames, frame);
+	} while (*err > 0);
+	dx_release (frames, frame);
+	return NULL;
+}
+
 /*
  *	ext2_find_entry()
  *
@@ -94,6 +320,14 @@ static struct buffer_head * ext2_find_entry (struct inode * dir,
 	if (namelen > EXT2_NAME_LEN)
 		namelen = EXT2_NAME_LEN;
 #endif
+	if ((dir->u.ext2_i.i_flags & EXT2_INDEX_FL) &&
+	    !dx_dot_name (name, namelen)) {
+		struct buffer_head * bh;
+
+		bh = ext2_dx_find_entry (dir, name, namelen, res_dir, &err);
+		if (bh || err != 1)
+			return bh;
+	}
 
 	memset (bh_use, 0, sizeof (bh_use));
 	toread = 0;
@@ -205,6 +439,386 @@ int ext2_lookup (struct inode * dir, const char * name, int len,
 	return 0;
 }
 
+/*
+ * Put a new entry into one block of a directory, if it has room.  On
+ * failure *err is -ENOSPC if the block is just full.
+ */
+static struct ext2_dir_entry * ext2_add_to_block (struct inode * dir,
+						  struct buffer_head * bh,
+						  const char * name,
+						  int namelen, int * err)
+{
+	struct super_block * sb = dir->i_sb;
+	struct ext2_dir_entry * de, * de1;
+	unsigned short rec_len = EXT2_DIR_REC_LEN(namelen);
+	unsigned long offset = 0;
+	char * dlimit = bh->b_data + sb->s_blocksize;
+
+	de = (struct ext2_dir_entry *) bh->b_data;
+	while ((char *) de < dlimit) {
+		if (!ext2_check_dir_entry ("ext2_add_to_block", dir, de, bh,
+					   offset)) {
+			*err = -ENOENT;
+			return NULL;
+		}
+		if ((de->inode == 0 && de->rec_len >= rec_len) ||
+		    (de->rec_len >= EXT2_DIR_REC_LEN(de->name_len) + rec_len)) {
+			if (de->inode) {
+				de1 = (struct ext2_dir_entry *) ((char *) de +
+					EXT2_DIR_REC_LEN(de->name_len));
+				de1->rec_len = de->rec_len -
+					EXT2_DIR_REC_LEN(de->name_len);
+				de->rec_len = EXT2_DIR_REC_LEN(de->name_len);
+				de = de1;
+			}
+			de->inode = 0;
+			de->name_len = namelen;
+			memcpy (de->name, name, namelen);
+			ext2_journal_dirty (sb, bh);
+			*err = 0;
+			return de;
+		}
+		offset += de->rec_len;
+		de = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+	}
+	*err = -ENOSPC;
+	return NULL;
+}
+
+/*
+ * Add a block to the end of a directory.
+ */
+static struct buffer_head * dx_append_block (struct inode * dir,
+					     unsigned long * block, int * err)
+{
+	struct buffer_head * bh;
+
+	*block = dir->i_size >> EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+	if (!(bh = ext2_bread (dir, *block, 1, err)))
+		return NULL;
+	dir->i_size += dir->i_sb->s_blocksize;
+	dir->i_dirt = 1;
+	return bh;
+}
+
+static void dx_insert (struct inode * dir, struct dx_frame * frame,
+		       unsigned long hash, unsigned long block)
+{
+	struct ext2_dx_entry * new = frame->at + 1;
+	int count = dx_count(frame->entries);
+
+	memmove (new + 1, new,
+		 (char *) (frame->entries + count) - (char *) new);
+	new->hash = hash;
+	new->block = block;
+	dx_count(frame->entries) = count + 1;
+	ext2_journal_dirty (dir->i_sb, frame->bh);
+}
+
+/*
+ * Make sure the deepest index block has room for one more entry, adding
+ * a level below the root or splitting a node as needed.  *framep is
+ * moved to wherever the entry for the leaf now is.
+ */
+static int dx_make_room (struct inode * dir, struct dx_frame * frames,
+			 struct dx_frame ** framep)
+{
+	struct super_block * sb = dir->i_sb;
+	struct dx_frame * frame = *framep;
+	struct buffer_head * bh;
+	struct ext2_dir_entry * de;
+	struct ext2_dx_entry * entries;
+	unsigned long block;
+	int count, count1, err;
+
+	count = dx_count(frame->entries);
+	if (count < dx_limit(frame->entries))
+		return 0;
+	if (frame != frames && dx_count(frames->entries) ==
+			       dx_limit(frames->entries)) {
+		ext2_warning (sb, "dx_make_room", "directory %lu index full",
+			      dir->i_ino);
+		return -ENOSPC;
+	}
+	if (!(bh = dx_append_block (dir, &block, &err)))
+		return err;
+	de = (struct ext2_dir_entry *) bh->b_data;
+	de->inode = 0;
+	de->rec_len = sb->s_blocksize;
+	de->name_len = 0;
+	entries = (struct ext2_dx_entry *) (bh->b_data + EXT2_DIR_REC_LEN(0));
+	ext2_journal_dirty (sb, bh);
+	if (frame == frames) {
+		/* The root is full: move its entries down into a new node */
+		memcpy (entries, frame->entries, count * sizeof (*entries));
+		dx_limit(entries) = dx_node_limit(sb);
+		dx_count(frame->entries) = 1;
+		frame->entries->block = block;
+		dx_root_info(frame->bh)->indirect_levels++;
+		ext2_journal_dirty (sb, frame->bh);
+		frame[1].bh = bh;
+		frame[1].entries = entries;
+		frame[1].at = entries + (frame->at - frame->entries);
+		frame->at = frame->entries;
+		*framep = frame + 1;
+		return 0;
+	}
+	/* Split the node, and enter the upper half in the root */
+	count1 = count / 2;
+	memcpy (entries, frame->entries + count1,
+		(count - count1) * sizeof (*entries));
+	dx_insert (dir, frames, frame->entries[count1].hash, block);
+	dx_count(entries) = count - count1;
+	dx_limit(entries) = dx_node_limit(sb);
+	dx_count(frame->entries) = count1;
+	ext2_journal_dirty (sb, frame->bh);
+	if (frame->at >= frame->entries + count1) {
+		frame->at = entries + (frame->at - (frame->entries + count1));
+		frame->entries = entries;
+		brelse (frame->bh);
+		frame->bh = bh;
+		frames->at++;
+	} else
+		brelse (bh);
+	return 0;
+}
+
+struct dx_map {
+	unsigned long hash;
+	unsigned short offs;
+	unsigned short size;
+};
+
+/*
+ * Split a full leaf by hash, moving the upper half of its entries to a
+ * new block at the end of the directory.  Returns whichever of the two
+ * blocks the hash now belongs in, and releases the other.
+ */
+static struct buffer_head * dx_split_leaf (struct inode * dir,
+					   struct dx_frame * frame,
+					   struct buffer_head * bh,
+					   unsigned long hash, int * err)
+{
+	struct super_block * sb = dir->i_sb;
+	struct buffer_head * bh2;
+	struct ext2_dir_entry * de, * de2, * last, * next;
+	struct dx_map * map, tmp;
+	unsigned long block, split;
+	char * p, * dlimit = bh->b_data + sb->s_blocksize;
+	int count, i, j, size;
+
+	if (!(map = (struct dx_map *) __get_free_page (GFP_KERNEL))) {
+		*err = -ENOMEM;
+		brelse (bh);
+		return NULL;
+	}
+	count = 0;
+	for (de = (struct ext2_dir_entry *) bh->b_data; (char *) de < dlimit;
+	     de = (struct ext2_dir_entry *) ((char *) de + de->rec_len)) {
+		if (!de->inode)
+			continue;
+		map[count].hash = ext2_dx_hash (de->name, de->name_len);
+		map[count].offs = (char *) de - bh->b_data;
+		map[count].size = EXT2_DIR_REC_LEN(de->name_len);
+		count++;
+	}
+	for (i = 1; i < count; i++) {
+		tmp = map[i];
+		for (j = i; j > 0 && map[j - 1].hash > tmp.hash; j--)
+			map[j] = map[j - 1];
+		map[j] = tmp;
+	}
+	/* Move about half the bytes, but always leave one entry behind */
+	size = 0;
+	for (i = count; i > 1 && size < sb->s_blocksize / 2; )
+		size += map[--i].size;
+	if (i < 1 || i >= count) {
+		free_page ((unsigned long) map);
+		brelse (bh);
+		*err = -ENOSPC;
+		return NULL;
+	}
+	if (!(bh2 = dx_append_block (dir, &block, err))) {
+		free_page ((unsigned long) map);
+		brelse (bh);
+		return NULL;
+	}
+	split = map[i].hash;
+	if (map[i - 1].hash == split)
+		split |= 1;
+
+	p = bh2->b_data;
+	last = NULL;
+	for (j = i; j < count; j++) {
+		de = (struct ext2_dir_entry *) (bh->b_data + map[j].offs);
+		memcpy (p, de, map[j].size);
+		last = (struct ext2_dir_entry *) p;
+		last->rec_len = map[j].size;
+		p += map[j].size;
+		de->inode = 0;
+	}
+	last->rec_len += bh2->b_data + sb->s_blocksize - p;
+	free_page ((unsigned long) map);
+
+	/* Close up what stays behind */
+	p = bh->b_data;
+	last = NULL;
+	for (de = (struct ext2_dir_entry *) bh->b_data; (char *) de < dlimit;
+	     de = next) {
+		next = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+		if (!de->inode)
+			continue;
+		size = EXT2_DIR_REC_LEN(de->name_len);
+		memmove (p, de, size);
+		de2 = (struct ext2_dir_entry *) p;
+		de2->rec_len = size;
+		last = de2;
+		p += size;
+	}
+	last->rec_len += dlimit - p;
+
+	dx_insert (dir, frame, split, block);
+	ext2_journal_dirty (sb, bh);
+	ext2_journal_dirty (sb, bh2);
+	if (hash >= split) {
+		brelse (bh);
+		return bh2;
+	}
+	brelse (bh2);
+	return bh;
+}
+
+/*
+ * ext2_add_entry() for an indexed directory.  It returns NULL with *err
+ * set to 1 when the index can't be used.
+ */
+static struct buffer_head * ext2_dx_add_entry (struct inode * dir,
+					       const char * name, int namelen,
+					       struct ext2_dir_entry ** res_dir,
+					       int * err)
+{
+	struct dx_frame frames[EXT2_DX_MAX_LEVELS], * frame;
+	struct buffer_head * bh;
+	struct ext2_dir_entry * de;
+	unsigned long hash;
+
+	bh = ext2_dx_find_entry (dir, name, namelen, &de, err);
+	if (bh) {
+		brelse (bh);
+		*err = -EEXIST;
+		return NULL;
+	}
+	if (*err)
+		return NULL;
+	hash = ext2_dx_hash (name, namelen);
+	if (!(frame = dx_probe (dir, hash, frames, err))) {
+		if (!*err)
+			*err = 1;
+		return NULL;
+	}
+	if (!(bh = ext2_bread (dir, frame->at->block, 0, err)))
+		goto out;
+	de = ext2_add_to_block (dir, bh, name, namelen, err);
+	if (!de && *err == -ENOSPC) {
+		if ((*err = dx_make_room (dir, frames, &frame))) {
+			brelse (bh);
+			bh = NULL;
+			goto out;
+		}
+		if (!(bh = dx_split_leaf (dir, frame, bh, hash, err)))
+			goto out;
+		de = ext2_add_to_block (dir, bh, name, namelen, err);
+	}
+	if (!de) {
+		brelse (bh);
+		bh = NULL;
+		goto out;
+	}
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	dir->i_dirt = 1;
+	*res_dir = de;
+out:
+	dx_release (frames, frame);
+	return bh;
+}
+
+/*
+ * The only block of a directory is full: rather than growing it, move
+ * its entries out to block 1 and build the root of an index in block 0.
+ * Returns 0 if the directory is now indexed, leaving bh alone otherwise.
+ */
+static int ext2_dx_make_indexed (struct inode * dir, struct buffer_head * bh)
+{
+	struct super_block * sb = dir->i_sb;
+	struct buffer_head * bh1;
+	struct ext2_dir_entry * de, * de1, * last, * next;
+	struct ext2_dx_root_info * info;
+	struct ext2_dx_entry * entries;
+	char * p, * dlimit = bh->b_data + sb->s_blocksize;
+	int err, size;
+
+	de = (struct ext2_dir_entry *) bh->b_data;
+	de1 = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+	if (de->rec_len != EXT2_DIR_REC_LEN(1) || de1->name_len != 2 ||
+	    de1->name[0] != '.' || de1->name[1] != '.' ||
+	    de1->rec_len != EXT2_DIR_REC_LEN(2))
+		return 1;
+	if (!(bh1 = ext2_bread (dir, 1, 1, &err)))
+		return err;
+	/*
+	 * ext2_bread may have slept, and someone else may have converted
+	 * the directory or added to it meanwhile
+	 */
+	if (dir->u.ext2_i.i_flags & EXT2_INDEX_FL) {
+		brelse (bh1);
+		brelse (bh);
+		return 0;
+	}
+	if (dir->i_size != sb->s_blocksize ||
+	    de1->rec_len != EXT2_DIR_REC_LEN(2)) {
+		brelse (bh1);
+		return 1;
+	}
+	p = bh1->b_data;
+	last = NULL;
+	for (de = (struct ext2_dir_entry *) ((char *) de1 + de1->rec_len);
+	     (char *) de < dlimit; de = next) {
+		next = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+		if (!de->inode)
+			continue;
+		size = EXT2_DIR_REC_LEN(de->name_len);
+		memcpy (p, de, size);
+		last = (struct ext2_dir_entry *) p;
+		last->rec_len = size;
+		p += size;
+	}
+	if (!last) {
+		last = (struct ext2_dir_entry *) p;
+		last->inode = 0;
+		last->name_len = 0;
+		last->rec_len = 0;
+	}
+	last->rec_len += bh1->b_data + sb->s_blocksize - p;
+	ext2_journal_dirty (sb, bh1);
+	brelse (bh1);
+
+	de1->rec_len = sb->s_blocksize - EXT2_DIR_REC_LEN(1);
+	info = dx_root_info(bh);
+	memset (info, 0, dlimit - (char *) info);
+	info->hash_version = EXT2_DX_HASH_LEGACY;
+	info->info_length = sizeof (*info);
+	entries = (struct ext2_dx_entry *) (info + 1);
+	dx_limit(entries) = dx_root_limit(sb);
+	dx_count(entries) = 1;
+	entries->block = 1;
+	ext2_journal_dirty (sb, bh);
+	brelse (bh);
+	dir->i_size = 2 * sb->s_blocksize;
+	dir->u.ext2_i.i_flags |= EXT2_INDEX_FL;
+	dir->i_dirt = 1;
+	return 0;
+}
+
 /*
  *	ext2_add_entry()
  *
@@ -248,6 +862,12 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 		*err = -ENOENT;
 		return NULL;
 	}
+	if ((dir->u.ext2_i.i_flags & EXT2_INDEX_FL) &&
+	    !dx_dot_name (name, namelen)) {
+		bh = ext2_dx_add_entry (dir, name, namelen, res_dir, err);
+		if (bh || *err != 1)
+			return bh;
+	}
 	bh = ext2_bread (dir, 0, 0, err);
 	if (!bh)
 		return NULL;
@@ -257,6 +877,11 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 	*err = -ENOSPC;
 	while (1) {
 		if ((char *)de >= sb->s_blocksize + bh->b_data) {
+			if (offset == sb->s_blocksize &&
+			    dir->i_size == offset && test_opt (sb, INDEX) &&
+			    !ext2_dx_make_indexed (dir, bh))
+				return ext2_add_entry (dir, name, namelen,
+						       res_dir, err);
 			brelse (bh);
 			bh = NULL;
 			bh = ext2_bread (dir, offset >> EXT2_BLOCK_SIZE_BITS(sb), 1, err);
@@ -323,7 +948,7 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 			 */
 			dir->i_mtime = dir->i_ctime = CURRENT_TIME;
 			dir->i_dirt = 1;
-			bh->b_dirt = 1;
+			ext2_journal_dirty (sb, bh);
 			*res_dir = de;
 			*err = 0;
 			return bh;
@@ -365,8 +990,12 @@ static int ext2_delete_entry (struct ext2_dir_entry * dir,
 	return -ENOENT;
 }
 
-int ext2_create (struct inode * dir,const char * name, int len, int mode,
-		 struct inode ** result)
+/*
+ * Each of the directory operations is done within one journal transaction.
+ * Synchronous directories wait for the transaction to reach the disk.
+ */
+static int do_ext2_create (struct inode * dir, const char * name,
+			   int len, int mode, struct inode ** result)
 {
 	struct inode * inode;
 	struct buffer_head * bh;
@@ -397,7 +1026,7 @@ int ext2_create (struct inode * dir,const char * name, int len, int mode,
 	ext2_dcache_add (dir->i_dev, dir->i_ino, de->name, de->name_len,
 			 de->inode);
 #endif
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -408,8 +1037,21 @@ int ext2_create (struct inode * dir,const char * name, int len, int mode,
 	return 0;
 }
 
-int ext2_mknod (struct inode * dir, const char * name, int len, int mode,
-		int rdev)
+int ext2_create (struct inode * dir, const char * name, int len, int mode,
+		 struct inode ** result)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_create (dir, name, len, mode, result);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
+static int do_ext2_mknod (struct inode * dir, const char * name,
+			  int len, int mode, int rdev)
 {
 	struct inode * inode;
 	struct buffer_head * bh;
@@ -471,7 +1113,7 @@ int ext2_mknod (struct inode * dir, const char * name, int len, int mode,
 	ext2_dcache_add (dir->i_dev, dir->i_ino, de->name, de->name_len,
 			 de->inode);
 #endif
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -482,7 +1124,21 @@ int ext2_mknod (struct inode * dir, const char * name, int len, int mode,
 	return 0;
 }
 
-int ext2_mkdir (struct inode * dir, const char * name, int len, int mode)
+int ext2_mknod (struct inode * dir, const char * name, int len, int mode,
+		int rdev)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_mknod (dir, name, len, mode, rdev);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
+static int do_ext2_mkdir (struct inode * dir, const char * name,
+			  int len, int mode)
 {
 	struct inode * inode;
 	struct buffer_head * bh, * dir_block;
@@ -531,7 +1187,7 @@ int ext2_mkdir (struct inode * dir, const char * name, int len, int mode)
 	de->name_len = 2;
 	strcpy (de->name, "..");
 	inode->i_nlink = 2;
-	dir_block->b_dirt = 1;
+	ext2_journal_dirty (inode->i_sb, dir_block);
 	brelse (dir_block);
 	inode->i_mode = S_IFDIR | (mode & S_IRWXUGO & ~current->umask);
 	if (dir->i_mode & S_ISGID)
@@ -550,7 +1206,7 @@ int ext2_mkdir (struct inode * dir, const char * name, int len, int mode)
 	ext2_dcache_add (dir->i_dev, dir->i_ino, de->name, de->name_len,
 			 de->inode);
 #endif
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -563,6 +1219,18 @@ int ext2_mkdir (struct inode * dir, const char * name, int len, int mode)
 	return 0;
 }
 
+int ext2_mkdir (struct inode * dir, const char * name, int len, int mode)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_mkdir (dir, name, len, mode);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
 /*
  * routine to check that the specified directory is empty (for rmdir)
  */
@@ -617,7 +1285,7 @@ static int empty_dir (struct inode * inode)
 	return 1;
 }
 
-int ext2_rmdir (struct inode * dir, const char * name, int len)
+static int do_ext2_rmdir (struct inode * dir, const char * name, int len)
 {
 	int retval;
 	struct inode * inode;
@@ -653,6 +1321,19 @@ repeat:
 		retval = -ENOTDIR;
 		goto end_rmdir;
 	}
+	/*
+	 * Whoever holds i_sem may be waiting to start an operation, and so
+	 * for this one to end.  Nothing is changed yet: end it meanwhile.
+	 */
+	if (inode->i_sem.count <= 0) {
+		brelse (bh);
+		ext2_journal_stop (dir->i_sb, 0);
+		down(&inode->i_sem);
+		up(&inode->i_sem);
+		ext2_journal_start (dir->i_sb);
+		iput (inode);
+		goto repeat;
+	}
 	down(&inode->i_sem);
 	if (!empty_dir (inode))
 		retval = -ENOTEMPTY;
@@ -674,7 +1355,7 @@ repeat:
 	up(&inode->i_sem);
 	if (retval)
 		goto end_rmdir;
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -702,7 +1383,19 @@ end_rmdir:
 	return retval;
 }
 
-int ext2_unlink (struct inode * dir, const char * name, int len)
+int ext2_rmdir (struct inode * dir, const char * name, int len)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_rmdir (dir, name, len);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
+static int do_ext2_unlink (struct inode * dir, const char * name, int len)
 {
 	int retval;
 	struct inode * inode;
@@ -720,7 +1413,7 @@ repeat:
 	if (!(inode = iget (dir->i_sb, de->inode)))
 		goto end_unlink;
 	retval = -EPERM;
-	if (S_ISDIR(inode->i_mode))
+	if (S_ISDIR(inode->i_mode) || ext2_journal_file (inode))
 		goto end_unlink;
 	if (de->inode != inode->i_ino) {
 		iput(inode);
@@ -742,7 +1435,7 @@ repeat:
 	retval = ext2_delete_entry (de, bh);
 	if (retval)
 		goto end_unlink;
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -763,8 +1456,20 @@ end_unlink:
 	return retval;
 }
 
-int ext2_symlink (struct inode * dir, const char * name, int len,
-		  const char * symname)
+int ext2_unlink (struct inode * dir, const char * name, int len)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_unlink (dir, name, len);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
+static int do_ext2_symlink (struct inode * dir, const char * name,
+			    int len, const char * symname)
 {
 	struct ext2_dir_entry * de;
 	struct inode * inode = NULL;
@@ -807,7 +1512,7 @@ int ext2_symlink (struct inode * dir, const char * name, int len,
 		link[i++] = c;
 	link[i] = 0;
 	if (name_block) {
-		name_block->b_dirt = 1;
+		ext2_journal_dirty (inode->i_sb, name_block);
 		brelse (name_block);
 	}
 	inode->i_size = i;
@@ -834,7 +1539,7 @@ int ext2_symlink (struct inode * dir, const char * name, int len,
 	ext2_dcache_add (dir->i_dev, dir->i_ino, de->name, de->name_len,
 			 de->inode);
 #endif
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -845,8 +1550,21 @@ int ext2_symlink (struct inode * dir, const char * name, int len,
 	return 0;
 }
 
-int ext2_link (struct inode * oldinode, struct inode * dir,
-	       const char * name, int len)
+int ext2_symlink (struct inode * dir, const char * name, int len,
+		  const char * symname)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_symlink (dir, name, len, symname);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
+static int do_ext2_link (struct inode * oldinode, struct inode * dir,
+			 const char * name, int len)
 {
 	struct ext2_dir_entry * de;
 	struct buffer_head * bh;
@@ -880,7 +1598,7 @@ int ext2_link (struct inode * oldinode, struct inode * dir,
 	ext2_dcache_add (dir->i_dev, dir->i_ino, de->name, de->name_len,
 			 de->inode);
 #endif
-	bh->b_dirt = 1;
+	ext2_journal_dirty (dir->i_sb, bh);
 	if (IS_SYNC(dir)) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
@@ -894,6 +1612,19 @@ int ext2_link (struct inode * oldinode, struct inode * dir,
 	return 0;
 }
 
+int ext2_link (struct inode * oldinode, struct inode * dir,
+	       const char * name, int len)
+{
+	struct super_block * sb = dir->i_sb;
+	int sync = IS_SYNC(dir);
+	int err;
+
+	ext2_journal_start (sb);
+	err = do_ext2_link (oldinode, dir, name, len);
+	ext2_journal_stop (sb, sync);
+	return err;
+}
+
 static int subdir (struct inode * new_inode, struct inode * old_inode)
 {
 	int ino;
@@ -944,7 +1675,7 @@ static int do_ext2_rename (struct inode * old_dir, const char * old_name,
 	struct inode * old_inode, * new_inode;
 	struct buffer_head * old_bh, * new_bh, * dir_bh;
 	struct ext2_dir_entry * old_de, * new_de;
-	int retval;
+	int retval, reserved;
 
 	goto start_up;
 try_again:
@@ -961,6 +1692,7 @@ start_up:
 	old_inode = new_inode = NULL;
 	old_bh = new_bh = dir_bh = NULL;
 	new_de = NULL;
+	reserved = 0;
 	old_bh = ext2_find_entry (old_dir, old_name, old_len, &old_de);
 	retval = -ENOENT;
 	if (!old_bh)
@@ -1000,6 +1732,8 @@ start_up:
 			goto end_rename;
 	}
 	retval = -EPERM;
+	if (new_inode && ext2_journal_file (new_inode))
+		goto end_rename;
 	if (new_inode && (new_dir->i_mode & S_ISVTX) &&
 	    current->euid != new_inode->i_uid &&
 	    current->euid != new_dir->i_uid && !suser())
@@ -1020,17 +1754,37 @@ start_up:
 		if (!new_inode && new_dir->i_nlink >= EXT2_LINK_MAX)
 			goto end_rename;
 	}
-	if (!new_bh)
+	if (!new_bh) {
 		new_bh = ext2_add_entry (new_dir, new_name, new_len, &new_de,
 					 &retval);
-	if (!new_bh)
-		goto end_rename;
+		if (!new_bh)
+			goto end_rename;
+		/*
+		 * Splitting a block of an indexed directory can move the
+		 * old entry, so look for it again.  That may sleep: claim
+		 * the new slot first, so that nobody else can take it.
+		 */
+		if (old_dir == new_dir &&
+		    (old_dir->u.ext2_i.i_flags & EXT2_INDEX_FL)) {
+			new_de->inode = old_inode->i_ino;
+			ext2_journal_dirty (new_dir->i_sb, new_bh);
+			reserved = 1;
+			brelse (old_bh);
+			old_bh = ext2_find_entry (old_dir, old_name, old_len,
+						  &old_de);
+			if (!old_bh) {
+				new_de->inode = 0;
+				goto try_again;
+			}
+		}
+	}
 	/*
 	 * sanity checking before doing the rename - avoid races
 	 */
 	if (new_inode && (new_de->inode != new_inode->i_ino))
 		goto try_again;
-	if (new_de->inode && !new_inode)
+	if (new_de->inode && !new_inode &&
+	    !(reserved && new_de->inode == old_inode->i_ino))
 		goto try_again;
 	if (old_de->inode != old_inode->i_ino)
 		goto try_again;
@@ -1056,19 +1810,19 @@ start_up:
 	}
 	old_dir->i_ctime = old_dir->i_mtime = CURRENT_TIME;
 	old_dir->i_dirt = 1;
-	old_bh->b_dirt = 1;
+	ext2_journal_dirty (old_dir->i_sb, old_bh);
 	if (IS_SYNC(old_dir)) {
 		ll_rw_block (WRITE, 1, &old_bh);
 		wait_on_buffer (old_bh);
 	}
-	new_bh->b_dirt = 1;
+	ext2_journal_dirty (new_dir->i_sb, new_bh);
 	if (IS_SYNC(new_dir)) {
 		ll_rw_block (WRITE, 1, &new_bh);
 		wait_on_buffer (new_bh);
 	}
 	if (dir_bh) {
 		PARENT_INO(dir_bh->b_data) = new_dir->i_ino;
-		dir_bh->b_dirt = 1;
+		ext2_journal_dirty (old_dir->i_sb, dir_bh);
 		old_dir->i_nlink--;
 		old_dir->i_dirt = 1;
 		if (new_inode) {
@@ -1107,14 +1861,18 @@ end_rename:
 int ext2_rename (struct inode * old_dir, const char * old_name, int old_len,
 		 struct inode * new_dir, const char * new_name, int new_len)
 {
+	struct super_block * sb = old_dir->i_sb;
+	int sync = IS_SYNC(old_dir) || IS_SYNC(new_dir);
 	int result;
 
 	while (old_dir->i_sb->u.ext2_sb.s_rename_lock)
 		sleep_on (&old_dir->i_sb->u.ext2_sb.s_rename_wait);
 	old_dir->i_sb->u.ext2_sb.s_rename_lock = 1;
+	ext2_journal_start (sb);
 	result = do_ext2_rename (old_dir, old_name, old_len, new_dir,
 				 new_name, new_len);
 	old_dir->i_sb->u.ext2_sb.s_rename_lock = 0;
-	wake_up (&old_dir->i_sb->u.ext2_sb.s_rename_wait);
+	wake_up (&sb->u.ext2_sb.s_rename_wait);
+	ext2_journal_stop (sb, sync);
 	return result;
 }
@@ -24,6 +24,7 @@
 #include <linux/stat.h>
 #include <linux/string.h>
 #include <linux/locks.h>
+#include <linux/malloc.h>
 
 extern int vsprintf (char *, const char *, va_list);
 
@@ -93,6 +94,13 @@ void ext2_put_super (struct super_block * sb)
 {
 	int i;
 
+	ext2_journal_release (sb);
+	if (test_opt (sb, DEBUG))
+		printk ("[EXT II FS inode table updates %lu, inodes written "
+			"with a neighbour %lu, atime updates skipped %lu]\n",
+			sb->u.ext2_sb.s_inode_writes,
+			sb->u.ext2_sb.s_inodes_batched,
+			sb->u.ext2_sb.s_atime_skipped);
 	lock_super (sb);
 	if (!(sb->s_flags & MS_RDONLY)) {
 		sb->u.ext2_sb.s_es->s_state = sb->u.ext2_sb.s_mount_state;
@@ -102,15 +110,12 @@ void ext2_put_super (struct super_block * sb)
 	ext2_dcache_invalidate (sb->s_dev);
 #endif
 	sb->s_dev = 0;
-	for (i = 0; i < EXT2_MAX_GROUP_DESC; i++)
-		if (sb->u.ext2_sb.s_group_desc[i])
-			brelse (sb->u.ext2_sb.s_group_desc[i]);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_inode_bitmap[i])
-			brelse (sb->u.ext2_sb.s_inode_bitmap[i]);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_block_bitmap[i])
-			brelse (sb->u.ext2_sb.s_block_bitmap[i]);
+	for (i = 0; i < sb->u.ext2_sb.s_gdb_count; i++)
+		brelse (sb->u.ext2_sb.s_group_desc[i]);
+	kfree_s (sb->u.ext2_sb.s_group_desc,
+		 sb->u.ext2_sb.s_gdb_count * sizeof (struct buffer_head *));
+	ext2_bitmap_cache_release (&sb->u.ext2_sb.s_inode_bitmaps);
+	ext2_bitmap_cache_release (&sb->u.ext2_sb.s_block_bitmaps);
 	brelse (sb->u.ext2_sb.s_sbh);
 	unlock_super (sb);
 	return;
@@ -173,7 +178,7 @@ static int convert_pre_02b_fs (struct super_block * sb,
  * This function has been shamelessly adapted from the msdos fs
  */
 static int parse_options (char * options, unsigned long * sb_block,
-			  unsigned long * mount_options)
+			  unsigned long * journal, unsigned long * mount_options)
 {
 	char * this_char;
 	char * value;
@@ -236,6 +241,31 @@ static int parse_options (char * options, unsigned long * sb_block,
 		else if (!strcmp (this_char, "grpid") ||
 			 !strcmp (this_char, "bsdgroups"))
 			set_opt (*mount_options, GRPID);
+		else if (!strcmp (this_char, "journal")) {
+			if (!value || !*value) {
+				printk ("EXT2-fs: the journal option requires "
+					"an argument");
+				return 0;
+			}
+			*journal = simple_strtoul (value, &value, 0);
+			if (*value) {
+				printk ("EXT2-fs: Invalid journal option: %s\n",
+					value);
+				return 0;
+			}
+		}
+		else if (!strcmp (this_char, "batchinodes"))
+			set_opt (*mount_options, BATCH_INODES);
+		else if (!strcmp (this_char, "nobatchinodes"))
+			clear_opt (*mount_options, BATCH_INODES);
+		else if (!strcmp (this_char, "lazyatime"))
+			set_opt (*mount_options, LAZY_ATIME);
+		else if (!strcmp (this_char, "strictatime"))
+			clear_opt (*mount_options, LAZY_ATIME);
+		else if (!strcmp (this_char, "index"))
+			set_opt (*mount_options, INDEX);
+		else if (!strcmp (this_char, "noindex"))
+			clear_opt (*mount_options, INDEX);
 		else if (!strcmp (this_char, "nocheck")) {
 			clear_opt (*mount_options, CHECK_NORMAL);
 			clear_opt (*mount_options, CHECK_STRICT);
@@ -289,6 +319,7 @@ static void ext2_setup_super (struct super_block * sb,
 		es->s_mtime = CURRENT_TIME;
 		sb->u.ext2_sb.s_sbh->b_dirt = 1;
 		sb->s_dirt = 1;
+		ext2_journal_stamp (sb);
 		if (test_opt (sb, DEBUG))
 			printk ("[EXT II FS %s, %s, bs=%lu, fs=%lu, gc=%lu, "
 				"bpg=%lu, ipg=%lu, mo=%04lx]\n",
@@ -352,6 +383,50 @@ static int ext2_check_descriptors (struct super_block * sb)
 	return 1;
 }
 
+/*
+ * Recovers the journal the fs was last used with, if it isn't the one
+ * wanted, and starts the one wanted.  Read-only mounts are recovered but
+ * don't keep a journal.  replay is passed on to ext2_journal_load.
+ */
+static int ext2_setup_journal (struct super_block * sb, unsigned long journal,
+			       int replay)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	unsigned long orphans[EXT2_JOURNAL_ORPHANS];
+	int i, nr_orphans = 0;
+
+	sb->u.ext2_sb.s_journal = NULL;
+	if (es->s_journal_inum && (es->s_journal_inum != journal ||
+				   (sb->s_flags & MS_RDONLY))) {
+		if (!ext2_journal_load (sb, es->s_journal_inum, replay))
+			return 0;
+		nr_orphans = sb->u.ext2_sb.s_journal->j_nr_orphans;
+		memcpy (orphans, sb->u.ext2_sb.s_journal->j_orphans,
+			nr_orphans * sizeof (unsigned long));
+		ext2_journal_release (sb);
+	}
+	if (sb->s_flags & MS_RDONLY)
+		return 1;
+	if (journal && !ext2_journal_load (sb, journal, replay))
+		return 0;
+	/*
+	 * Deletions left unfinished by the old journal go on with the new
+	 * one; without any, only e2fsck can finish them
+	 */
+	for (i = 0; i < nr_orphans; i++)
+		ext2_journal_orphan (sb, orphans[i], 1);
+	if (nr_orphans && !journal) {
+		printk ("EXT2-fs: orphan inodes left, running e2fsck is "
+			"recommended\n");
+		sb->u.ext2_sb.s_mount_state &= ~EXT2_VALID_FS;
+	}
+	if (es->s_journal_inum != journal) {
+		es->s_journal_inum = journal;
+		sb->u.ext2_sb.s_sbh->b_dirt = 1;
+	}
+	return 1;
+}
+
 struct super_block * ext2_read_super (struct super_block * sb, void * data,
 				      int silent)
 {
@@ -359,6 +434,7 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	struct ext2_super_block * es;
 	unsigned long sb_block = 1;
 	unsigned long logic_sb_block = 1;
+	unsigned long journal = ~0UL;
 	int dev = sb->s_dev;
 	int bh_count;
 	int i, j;
@@ -367,7 +443,12 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 #endif
 
 	set_opt (sb->u.ext2_sb.s_mount_opt, CHECK_NORMAL);
-	if (!parse_options ((char *) data, &sb_block,
+	set_opt (sb->u.ext2_sb.s_mount_opt, BATCH_INODES);
+	sb->u.ext2_sb.s_journal = NULL;
+	sb->u.ext2_sb.s_inode_writes = 0;
+	sb->u.ext2_sb.s_inodes_batched = 0;
+	sb->u.ext2_sb.s_atime_skipped = 0;
+	if (!parse_options ((char *) data, &sb_block, &journal,
 	    &sb->u.ext2_sb.s_mount_opt)) {
 		sb->s_dev = 0;
 		return NULL;
@@ -511,17 +592,18 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 				        es->s_first_data_block +
 				       EXT2_BLOCKS_PER_GROUP(sb) - 1) /
 				       EXT2_BLOCKS_PER_GROUP(sb);
-	for (i = 0; i < EXT2_MAX_GROUP_DESC; i++)
-		sb->u.ext2_sb.s_group_desc[i] = NULL;
 	bh_count = (sb->u.ext2_sb.s_groups_count + EXT2_DESC_PER_BLOCK(sb) - 1) /
 		   EXT2_DESC_PER_BLOCK(sb);
-	if (bh_count > EXT2_MAX_GROUP_DESC) {
+	sb->u.ext2_sb.s_group_desc = (struct buffer_head **)
+		kmalloc (bh_count * sizeof (struct buffer_head *), GFP_KERNEL);
+	if (!sb->u.ext2_sb.s_group_desc) {
 		sb->s_dev = 0;
 		unlock_super (sb);
 		brelse (bh);
 		printk ("EXT2-fs: file system is too big\n");
 		return NULL;
 	}
+	sb->u.ext2_sb.s_gdb_count = bh_count;
 	for (i = 0; i < bh_count; i++) {
 		sb->u.ext2_sb.s_group_desc[i] = bread (dev, logic_sb_block + i + 1,
 						       sb->s_blocksize);
@@ -530,39 +612,58 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 			unlock_super (sb);
 			for (j = 0; j < i; j++)
 				brelse (sb->u.ext2_sb.s_group_desc[j]);
+			kfree_s (sb->u.ext2_sb.s_group_desc,
+				 bh_count * sizeof (struct buffer_head *));
 			brelse (bh);
 			printk ("EXT2-fs: unable to read group descriptors\n");
 			return NULL;
 		}
 	}
 	if (!ext2_check_descriptors (sb)) {
-		sb->s_dev = 0;
-		unlock_super (sb);
-		for (j = 0; j < i; j++)
-			brelse (sb->u.ext2_sb.s_group_desc[j]);
-		brelse (bh);
 		printk ("EXT2-fs: group descriptors corrupted !\n");
-		return NULL;
+		goto failed_desc;
 	}
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++) {
-		sb->u.ext2_sb.s_inode_bitmap_number[i] = 0;
-		sb->u.ext2_sb.s_inode_bitmap[i] = NULL;
-		sb->u.ext2_sb.s_block_bitmap_number[i] = 0;
-		sb->u.ext2_sb.s_block_bitmap[i] = NULL;
+	sb->u.ext2_sb.s_inode_bitmaps.bc_slot = NULL;
+	sb->u.ext2_sb.s_block_bitmaps.bc_slot = NULL;
+	if (!ext2_bitmap_cache_init (sb, &sb->u.ext2_sb.s_inode_bitmaps) ||
+	    !ext2_bitmap_cache_init (sb, &sb->u.ext2_sb.s_block_bitmaps)) {
+		ext2_bitmap_cache_release (&sb->u.ext2_sb.s_inode_bitmaps);
+		printk ("EXT2-fs: no memory for the bitmap cache\n");
+		goto failed_desc;
 	}
-	sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
-	sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
 	unlock_super (sb);
 	/*
 	 * set up enough so that it can read an inode
 	 */
 	sb->s_dev = dev;
 	sb->s_op = &ext2_sops;
+	/*
+	 * Replaying the journal changes inodes on the disk, so it comes
+	 * before anything but the journal itself is read
+	 */
+	if (journal == ~0UL)
+		journal = es->s_journal_inum;
+	if (!ext2_setup_journal (sb, journal, 1)) {
+		sb->s_dev = 0;
+		for (i = 0; i < bh_count; i++)
+			brelse (sb->u.ext2_sb.s_group_desc[i]);
+		kfree_s (sb->u.ext2_sb.s_group_desc,
+			 bh_count * sizeof (struct buffer_head *));
+		ext2_bitmap_cache_release (&sb->u.ext2_sb.s_inode_bitmaps);
+		ext2_bitmap_cache_release (&sb->u.ext2_sb.s_block_bitmaps);
+		brelse (bh);
+		printk ("EXT2-fs: cannot load the journal\n");
+		return NULL;
+	}
 	if (!(sb->s_mounted = iget (sb, EXT2_ROOT_INO))) {
+		ext2_journal_release (sb);
 		sb->s_dev = 0;
-		for (i = 0; i < EXT2_MAX_GROUP_DESC; i++)
-			if (sb->u.ext2_sb.s_group_desc[i])
-				brelse (sb->u.ext2_sb.s_group_desc[i]);
+		for (i = 0; i < bh_count; i++)
+			brelse (sb->u.ext2_sb.s_group_desc[i]);
+		kfree_s (sb->u.ext2_sb.s_group_desc,
+			 bh_count * sizeof (struct buffer_head *));
+		ext2_bitmap_cache_release (&sb->u.ext2_sb.s_inode_bitmaps);
+		ext2_bitmap_cache_release (&sb->u.ext2_sb.s_block_bitmaps);
 		brelse (bh);
 		printk ("EXT2-fs: get root inode failed\n");
 		return NULL;
@@ -575,7 +676,18 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	}
 #endif
 	ext2_setup_super (sb, es);
+	ext2_journal_orphans (sb);
 	return sb;
+
+failed_desc:
+	sb->s_dev = 0;
+	unlock_super (sb);
+	for (i = 0; i < bh_count; i++)
+		brelse (sb->u.ext2_sb.s_group_desc[i]);
+	kfree_s (sb->u.ext2_sb.s_group_desc,
+		 bh_count * sizeof (struct buffer_head *));
+	brelse (bh);
+	return NULL;
 }
 
 static void ext2_commit_super (struct super_block * sb,
@@ -600,6 +712,7 @@ static void ext2_commit_super (struct super_block * sb,
 void ext2_write_super (struct super_block * sb)
 {
 	struct ext2_super_block * es;
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
 
 	if (!(sb->s_flags & MS_RDONLY)) {
 		es = sb->u.ext2_sb.s_es;
@@ -613,23 +726,33 @@ void ext2_write_super (struct super_block * sb)
 		ext2_commit_super (sb, es);
 	}
 	sb->s_dirt = 0;
+	/*
+	 * This is where sync and the update daemon commit the journal.  If
+	 * an operation is in progress, try again next time.
+	 */
+	if (j) {
+		ext2_journal_commit (sb);
+		sb->s_dirt = j->j_commit_wanted;
+	}
 }
 
 int ext2_remount (struct super_block * sb, int * flags, char * data)
 {
 	struct ext2_super_block * es;
 	unsigned long tmp;
+	unsigned long journal = ~0UL;
 
 	/*
 	 * Allow the "check" option to be passed as a remount option.
 	 */
 	set_opt (sb->u.ext2_sb.s_mount_opt, CHECK_NORMAL);
-	parse_options (data, &tmp, &sb->u.ext2_sb.s_mount_opt);
+	parse_options (data, &tmp, &journal, &sb->u.ext2_sb.s_mount_opt);
 
 	es = sb->u.ext2_sb.s_es;
 	if ((*flags & MS_RDONLY) == (sb->s_flags & MS_RDONLY))
 		return 0;
 	if (*flags & MS_RDONLY) {
+		ext2_journal_release (sb);
 		if (es->s_state & EXT2_VALID_FS ||
 		    !(sb->u.ext2_sb.s_mount_state & EXT2_VALID_FS))
 			return 0;
@@ -651,7 +774,19 @@ int ext2_remount (struct super_block * sb, int * flags, char * data)
 		 */
 		sb->u.ext2_sb.s_mount_state = es->s_state;
 		sb->s_flags &= ~MS_RDONLY;
+		if (journal == ~0UL)
+			journal = es->s_journal_inum;
+		/*
+		 * The journal was recovered when the fs was mounted, and
+		 * inodes are in use now: don't replay anything over them
+		 */
+		if (!ext2_setup_journal (sb, journal, 0)) {
+			sb->s_flags |= MS_RDONLY;
+			printk ("EXT2-fs: cannot load the journal\n");
+			return -EINVAL;
+		}
 		ext2_setup_super (sb, es);
+		ext2_journal_orphans (sb);
 	}
 	return 0;
 }
@@ -48,8 +48,15 @@ static int ext2_secrm_seed = 152;	/* Random generator base */
  *
  * The new code handles normal truncates (size = 0) as well as the more
  * general case (size = XXX). I hope.
+ *
+ * With a journal, a truncate stops when the transaction has no room left
+ * for what it frees, and goes on in the next one.  Freeing a run of
+ * blocks takes a revoke record each, plus the bitmap and descriptor.
  */
 
+#define TRUNC_ROOM(inode, count) \
+	(ext2_journal_room ((inode)->i_sb) < (int) (count) + 4)
+
 static int trunc_direct (struct inode * inode)
 {
 	int i, tmp;
@@ -69,6 +76,10 @@ repeat:
 		tmp = *p;
 		if (!tmp)
 			continue;
+		if (TRUNC_ROOM(inode, free_count)) {
+			retry = 1;
+			break;
+		}
 		if (inode->u.ext2_i.i_flags & EXT2_SECRM_FL)
 			bh = getblk (inode->i_dev, tmp,
 				     inode->i_sb->s_blocksize);
@@ -79,7 +90,7 @@ repeat:
 			brelse (bh);
 			goto repeat;
 		}
-		if ((bh && bh->b_count != 1) || tmp != *p) {
+		if ((bh && ext2_journal_busy (inode->i_sb, bh)) || tmp != *p) {
 			retry = 1;
 			brelse (bh);
 			continue;
@@ -127,6 +138,8 @@ static int trunc_indirect (struct inode * inode, int offset, unsigned long * p)
 	tmp = *p;
 	if (!tmp)
 		return 0;
+	if (TRUNC_ROOM(inode, 4))
+		return 1;
 	ind_bh = bread (inode->i_dev, tmp, inode->i_sb->s_blocksize);
 	if (tmp != *p) {
 		brelse (ind_bh);
@@ -146,6 +159,10 @@ repeat:
 		tmp = *ind;
 		if (!tmp)
 			continue;
+		if (TRUNC_ROOM(inode, free_count)) {
+			retry = 1;
+			break;
+		}
 		if (inode->u.ext2_i.i_flags & EXT2_SECRM_FL)
 			bh = getblk (inode->i_dev, tmp,
 				     inode->i_sb->s_blocksize);
@@ -156,13 +173,13 @@ repeat:
 			brelse (bh);
 			goto repeat;
 		}
-		if ((bh && bh->b_count != 1) || tmp != *ind) {
+		if ((bh && ext2_journal_busy (inode->i_sb, bh)) || tmp != *ind) {
 			retry = 1;
 			brelse (bh);
 			continue;
 		}
 		*ind = 0;
-		ind_bh->b_dirt = 1;
+		ext2_journal_dirty (inode->i_sb, ind_bh);
 		if (inode->u.ext2_i.i_flags & EXT2_SECRM_FL) {
 			clear_block (bh->b_data, inode->i_sb->s_blocksize,
 				     RANDOM_INT);
@@ -190,7 +207,7 @@ repeat:
 		if (*(ind++))
 			break;
 	if (i >= addr_per_block)
-		if (ind_bh->b_count != 1)
+		if (ext2_journal_busy (inode->i_sb, ind_bh))
 			retry = 1;
 		else {
 			tmp = *p;
@@ -222,6 +239,8 @@ static int trunc_dindirect (struct inode * inode, int offset,
 	tmp = *p;
 	if (!tmp)
 		return 0;
+	if (TRUNC_ROOM(inode, 4))
+		return 1;
 	dind_bh = bread (inode->i_dev, tmp, inode->i_sb->s_blocksize);
 	if (tmp != *p) {
 		brelse (dind_bh);
@@ -243,14 +262,14 @@ repeat:
 			continue;
 		retry |= trunc_indirect (inode, offset + (i * addr_per_block),
 					  dind);
-		dind_bh->b_dirt = 1;
+		ext2_journal_dirty (inode->i_sb, dind_bh);
 	}
 	dind = (unsigned long *) dind_bh->b_data;
 	for (i = 0; i < addr_per_block; i++)
 		if (*(dind++))
 			break;
 	if (i >= addr_per_block)
-		if (dind_bh->b_count != 1)
+		if (ext2_journal_busy (inode->i_sb, dind_bh))
 			retry = 1;
 		else {
 			tmp = *p;
@@ -302,14 +321,14 @@ repeat:
 		retry |= trunc_dindirect(inode, EXT2_NDIR_BLOCKS +
 			addr_per_block + (i + 1) * addr_per_block * addr_per_block,
 			tind);
-		tind_bh->b_dirt = 1;
+		ext2_journal_dirty (inode->i_sb, tind_bh);
 	}
 	tind = (unsigned long *) tind_bh->b_data;
 	for (i = 0; i < addr_per_block; i++)
 		if (*(tind++))
 			break;
 	if (i >= addr_per_block)
-		if (tind_bh->b_count != 1)
+		if (ext2_journal_busy (inode->i_sb, tind_bh))
 			retry = 1;
 		else {
 			tmp = *p;
@@ -333,9 +352,22 @@ void ext2_truncate (struct inode * inode)
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 	    S_ISLNK(inode->i_mode)))
 		return;
+	/*
+	 * ext2_permission should have refused it already
+	 */
+	if (ext2_journal_file (inode)) {
+		inode->i_size = inode->i_sb->u.ext2_sb.s_journal->j_size;
+		return;
+	}
+	/*
+	 * i_sem comes first: ext2_file_write holds it when it starts an
+	 * operation, which may wait for this one to end
+	 */
+	down(&inode->i_sem);
+	ext2_journal_start (inode->i_sb);
 	ext2_discard_prealloc(inode);
 	while (1) {
-		down(&inode->i_sem);
+		inode->u.ext2_i.i_map_len = 0;
 		retry = trunc_direct(inode);
 		retry |= trunc_indirect (inode, EXT2_IND_BLOCK,
 			(unsigned long *) &inode->u.ext2_i.i_data[EXT2_IND_BLOCK]);
@@ -343,14 +375,20 @@ void ext2_truncate (struct inode * inode)
 			EXT2_ADDR_PER_BLOCK(inode->i_sb),
 			(unsigned long *) &inode->u.ext2_i.i_data[EXT2_DIND_BLOCK]);
 		retry |= trunc_tindirect (inode);
-		up(&inode->i_sem);
+		inode->u.ext2_i.i_map_len = 0;
 		if (!retry)
 			break;
 		if (IS_SYNC(inode) && inode->i_dirt)
 			ext2_sync_inode (inode);
 		current->counter = 0;
+		ext2_journal_stop (inode->i_sb, 0);
+		up(&inode->i_sem);
 		schedule ();
+		down(&inode->i_sem);
+		ext2_journal_start (inode->i_sb);
 	}
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME;
 	inode->i_dirt = 1;
+	ext2_journal_stop (inode->i_sb, 0);
+	up(&inode->i_sem);
 }
@@ -419,6 +419,20 @@ struct inode * get_pipe_inode(void)
 	return inode;
 }
 
+/*
+ * Looks an inode up in core, without reading it or taking a reference.
+ * File systems use it to write dirty inodes that share a block together.
+ */
+struct inode * find_inode(dev_t dev, int nr)
+{
+	struct inode * inode;
+
+	for (inode = hash(dev, nr)->inode; inode ; inode = inode->i_hash_next)
+		if (inode->i_dev == dev && inode->i_ino == nr)
+			return inode;
+	return NULL;
+}
+
 struct inode * iget(struct super_block * sb,int nr)
 {
 	return __iget(sb,nr,1);
@@ -8,6 +8,10 @@
 #include <linux/kernel.h>
 #include <linux/errno.h>
 #include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+
+#include <asm/bitops.h>
 
 
 static struct fat_cache *fat_cache,cache[FAT_CACHE];
@@ -94,6 +98,14 @@ int fat_access(struct super_block *sb,int nr,int new_value)
 			}
 			brelse(c_bh);
 		}
+		if (MSDOS_SB(sb)->free_map[0]) {
+			nr -= 2;
+			if (new_value)
+				set_bit(nr % FAT_MAP_BITS,MSDOS_SB(sb)->
+				    free_map[nr/FAT_MAP_BITS]);
+			else clear_bit(nr % FAT_MAP_BITS,MSDOS_SB(sb)->
+				    free_map[nr/FAT_MAP_BITS]);
+		}
 	}
 	brelse(bh);
 	if (data != data2) brelse(bh2);
@@ -202,7 +214,9 @@ list_cache();
 void cache_inval_inode(struct inode *inode)
 {
 	struct fat_cache *walk;
+	int i;
 
+	for (i = 0; i < MSDOS_RUNS; i++) MSDOS_I(inode)->i_runs[i].len = 0;
 	for (walk = fat_cache; walk; walk = walk->next)
 		if (walk->device == inode->i_dev && walk->ino == inode->i_ino)
 			walk->device = 0;
@@ -218,18 +232,88 @@ void cache_inval_dev(int device)
 }
 
 
+/* Returns how many of the clusters following nr continue its chain
+   contiguously, at most max. FAT16 entries are read straight from the
+   sector, so a long run costs one buffer lookup per 256 clusters. */
+
+static int fat_run(struct super_block *sb,int nr,int max)
+{
+	struct buffer_head *bh;
+	unsigned short *data;
+	int len,sector;
+
+	len = 0;
+	if (MSDOS_SB(sb)->fat_bits != 16) {
+		while (len < max && fat_access(sb,nr+len,-1) == nr+len+1) len++;
+		return len;
+	}
+	bh = NULL;
+	sector = -1;
+	while (len < max && (unsigned) (nr+len-2) < MSDOS_SB(sb)->clusters) {
+		if (((nr+len)*2 >> SECTOR_BITS) != sector) {
+			if (bh) brelse(bh);
+			sector = (nr+len)*2 >> SECTOR_BITS;
+			if (!(bh = msdos_sread(sb->s_dev,MSDOS_SB(sb)->fat_start+
+			    sector,(void **) &data))) return len;
+		}
+		if (CF_LE_W(data[(nr+len) & (SECTOR_SIZE/2-1)]) != nr+len+1)
+			break;
+		len++;
+	}
+	if (bh) brelse(bh);
+	return len;
+}
+
+
+/* Each inode remembers a few runs of clusters that are contiguous on disk,
+   so mapping a cluster inside a run needs no FAT access at all. Otherwise
+   the chain is walked from the nearest run or cache entry before the
+   target, skipping contiguous stretches with fat_run, and the run that
+   contains the target is remembered. */
+
 int get_cluster(struct inode *inode,int cluster)
 {
-	int nr,count;
+	struct msdos_run *run,*runs;
+	int nr,count,first,start,len;
 
 	if (!(nr = MSDOS_I(inode)->i_start)) return 0;
 	if (!cluster) return nr;
+	runs = MSDOS_I(inode)->i_runs;
 	count = 0;
-	for (cache_lookup(inode,cluster,&count,&nr); count < cluster;
-	    count++) {
+	for (run = runs; run < runs+MSDOS_RUNS; run++) {
+		if (!run->len || run->file > cluster) continue;
+		if (cluster < run->file+run->len)
+			return run->disk+cluster-run->file;
+		if (run->file+run->len-1 > count) {
+			count = run->file+run->len-1;
+			nr = run->disk+run->len-1;
+		}
+	}
+	cache_lookup(inode,cluster,&count,&nr);
+	first = count;
+	start = nr;
+	while (count < cluster) {
+		len = fat_run(inode->i_sb,nr,cluster-count);
+		count += len;
+		nr += len;
+		if (count == cluster) break;
 		if ((nr = fat_access(inode->i_sb,nr,-1)) == -1) return 0;
 		if (!nr) return 0;
+		first = ++count;
+		start = nr;
+	}
+	len = count-first+1+fat_run(inode->i_sb,nr,MSDOS_SB(inode->i_sb)->
+	    clusters);
+	for (run = runs; run < runs+MSDOS_RUNS; run++)
+		if (run->len && run->file == first) break;
+	if (run == runs+MSDOS_RUNS) {
+		run = runs+MSDOS_I(inode)->i_run_hand;
+		MSDOS_I(inode)->i_run_hand = (MSDOS_I(inode)->i_run_hand+1) %
+		    MSDOS_RUNS;
 	}
+	run->file = first;
+	run->disk = start;
+	run->len = len;
 	cache_add(inode,cluster,nr);
 	return nr;
 }
@@ -261,6 +345,7 @@ int fat_free(struct inode *inode,int skip)
 	int nr,last;
 
 	if (!(nr = MSDOS_I(inode)->i_start)) return 0;
+	if (S_ISDIR(inode->i_mode)) msdos_dhash_inval(inode);
 	last = 0;
 	while (skip--) {
 		last = nr;
@@ -291,3 +376,103 @@ int fat_free(struct inode *inode,int skip)
 	cache_inval_inode(inode);
 	return 0;
 }
+
+
+/* The free cluster map has one bit per cluster, set if the FAT entry is in
+   use. It is built on the first allocation or statfs, kept current by
+   fat_access, and lets msdos_add_cluster find a free cluster without
+   reading the FAT. Returns 1 if the map is available. Called with the FAT
+   locked. */
+
+int fat_map_build(struct super_block *sb)
+{
+	struct msdos_sb_info *msb;
+	struct buffer_head *bh;
+	unsigned short *data;
+	unsigned long *map[2];
+	int pages,nr,limit,free,sector,used;
+
+	msb = MSDOS_SB(sb);
+	if (msb->free_map[0]) return 1;
+	pages = (msb->clusters+FAT_MAP_BITS-1)/FAT_MAP_BITS;
+	if (pages > 2) return 0;
+	map[0] = map[1] = NULL;
+	for (nr = 0; nr < pages; nr++) {
+		if (!(map[nr] = (unsigned long *) __get_free_page(GFP_KERNEL)))
+			goto fail;
+		memset(map[nr],0,PAGE_SIZE);
+	}
+	limit = msb->clusters+2;
+	free = 0;
+	bh = NULL;
+	sector = -1;
+	for (nr = 2; nr < limit; nr++) {
+		if (msb->fat_bits == 16) {
+			if ((nr*2 >> SECTOR_BITS) != sector) {
+				if (bh) brelse(bh);
+				sector = nr*2 >> SECTOR_BITS;
+				if (!(bh = msdos_sread(sb->s_dev,msb->fat_start+
+				    sector,(void **) &data))) goto fail;
+			}
+			used = data[nr & (SECTOR_SIZE/2-1)] != 0;
+		}
+		else used = fat_access(sb,nr,-1) != 0;
+		if (used) set_bit((nr-2) % FAT_MAP_BITS,map[(nr-2)/FAT_MAP_BITS]);
+		else free++;
+	}
+	if (bh) brelse(bh);
+	msb->free_map[0] = map[0];
+	msb->free_map[1] = map[1];
+	msb->free_clusters = free;
+	return 1;
+fail:
+	printk("MS-DOS FS: no free cluster map\n");
+	if (map[0]) free_page((unsigned long) map[0]);
+	if (map[1]) free_page((unsigned long) map[1]);
+	return 0;
+}
+
+
+static int map_search(struct msdos_sb_info *msb,int from,int to)
+{
+	int page,end,bit;
+
+	while (from < to) {
+		page = from/FAT_MAP_BITS;
+		end = to-page*FAT_MAP_BITS;
+		if (end > FAT_MAP_BITS) end = FAT_MAP_BITS;
+		bit = find_next_zero_bit(msb->free_map[page],end,
+		    from % FAT_MAP_BITS);
+		if (bit < end) return page*FAT_MAP_BITS+bit;
+		from = (page+1)*FAT_MAP_BITS;
+	}
+	return -1;
+}
+
+
+/* Returns the distance of the next free cluster from prev_free, the number
+   of clusters if there is none, or -1 if there is no map to search. Called
+   with the FAT locked. */
+
+int fat_map_free(struct super_block *sb)
+{
+	struct msdos_sb_info *msb;
+	int start,nr;
+
+	if (!fat_map_build(sb)) return -1;
+	msb = MSDOS_SB(sb);
+	start = msb->prev_free;
+	if ((nr = map_search(msb,start,msb->clusters)) < 0 &&
+	    (nr = map_search(msb,0,start)) < 0) return msb->clusters;
+	return (nr-start+msb->clusters) % msb->clusters;
+}
+
+
+void fat_map_release(struct super_block *sb)
+{
+	if (MSDOS_SB(sb)->free_map[0])
+		free_page((unsigned long) MSDOS_SB(sb)->free_map[0]);
+	if (MSDOS_SB(sb)->free_map[1])
+		free_page((unsigned long) MSDOS_SB(sb)->free_map[1]);
+	MSDOS_SB(sb)->free_map[0] = MSDOS_SB(sb)->free_map[1] = NULL;
+}
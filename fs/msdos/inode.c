@@ -47,6 +47,8 @@ void msdos_put_inode(struct inode *inode)
 void msdos_put_super(struct super_block *sb)
 {
 	cache_inval_dev(sb->s_dev);
+	fat_map_release(sb);
+	msdos_dhash_inval_dev(sb->s_dev);
 	lock_super(sb);
 	sb->s_dev = 0;
 	unlock_super(sb);
@@ -250,6 +252,7 @@ struct super_block *msdos_read_super(struct super_block *s,void *data,
 	MSDOS_SB(s)->fat_wait = NULL;
 	MSDOS_SB(s)->fat_lock = 0;
 	MSDOS_SB(s)->prev_free = 0;
+	MSDOS_SB(s)->free_map[0] = MSDOS_SB(s)->free_map[1] = NULL;
 	if (!(s->s_mounted = iget(s,MSDOS_ROOT_INO))) {
 		s->s_dev = 0;
 		printk("get root inode failed\n");
@@ -267,7 +270,7 @@ void msdos_statfs(struct super_block *sb,struct statfs *buf)
 	put_fs_long(MSDOS_SB(sb)->cluster_size*SECTOR_SIZE,&buf->f_bsize);
 	put_fs_long(MSDOS_SB(sb)->clusters,&buf->f_blocks);
 	lock_fat(sb);
-	if (MSDOS_SB(sb)->free_clusters != -1)
+	if (MSDOS_SB(sb)->free_clusters != -1 || fat_map_build(sb))
 		free = MSDOS_SB(sb)->free_clusters;
 	else {
 		free = 0;
@@ -312,6 +315,8 @@ void msdos_read_inode(struct inode *inode)
 	MSDOS_I(inode)->i_busy = 0;
 	MSDOS_I(inode)->i_depend = MSDOS_I(inode)->i_old = NULL;
 	MSDOS_I(inode)->i_binary = 1;
+	MSDOS_I(inode)->i_parent = 0;
+	cache_inval_inode(inode);
 	inode->i_uid = MSDOS_SB(inode->i_sb)->fs_uid;
 	inode->i_gid = MSDOS_SB(inode->i_sb)->fs_gid;
 	if (inode->i_ino == MSDOS_ROOT_INO) {
@@ -11,6 +11,7 @@
 #include <linux/errno.h>
 #include <linux/string.h>
 #include <linux/stat.h>
+#include <linux/mm.h>
 
 /* Well-known binary file extensions */
 
@@ -116,11 +117,12 @@ int msdos_add_cluster(struct inode *inode)
 	if (!MSDOS_SB(inode->i_sb)->free_clusters) return -ENOSPC;
 	lock_fat(inode->i_sb);
 	limit = MSDOS_SB(inode->i_sb)->clusters;
-	nr = limit; /* to keep GCC happy */
-	for (count = 0; count < limit; count++) {
-		nr = ((count+MSDOS_SB(inode->i_sb)->prev_free) % limit)+2;
-		if (fat_access(inode->i_sb,nr,-1) == 0) break;
-	}
+	if ((count = fat_map_free(inode->i_sb)) < 0)
+		for (count = 0; count < limit; count++) {
+			nr = ((count+MSDOS_SB(inode->i_sb)->prev_free) % limit)+2;
+			if (fat_access(inode->i_sb,nr,-1) == 0) break;
+		}
+	nr = ((count+MSDOS_SB(inode->i_sb)->prev_free) % limit)+2;
 #ifdef DEBUG
 printk("free cluster: %d\n",nr);
 #endif
@@ -446,10 +448,33 @@ static int raw_scan(struct super_block *sb,int start,char *name,int *number,
 }
 
 
+/*
+ * parent_valid checks that the entry at inode number ino still describes the
+ * directory starting at cluster start.
+ */
+
+static int parent_valid(struct super_block *sb,int ino,int start)
+{
+	struct buffer_head *bh;
+	struct msdos_dir_entry *data;
+	int valid;
+
+	if (!(bh = msdos_sread(sb->s_dev,ino >> MSDOS_DPS_BITS,(void **) &data)))
+		return 0;
+	data += ino & (MSDOS_DPS-1);
+	valid = !IS_FREE(data->name) && data->name[0] != '.' &&
+	    (data->attr & ATTR_DIR) && CF_LE_W(data->start) == start;
+	brelse(bh);
+	return valid;
+}
+
+
 /*
  * msdos_parent_ino returns the inode number of the parent directory of dir.
  * File creation has to be deferred while msdos_parent_ino is running to
- * prevent renames.
+ * prevent renames. The result is remembered in the inode and reused as long
+ * as the entry it points to still describes the parent, which saves the scan
+ * of the grandparent.
  */
 
 int msdos_parent_ino(struct inode *dir,int locked)
@@ -466,6 +491,9 @@ int msdos_parent_ino(struct inode *dir,int locked)
 		return current;
 	}
 	if (!current) nr = MSDOS_ROOT_INO;
+	else if (MSDOS_I(dir)->i_parent && parent_valid(dir->i_sb,
+	    MSDOS_I(dir)->i_parent,current))
+		nr = MSDOS_I(dir)->i_parent;
 	else {
 		if ((prev = raw_scan(dir->i_sb,current,MSDOS_DOTDOT,&zero,NULL,
 		    NULL,NULL)) < 0) {
@@ -478,6 +506,7 @@ int msdos_parent_ino(struct inode *dir,int locked)
 			return error;
 		}
 	}
+	MSDOS_I(dir)->i_parent = nr;
 	if (!locked) unlock_creation();
 	return nr;
 }
@@ -504,6 +533,237 @@ int msdos_subdirs(struct inode *dir)
 }
 
 
+/*
+ * Large directories get a name hash: one byte per directory slot, holding a
+ * hash of the name in that slot or zero if the slot is free. A lookup then
+ * only reads the slots whose hash matches, and a search for a free slot only
+ * those marked free. The hashes live in a small LRU cache keyed by device
+ * and first cluster, much like the FAT cache. namei keeps them current with
+ * msdos_dhash_update; whenever that cannot be done exactly, the hash is
+ * simply dropped and rebuilt on the next scan. Every candidate is checked
+ * against the entry on disk, so a hash never causes a wrong match.
+ */
+
+static struct msdos_dhash dhash[MSDOS_DHASH];
+static unsigned long dhash_clock = 0;
+static int dhash_changes = 0; /* a hash being built is stale if changed */
+
+
+static int name_sig(char *name)
+{
+	unsigned long hash;
+	int i;
+
+	hash = 0;
+	for (i = 0; i < MSDOS_NAME; i++)
+		hash = hash*37+(unsigned char) name[i];
+	hash ^= (hash >> 8) ^ (hash >> 16) ^ (hash >> 24);
+	return (hash & 0xff) ? hash & 0xff : 1;
+}
+
+
+/* Returns the inode number of directory slot pos and its entry, or -1. */
+
+static int dhash_entry(struct inode *dir,int pos,struct buffer_head **bh,
+    struct msdos_dir_entry **de)
+{
+	int sector;
+	void *data;
+
+	if ((sector = msdos_smap(dir,pos >> MSDOS_DPS_BITS)) <= 0) return -1;
+	if (!(*bh = msdos_sread(dir->i_dev,sector,&data))) return -1;
+	*de = (struct msdos_dir_entry *) data+(pos & (MSDOS_DPS-1));
+	return sector*MSDOS_DPS+(pos & (MSDOS_DPS-1));
+}
+
+
+static struct msdos_dhash *dhash_find(struct inode *dir)
+{
+	struct msdos_dhash *dh;
+	int start;
+
+	start = dir->i_ino == MSDOS_ROOT_INO ? 0 : MSDOS_I(dir)->i_start;
+	if (!start && dir->i_ino != MSDOS_ROOT_INO) return NULL; /* in mkdir */
+	for (dh = dhash; dh < dhash+MSDOS_DHASH; dh++)
+		if (dh->device == dir->i_dev && dh->start == start) return dh;
+	return NULL;
+}
+
+
+/* Returns the name hash of dir, building it if necessary, or NULL if the
+   directory is too small or too large to bother. */
+
+static struct msdos_dhash *dhash_get(struct inode *dir)
+{
+	struct msdos_dhash *dh,*victim;
+	struct buffer_head *bh;
+	struct msdos_dir_entry *de;
+	int size,pos,changes;
+
+	if (dir->i_ino == MSDOS_ROOT_INO)
+		size = MSDOS_SB(dir->i_sb)->dir_entries;
+	else {
+		if (!MSDOS_I(dir)->i_start) return NULL;
+		size = dir->i_size >> MSDOS_DIR_BITS;
+	}
+	if (size < MSDOS_DHASH_MIN || size > PAGE_SIZE) return NULL;
+	if ((dh = dhash_find(dir)) != NULL) {
+		if (size < dh->size) {
+			dh->device = 0;
+			dh->stamp = 0;
+			return NULL;
+		}
+		dh->size = size; /* slots added since are free */
+		dh->stamp = ++dhash_clock;
+		return dh;
+	}
+	victim = NULL;
+	for (dh = dhash; dh < dhash+MSDOS_DHASH; dh++)
+		if (!dh->busy && (!victim || dh->stamp < victim->stamp))
+			victim = dh;
+	if (!victim) return NULL;
+	victim->device = 0;
+	victim->busy = 1;
+	changes = dhash_changes;
+	if (!victim->sig && !(victim->sig = (unsigned char *)
+	    __get_free_page(GFP_KERNEL))) {
+		victim->busy = 0;
+		victim->stamp = 0;
+		return NULL;
+	}
+	memset(victim->sig,0,PAGE_SIZE);
+	bh = NULL;
+	de = NULL; /* GCC needs that stuff */
+	for (pos = 0; pos < size; pos++) {
+		if (!(pos & (MSDOS_DPS-1))) {
+			if (bh) brelse(bh);
+			bh = NULL;
+			if (dhash_entry(dir,pos,&bh,&de) < 0) break;
+		}
+		else de++;
+		if (!IS_FREE(de->name)) victim->sig[pos] = name_sig(de->name);
+	}
+	if (bh) brelse(bh);
+	victim->busy = 0;
+	victim->stamp = 0;
+	if (pos < size || changes != dhash_changes) return NULL;
+	dhash_changes++; /* fails anyone building the same hash */
+	victim->device = dir->i_dev;
+	victim->start = dir->i_ino == MSDOS_ROOT_INO ? 0 : MSDOS_I(dir)->
+	    i_start;
+	victim->size = size;
+	for (pos = 0; pos < MSDOS_DHINTS; pos++) victim->hint_ino[pos] = 0;
+	victim->stamp = ++dhash_clock;
+	return victim;
+}
+
+
+/*
+ * Scans a directory using its name hash. Returns -EAGAIN if there is no hash
+ * or it went away while sleeping, so that the caller falls back to raw_scan.
+ */
+
+static int dhash_scan(struct inode *dir,char *name,struct buffer_head **res_bh,
+    struct msdos_dir_entry **res_de,int *ino)
+{
+	struct msdos_dhash *dh;
+	struct buffer_head *bh;
+	struct msdos_dir_entry *de;
+	struct inode *inode;
+	int sig,pos,nr,start,done;
+
+	if (!(dh = dhash_get(dir))) return -EAGAIN;
+	start = dh->start;
+	sig = name ? name_sig(name) : 0;
+	for (pos = 0; pos < dh->size; pos++) {
+		if (dh->sig[pos] != sig) continue;
+		if ((nr = dhash_entry(dir,pos,&bh,&de)) < 0) return -EAGAIN;
+		if (name)
+			done = !strncmp(de->name,name,MSDOS_NAME) &&
+			    !(de->attr & ATTR_VOLUME);
+		else {
+			done = IS_FREE(de->name);
+			if (done && (inode = iget(dir->i_sb,nr)) != NULL) {
+			/* Directory slots of busy deleted files aren't available yet. */
+				done = !MSDOS_I(inode)->i_busy;
+				iput(inode);
+			}
+		}
+		if (dh->device != dir->i_dev || dh->start != start) {
+			brelse(bh);
+			return -EAGAIN;
+		}
+		if (done) {
+			dh->hint_ino[dh->hint_hand] = nr;
+			dh->hint_pos[dh->hint_hand] = pos;
+			dh->hint_hand = (dh->hint_hand+1) % MSDOS_DHINTS;
+			if (ino) *ino = nr;
+			if (!res_bh) brelse(bh);
+			else {
+				*res_bh = bh;
+				*res_de = de;
+			}
+			return 0;
+		}
+		brelse(bh);
+	}
+	return -ENOENT;
+}
+
+
+/*
+ * msdos_dhash_update records that the slot of dir with inode number ino now
+ * holds name, or is free if name is NULL. The slot must have been returned
+ * by a recent msdos_scan of dir, or the hash is dropped. Doesn't sleep, so
+ * it must be called right before or after the entry is changed.
+ */
+
+void msdos_dhash_update(struct inode *dir,int ino,char *name)
+{
+	struct msdos_dhash *dh;
+	int i;
+
+	dhash_changes++;
+	if (!(dh = dhash_find(dir))) return;
+	for (i = 0; i < MSDOS_DHINTS; i++)
+		if (dh->hint_ino[i] == ino && dh->hint_pos[i] < dh->size) {
+			dh->sig[dh->hint_pos[i]] = name ? name_sig(name) : 0;
+			return;
+		}
+	dh->device = 0;
+	dh->stamp = 0;
+}
+
+
+/* Drops the name hash of a directory whose clusters are being freed. */
+
+void msdos_dhash_inval(struct inode *dir)
+{
+	struct msdos_dhash *dh;
+
+	dhash_changes++;
+	if ((dh = dhash_find(dir)) != NULL) {
+		dh->device = 0;
+		dh->stamp = 0;
+	}
+}
+
+
+void msdos_dhash_inval_dev(int device)
+{
+	struct msdos_dhash *dh;
+
+	dhash_changes++;
+	for (dh = dhash; dh < dhash+MSDOS_DHASH; dh++)
+		if (dh->device == device) {
+			dh->device = 0;
+			dh->stamp = 0;
+			if (dh->sig) free_page((unsigned long) dh->sig);
+			dh->sig = NULL;
+		}
+}
+
+
 /*
  * Scans a directory for a given file (name points to its formatted name) or
  * for an empty directory slot (name is NULL). Returns an error code or zero.
@@ -514,6 +774,8 @@ int msdos_scan(struct inode *dir,char *name,struct buffer_head **res_bh,
 {
 	int res;
 
+	if ((res = dhash_scan(dir,name,res_bh,res_de,ino)) != -EAGAIN)
+		return res;
 	if (name)
 		res = raw_scan(dir->i_sb,MSDOS_I(dir)->i_start,name,NULL,ino,
 		    res_bh,res_de);
@@ -177,6 +177,7 @@ static int msdos_create_entry(struct inode *dir,char *name,int is_dir,
 	dir->i_ctime = dir->i_mtime = CURRENT_TIME;
 	dir->i_dirt = 1;
 	memcpy(de->name,name,MSDOS_NAME);
+	msdos_dhash_update(dir,ino,name);
 	de->attr = is_dir ? ATTR_DIR : ATTR_ARCH;
 	de->start = 0;
 	date_unix2dos(dir->i_mtime,&de->time,&de->date);
@@ -349,6 +350,7 @@ int msdos_rmdir(struct inode *dir,const char *name,int len)
 	inode->i_ctime = dir->i_ctime = dir->i_mtime = CURRENT_TIME;
 	dir->i_nlink--;
 	inode->i_dirt = dir->i_dirt = 1;
+	msdos_dhash_update(dir,ino,NULL);
 	de->name[0] = DELETED_FLAG;
 	bh->b_dirt = 1;
 	res = 0;
@@ -383,6 +385,7 @@ int msdos_unlink(struct inode *dir,const char *name,int len)
 	inode->i_ctime = dir->i_ctime = dir->i_mtime = CURRENT_TIME;
 	MSDOS_I(inode)->i_busy = 1;
 	inode->i_dirt = dir->i_dirt = 1;
+	msdos_dhash_update(dir,ino,NULL);
 	de->name[0] = DELETED_FLAG;
 	bh->b_dirt = 1;
 unlink_done:
@@ -428,11 +431,13 @@ static int rename_same_dir(struct inode *old_dir,char *old_name,
 		new_inode->i_nlink = 0;
 		MSDOS_I(new_inode)->i_busy = 1;
 		new_inode->i_dirt = 1;
+		msdos_dhash_update(new_dir,new_ino,NULL);
 		new_de->name[0] = DELETED_FLAG;
 		new_bh->b_dirt = 1;
 		iput(new_inode);
 		brelse(new_bh);
 	}
+	msdos_dhash_update(old_dir,old_ino,new_name);
 	memcpy(old_de->name,new_name,MSDOS_NAME);
 	old_bh->b_dirt = 1;
 	if (MSDOS_SB(old_dir->i_sb)->conversion == 'a') /* update binary info */
@@ -502,12 +507,15 @@ static int rename_diff_dir(struct inode *old_dir,char *old_name,
 		new_inode->i_nlink = 0;
 		MSDOS_I(new_inode)->i_busy = 1;
 		new_inode->i_dirt = 1;
+		msdos_dhash_update(new_dir,new_ino,NULL);
 		new_de->name[0] = DELETED_FLAG;
 		new_bh->b_dirt = 1;
 	}
 	memcpy(free_de,old_de,sizeof(struct msdos_dir_entry));
 	memcpy(free_de->name,new_name,MSDOS_NAME);
+	msdos_dhash_update(new_dir,free_ino,new_name);
 	if (!(free_inode = iget(new_dir->i_sb,free_ino))) {
+		msdos_dhash_update(new_dir,free_ino,NULL);
 		free_de->name[0] = DELETED_FLAG;
 /*  Don't mark free_bh as dirty. Both states are supposed to be equivalent. */
 		brelse(free_bh);
@@ -525,6 +533,7 @@ static int rename_diff_dir(struct inode *old_dir,char *old_name,
 	MSDOS_I(old_inode)->i_busy = 1;
 	cache_inval_inode(old_inode);
 	old_inode->i_dirt = 1;
+	msdos_dhash_update(old_dir,old_ino,NULL);
 	old_de->name[0] = DELETED_FLAG;
 	old_bh->b_dirt = 1;
 	free_bh->b_dirt = 1;
@@ -546,6 +555,7 @@ static int rename_diff_dir(struct inode *old_dir,char *old_name,
 		}
 		dotdot_de->start = MSDOS_I(dotdot_inode)->i_start =
 		    MSDOS_I(new_dir)->i_start;
+		cache_inval_inode(dotdot_inode);
 		dotdot_inode->i_dirt = 1;
 		dotdot_bh->b_dirt = 1;
 		old_dir->i_nlink--;
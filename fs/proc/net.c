@@ -44,6 +44,10 @@ extern int raw_get_info(char *);
 extern int arp_get_info(char *);
 extern int dev_get_info(char *);
 extern int rt_get_info(char *);
+extern int snmp_get_info(char *);
+#ifdef CONFIG_IP_FIREWALL
+extern int ip_fw_get_info(char *, int);
+#endif
 #endif /* CONFIG_INET */
 
 
@@ -91,7 +95,14 @@ static struct proc_dir_entry net_dir[] = {
 	{ 131,3,"dev" },
 	{ 132,3,"raw" },
 	{ 133,3,"tcp" },
-	{ 134,3,"udp" }
+	{ 134,3,"udp" },
+	{ 135,4,"snmp" }
+#ifdef CONFIG_IP_FIREWALL
+	,{ 136,8,"ip_input" },
+	{ 137,10,"ip_forward" },
+	{ 138,9,"ip_output" },
+	{ 139,7,"ip_acct" }
+#endif	/* CONFIG_IP_FIREWALL */
 #endif	/* CONFIG_INET */
 };
 
@@ -190,6 +201,18 @@ static int proc_readnet(struct inode * inode, struct file * file,
 		case 134:
 			length = udp_get_info(page);
 			break;
+		case 135:
+			length = snmp_get_info(page);
+			break;
+#ifdef CONFIG_IP_FIREWALL
+		case 136:
+		case 137:
+		case 138:
+		case 139:
+			/* The chains are numbered in the same order. */
+			length = ip_fw_get_info(page, ino - 136);
+			break;
+#endif /* CONFIG_IP_FIREWALL */
 #endif /* CONFIG_INET */
 		default:
 			free_page((unsigned long) page);
@@ -106,3 +106,95 @@ asmlinkage int sys_write(unsigned int fd,char * buf,unsigned int count)
 		return error;
 	return file->f_op->write(inode,file,buf,count);
 }
+
+/*
+ * sendfile() copies data from a block-mapped file to any writable
+ * descriptor (normally a socket) without going through user space:
+ * blocks are read into the buffer cache and handed straight to the
+ * write routine of the output file under KERNEL_DS, so the only copy
+ * is the one the output side makes (eg. into the tcp send queue).
+ *
+ * If offset is non-NULL, it gives the starting position and is updated,
+ * and the file position of in_fd is left alone.
+ */
+asmlinkage int sys_sendfile(unsigned int out_fd, unsigned int in_fd,
+	off_t * offset, unsigned int count)
+{
+	struct file * in_file, * out_file;
+	struct inode * in_inode, * out_inode;
+	struct buffer_head * bh;
+	unsigned long old_fs;
+	int blocksize, block, nr, chars, written, error;
+	off_t pos;
+	char * data;
+
+	if (in_fd>=NR_OPEN || !(in_file=current->filp[in_fd]) || !(in_inode=in_file->f_inode))
+		return -EBADF;
+	if (out_fd>=NR_OPEN || !(out_file=current->filp[out_fd]) || !(out_inode=out_file->f_inode))
+		return -EBADF;
+	if (!(in_file->f_mode & 1) || !(out_file->f_mode & 2))
+		return -EBADF;
+	if (!S_ISREG(in_inode->i_mode) || !in_inode->i_sb ||
+	    !in_inode->i_op || !in_inode->i_op->bmap)
+		return -EINVAL;
+	if (!out_file->f_op || !out_file->f_op->write)
+		return -EINVAL;
+	if (offset) {
+		error = verify_area(VERIFY_WRITE, offset, sizeof(off_t));
+		if (error)
+			return error;
+		pos = get_fs_long((unsigned long *) offset);
+	} else
+		pos = in_file->f_pos;
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= in_inode->i_size)
+		count = 0;
+	else if (count > in_inode->i_size - pos)
+		count = in_inode->i_size - pos;
+	blocksize = in_inode->i_sb->s_blocksize;
+	written = 0;
+	error = 0;
+	while (count > 0) {
+		block = pos >> in_inode->i_sb->s_blocksize_bits;
+		chars = blocksize - (pos & (blocksize - 1));
+		if (chars > count)
+			chars = count;
+		bh = NULL;
+		nr = bmap(in_inode, block);
+		if (nr) {
+			bh = bread(in_inode->i_dev, nr, blocksize);
+			if (!bh) {
+				error = -EIO;
+				break;
+			}
+			data = bh->b_data + (pos & (blocksize - 1));
+		} else {
+			/* a hole: send zeroes, at most a page at a time */
+			data = (char *) ZERO_PAGE;
+			if (chars > PAGE_SIZE)
+				chars = PAGE_SIZE;
+		}
+		old_fs = get_fs();
+		set_fs(get_ds());
+		error = out_file->f_op->write(out_inode, out_file, data, chars);
+		set_fs(old_fs);
+		brelse(bh);
+		if (error <= 0)
+			break;
+		pos += error;
+		written += error;
+		count -= error;
+		if (error < chars)
+			break;
+	}
+	if (offset)
+		put_fs_long(pos, (unsigned long *) offset);
+	else
+		in_file->f_pos = pos;
+	if (written && !IS_RDONLY(in_inode)) {
+		in_inode->i_atime = CURRENT_TIME;
+		in_inode->i_dirt = 1;
+	}
+	return written ? written : error;
+}
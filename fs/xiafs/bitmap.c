@@ -18,6 +18,8 @@
 #include <linux/kernel.h>
 #include <linux/string.h>
 
+#include <asm/bitops.h>
+
 #include "xiafs_mac.h"
 
 
@@ -37,36 +39,18 @@ static int find_first_zero(struct buffer_head *bh, int start_bit, int end_bit)
      * "goto repeat".  ---Frank.
      */
 
-    int end, i, j, tmp;
-    u_long *bmap;
-    char res;
-
-    bmap=(u_long *)bh->b_data;
-    end = end_bit >> 5;
+    int j;
 
 repeat:
-    i=start_bit >> 5;
-    if ( (tmp=(~bmap[i]) & (0xffffffff << (start_bit & 31))) )        
-        goto zone_found;
-    while (++i < end)
-        if (~bmap[i]) {
-	    tmp=~bmap[i];
-	    goto zone_found;
-	}
-    if ( !(tmp=~bmap[i] & ((1 << (end_bit & 31)) -1)) )
+    j = find_next_zero_bit(bh->b_data, end_bit, start_bit);
+    if (j >= end_bit)
         return -1;
-zone_found:    
-    for (j=0; j < 32; j++)
-        if (tmp & (1 << j))
-	    break;
-    __asm__ ("btsl %1,%2\n\tsetb %0": \
-	     "=q" (res):"r" (j),"m" (bmap[i]));
-    if (res) {
-        start_bit=j + (i << 5) + 1;
+    if (set_bit(j, bh->b_data)) {
+        start_bit = j + 1;
 	goto repeat;
     }
     bh->b_dirt=1;
-    return j + (i << 5);
+    return j;
 }
 
 static void clear_buf(struct buffer_head * bh) 
@@ -341,19 +325,9 @@ struct inode * xiafs_new_inode(struct inode * dir)
     return inode;
 }
 
-static int nibblemap[] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
-
 static u_long count_zone(struct buffer_head * bh)
 {
-    int i, tmp;
-    u_long sum;
-
-    sum=0;
-    for (i=bh->b_size; i-- > 0; ) {
-        tmp=bh->b_data[i];
-        sum += nibblemap[tmp & 0xf] + nibblemap[(tmp & 0xff) >> 4];
-    }
-    return sum;
+    return count_set_bits(bh->b_data, bh->b_size << 3);
 } 
 
 unsigned long xiafs_count_free_inodes(struct super_block *sb)
@@ -53,6 +53,88 @@ extern __inline__ int test_bit(int nr, void * addr)
 	return oldbit;
 }
 
+/*
+ * Find-bit routines for the file system allocators.  Sizes and offsets
+ * are in bits, and the bitmaps are scanned a long word at a time.  A
+ * result >= size means there is no zero bit.
+ */
+extern __inline__ int find_first_zero_bit(void * addr, unsigned size)
+{
+	int res;
+
+	if (!size)
+		return 0;
+	__asm__("cld\n\t"
+		"movl $-1,%%eax\n\t"
+		"repe; scasl\n\t"
+		"je 1f\n\t"
+		"subl $4,%%edi\n\t"
+		"movl (%%edi),%%eax\n\t"
+		"notl %%eax\n\t"
+		"bsfl %%eax,%%edx\n\t"
+		"jmp 2f\n"
+		"1:\txorl %%edx,%%edx\n"
+		"2:\tsubl %%ebx,%%edi\n\t"
+		"shll $3,%%edi\n\t"
+		"addl %%edi,%%edx"
+		:"=d" (res)
+		:"c" ((size + 31) >> 5), "D" (addr), "b" (addr)
+		:"ax", "bx", "cx", "di");
+	return res;
+}
+
+extern __inline__ int find_next_zero_bit(void * addr, int size, int offset)
+{
+	unsigned long * p = ((unsigned long *) addr) + (offset >> 5);
+	int set = 0, bit = offset & 31, res;
+
+	if (offset >= size)
+		return size;
+	if (bit) {
+		/*
+		 * Look for zero in the first word
+		 */
+		__asm__("bsfl %1,%0\n\t"
+			"jne 1f\n\t"
+			"movl $32, %0\n"
+			"1:"
+			:"=r" (set)
+			:"r" (~(*p >> bit)));
+		if (set < (32 - bit))
+			return set + offset;
+		set = 32 - bit;
+		p++;
+	}
+	/*
+	 * No zero yet, search the remaining full words for a zero
+	 */
+	res = size - 32 * (p - (unsigned long *) addr);
+	if (res <= 0)
+		return size;
+	return offset + set + find_first_zero_bit(p, res);
+}
+
+/*
+ * Returns a pointer to the first zero byte, or addr + size.
+ */
+extern __inline__ char * find_first_zero_byte(void * addr, int size)
+{
+	char *res;
+
+	if (!size)
+		return (char *) addr;
+	__asm__("cld\n\t"
+		"mov $0,%%eax\n\t"
+		"repnz; scasb\n\t"
+		"jnz 1f\n\t"
+		"dec %%edi\n"
+		"1:"
+		:"=D" (res)
+		:"0" (addr), "c" (size)
+		:"ax");
+	return res;
+}
+
 #else
 /*
  * For the benefit of those who are trying to port Linux to another
@@ -103,5 +185,101 @@ extern __inline__ int test_bit(int nr, int * addr)
 	mask = 1 << (nr & 0x1f);
 	return ((mask & *addr) != 0);
 }
+extern __inline__ int find_first_zero_bit(void * addr, unsigned size)
+{
+	unsigned long * p = (unsigned long *) addr;
+	unsigned long w;
+	int res;
+
+	for (res = 0; res < size; res += 32) {
+		if ((w = ~*p++) != 0) {
+			for (; !(w & 1); w >>= 1)
+				res++;
+			break;
+		}
+	}
+	return res;
+}
+
+extern __inline__ int find_next_zero_bit(void * addr, int size, int offset)
+{
+	unsigned long * p = ((unsigned long *) addr) + (offset >> 5);
+	int bit = offset & 31;
+
+	if (offset >= size)
+		return size;
+	if (bit) {
+		for (; bit < 32; bit++, offset++)
+			if (!(*p & (1 << bit)))
+				return offset;
+		p++;
+	}
+	if (offset >= size)
+		return size;
+	return offset + find_first_zero_bit(p, size - offset);
+}
+
+extern __inline__ char * find_first_zero_byte(void * addr, int size)
+{
+	char * p = (char *) addr;
+
+	for (; size > 0 && *p; size--)
+		p++;
+	return p;
+}
 #endif	/* i386 */
+
+/*
+ * The number of bits set in a long word, added up a field at a time.
+ */
+extern __inline__ unsigned long hweight32(unsigned long w)
+{
+	w = w - ((w >> 1) & 0x55555555);
+	w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+	w = (w + (w >> 4)) & 0x0f0f0f0f;
+	return (w * 0x01010101) >> 24;
+}
+
+/*
+ * The number of bits set in the first size bits of a bitmap.
+ */
+extern __inline__ unsigned long count_set_bits(void * addr, int size)
+{
+	unsigned long * p = (unsigned long *) addr;
+	unsigned long sum = 0;
+
+	for (; size >= 32; size -= 32)
+		sum += hweight32(*p++);
+	if (size > 0)
+		sum += hweight32(*p & ((1UL << size) - 1));
+	return sum;
+}
+
+/*
+ * Look for a run of at least len zero bits, from bit offset on, in one
+ * pass over the bitmap; zero words are stepped over whole.  Returns the
+ * first bit of the run, or size.
+ */
+extern __inline__ int find_zero_run(void * addr, int size, int offset, int len)
+{
+	unsigned long * p = (unsigned long *) addr;
+	int j, k;
+
+	for (j = offset; j < size; j = k) {
+		j = find_next_zero_bit(addr, size, j);
+		if (j >= size)
+			break;
+		for (k = j + 1; k < size && k - j < len; k++) {
+			if (!(k & 31) && !p[k >> 5])
+				k += 31;
+			else if (test_bit(k, addr))
+				break;
+		}
+		if (k > size)
+			k = size;
+		if (k - j >= len)
+			return j;
+	}
+	return size;
+}
 #endif /* _ASM_BITOPS_H */
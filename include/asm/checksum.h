@@ -0,0 +1,199 @@
+#ifndef _ASM_CHECKSUM_H
+#define _ASM_CHECKSUM_H
+
+#include <asm/segment.h>
+
+/*
+ * Internet checksum primitives.  A partial checksum is kept as a 32 bit
+ * one's complement sum so that pieces can be added up cheaply; only
+ * csum_fold() turns it into the 16 bit value that goes into a header.
+ *
+ * The copy versions checksum the data while it is being moved between
+ * user space (%fs) and an sk_buff, so the networking code doesn't have
+ * to go over every byte twice.
+ */
+
+/* Add two partial sums with end-around carry. */
+static inline unsigned long csum_add(unsigned long sum, unsigned long x)
+{
+	sum += x;
+	return sum + (sum < x);
+}
+
+/*
+ * Add in the sum of a block that started at the given byte offset.  A
+ * block at an odd offset was summed with its bytes in the wrong halves
+ * of each 16 bit word, so fold it and swap them back.
+ */
+static inline unsigned long csum_block_add(unsigned long sum, unsigned long sum2, int offset)
+{
+	if (offset & 1) {
+		sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+		sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+		sum2 = ((sum2 & 0xff) << 8) | (sum2 >> 8);
+	}
+	return csum_add(sum, sum2);
+}
+
+/* Fold a partial sum to 16 bits and complement it. */
+static inline unsigned short csum_fold(unsigned long sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (~sum) & 0xffff;
+}
+
+/*
+ * Add the TCP/UDP pseudo header to a partial sum.  The addresses are
+ * in network order, len and proto in host order.
+ */
+static inline unsigned long csum_tcpudp_nofold(unsigned long saddr, unsigned long daddr,
+	unsigned short len, unsigned short proto, unsigned long sum)
+{
+	sum = csum_add(sum, saddr);
+	sum = csum_add(sum, daddr);
+	return csum_add(sum, ((((len >> 8) | (len << 8)) & 0xffff) << 16) + (proto << 8));
+}
+
+/* The same, folded ready to go into a header. */
+static inline unsigned short csum_tcpudp_magic(unsigned long saddr, unsigned long daddr,
+	unsigned short len, unsigned short proto, unsigned long sum)
+{
+	return csum_fold(csum_tcpudp_nofold(saddr, daddr, len, proto, sum));
+}
+
+/* Partial sum of a block of kernel memory. */
+static inline unsigned long csum_partial(unsigned char * buff, int len, unsigned long sum)
+{
+	if (len > 3) {
+		int count = len >> 2;
+		unsigned long tmp;
+
+		__asm__("clc\n"
+			"1:\t"
+			"lodsl\n\t"
+			"adcl %%eax, %0\n\t"
+			"loop 1b\n\t"
+			"adcl $0, %0"
+			: "=r" (sum), "=S" (buff), "=c" (count), "=a" (tmp)
+			: "0" (sum), "1" (buff), "2" (count)
+			: "cc", "memory");
+	}
+	if (len & 2) {
+		sum = csum_add(sum, *(unsigned short *) buff);
+		buff += 2;
+	}
+	if (len & 1)
+		sum = csum_add(sum, *buff);
+	return sum;
+}
+
+/*
+ * Copy len bytes from user space to dst, returning the partial sum of
+ * the data.  The inner loop steps with leal and counts with decl so the
+ * carry survives from one adcl to the next.
+ */
+static inline unsigned long csum_partial_copy_fromfs(unsigned char * src, unsigned char * dst,
+	int len, unsigned long sum)
+{
+	if (len > 3) {
+		int count = len >> 2;
+		unsigned long tmp;
+
+		__asm__ __volatile__("clc\n"
+			"1:\t"
+			"movl %%fs:(%1), %%eax\n\t"
+			"leal 4(%1), %1\n\t"
+			"movl %%eax, (%2)\n\t"
+			"leal 4(%2), %2\n\t"
+			"adcl %%eax, %0\n\t"
+			"decl %3\n\t"
+			"jne 1b\n\t"
+			"adcl $0, %0"
+			: "=r" (sum), "=r" (src), "=r" (dst), "=r" (count), "=a" (tmp)
+			: "0" (sum), "1" (src), "2" (dst), "3" (count)
+			: "cc", "memory");
+	}
+	if (len & 2) {
+		unsigned short w = get_fs_word(src);
+
+		*(unsigned short *) dst = w;
+		sum = csum_add(sum, w);
+		src += 2;
+		dst += 2;
+	}
+	if (len & 1) {
+		unsigned char c = get_fs_byte(src);
+
+		*dst = c;
+		sum = csum_add(sum, c);
+	}
+	return sum;
+}
+
+/* Copy len bytes from src to user space, returning the partial sum. */
+static inline unsigned long csum_partial_copy_tofs(unsigned char * src, unsigned char * dst,
+	int len, unsigned long sum)
+{
+	if (len > 3) {
+		int count = len >> 2;
+		unsigned long tmp;
+
+		__asm__ __volatile__("clc\n"
+			"1:\t"
+			"movl (%1), %%eax\n\t"
+			"leal 4(%1), %1\n\t"
+			"movl %%eax, %%fs:(%2)\n\t"
+			"leal 4(%2), %2\n\t"
+			"adcl %%eax, %0\n\t"
+			"decl %3\n\t"
+			"jne 1b\n\t"
+			"adcl $0, %0"
+			: "=r" (sum), "=r" (src), "=r" (dst), "=r" (count), "=a" (tmp)
+			: "0" (sum), "1" (src), "2" (dst), "3" (count)
+			: "cc", "memory");
+	}
+	if (len & 2) {
+		unsigned short w = *(unsigned short *) src;
+
+		put_fs_word(w, dst);
+		sum = csum_add(sum, w);
+		src += 2;
+		dst += 2;
+	}
+	if (len & 1) {
+		put_fs_byte(*src, dst);
+		sum = csum_add(sum, *src);
+	}
+	return sum;
+}
+
+/*
+ * This is a version of ip_compute_csum() optimized for IP headers, which
+ * always checksum on 4 octet boundaries.
+ */
+static inline unsigned short ip_fast_csum(unsigned char * buff, int wlen)
+{
+	unsigned long sum = 0;
+
+	if (wlen) {
+		unsigned long bogus;
+		__asm__("clc\n"
+			"1:\t"
+			"lodsl\n\t"
+			"adcl %3, %0\n\t"
+			"decl %2\n\t"
+			"jne 1b\n\t"
+			"adcl $0, %0\n\t"
+			"movl %0, %3\n\t"
+			"shrl $16, %3\n\t"
+			"addw %w3, %w0\n\t"
+			"adcw $0, %w0"
+			: "=r" (sum), "=S" (buff), "=r" (wlen), "=a" (bogus)
+			: "0"  (sum),  "1" (buff),  "2" (wlen)
+			: "memory");
+	}
+	return (~sum) & 0xffff;
+}
+
+#endif
@@ -49,6 +49,13 @@
  */
 #define EXT2_PREALLOCATE
 
+/*
+ * Blocks reserved past the one allocated on a preallocation miss, and the
+ * most reserved when the write in progress is known to need more
+ */
+#define EXT2_DEFAULT_PREALLOC	7
+#define EXT2_MAX_PREALLOC	63
+
 /*
  * The second extended file system version
  */
@@ -199,12 +206,14 @@ struct ext2_group_desc
 #define	EXT2_UNRM_FL			0x0002	/* Undelete */
 #define	EXT2_COMPR_FL			0x0004	/* Compress file */
 #define EXT2_SYNC_FL			0x0008	/* Synchronous updates */
+#define EXT2_INDEX_FL			0x1000	/* Hashed directory index */
 
 /*
  * ioctl commands
  */
 #define	EXT2_IOC_GETFLAGS		_IOR('f', 1, long)
 #define	EXT2_IOC_SETFLAGS		_IOW('f', 2, long)
+#define	EXT2_IOC_GETEXTENTS		_IOR('f', 3, long)
 #define	EXT2_IOC_GETVERSION		_IOR('v', 1, long)
 #define	EXT2_IOC_SETVERSION		_IOW('v', 2, long)
 
@@ -253,11 +262,19 @@ struct ext2_inode {
 #define EXT2_MOUNT_ERRORS_CONT		0x0010	/* Continue on errors */
 #define EXT2_MOUNT_ERRORS_RO		0x0020	/* Remount fs ro on errors */
 #define EXT2_MOUNT_ERRORS_PANIC		0x0040	/* Panic on errors */
+#define EXT2_MOUNT_INDEX		0x0080	/* Index directories that grow */
+#define EXT2_MOUNT_LAZY_ATIME		0x0100	/* Update atime only when stale */
+#define EXT2_MOUNT_BATCH_INODES		0x0200	/* Write neighbouring inodes together */
 
 #define clear_opt(o, opt)		o &= ~EXT2_MOUNT_##opt
 #define set_opt(o, opt)			o |= EXT2_MOUNT_##opt
 #define test_opt(sb, opt)		((sb)->u.ext2_sb.s_mount_opt & \
 					 EXT2_MOUNT_##opt)
+/*
+ * With lazyatime, how old the access time may get before a read updates it
+ */
+#define EXT2_ATIME_DELAY		(24 * 60 * 60)
+
 /*
  * Maximal mount counts between two filesystem checks
  */
@@ -297,9 +314,54 @@ struct ext2_super_block {
 	unsigned short s_pad;
 	unsigned long  s_lastcheck;	/* time of last check */
 	unsigned long  s_checkinterval;	/* max. time between checks */
-	unsigned long  s_reserved[238];	/* Padding to the end of the block */
+	unsigned long  s_journal_inum;	/* Inode of the metadata journal */
+	unsigned long  s_reserved[237];	/* Padding to the end of the block */
 };
 
+/*
+ * The metadata journal lives in an ordinary file, named with the journal
+ * mount option and then recorded in the super block.  Its first block is
+ * the journal super block; the rest is a log of transactions, each made
+ * of a revoke block when blocks were freed, a descriptor block listing
+ * the blocks logged, their contents, and a commit block.  All of them
+ * carry the sequence number of their transaction, so that recovery stops
+ * at the first one that was not committed.  The commit block lists the
+ * orphans: inodes whose deletion was begun but not finished.
+ */
+#define EXT2_JOURNAL_MAGIC	0x4a524e4c
+#define EXT2_JOURNAL_SUPER	1
+#define EXT2_JOURNAL_DESC	2
+#define EXT2_JOURNAL_COMMIT	3
+#define EXT2_JOURNAL_REVOKE	4
+
+#define EXT2_JOURNAL_MIN_BLOCKS	128
+
+struct ext2_journal_header {
+	unsigned long  h_magic;
+	unsigned long  h_type;
+	unsigned long  h_sequence;	/* Transaction it belongs to */
+	unsigned long  h_count;		/* Block numbers following it */
+};
+
+struct ext2_journal_super {
+	struct ext2_journal_header js_header;
+	unsigned long  js_blocksize;
+	unsigned long  js_maxlen;	/* Blocks in the journal */
+	unsigned long  js_sequence;	/* First transaction in the log */
+	unsigned long  js_start;	/* Its first block, 0 if none */
+	unsigned long  js_mnt_count;	/* Mount the log was written by: */
+	unsigned long  js_mtime;	/* s_mnt_count and s_mtime */
+	unsigned long  js_nr_orphans;	/* Orphans at the last checkpoint */
+	unsigned long  js_orphans[EXT2_JOURNAL_ORPHANS];
+};
+
+/*
+ * Block numbers a descriptor or revoke block can hold
+ */
+#define EXT2_JOURNAL_ENTRIES(s)	(((s)->s_blocksize - \
+				  sizeof (struct ext2_journal_header)) / \
+				 sizeof (unsigned long))
+
 /*
  * Structure of a directory entry
  */
@@ -322,6 +384,41 @@ struct ext2_dir_entry {
 #define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
 					 ~EXT2_DIR_ROUND)
 
+/*
+ * Hashed directory index
+ *
+ * Block 0 of an indexed directory holds "." and a ".." entry which spans
+ * the rest of the block; the root of the index follows the name of "..".
+ * Interior index blocks hold a single empty entry covering the block,
+ * followed by the index entries.  Kernels which don't know about the
+ * index just see large empty entries.
+ *
+ * The first index entry of each block holds the count and limit in place
+ * of a hash, and points to the block for hashes below the second entry.
+ * The low bit of a hash is set when the block it starts continues a run
+ * of equal hashes from the previous block.
+ */
+#define EXT2_DX_HASH_LEGACY	0
+#define EXT2_DX_MAX_LEVELS	2	/* root and one level of nodes */
+
+struct ext2_dx_root_info {
+	unsigned long  reserved_zero;
+	unsigned char  hash_version;	/* EXT2_DX_HASH_* */
+	unsigned char  info_length;	/* 8 */
+	unsigned char  indirect_levels;	/* levels of nodes below the root */
+	unsigned char  unused_flags;
+};
+
+struct ext2_dx_entry {
+	unsigned long  hash;
+	unsigned long  block;		/* Directory block */
+};
+
+struct ext2_dx_countlimit {
+	unsigned short limit;
+	unsigned short count;
+};
+
 #ifdef __KERNEL__
 /*
  * Function prototypes
@@ -354,6 +451,17 @@ extern void ext2_check_blocks_bitmap (struct super_block *);
 
 /* bitmap.c */
 extern unsigned long ext2_count_free (struct buffer_head *, unsigned);
+extern int ext2_bitmap_cache_init (struct super_block *,
+				   struct ext2_bitmap_cache *);
+extern void ext2_bitmap_cache_release (struct ext2_bitmap_cache *);
+extern struct buffer_head * ext2_bitmap_lookup (struct ext2_bitmap_cache *,
+						unsigned long);
+extern void ext2_bitmap_insert (struct ext2_bitmap_cache *, unsigned long,
+				struct buffer_head *);
+extern void ext2_scan_start (struct ext2_bitmap_scan *, struct super_block *,
+			     int);
+extern struct buffer_head * ext2_scan_next (struct ext2_bitmap_scan *);
+extern void ext2_scan_end (struct ext2_bitmap_scan *);
 
 #ifndef DONT_USE_DCACHE
 /* dcache.c */
@@ -378,6 +486,24 @@ extern int ext2_write (struct inode *, struct file *, char *, int);
 /* fsync.c */
 extern int ext2_sync_file (struct inode *, struct file *);
 
+/* journal.c */
+extern int ext2_journal_load (struct super_block *, unsigned long, int);
+extern void ext2_journal_release (struct super_block *);
+extern void ext2_journal_stamp (struct super_block *);
+extern void ext2_journal_start (struct super_block *);
+extern void ext2_journal_start_inode (struct inode *);
+extern void ext2_journal_stop (struct super_block *, int);
+extern void ext2_journal_dirty (struct super_block *, struct buffer_head *);
+extern void ext2_journal_revoke (struct super_block *, unsigned long);
+extern void ext2_journal_commit (struct super_block *);
+extern void ext2_journal_force (struct super_block *);
+extern int ext2_journal_busy (struct super_block *, struct buffer_head *);
+extern int ext2_journal_file (struct inode *);
+extern int ext2_journal_room (struct super_block *);
+extern int ext2_journal_defer (struct inode *);
+extern void ext2_journal_orphan (struct super_block *, unsigned long, int);
+extern void ext2_journal_orphans (struct super_block *);
+
 /* ialloc.c */
 extern struct inode * ext2_new_inode (const struct inode *, int);
 extern void ext2_free_inode (struct inode *);
@@ -395,6 +521,7 @@ extern void ext2_write_inode (struct inode *);
 extern void ext2_put_inode (struct inode *);
 extern int ext2_sync_inode (struct inode *);
 extern void ext2_discard_prealloc (struct inode *);
+extern void ext2_update_atime (struct inode *);
 
 /* ioctl.c */
 extern int ext2_ioctl (struct inode *, struct file *, unsigned int,
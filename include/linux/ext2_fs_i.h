@@ -34,6 +34,10 @@ struct ext2_inode_info {
 	unsigned long  i_next_alloc_goal;
 	unsigned long  i_prealloc_block;
 	unsigned long  i_prealloc_count;
+	unsigned long  i_alloc_hint;
+	unsigned long  i_map_block;	/* Last run of blocks mapped: */
+	unsigned long  i_map_start;	/* its first logical and physical */
+	unsigned long  i_map_len;	/* blocks, and its length */
 };
 
 #endif	/* _LINUX_EXT2_FS_I */
@@ -15,8 +15,109 @@
 #ifndef _LINUX_EXT2_FS_SB
 #define _LINUX_EXT2_FS_SB
 
-#define EXT2_MAX_GROUP_DESC	8
-#define EXT2_MAX_GROUP_LOADED	8
+/*
+ * The bitmaps kept in memory: at least EXT2_MIN_BITMAP_CACHE (or one per
+ * group on smaller file systems), at most EXT2_MAX_BITMAP_CACHE, and
+ * otherwise as many as fit in 1/2^EXT2_BITMAP_MEM_SHIFT of memory.
+ */
+#define EXT2_MIN_BITMAP_CACHE	8
+#define EXT2_MAX_BITMAP_CACHE	256
+#define EXT2_BITMAP_MEM_SHIFT	8
+
+struct ext2_bitmap_slot {
+	unsigned long bs_group;		/* Group whose bitmap this is */
+	struct buffer_head * bs_bh;
+	short bs_next;			/* Next slot on the hash chain */
+	unsigned char bs_ref;		/* Used since the clock passed */
+	unsigned char bs_pad;
+};
+
+/*
+ * A cache of bitmaps of one kind, hashed on the group number.  When it
+ * is full, a clock sweep picks the bitmap to release.
+ */
+struct ext2_bitmap_cache {
+	unsigned short bc_size;		/* Number of slots */
+	unsigned short bc_loaded;	/* Slots in use */
+	unsigned short bc_hand;		/* Where the clock is */
+	unsigned short bc_hash_mask;
+	struct ext2_bitmap_slot * bc_slot;
+	short * bc_hash;		/* First slot of each chain, or -1 */
+};
+
+/*
+ * A pass over all the block or inode bitmaps, reading ahead
+ */
+#define EXT2_SCAN_AHEAD		32
+
+struct ext2_bitmap_scan {
+	struct super_block * bs_sb;
+	int bs_inodes;			/* Inode bitmaps, else block bitmaps */
+	unsigned long bs_next;		/* Next group to request */
+	int bs_head;			/* First bitmap requested in bs_bh */
+	int bs_count;			/* Bitmaps requested, not returned */
+	struct buffer_head * bs_last;	/* Bitmap returned last */
+	struct buffer_head * bs_bh[EXT2_SCAN_AHEAD];
+};
+
+#define EXT2_JOURNAL_HASH	64	/* Chains through the running list */
+#define EXT2_JOURNAL_LOGGED	1024	/* Bits in the filter of logged blocks */
+#define EXT2_JOURNAL_MAX_RUNS	(4080 / sizeof (struct ext2_journal_run))
+#define EXT2_JOURNAL_OWNERS	16	/* Tasks in an operation at a time */
+#define EXT2_JOURNAL_DEFERRED	32	/* Deletions waiting for their turn */
+#define EXT2_JOURNAL_ORPHANS	64	/* Also kept in the journal super block */
+
+/*
+ * A piece of the journal file that is contiguous on the disk
+ */
+struct ext2_journal_run {
+	unsigned long r_block;
+	unsigned long r_len;
+};
+
+/*
+ * The journal of a mounted file system.  Buffers changed by the running
+ * transaction are held, and kept clean, until it commits; then they may go
+ * home.  The blocks committed since the last checkpoint are listed, so
+ * that they can be forced home before the log is reused.
+ */
+struct ext2_journal {
+	struct ext2_journal_run * j_runs;	/* Where the log is */
+	int j_nr_runs;
+	unsigned long j_ino;		/* The journal file */
+	unsigned long j_size;		/* and its size */
+	struct buffer_head * j_sbh;	/* The journal super block */
+	unsigned long j_maxlen;		/* Blocks in the journal */
+	unsigned long j_head;		/* Next log block to write */
+	unsigned long j_sequence;	/* Of the running transaction */
+	int j_max_blocks;		/* Most blocks in a transaction */
+	int j_op_blocks;		/* Reserved for an operation */
+	int j_reserved;			/* By the operations in progress */
+	int j_handles;			/* Operations in progress */
+	unsigned long j_nr_ops;		/* Operations begun so far */
+	int j_nr_owners;
+	struct task_struct * j_owner[EXT2_JOURNAL_OWNERS];
+	unsigned char j_depth[EXT2_JOURNAL_OWNERS];	/* Of their nesting */
+	struct task_struct * j_flusher;	/* Writing the inodes for a commit */
+	unsigned char j_flushing;
+	unsigned char j_committing;
+	unsigned char j_commit_wanted;
+	unsigned char j_reaping;
+	int j_nr_deferred;
+	struct inode * j_deferred[EXT2_JOURNAL_DEFERRED];
+	int j_nr_orphans;
+	unsigned long j_orphans[EXT2_JOURNAL_ORPHANS];
+	int j_nr_running;
+	struct buffer_head ** j_running;
+	short * j_next;
+	short j_hash[EXT2_JOURNAL_HASH];
+	int j_nr_revoked;
+	unsigned long * j_revoked;	/* Freed blocks that may be logged */
+	int j_nr_checkpoint;
+	unsigned long * j_checkpoint;	/* A page of block numbers */
+	unsigned long j_logged[EXT2_JOURNAL_LOGGED / 32];
+	struct wait_queue * j_wait;
+};
 
 /*
  * second extended-fs super-block data in memory
@@ -33,13 +134,14 @@ struct ext2_sb_info {
 	unsigned long s_groups_count;	/* Number of groups in the fs */
 	struct buffer_head * s_sbh;	/* Buffer containing the super block */
 	struct ext2_super_block * s_es;	/* Pointer to the super block in the buffer */
-	struct buffer_head * s_group_desc[EXT2_MAX_GROUP_DESC];
-	unsigned short s_loaded_inode_bitmaps;
-	unsigned short s_loaded_block_bitmaps;
-	unsigned long s_inode_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_inode_bitmap[EXT2_MAX_GROUP_LOADED];
-	unsigned long s_block_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_block_bitmap[EXT2_MAX_GROUP_LOADED];
+	unsigned long s_gdb_count;	/* Number of group descriptor blocks */
+	struct buffer_head ** s_group_desc;
+	struct ext2_bitmap_cache s_inode_bitmaps;
+	struct ext2_bitmap_cache s_block_bitmaps;
+	struct ext2_journal * s_journal;
+	unsigned long s_inode_writes;	/* Inode table updates */
+	unsigned long s_inodes_batched;	/* Inodes written with a neighbour */
+	unsigned long s_atime_skipped;	/* Access time updates not done */
 	int s_rename_lock;
 	struct wait_queue * s_rename_wait;
 	unsigned long  s_mount_opt;
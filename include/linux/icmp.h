@@ -68,6 +68,10 @@ struct icmphdr {
 		unsigned short	sequence;
 	} echo;
 	unsigned long gateway;
+	struct {
+		unsigned short	__unused;
+		unsigned short	mtu;	/* next hop MTU (RFC 1191) */
+	} frag;
   } un;
 };
 
@@ -0,0 +1,65 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the SOCK_PACKET socket options: the packet
+ *		filter, the receive ring shared with user space, and the
+ *		capture statistics.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _LINUX_IF_PACKET_H
+#define _LINUX_IF_PACKET_H
+
+/* setsockopt(2)/getsockopt(2) at level SOL_PACKET. */
+#define PACKET_ATTACH_FILTER	1	/* struct sock_fprog		*/
+#define PACKET_DETACH_FILTER	2
+#define PACKET_RX_RING		3	/* struct tpacket_req		*/
+#define PACKET_STATISTICS	4	/* struct tpacket_stats		*/
+
+/*
+ * The receive ring.  frame_nr frames of frame_size bytes each, packed
+ * into whole pages, are mapped by mmap(2) on the socket.  A frame_nr
+ * of 0 tears the ring down again.
+ */
+struct tpacket_req {
+  unsigned int	tp_frame_size;		/* multiple of 16, divides a page */
+  unsigned int	tp_frame_nr;
+};
+
+/*
+ * Every frame starts with this header, then a struct sockaddr naming
+ * the device, then the packet itself at tp_mac bytes into the frame.
+ * The kernel only fills a frame whose status is TP_STATUS_KERNEL; user
+ * space hands it back by writing TP_STATUS_KERNEL when done with it.
+ */
+struct tpacket_hdr {
+  unsigned long	tp_status;
+  unsigned int	tp_len;			/* length on the wire		*/
+  unsigned int	tp_snaplen;		/* bytes stored in the frame	*/
+  unsigned short tp_mac;		/* offset of the packet		*/
+  unsigned short tp_net;		/* offset of the network header	*/
+  unsigned long	tp_sec;
+  unsigned long	tp_usec;
+};
+
+#define TP_STATUS_KERNEL	0	/* free for the kernel to fill	*/
+#define TP_STATUS_USER		1	/* holds a packet for the user	*/
+#define TP_STATUS_LOSING	4	/* packets were dropped before it */
+
+#define TPACKET_ALIGN(x)	(((x) + 15) & ~15)
+#define TPACKET_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket_hdr)) + \
+				 sizeof(struct sockaddr))
+
+/* Counters since the last PACKET_STATISTICS; reading resets them. */
+struct tpacket_stats {
+  unsigned int	tp_packets;		/* passed the filter		*/
+  unsigned int	tp_drops;		/* no room in queue or ring	*/
+  unsigned int	tp_filtered;		/* rejected by the filter	*/
+};
+
+#endif	/* _LINUX_IF_PACKET_H */
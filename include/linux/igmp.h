@@ -0,0 +1,36 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the Internet Group Management Protocol
+ *		(RFC 1112), with the leave message of the version 2 drafts.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _LINUX_IGMP_H
+#define _LINUX_IGMP_H
+
+
+struct igmphdr {
+  unsigned char		type;
+  unsigned char		code;		/* v2: max response time, 1/10s	*/
+  unsigned short	csum;
+  unsigned long		group;
+};
+
+
+#define IGMP_HOST_MEMBERSHIP_QUERY	0x11	/* From RFC1112 */
+#define IGMP_HOST_MEMBERSHIP_REPORT	0x12	/* Ditto */
+#define IGMP_HOST_NEW_MEMBERSHIP_REPORT	0x16	/* v2 report */
+#define IGMP_HOST_LEAVE_MESSAGE		0x17	/* v2 leave */
+
+#define IGMP_MAX_HOST_REPORT_DELAY	10	/* seconds, from RFC1112 */
+
+#define IGMP_ALL_HOSTS		htonl(0xE0000001L)
+#define IGMP_ALL_ROUTER		htonl(0xE0000002L)
+
+#endif	/* _LINUX_IGMP_H */
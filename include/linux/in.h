@@ -23,7 +23,8 @@
 enum {
   IPPROTO_IP = 0,		/* Dummy protocol for TCP		*/
   IPPROTO_ICMP = 1,		/* Internet Control Message Protocol	*/
-  IPPROTO_GGP = 2,		/* Gateway Protocol (deprecated)	*/
+  IPPROTO_IGMP = 2,		/* Internet Group Management Protocol	*/
+  IPPROTO_GGP = 3,		/* Gateway Protocol (deprecated)	*/
   IPPROTO_TCP = 6,		/* Transmission Control Protocol	*/
   IPPROTO_EGP = 8,		/* Exterior Gateway Protocol		*/
   IPPROTO_PUP = 12,		/* PUP protocol				*/
@@ -55,6 +56,13 @@ struct sockaddr_in {
 #define sin_zero	__pad		/* for BSD UNIX comp. -FvK	*/
 
 
+/* Argument to IP_ADD_MEMBERSHIP and IP_DROP_MEMBERSHIP. */
+struct ip_mreq {
+  struct in_addr	imr_multiaddr;	/* IP multicast group		*/
+  struct in_addr	imr_interface;	/* local address of interface	*/
+};
+
+
 /*
  * Definitions of the bits in an Internet address integer.
  * On subnets, host and network parts are found according
@@ -98,6 +106,11 @@ struct sockaddr_in {
 /* Address to loopback in software to local host.  */
 #define	INADDR_LOOPBACK		0x7f000001	/* 127.0.0.1		*/
 
+/* Multicast groups every host is in, and the top of the link-local ones. */
+#define	INADDR_UNSPEC_GROUP	0xe0000000	/* 224.0.0.0		*/
+#define	INADDR_ALLHOSTS_GROUP	0xe0000001	/* 224.0.0.1		*/
+#define	INADDR_MAX_LOCAL_GROUP	0xe00000ff	/* 224.0.0.255		*/
+
 
 /*
  * Options for use with `getsockopt' and `setsockopt' at
@@ -109,6 +122,16 @@ struct sockaddr_in {
 #endif
 #define IP_HDRINCL	2		/* raw packet header option	*/
 
+#define IP_MULTICAST_IF		32	/* set/get outgoing interface	*/
+#define IP_MULTICAST_TTL	33	/* set/get multicast TTL	*/
+#define IP_MULTICAST_LOOP	34	/* loop sent multicasts back?	*/
+#define IP_ADD_MEMBERSHIP	35	/* join a group			*/
+#define IP_DROP_MEMBERSHIP	36	/* leave a group		*/
+
+#define IP_DEFAULT_MULTICAST_TTL	1
+#define IP_DEFAULT_MULTICAST_LOOP	1
+#define IP_MAX_MEMBERSHIPS		20	/* per socket		*/
+
 
 /* Linux Internet number representation function declarations. */
 #undef ntohl
@@ -0,0 +1,64 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the IP packet filter and accounting rules,
+ *		as they are handed in with setsockopt() on a raw socket.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _LINUX_IP_FW_H
+#define _LINUX_IP_FW_H
+
+#include <linux/in.h>
+
+
+/*
+ * One rule.  Addresses and masks are in network order, ports in host
+ * order.  A port range of 0,0 means any port; for ICMP the "ports" are
+ * the message type and code.
+ */
+struct ip_fw {
+  struct in_addr	fw_src, fw_smsk;	/* source and its mask	*/
+  struct in_addr	fw_dst, fw_dmsk;	/* destination and mask	*/
+  unsigned short	fw_flg;			/* IP_FW_F_* below	*/
+  unsigned short	fw_sport[2];		/* source port range	*/
+  unsigned short	fw_dport[2];		/* dest. port range	*/
+  unsigned long		fw_pcnt;		/* packets matched	*/
+  unsigned long		fw_bcnt;		/* bytes matched	*/
+};
+
+#define IP_FW_F_ALL	0x0000		/* any protocol			*/
+#define IP_FW_F_TCP	0x0001
+#define IP_FW_F_UDP	0x0002
+#define IP_FW_F_ICMP	0x0003
+#define IP_FW_F_KIND	0x0003		/* which of the above		*/
+#define IP_FW_F_ACCEPT	0x0010		/* let it through, else drop it	*/
+#define IP_FW_F_ICMPRPL	0x0020		/* tell the sender we dropped it */
+#define IP_FW_F_PRN	0x0040		/* log the datagrams it matches	*/
+#define IP_FW_F_MASK	0x0073
+
+/* The chains. */
+#define IP_FW_IN	0		/* everything that arrives	*/
+#define IP_FW_FWD	1		/* what we route on		*/
+#define IP_FW_OUT	2		/* what we send ourselves	*/
+#define IP_FW_ACCT	3		/* counts only, every match	*/
+#define IP_FW_CHAINS	4
+
+/* setsockopt() options at SOL_IP on a raw socket, taking an ip_fwctl. */
+#define IP_FW_APPEND	64		/* add the rule to the chain	*/
+#define IP_FW_DELETE	65		/* remove the first one like it	*/
+#define IP_FW_FLUSH	66		/* remove all the chain's rules	*/
+#define IP_FW_ZERO	67		/* clear the chain's counters	*/
+#define IP_FW_POLICY	68		/* fw_flg is the default verdict */
+
+struct ip_fwctl {
+  int			fwc_chain;	/* IP_FW_IN etc.		*/
+  struct ip_fw		fwc_rule;
+};
+
+#endif	/* _LINUX_IP_FW_H */
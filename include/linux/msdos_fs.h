@@ -21,6 +21,10 @@
 #define MSDOS_SUPER_MAGIC 0x4d44 /* MD */
 
 #define FAT_CACHE    8 /* FAT cache size */
+#define FAT_MAP_BITS (PAGE_SIZE*8) /* clusters per free map page */
+#define MSDOS_DHASH  4 /* directories with a name hash */
+#define MSDOS_DHASH_MIN 64 /* smaller directories are just scanned */
+#define MSDOS_DHINTS 4 /* recently found slots remembered per hash */
 
 #define ATTR_RO      1  /* read-only */
 #define ATTR_HIDDEN  2  /* hidden */
@@ -88,6 +92,17 @@ struct msdos_dir_entry {
 	unsigned long size;  /* file size (in bytes) */
 };
 
+struct msdos_dhash {
+	int device; /* device number. 0 means unused. */
+	int start; /* first cluster of the directory, 0 for the root */
+	int size; /* number of directory slots covered */
+	int busy; /* being built */
+	unsigned long stamp; /* for LRU replacement */
+	unsigned char *sig; /* name hash of each slot, 0 if free; one page */
+	int hint_ino[MSDOS_DHINTS],hint_pos[MSDOS_DHINTS]; /* found slots */
+	int hint_hand; /* next hint to replace */
+};
+
 struct fat_cache {
 	int device; /* device number. 0 means unused. */
 	int ino; /* inode number. */
@@ -139,6 +154,9 @@ extern int msdos_scan(struct inode *dir,char *name,struct buffer_head **res_bh,
     struct msdos_dir_entry **res_de,int *ino);
 extern int msdos_parent_ino(struct inode *dir,int locked);
 extern int msdos_subdirs(struct inode *dir);
+extern void msdos_dhash_update(struct inode *dir,int ino,char *name);
+extern void msdos_dhash_inval(struct inode *dir);
+extern void msdos_dhash_inval_dev(int device);
 
 /* fat.c */
 
@@ -151,6 +169,9 @@ void cache_add(struct inode *inode,int f_clu,int d_clu);
 void cache_inval_inode(struct inode *inode);
 void cache_inval_dev(int device);
 int get_cluster(struct inode *inode,int cluster);
+extern int fat_map_build(struct super_block *sb);
+extern int fat_map_free(struct super_block *sb);
+extern void fat_map_release(struct super_block *sb);
 
 /* namei.c */
 
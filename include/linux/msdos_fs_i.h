@@ -5,6 +5,14 @@
  * MS-DOS file system inode data in memory
  */
 
+#define MSDOS_RUNS 4 /* contiguous cluster runs remembered per inode */
+
+struct msdos_run {
+	int file;	/* first file cluster of the run */
+	int disk;	/* disk cluster it lives in */
+	int len;	/* number of clusters, 0 if unused */
+};
+
 struct msdos_inode_info {
 	int i_start;	/* first cluster or 0 */
 	int i_attrs;	/* unused attribute bits */
@@ -15,6 +23,9 @@ struct msdos_inode_info {
 	struct inode *i_old;	/* pointer to the old inode this inode
 				   depends on */
 	int i_binary;	/* file contains non-text data */
+	struct msdos_run i_runs[MSDOS_RUNS]; /* see get_cluster */
+	int i_run_hand;	/* next run slot to replace */
+	int i_parent;	/* last known inode of the parent directory, or 0 */
 };
 
 #endif
@@ -81,6 +81,8 @@ struct socket {
 
 #define SOCK_INODE(S)	((S)->inode)
 
+struct file;
+
 struct proto_ops {
   int	family;
 
@@ -120,6 +122,9 @@ struct proto_ops {
 			 char *optval, int *optlen);
   int	(*fcntl)	(struct socket *sock, unsigned int cmd,
 			 unsigned long arg);	
+  int	(*mmap)		(struct socket *sock, struct inode *inode,
+			 struct file *file, unsigned long addr, size_t len,
+			 int prot, unsigned long off);
 };
 
 
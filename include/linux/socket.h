@@ -48,6 +48,7 @@ struct linger {
 #define SOL_IP		0
 #define SOL_IPX		256
 #define SOL_AX25	257
+#define SOL_PACKET	263
 #define SOL_TCP		6
 #define SOL_UDP		17
 
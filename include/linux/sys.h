@@ -145,6 +145,7 @@ extern int sys_quotactl();
 extern int sys_getpgid();
 extern int sys_fchdir();
 extern int sys_bdflush();
+extern int sys_sendfile();
 
 /*
  * These are system calls that will be removed at some time
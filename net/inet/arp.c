@@ -78,6 +78,7 @@
 #include "skbuff.h"
 #include "sock.h"
 #include "arp.h"
+#include "igmp.h"
 
 
 #define ARP_MAX_TRIES	3
@@ -689,6 +690,13 @@ arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 	case IS_BROADCAST:
 		memcpy(haddr, dev->broadcast, dev->addr_len);
 		return(0);
+	case IS_MULTICAST:
+		/* Groups map straight onto ethernet addresses, no asking. */
+		if (dev->type == ARPHRD_ETHER)
+			ip_mc_map(paddr, haddr);
+		else
+			memcpy(haddr, dev->broadcast, dev->addr_len);
+		return(0);
   }
 		
   apt = arp_lookup(paddr);
@@ -155,11 +155,49 @@ void skb_free_datagram(struct sk_buff *skb)
 	restore_flags(flags);
 }
 
+/*
+ *	Copy a datagram to user space. Reassembled datagrams may still be
+ *	a chain of the original fragments (see skb_add_frag()), in which
+ *	case we walk the chain rather than ever flattening it.
+ */
+
 void skb_copy_datagram(struct sk_buff *skb, int offset, char *to, int size)
 {
-	/* We will know all about the fraglist options to allow >4K receives
-	   but not this release */
-	memcpy_tofs(to,skb->h.raw+offset,size);
+	struct sk_buff *frag;
+	int n;
+
+	if (skb->fraglist == NULL)
+	{
+		memcpy_tofs(to,skb->h.raw+offset,size);
+		return;
+	}
+	n = (skb->tail - skb->h.raw) - offset;
+	if (n > 0)
+	{
+		if (n > size)
+			n = size;
+		memcpy_tofs(to,skb->h.raw+offset,n);
+		to += n;
+		size -= n;
+		offset = 0;
+	}
+	else
+		offset = -n;
+	for (frag = skb->fraglist; frag != NULL && size > 0; frag = frag->fraglist)
+	{
+		n = frag->len - offset;
+		if (n <= 0)
+		{
+			offset -= frag->len;
+			continue;
+		}
+		if (n > size)
+			n = size;
+		memcpy_tofs(to,frag->h.raw+offset,n);
+		to += n;
+		size -= n;
+		offset = 0;
+	}
 }
 
 /*
@@ -61,6 +61,7 @@
 #include "skbuff.h"
 #include "sock.h"
 #include "arp.h"
+#include "igmp.h"
 #ifdef CONFIG_AX25
 #include "ax25.h"
 #endif
@@ -203,6 +204,10 @@ int chk_addr(unsigned long addr)
 	if (addr == INADDR_ANY || addr == INADDR_BROADCAST)
 		return IS_BROADCAST;
 
+	/* A group address; ip_rcv() looks to see if we are in it. */
+	if (IN_MULTICAST(ntohl(addr)))
+		return IS_MULTICAST;
+
 	mask = get_mask(addr);
 
 	/* Accept all of the `loopback' class A net. */
@@ -378,6 +383,99 @@ struct device * dev_check(unsigned long addr)
 }
 
 
+/*
+ * Give the driver the device's multicast list.  Promiscuous mode takes
+ * everything anyway, so it is passed as -1; IFF_ALLMULTI is for the
+ * driver to look at.
+ */
+void
+dev_mc_upload(struct device *dev)
+{
+  struct dev_mc_list *dmi;
+  unsigned char *data, *tmp;
+
+  if (dev->set_multicast_list == NULL || !(dev->flags & IFF_UP))
+	return;
+  if (dev->flags & IFF_PROMISC) {
+	dev->set_multicast_list(dev, -1, NULL);
+	return;
+  }
+  if (dev->mc_count == 0) {
+	dev->set_multicast_list(dev, 0, NULL);
+	return;
+  }
+  data = kmalloc(dev->mc_count * dev->addr_len, GFP_ATOMIC);
+  if (data == NULL) {
+	printk("%s: no memory for the multicast list\n", dev->name);
+	return;
+  }
+  for (tmp = data, dmi = dev->mc_list; dmi != NULL; dmi = dmi->next) {
+	memcpy(tmp, dmi->dmi_addr, dev->addr_len);
+	tmp += dev->addr_len;
+  }
+  dev->set_multicast_list(dev, dev->mc_count, data);
+  kfree_s(data, dev->mc_count * dev->addr_len);
+}
+
+
+/*
+ * Add a hardware address to the list, or one more user to its entry.
+ * kmalloc may sleep, so the entry is had before looking.
+ */
+void
+dev_mc_add(struct device *dev, void *addr, int alen)
+{
+  struct dev_mc_list *dmi, *new;
+  unsigned long flags;
+
+  new = (struct dev_mc_list *) kmalloc(sizeof(*new), GFP_KERNEL);
+  for (dmi = dev->mc_list; dmi != NULL; dmi = dmi->next) {
+	if (dmi->dmi_addrlen == alen && memcmp(dmi->dmi_addr, addr, alen) == 0) {
+		dmi->dmi_users++;
+		if (new != NULL)
+			kfree_s(new, sizeof(*new));
+		return;
+	}
+  }
+  if ((dmi = new) == NULL)
+	return;
+  memcpy(dmi->dmi_addr, addr, alen);
+  dmi->dmi_addrlen = alen;
+  dmi->dmi_users = 1;
+  save_flags(flags);
+  cli();
+  dmi->next = dev->mc_list;
+  dev->mc_list = dmi;
+  dev->mc_count++;
+  restore_flags(flags);
+  dev_mc_upload(dev);
+}
+
+
+/* Drop a user of a hardware address, and the address with the last one. */
+void
+dev_mc_delete(struct device *dev, void *addr, int alen)
+{
+  struct dev_mc_list *dmi, **dmip;
+  unsigned long flags;
+
+  for (dmip = &dev->mc_list; (dmi = *dmip) != NULL; dmip = &dmi->next) {
+	if (dmi->dmi_addrlen != alen || memcmp(dmi->dmi_addr, addr, alen) != 0)
+		continue;
+	if (--dmi->dmi_users > 0)
+		return;
+	save_flags(flags);
+	cli();
+	*dmip = dmi->next;
+	dev->mc_count--;
+	restore_flags(flags);
+	kfree_s(dmi, sizeof(*dmi));
+	dev_mc_upload(dev);
+	return;
+  }
+}
+
+
 /* Prepare an interface for use. */
 int
 dev_open(struct device *dev)
@@ -386,8 +484,12 @@ dev_open(struct device *dev)
 
   if (dev->open) 
   	ret = dev->open(dev);
-  if (ret == 0) 
+  if (ret == 0) {
   	dev->flags |= (IFF_UP | IFF_RUNNING);
+	/* Every multicast capable interface is in the all-hosts group. */
+	ip_mc_device_up(dev);
+	dev_mc_upload(dev);
+  }
 
   return(ret);
 }
@@ -403,6 +505,8 @@ dev_close(struct device *dev)
 	if (dev->stop) 
 		dev->stop(dev);
 	rt_flush(dev);
+	/* The groups and their filter stay for when it comes up again. */
+	ip_mc_device_down(dev);
 	dev->pa_addr = 0;
 	dev->pa_dstaddr = 0;
 	dev->pa_brdaddr = 0;
@@ -447,6 +551,24 @@ dev_queue_xmit(struct sk_buff *skb, struct device *dev, int pri)
 	return;
   }
 
+  /*
+   * Flatten a fraglisted buffer for a driver that can't gather.  The
+   * original may still be wanted by its socket (TCP keeps it for
+   * retransmission), so send a copy and let the original go the way
+   * the driver would have let it go.
+   */
+  if (skb->fraglist != NULL && !dev->gather) {
+	struct sk_buff *n;
+
+	n = skb_flatten(skb, GFP_ATOMIC);
+	if (skb->free)
+		kfree_skb(skb, FREE_WRITE);
+	if (n == NULL)
+		return;
+	skb = n;
+	skb->dev = dev;
+  }
+
   if (pri < 0) {
 	pri = -pri-1;
 	where = 1;
@@ -655,6 +777,22 @@ inet_bh(void *tmp)
 
 			if (ptype->type==NET16(ETH_P_ALL))
 				nitcount--;
+
+			/*
+			 * A handler with a peek routine gets to look at
+			 * the shared buffer first.  If it takes what it
+			 * wants from it there (or wants nothing at all)
+			 * we save ourselves the copy.
+			 */
+			if (ptype->peek && ptype->peek(skb, skb->dev, ptype) == 0) {
+				flag = 1;
+				if (!(ptype->copy || nitcount)) {
+					skb->sk = NULL;
+					kfree_skb(skb, FREE_READ);
+				}
+				continue;
+			}
+
 			if (ptype->copy || nitcount) {	/* copy if we need to	*/
 				skb2 = alloc_skb(skb->mem_len, GFP_ATOMIC);
 				if (skb2 == NULL) 
@@ -855,10 +993,8 @@ dev_ifsioc(void *arg, unsigned int getset)
 			IFF_POINTOPOINT | IFF_NOTRAILERS | IFF_RUNNING |
 			IFF_NOARP | IFF_PROMISC | IFF_ALLMULTI);
 			
-		  if ( (old_flags & IFF_PROMISC) && ((dev->flags & IFF_PROMISC) == 0))
-		  	dev->set_multicast_list(dev,0,NULL);
-		  if ( (dev->flags & IFF_PROMISC) && ((old_flags & IFF_PROMISC) == 0))
-		  	dev->set_multicast_list(dev,-1,NULL);
+		  if ((old_flags ^ dev->flags) & (IFF_PROMISC | IFF_ALLMULTI))
+		  	dev_mc_upload(dev);
 		  if ((old_flags & IFF_UP) && ((dev->flags & IFF_UP) == 0)) {
 			ret = dev_close(dev);
 		  } else
@@ -886,6 +1022,7 @@ dev_ifsioc(void *arg, unsigned int getset)
 		dev->family = ifr.ifr_addr.sa_family;
 		dev->pa_mask = get_mask(dev->pa_addr);
 		dev->pa_brdaddr = dev->pa_addr | ~dev->pa_mask;
+		rt_cache_flush();
 		ret = 0;
 		break;
 	case SIOCGIFBRDADDR:
@@ -901,6 +1038,7 @@ dev_ifsioc(void *arg, unsigned int getset)
 	case SIOCSIFBRDADDR:
 		dev->pa_brdaddr = (*(struct sockaddr_in *)
 				    &ifr.ifr_broadaddr).sin_addr.s_addr;
+		rt_cache_flush();
 		ret = 0;
 		break;
 	case SIOCGIFDSTADDR:
@@ -33,6 +33,15 @@
 #define IS_LOOPBACK	2		/* address is for LOOPBACK	*/
 #define IS_BROADCAST	3		/* address is a valid broadcast	*/
 #define IS_INVBCAST	4		/* Wrong netmask bcast not for us */
+#define IS_MULTICAST	5		/* class D, maybe a group of ours */
+
+/* A hardware multicast address the device has been asked to take. */
+struct dev_mc_list {
+  struct dev_mc_list	*next;
+  unsigned char		dmi_addr[MAX_ADDR_LEN];
+  unsigned char		dmi_addrlen;
+  int			dmi_users;
+};
 
 /*
  * The DEVICE structure.
@@ -137,6 +146,13 @@ struct device {
   					 int num_addrs, void *addrs);
 #define HAVE_SET_MAC_ADDR  		 
   int			  (*set_mac_address)(struct device *dev, void *addr);
+#define HAVE_DEV_GATHER
+  unsigned char		  gather;	/* hard_start_xmit walks fraglists */
+
+  /* Multicast: what the hardware filter holds, and the IP groups. */
+  struct dev_mc_list	  *mc_list;
+  int			  mc_count;
+  struct ip_mc_list	  *ip_mc_list;
 };
 
 
@@ -150,6 +166,8 @@ struct packet_type {
 				 struct packet_type *);
   void			*data;
   struct packet_type	*next;
+  int			(*peek) (struct sk_buff *, struct device *,
+				 struct packet_type *);
 };
 
 
@@ -172,6 +190,9 @@ extern void		dev_remove_pack(struct packet_type *pt);
 extern struct device	*dev_get(char *name);
 extern int		dev_open(struct device *dev);
 extern int		dev_close(struct device *dev);
+extern void		dev_mc_add(struct device *dev, void *addr, int alen);
+extern void		dev_mc_delete(struct device *dev, void *addr, int alen);
+extern void		dev_mc_upload(struct device *dev);
 extern void		dev_queue_xmit(struct sk_buff *skb, struct device *dev,
 				       int pri);
 #define HAVE_NETIF_RX 1
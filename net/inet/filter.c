@@ -0,0 +1,248 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		The packet filter machine.  A program is checked once by
+ *		sk_chk_filter() when it is attached, so sk_run_filter()
+ *		only has to guard the packet accesses.  Programs can only
+ *		jump forwards, so every one of them terminates.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/filter.h>
+
+
+/*
+ * Run a filter over len bytes of packet data.  Returns how many bytes
+ * of the packet to accept, 0 meaning drop it.
+ */
+int
+sk_run_filter(unsigned char *data, int len, struct sock_filter *filter, int flen)
+{
+  struct sock_filter *fentry;
+  unsigned long A = 0, X = 0;
+  unsigned long mem[BPF_MEMWORDS];
+  unsigned long k;
+  int pc;
+
+  /* Nothing on the stack may leak out through an unwritten M[]. */
+  memset(mem, 0, sizeof(mem));
+  for (pc = 0; pc < flen; pc++) {
+	fentry = &filter[pc];
+	switch (fentry->code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+			k = fentry->k;
+load_w:
+			if (k + 4 > len || k + 4 < k) return(0);
+			A = (data[k] << 24) | (data[k+1] << 16) |
+			    (data[k+2] << 8) | data[k+3];
+			continue;
+		case BPF_LD|BPF_H|BPF_ABS:
+			k = fentry->k;
+load_h:
+			if (k + 2 > len || k + 2 < k) return(0);
+			A = (data[k] << 8) | data[k+1];
+			continue;
+		case BPF_LD|BPF_B|BPF_ABS:
+			k = fentry->k;
+load_b:
+			if (k >= len) return(0);
+			A = data[k];
+			continue;
+		case BPF_LD|BPF_W|BPF_IND:
+			k = X + fentry->k;
+			goto load_w;
+		case BPF_LD|BPF_H|BPF_IND:
+			k = X + fentry->k;
+			goto load_h;
+		case BPF_LD|BPF_B|BPF_IND:
+			k = X + fentry->k;
+			goto load_b;
+		case BPF_LD|BPF_W|BPF_LEN:
+			A = len;
+			continue;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			X = len;
+			continue;
+		case BPF_LDX|BPF_B|BPF_MSH:	/* IP header length */
+			k = fentry->k;
+			if (k >= len) return(0);
+			X = (data[k] & 0xf) << 2;
+			continue;
+		case BPF_LD|BPF_IMM:
+			A = fentry->k;
+			continue;
+		case BPF_LDX|BPF_IMM:
+			X = fentry->k;
+			continue;
+		case BPF_LD|BPF_MEM:
+			A = mem[fentry->k];
+			continue;
+		case BPF_LDX|BPF_MEM:
+			X = mem[fentry->k];
+			continue;
+		case BPF_ST:
+			mem[fentry->k] = A;
+			continue;
+		case BPF_STX:
+			mem[fentry->k] = X;
+			continue;
+
+		case BPF_ALU|BPF_ADD|BPF_X:	A += X;			continue;
+		case BPF_ALU|BPF_ADD|BPF_K:	A += fentry->k;		continue;
+		case BPF_ALU|BPF_SUB|BPF_X:	A -= X;			continue;
+		case BPF_ALU|BPF_SUB|BPF_K:	A -= fentry->k;		continue;
+		case BPF_ALU|BPF_MUL|BPF_X:	A *= X;			continue;
+		case BPF_ALU|BPF_MUL|BPF_K:	A *= fentry->k;		continue;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			if (X == 0) return(0);
+			A /= X;
+			continue;
+		case BPF_ALU|BPF_DIV|BPF_K:	A /= fentry->k;		continue;
+		case BPF_ALU|BPF_AND|BPF_X:	A &= X;			continue;
+		case BPF_ALU|BPF_AND|BPF_K:	A &= fentry->k;		continue;
+		case BPF_ALU|BPF_OR|BPF_X:	A |= X;			continue;
+		case BPF_ALU|BPF_OR|BPF_K:	A |= fentry->k;		continue;
+		case BPF_ALU|BPF_LSH|BPF_X:	A <<= X;		continue;
+		case BPF_ALU|BPF_LSH|BPF_K:	A <<= fentry->k;	continue;
+		case BPF_ALU|BPF_RSH|BPF_X:	A >>= X;		continue;
+		case BPF_ALU|BPF_RSH|BPF_K:	A >>= fentry->k;	continue;
+		case BPF_ALU|BPF_NEG:		A = -A;			continue;
+
+		case BPF_JMP|BPF_JA:
+			pc += fentry->k;
+			continue;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			pc += (A == fentry->k) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JGT|BPF_K:
+			pc += (A > fentry->k) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			pc += (A >= fentry->k) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			pc += (A & fentry->k) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			pc += (A == X) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			pc += (A > X) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JGE|BPF_X:
+			pc += (A >= X) ? fentry->jt : fentry->jf;
+			continue;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			pc += (A & X) ? fentry->jt : fentry->jf;
+			continue;
+
+		case BPF_MISC|BPF_TAX:
+			X = A;
+			continue;
+		case BPF_MISC|BPF_TXA:
+			A = X;
+			continue;
+
+		case BPF_RET|BPF_K:
+			return((int) fentry->k);
+		case BPF_RET|BPF_A:
+			return((int) A);
+
+		default:
+			/* sk_chk_filter() lets nothing else through */
+			return(0);
+	}
+  }
+  return(0);
+}
+
+
+/*
+ * Check a program before it is attached: known opcodes only, jumps
+ * and scratch memory in range, no constant division by zero, and a
+ * return at the end so we can't run off it.
+ */
+int
+sk_chk_filter(struct sock_filter *filter, int flen)
+{
+  struct sock_filter *ftest;
+  int pc;
+
+  if (flen <= 0 || flen > BPF_MAXINSNS)
+	return(-EINVAL);
+
+  for (pc = 0; pc < flen; pc++) {
+	ftest = &filter[pc];
+	switch (BPF_CLASS(ftest->code)) {
+		case BPF_LD:
+		case BPF_LDX:
+			if (BPF_MODE(ftest->code) == BPF_MEM &&
+			    ftest->k >= BPF_MEMWORDS)
+				return(-EINVAL);
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			if (ftest->k >= BPF_MEMWORDS)
+				return(-EINVAL);
+			break;
+		case BPF_ALU:
+			if (ftest->code == (BPF_ALU|BPF_DIV|BPF_K) && ftest->k == 0)
+				return(-EINVAL);
+			break;
+		case BPF_JMP:
+			if (BPF_OP(ftest->code) == BPF_JA) {
+				if (ftest->k >= flen - pc - 1)
+					return(-EINVAL);
+			} else if (pc + ftest->jt + 1 >= flen ||
+				   pc + ftest->jf + 1 >= flen)
+				return(-EINVAL);
+			break;
+		case BPF_RET:
+		case BPF_MISC:
+			break;
+	}
+  }
+  if (BPF_CLASS(filter[flen - 1].code) != BPF_RET)
+	return(-EINVAL);
+
+  /* Weed out the opcodes sk_run_filter() doesn't know. */
+  for (pc = 0; pc < flen; pc++) {
+	switch (filter[pc].code) {
+		case BPF_LD|BPF_W|BPF_ABS: case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS: case BPF_LD|BPF_W|BPF_IND:
+		case BPF_LD|BPF_H|BPF_IND: case BPF_LD|BPF_B|BPF_IND:
+		case BPF_LD|BPF_W|BPF_LEN: case BPF_LDX|BPF_W|BPF_LEN:
+		case BPF_LDX|BPF_B|BPF_MSH: case BPF_LD|BPF_IMM:
+		case BPF_LDX|BPF_IMM: case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM: case BPF_ST: case BPF_STX:
+		case BPF_ALU|BPF_ADD|BPF_X: case BPF_ALU|BPF_ADD|BPF_K:
+		case BPF_ALU|BPF_SUB|BPF_X: case BPF_ALU|BPF_SUB|BPF_K:
+		case BPF_ALU|BPF_MUL|BPF_X: case BPF_ALU|BPF_MUL|BPF_K:
+		case BPF_ALU|BPF_DIV|BPF_X: case BPF_ALU|BPF_DIV|BPF_K:
+		case BPF_ALU|BPF_AND|BPF_X: case BPF_ALU|BPF_AND|BPF_K:
+		case BPF_ALU|BPF_OR|BPF_X: case BPF_ALU|BPF_OR|BPF_K:
+		case BPF_ALU|BPF_LSH|BPF_X: case BPF_ALU|BPF_LSH|BPF_K:
+		case BPF_ALU|BPF_RSH|BPF_X: case BPF_ALU|BPF_RSH|BPF_K:
+		case BPF_ALU|BPF_NEG: case BPF_JMP|BPF_JA:
+		case BPF_JMP|BPF_JEQ|BPF_K: case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K: case BPF_JMP|BPF_JSET|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_X: case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X: case BPF_JMP|BPF_JSET|BPF_X:
+		case BPF_MISC|BPF_TAX: case BPF_MISC|BPF_TXA:
+		case BPF_RET|BPF_K: case BPF_RET|BPF_A:
+			break;
+		default:
+			return(-EINVAL);
+	}
+  }
+  return(0);
+}
@@ -84,11 +84,14 @@ icmp_send(struct sk_buff *skb_in, int type, int code, struct device *dev)
   struct iphdr *iph;
   int offset;
   struct icmphdr *icmph;
-  int len;
+  int len, mtu;
 
   DPRINTF((DBG_ICMP, "icmp_send(skb_in = %X, type = %d, code = %d, dev=%X)\n",
 	   					skb_in, type, code, dev));
 
+  /* The datagram was too big for this device. */
+  mtu = dev->mtu;
+
   /* Get some memory for the reply. */
   len = sizeof(struct sk_buff) + dev->hard_header_len +
 	sizeof(struct iphdr) + sizeof(struct icmphdr) +
@@ -122,6 +125,8 @@ icmp_send(struct sk_buff *skb_in, int type, int code, struct device *dev)
   icmph->code = code;
   icmph->checksum = 0;
   icmph->un.gateway = 0;
+  if (type == ICMP_DEST_UNREACH && code == ICMP_FRAG_NEEDED)
+	icmph->un.frag.mtu = htons(mtu);
   memcpy(icmph + 1, iph, sizeof(struct iphdr) + 8);
 
   icmph->checksum = ip_compute_csum((unsigned char *)icmph,
@@ -135,6 +140,26 @@ icmp_send(struct sk_buff *skb_in, int type, int code, struct device *dev)
 }
 
 
+/*
+ * The MTU plateaus of RFC 1191, for routers that don't tell us the
+ * next hop MTU: we take the next one down from the datagram's size.
+ */
+static unsigned short icmp_mtu_plateaus[] = {
+  32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68
+};
+
+static unsigned short
+icmp_guess_mtu(unsigned short tot_len)
+{
+  int i;
+
+  for (i = 0; i < sizeof(icmp_mtu_plateaus)/sizeof(icmp_mtu_plateaus[0]); i++)
+	if (icmp_mtu_plateaus[i] < tot_len)
+		return(icmp_mtu_plateaus[i]);
+  return(68);
+}
+
+
 /* Handle ICMP_UNREACH and ICMP_QUENCH. */
 static void
 icmp_unreach(struct icmphdr *icmph, struct sk_buff *skb)
@@ -164,8 +189,17 @@ icmp_unreach(struct icmphdr *icmph, struct sk_buff *skb)
 			in_ntoa(iph->daddr), -1 /* FIXME: ntohs(iph->port) */));
 		break;
 	case ICMP_FRAG_NEEDED:
-		printk("ICMP: %s: fragmentation needed and DF set.\n",
-							in_ntoa(iph->daddr));
+		DPRINTF((DBG_ICMP, "ICMP: %s: fragmentation needed and DF set.\n",
+							in_ntoa(iph->daddr)));
+		/* Before the protocols hear of it, so they find the new MTU. */
+		if (icmph->type == ICMP_DEST_UNREACH &&
+		    icmph->code == ICMP_FRAG_NEEDED) {
+			unsigned short mtu = ntohs(icmph->un.frag.mtu);
+
+			if (mtu == 0)
+				mtu = icmp_guess_mtu(ntohs(iph->tot_len));
+			rt_update_pmtu(iph->daddr, mtu);
+		}
 		break;
 	case ICMP_SR_FAILED:
 		printk("ICMP: %s: Source Route Failed.\n", in_ntoa(iph->daddr));
@@ -419,9 +453,11 @@ icmp_rcv(struct sk_buff *skb1, struct device *dev, struct options *opt,
 {
   struct icmphdr *icmph;
   unsigned char *buff;
+  int atype;
 
-  /* Drop broadcast packets. */
-  if (chk_addr(daddr) == IS_BROADCAST) {
+  /* Drop broadcast and multicast packets. */
+  atype = chk_addr(daddr);
+  if (atype == IS_BROADCAST || atype == IS_MULTICAST) {
 	DPRINTF((DBG_ICMP, "ICMP: Discarded broadcast from %s\n",
 							in_ntoa(saddr)));
 	skb1->sk = NULL;
@@ -0,0 +1,395 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Internet Group Management Protocol (RFC 1112), and the
+ *		bookkeeping of which groups the sockets and devices are in.
+ *
+ *		A device holds one ip_mc_list entry per group joined on it,
+ *		counting the sockets that asked for it, and the hardware
+ *		filter is only changed when the first joins or the last
+ *		leaves.  Queries start a report timer per group; hearing
+ *		another host report the group first cancels ours.  The
+ *		groups outlive the device going down, as the sockets that
+ *		joined them still count on them, and are announced again
+ *		when it comes back up.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#include <asm/system.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/socket.h>
+#include <linux/in.h>
+#include <linux/if_arp.h>
+#include "inet.h"
+#include "dev.h"
+#include "ip.h"
+#include "protocol.h"
+#include "skbuff.h"
+#include "sock.h"
+#include "igmp.h"
+
+
+#define MAX_IGMP_SIZE	(sizeof(struct sk_buff) + MAX_HEADER + 20 + sizeof(struct igmphdr))
+
+
+/* Reports are spread over the delay so a LAN's worth don't collide. */
+static unsigned long
+igmp_random(void)
+{
+  static unsigned long seed = 152L;
+
+  seed = seed * 69069L + jiffies + 1;
+  return(seed >> 8);
+}
+
+
+static void
+igmp_send_report(struct device *dev, unsigned long group, int type)
+{
+  struct sk_buff *skb;
+  struct igmphdr *ih;
+  unsigned long daddr;
+  int tmp;
+
+  if (!(dev->flags & IFF_UP))
+	return;
+  /* Leaves go to the routers, reports to the group itself. */
+  daddr = (type == IGMP_HOST_LEAVE_MESSAGE) ? IGMP_ALL_ROUTER : group;
+  skb = alloc_skb(MAX_IGMP_SIZE, GFP_ATOMIC);
+  if (skb == NULL)
+	return;
+  skb->sk = NULL;
+  skb->mem_addr = skb;
+  skb->mem_len = MAX_IGMP_SIZE;
+  skb->free = 1;
+  tmp = ip_build_header(skb, dev->pa_addr, daddr, &dev, IPPROTO_IGMP, NULL,
+			skb->mem_len, 0, 1);
+  if (tmp < 0) {
+	kfree_skb(skb, FREE_WRITE);
+	return;
+  }
+  ih = (struct igmphdr *) (skb->data + tmp);
+  ih->type = type;
+  ih->code = 0;
+  ih->csum = 0;
+  ih->group = group;
+  ih->csum = ip_compute_csum((unsigned char *) ih, sizeof(struct igmphdr));
+  skb->len = tmp + sizeof(struct igmphdr);
+  ip_queue_xmit(NULL, dev, skb, 1);
+}
+
+
+static void
+igmp_timer_expire(unsigned long data)
+{
+  struct ip_mc_list *im = (struct ip_mc_list *) data;
+
+  im->tm_running = 0;
+  igmp_send_report(im->interface, im->multiaddr, IGMP_HOST_MEMBERSHIP_REPORT);
+}
+
+
+static void
+igmp_start_timer(struct ip_mc_list *im, unsigned long max)
+{
+  if (im->tm_running)
+	return;
+  im->timer.expires = igmp_random() % max + 1;
+  im->timer.data = (unsigned long) im;
+  im->timer.function = igmp_timer_expire;
+  im->tm_running = 1;
+  add_timer(&im->timer);
+}
+
+
+static void
+igmp_stop_timer(struct ip_mc_list *im)
+{
+  if (im->tm_running) {
+	del_timer(&im->timer);
+	im->tm_running = 0;
+  }
+}
+
+
+/* Somebody else on the wire is in the group; it will do for us too. */
+static void
+igmp_heard_report(struct device *dev, unsigned long group)
+{
+  struct ip_mc_list *im;
+
+  for (im = dev->ip_mc_list; im != NULL; im = im->next) {
+	if (im->multiaddr == group)
+		igmp_stop_timer(im);
+  }
+}
+
+
+static void
+igmp_heard_query(struct device *dev, int code)
+{
+  struct ip_mc_list *im;
+  unsigned long max;
+
+  max = code ? (code * HZ) / 10 : IGMP_MAX_HOST_REPORT_DELAY * HZ;
+  if (max == 0)
+	max = 1;
+  for (im = dev->ip_mc_list; im != NULL; im = im->next) {
+	if (im->multiaddr != IGMP_ALL_HOSTS)
+		igmp_start_timer(im, max);
+  }
+}
+
+
+int
+igmp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	 unsigned long daddr, unsigned short len, unsigned long saddr,
+	 int redo, struct inet_protocol *protocol)
+{
+  struct igmphdr *ih = (struct igmphdr *) skb->h.raw;
+
+  if (len < sizeof(struct igmphdr) ||
+      ip_compute_csum((unsigned char *) ih, len)) {
+	skb->sk = NULL;
+	kfree_skb(skb, FREE_READ);
+	return(0);
+  }
+  switch(ih->type) {
+	case IGMP_HOST_MEMBERSHIP_QUERY:
+		if (daddr == IGMP_ALL_HOSTS)
+			igmp_heard_query(dev, ih->code);
+		break;
+	case IGMP_HOST_MEMBERSHIP_REPORT:
+	case IGMP_HOST_NEW_MEMBERSHIP_REPORT:
+		if (daddr == ih->group)
+			igmp_heard_report(dev, ih->group);
+		break;
+  }
+  skb->sk = NULL;
+  kfree_skb(skb, FREE_READ);
+  return(0);
+}
+
+
+/* Are we in the group on this device?  Called from the bottom half. */
+int
+ip_mc_member(struct device *dev, unsigned long addr)
+{
+  struct ip_mc_list *im;
+
+  for (im = dev->ip_mc_list; im != NULL; im = im->next) {
+	if (im->multiaddr == addr)
+		return(1);
+  }
+  return(0);
+}
+
+
+/* Only ethernet has a group address mapping we know about. */
+static void
+ip_mc_filter_add(struct device *dev, unsigned long addr)
+{
+  unsigned char buf[6];
+
+  if (dev->type != ARPHRD_ETHER)
+	return;
+  ip_mc_map(addr, buf);
+  dev_mc_add(dev, buf, ETH_ALEN);
+}
+
+
+static void
+ip_mc_filter_del(struct device *dev, unsigned long addr)
+{
+  unsigned char buf[6];
+
+  if (dev->type != ARPHRD_ETHER)
+	return;
+  ip_mc_map(addr, buf);
+  dev_mc_delete(dev, buf, ETH_ALEN);
+}
+
+
+/*
+ * The entry is allocated before looking, as kmalloc may sleep and
+ * somebody else join the group meanwhile.
+ */
+static void
+ip_mc_inc_group(struct device *dev, unsigned long addr)
+{
+  struct ip_mc_list *im, *new;
+  unsigned long flags;
+
+  new = (struct ip_mc_list *) kmalloc(sizeof(*new), GFP_KERNEL);
+  for (im = dev->ip_mc_list; im != NULL; im = im->next) {
+	if (im->multiaddr == addr) {
+		im->users++;
+		if (new != NULL)
+			kfree_s(new, sizeof(*new));
+		return;
+	}
+  }
+  if ((im = new) == NULL)
+	return;
+  memset(im, 0, sizeof(*im));
+  im->users = 1;
+  im->interface = dev;
+  im->multiaddr = addr;
+  save_flags(flags);
+  cli();
+  im->next = dev->ip_mc_list;
+  dev->ip_mc_list = im;
+  restore_flags(flags);
+  ip_mc_filter_add(dev, addr);
+
+  /* Announce ourselves, and again a little later in case that was lost. */
+  if (addr != IGMP_ALL_HOSTS) {
+	igmp_send_report(dev, addr, IGMP_HOST_MEMBERSHIP_REPORT);
+	igmp_start_timer(im, IGMP_MAX_HOST_REPORT_DELAY * HZ);
+  }
+}
+
+
+static void
+ip_mc_dec_group(struct device *dev, unsigned long addr)
+{
+  struct ip_mc_list *im, **imp;
+  unsigned long flags;
+
+  for (imp = &dev->ip_mc_list; (im = *imp) != NULL; imp = &im->next) {
+	if (im->multiaddr != addr)
+		continue;
+	if (--im->users > 0)
+		return;
+	save_flags(flags);
+	cli();
+	*imp = im->next;
+	igmp_stop_timer(im);
+	restore_flags(flags);
+	ip_mc_filter_del(dev, addr);
+	if (addr != IGMP_ALL_HOSTS)
+		igmp_send_report(dev, addr, IGMP_HOST_LEAVE_MESSAGE);
+	kfree_s(im, sizeof(*im));
+	return;
+  }
+}
+
+
+/*
+ * A device coming up joins the all-hosts group the first time, if it
+ * can do multicast, and reports the groups it kept while it was down.
+ * dev_open uploads the hardware filter, which was kept too.
+ */
+void
+ip_mc_device_up(struct device *dev)
+{
+  struct ip_mc_list *im;
+
+  if (dev->set_multicast_list != NULL && !ip_mc_member(dev, IGMP_ALL_HOSTS))
+	ip_mc_inc_group(dev, IGMP_ALL_HOSTS);
+  for (im = dev->ip_mc_list; im != NULL; im = im->next) {
+	if (im->multiaddr == IGMP_ALL_HOSTS)
+		continue;
+	igmp_send_report(dev, im->multiaddr, IGMP_HOST_MEMBERSHIP_REPORT);
+	igmp_start_timer(im, IGMP_MAX_HOST_REPORT_DELAY * HZ);
+  }
+}
+
+
+/* A device going down has nothing to report until it is up again. */
+void
+ip_mc_device_down(struct device *dev)
+{
+  struct ip_mc_list *im;
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  for (im = dev->ip_mc_list; im != NULL; im = im->next)
+	igmp_stop_timer(im);
+  restore_flags(flags);
+}
+
+
+int
+ip_mc_join_group(struct sock *sk, struct device *dev, unsigned long addr)
+{
+  int i, unused = -1;
+
+  if (!IN_MULTICAST(ntohl(addr)))
+	return(-EINVAL);
+  if (!(dev->flags & IFF_UP))
+	return(-ENODEV);
+  if (sk->ip_mc_list == NULL) {
+	sk->ip_mc_list = (struct ip_mc_socklist *) kmalloc(sizeof(*sk->ip_mc_list), GFP_KERNEL);
+	if (sk->ip_mc_list == NULL)
+		return(-ENOMEM);
+	memset(sk->ip_mc_list, 0, sizeof(*sk->ip_mc_list));
+  }
+  for (i = 0; i < IP_MAX_MEMBERSHIPS; i++) {
+	if (sk->ip_mc_list->multidev[i] == NULL) {
+		if (unused < 0)
+			unused = i;
+		continue;
+	}
+	if (sk->ip_mc_list->multiaddr[i] == addr &&
+	    sk->ip_mc_list->multidev[i] == dev)
+		return(-EADDRINUSE);
+  }
+  if (unused < 0)
+	return(-ENOBUFS);
+  sk->ip_mc_list->multiaddr[unused] = addr;
+  sk->ip_mc_list->multidev[unused] = dev;
+  ip_mc_inc_group(dev, addr);
+  return(0);
+}
+
+
+int
+ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr)
+{
+  int i;
+
+  if (!IN_MULTICAST(ntohl(addr)))
+	return(-EINVAL);
+  if (sk->ip_mc_list == NULL)
+	return(-EADDRNOTAVAIL);
+  for (i = 0; i < IP_MAX_MEMBERSHIPS; i++) {
+	if (sk->ip_mc_list->multiaddr[i] == addr &&
+	    sk->ip_mc_list->multidev[i] == dev) {
+		sk->ip_mc_list->multidev[i] = NULL;
+		ip_mc_dec_group(dev, addr);
+		return(0);
+	}
+  }
+  return(-EADDRNOTAVAIL);
+}
+
+
+/* The socket is going away: leave everything it joined. */
+void
+ip_mc_drop_socket(struct sock *sk)
+{
+  int i;
+
+  if (sk->ip_mc_list == NULL)
+	return;
+  for (i = 0; i < IP_MAX_MEMBERSHIPS; i++) {
+	if (sk->ip_mc_list->multidev[i] != NULL) {
+		ip_mc_dec_group(sk->ip_mc_list->multidev[i],
+				sk->ip_mc_list->multiaddr[i]);
+		sk->ip_mc_list->multidev[i] = NULL;
+	}
+  }
+  kfree_s(sk->ip_mc_list, sizeof(*sk->ip_mc_list));
+  sk->ip_mc_list = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the IP multicast group code.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _IGMP_H
+#define _IGMP_H
+
+#include <linux/igmp.h>
+#include <linux/timer.h>
+
+
+/* A group joined on a device, shared by every socket that asked for it. */
+struct ip_mc_list {
+  struct device		*interface;
+  unsigned long		multiaddr;
+  struct ip_mc_list	*next;
+  struct timer_list	timer;		/* pending report		*/
+  int			tm_running;
+  int			users;
+};
+
+/* The groups one socket has joined. */
+struct ip_mc_socklist {
+  unsigned long		multiaddr[IP_MAX_MEMBERSHIPS];
+  struct device		*multidev[IP_MAX_MEMBERSHIPS];	/* NULL: unused	*/
+};
+
+
+/* The ethernet address an IP group maps to (RFC 1112, section 6.4). */
+static inline void
+ip_mc_map(unsigned long addr, unsigned char *buf)
+{
+  addr = ntohl(addr);
+  buf[0] = 0x01;
+  buf[1] = 0x00;
+  buf[2] = 0x5e;
+  buf[5] = addr & 0xff;
+  addr >>= 8;
+  buf[4] = addr & 0xff;
+  addr >>= 8;
+  buf[3] = addr & 0x7f;
+}
+
+
+extern int	igmp_rcv(struct sk_buff *skb, struct device *dev,
+			 struct options *opt, unsigned long daddr,
+			 unsigned short len, unsigned long saddr,
+			 int redo, struct inet_protocol *protocol);
+extern int	ip_mc_member(struct device *dev, unsigned long addr);
+extern void	ip_mc_device_up(struct device *dev);
+extern void	ip_mc_device_down(struct device *dev);
+extern int	ip_mc_join_group(struct sock *sk, struct device *dev,
+				 unsigned long addr);
+extern int	ip_mc_leave_group(struct sock *sk, struct device *dev,
+				  unsigned long addr);
+extern void	ip_mc_drop_socket(struct sock *sk);
+
+#endif	/* _IGMP_H */
@@ -54,8 +54,10 @@
  *		as published by the Free Software Foundation; either version
  *		2 of the License, or (at your option) any later version.
  */
+#include <linux/config.h>
 #include <asm/segment.h>
 #include <asm/system.h>
+#include <asm/checksum.h>
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/sched.h>
@@ -75,6 +77,9 @@
 #include "sock.h"
 #include "arp.h"
 #include "icmp.h"
+#include "snmp.h"
+#include "igmp.h"
+#include "ip_fw.h"
 
 #define CONFIG_IP_FORWARD
 #define CONFIG_IP_DEFRAG
@@ -232,6 +237,16 @@ ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long daddr,
 	   
   buff = skb->data;
 
+  /* A socket may pick the interface its multicasts leave by, and their TTL. */
+  if (IN_MULTICAST(ntohl(daddr)) && skb->sk != NULL) {
+	if (*dev == NULL && skb->sk->ip_mc_dev != NULL) {
+		*dev = skb->sk->ip_mc_dev;
+		if (saddr == 0x0100007FL)
+			saddr = (*dev)->pa_addr;
+	}
+	ttl = skb->sk->ip_mc_ttl;
+  }
+
   /* See if we need to look up the device. */
   if (*dev == NULL) {
 	rt = rt_route(daddr, &optmem);
@@ -250,7 +265,8 @@ ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long daddr,
 	rt = rt_route(daddr, &optmem);
 	raddr = (rt == NULL) ? 0 : rt->rt_gateway;
   }
-  if (raddr == 0)
+  /* A group is never sent by way of a gateway. */
+  if (raddr == 0 || IN_MULTICAST(ntohl(daddr)))
   	raddr = daddr;
 
   /* Now build the MAC header. */
@@ -272,7 +288,8 @@ ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long daddr,
   iph = (struct iphdr *)buff;
   iph->version  = 4;
   iph->tos      = tos;
-  iph->frag_off = 0;
+  /* TCP sizes its segments to the path MTU, and wants to hear if it's wrong. */
+  iph->frag_off = (type == IPPROTO_TCP) ? htons(IP_DF) : 0;
   iph->ttl      = ttl;
   iph->daddr    = daddr;
   iph->saddr    = saddr;
@@ -436,32 +453,6 @@ do_options(struct iphdr *iph, struct options *opt)
   return(0);
 }
 
-/* This is a version of ip_compute_csum() optimized for IP headers, which
-   always checksum on 4 octet boundaries. */
-static inline unsigned short
-ip_fast_csum(unsigned char * buff, int wlen)
-{
-    unsigned long sum = 0;
-
-    if (wlen) {
-    	unsigned long bogus;
-	 __asm__("clc\n"
-		"1:\t"
-		"lodsl\n\t"
-		"adcl %3, %0\n\t"
-		"decl %2\n\t"
-		"jne 1b\n\t"
-		"adcl $0, %0\n\t"
-		"movl %0, %3\n\t"
-		"shrl $16, %3\n\t"
-		"addw %w3, %w0\n\t"
-		"adcw $0, %w0"
-	    : "=r" (sum), "=S" (buff), "=r" (wlen), "=a" (bogus)
-	    : "0"  (sum),  "1" (buff),  "2" (wlen));
-    }
-    return (~sum) & 0xffff;
-}
-
 /*
  * This routine does all the checksum computations that don't
  * require anything special (like copying or special headers).
@@ -469,43 +460,7 @@ ip_fast_csum(unsigned char * buff, int wlen)
 unsigned short
 ip_compute_csum(unsigned char * buff, int len)
 {
-  unsigned long sum = 0;
-
-  /* Do the first multiple of 4 bytes and convert to 16 bits. */
-  if (len > 3) {
-	__asm__("clc\n"
-	        "1:\t"
-	    	"lodsl\n\t"
-	    	"adcl %%eax, %%ebx\n\t"
-	    	"loop 1b\n\t"
-	    	"adcl $0, %%ebx\n\t"
-	    	"movl %%ebx, %%eax\n\t"
-	    	"shrl $16, %%eax\n\t"
-	    	"addw %%ax, %%bx\n\t"
-	    	"adcw $0, %%bx"
-	        : "=b" (sum) , "=S" (buff)
-	        : "0" (sum), "c" (len >> 2) ,"1" (buff)
-	        : "ax", "cx", "si", "bx" );
-  }
-  if (len & 2) {
-	__asm__("lodsw\n\t"
-	    	"addw %%ax, %%bx\n\t"
-	    	"adcw $0, %%bx"
-	        : "=b" (sum), "=S" (buff)
-	        : "0" (sum), "1" (buff)
-	        : "bx", "ax", "si");
-  }
-  if (len & 1) {
-	__asm__("lodsb\n\t"
-	    	"movb $0, %%ah\n\t"
-	    	"addw %%ax, %%bx\n\t"
-	    	"adcw $0, %%bx"
-	        : "=b" (sum), "=S" (buff)
-	        : "0" (sum), "1" (buff)
-	        : "bx", "ax", "si");
-  }
-  sum =~sum;
-  return(sum & 0xffff);
+  return(csum_fold(csum_partial(buff, len, 0)));
 }
 
 /* Check the header of an incoming IP datagram.  This version is still used in slhc.c. */
@@ -516,7 +471,7 @@ ip_csum(struct iphdr *iph)
 }
 
 /* Generate a checksym for an outgoing IP datagram. */
-static void
+void
 ip_send_check(struct iphdr *iph)
 {
    iph->check = 0;
@@ -525,7 +480,24 @@ ip_send_check(struct iphdr *iph)
 
 /************************ Fragment Handlers From NET2E not yet with tweaks to beat 4K **********************************/
 
-static struct ipq *ipqueue = NULL;		/* IP fragment queue	*/
+struct ip_mib ip_statistics = { 0, 0, 0 };
+
+static struct ipq *ipqueue = NULL;		/* IP fragment queues, oldest first */
+static struct ipq *ipq_tail = NULL;
+static struct ipq *ipq_hash[IPQ_HASHSZ];	/* and hashed for lookup */
+static unsigned long ip_frag_mem = 0;		/* memory held by the queues */
+
+static inline int ipqhashfn(unsigned short id, unsigned long saddr,
+			    unsigned long daddr, unsigned char prot)
+{
+	unsigned long h;
+
+	h = id ^ saddr ^ daddr ^ prot;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return(h & (IPQ_HASHSZ - 1));
+}
+
  /* Create a new fragment entry. */
 static struct ipfrag *ip_frag_create(int offset, int end, struct sk_buff *skb, unsigned char *ptr)
 {
@@ -545,6 +517,7 @@ static struct ipfrag *ip_frag_create(int offset, int end, struct sk_buff *skb, u
 	fp->len = end - offset;
 	fp->skb = skb;
 	fp->ptr = ptr;
+	ip_frag_mem += skb->mem_len + sizeof(struct ipfrag);
  
 	return(fp);
 }
@@ -557,11 +530,10 @@ static struct ipfrag *ip_frag_create(int offset, int end, struct sk_buff *skb, u
 static struct ipq *ip_find(struct iphdr *iph)
 {
 	struct ipq *qp;
-	struct ipq *qplast;
  
 	cli();
-	qplast = NULL;
-	for(qp = ipqueue; qp != NULL; qplast = qp, qp = qp->next) 
+	qp = ipq_hash[ipqhashfn(iph->id, iph->saddr, iph->daddr, iph->protocol)];
+	for(; qp != NULL; qp = qp->hnext) 
 	{
  		if (iph->id== qp->iph->id && iph->saddr == qp->iph->saddr &&
 			iph->daddr == qp->iph->daddr && iph->protocol == qp->iph->protocol) 
@@ -586,6 +558,7 @@ static void ip_free(struct ipq *qp)
 {
 	struct ipfrag *fp;
 	struct ipfrag *xp;
+	struct ipq **qpp;
 
 	/* Stop the timer for this entry. */
 /*	printk("ip_free\n");*/
@@ -594,17 +567,21 @@ static void ip_free(struct ipq *qp)
 	/* Remove this entry from the "incomplete datagrams" queue. */
 	cli();
 	if (qp->prev == NULL) 
-	{
 	 	ipqueue = qp->next;
-	 	if (ipqueue != NULL) 
-	 		ipqueue->prev = NULL;
-   	} 
    	else 
-   	{
  		qp->prev->next = qp->next;
- 		if (qp->next != NULL) 
- 			qp->next->prev = qp->prev;
-   	}
+	if (qp->next == NULL) 
+		ipq_tail = qp->prev;
+	else 
+		qp->next->prev = qp->prev;
+
+	/* ...and from its hash chain. */
+	qpp = &ipq_hash[ipqhashfn(qp->iph->id, qp->iph->saddr,
+				  qp->iph->daddr, qp->iph->protocol)];
+	while (*qpp != NULL && *qpp != qp)
+		qpp = &(*qpp)->hnext;
+	if (*qpp != NULL)
+		*qpp = qp->hnext;
  
    	/* Release all fragment data. */
 /*   	printk("ip_free: kill frag data\n");*/
@@ -612,8 +589,13 @@ static void ip_free(struct ipq *qp)
    	while (fp != NULL) 
    	{
  		xp = fp->next;
- 		IS_SKB(fp->skb);
- 		kfree_skb(fp->skb,FREE_READ);
+ 		if (fp->skb != NULL)	/* ip_glue() may have taken it */
+ 		{
+ 			IS_SKB(fp->skb);
+ 			ip_frag_mem -= fp->skb->mem_len;
+ 			kfree_skb(fp->skb,FREE_READ);
+ 		}
+ 		ip_frag_mem -= sizeof(struct ipfrag);
  		kfree_s(fp, sizeof(struct ipfrag));
  		fp = xp;
    	}
@@ -627,6 +609,7 @@ static void ip_free(struct ipq *qp)
    	kfree_s(qp->iph, qp->ihlen + 8);
  
    	/* Finally, release the queue descriptor itself. */
+   	ip_frag_mem -= sizeof(struct ipq) + qp->maclen + qp->ihlen + 8;
    	kfree_s(qp, sizeof(struct ipq));
 /*   	printk("ip_free:done\n");*/
    	sti();
@@ -652,8 +635,23 @@ static void ip_expire(unsigned long arg)
  				ICMP_EXC_FRAGTIME, qp->dev);
  
    	/* Nuke the fragment queue. */
+	ip_statistics.IpReasmFails++;
 	ip_free(qp);
 }
+
+
+/*
+ * Memory limiting on fragments.  Once the queues hold more than
+ * IPFRAG_HIGH_THRESH bytes, throw away the oldest datagrams until we
+ * are back under IPFRAG_LOW_THRESH.
+ */
+static void ip_evictor(void)
+{
+	while (ip_frag_mem > IPFRAG_LOW_THRESH && ipqueue != NULL) {
+		ip_statistics.IpReasmFails++;
+		ip_free(ipqueue);
+	}
+}
  
  
 /*
@@ -668,6 +666,7 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
   	struct ipq *qp;
   	int maclen;
   	int ihlen;
+  	int hash;
 
   	qp = (struct ipq *) kmalloc(sizeof(struct ipq), GFP_ATOMIC);
   	if (qp == NULL) 
@@ -705,6 +704,7 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
   	qp->ihlen = ihlen;
   	qp->maclen = maclen;
   	qp->fragments = NULL;
+  	qp->last = NULL;
   	qp->dev = dev;
 /*  	printk("Protocol = %d\n",qp->iph->protocol);*/
 	
@@ -714,13 +714,19 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
   	qp->timer.function = ip_expire;			/* expire function	*/
   	add_timer(&qp->timer);
 
-  	/* Add this entry to the queue. */
-  	qp->prev = NULL;
+  	/* Add this entry to the tail of the queue, and hash it. */
+  	hash = ipqhashfn(iph->id, iph->saddr, iph->daddr, iph->protocol);
+  	qp->next = NULL;
   	cli();
-  	qp->next = ipqueue;
-  	if (qp->next != NULL) 
-  		qp->next->prev = qp;
-  	ipqueue = qp;
+  	qp->prev = ipq_tail;
+  	if (ipq_tail != NULL) 
+  		ipq_tail->next = qp;
+  	else
+  		ipqueue = qp;
+  	ipq_tail = qp;
+  	qp->hnext = ipq_hash[hash];
+  	ipq_hash[hash] = qp;
+  	ip_frag_mem += sizeof(struct ipq) + maclen + ihlen + 8;
   	sti();
   	return(qp);
 }
@@ -755,61 +761,51 @@ static int ip_done(struct ipq *qp)
 /* Build a new IP datagram from all its fragments. */
 static struct sk_buff *ip_glue(struct ipq *qp)
 {
-	struct sk_buff *skb;
+	struct sk_buff *skb, *frag;
    	struct iphdr *iph;
    	struct ipfrag *fp;
-   	unsigned char *ptr;
-   	int count, len;
+   	int count;
  
-   	/* Allocate a new buffer for the datagram. */
-   	len = sizeof(struct sk_buff)+qp->maclen + qp->ihlen + qp->len;
-   	if ((skb = alloc_skb(len,GFP_ATOMIC)) == NULL) 
-   	{
- 		printk("IP: queue_glue: no memory for glueing queue 0x%X\n", (int) qp);
- 		ip_free(qp);
- 		return(NULL);
-   	}
- 
-   	/* Fill in the basic details. */
-   	skb->len = (len - qp->maclen);
-   	skb->h.raw = skb->data;
+   	/*
+   	 * The first fragment becomes the head of the datagram, keeping
+   	 * its own MAC and IP headers, and the others are chained on its
+   	 * fraglist as they stand instead of being copied into one big
+   	 * buffer. ip_done() has made sure the first one is at offset 0.
+   	 */
+   	fp = qp->fragments;
+   	skb = fp->skb;
+   	fp->skb = NULL;
+   	ip_frag_mem -= skb->mem_len;
+   	iph = skb->h.iph;
+   	skb->tail = fp->ptr + fp->len;
+   	skb->len = (fp->ptr - skb->h.raw) + fp->len;
+   	skb->fraglen = 0;
    	skb->free = 1;
+   	count = fp->len;
  
-   	/* Copy the original MAC and IP headers into the new buffer. */
-   	ptr = (unsigned char *) skb->h.raw;
-   	memcpy(ptr, ((unsigned char *) qp->mac), qp->maclen);
-/*   	printk("Copied %d bytes of mac header.\n",qp->maclen);*/
-   	ptr += qp->maclen;
-   	memcpy(ptr, ((unsigned char *) qp->iph), qp->ihlen);
-/*   	printk("Copied %d byte of ip header.\n",qp->ihlen);*/
-   	ptr += qp->ihlen;
-   	skb->h.raw += qp->maclen;
-   	
-/*   	printk("Protocol = %d\n",skb->h.iph->protocol);*/
-   	count = 0;
- 
-   	/* Copy the data portions of all fragments into the new buffer. */
-   	fp = qp->fragments;
-   	while(fp != NULL) 
+   	for (fp = fp->next; fp != NULL; fp = fp->next) 
    	{
-   		if(count+fp->len>skb->len)
+   		if(count+fp->len>qp->len)
    		{
    			printk("Invalid fragment list: Fragment over size.\n");
+   			ip_statistics.IpReasmFails++;
    			ip_free(qp);
-   			kfree_skb(skb,FREE_WRITE);
+   			kfree_skb(skb,FREE_READ);
    			return NULL;
    		}
-/*   		printk("Fragment %d size %d\n",fp->offset,fp->len);*/
- 		memcpy((ptr + fp->offset), fp->ptr, fp->len);
+ 		frag = fp->skb;
+ 		fp->skb = NULL;
+ 		ip_frag_mem -= frag->mem_len;
+ 		frag->h.raw = fp->ptr;
+ 		frag->len = fp->len;
+ 		skb_add_frag(skb, frag);
  		count += fp->len;
- 		fp = fp->next;
    	}
  
-   	/* We glued together all fragments, so remove the queue entry. */
+   	/* We took all the fragments, so remove the queue entry. */
    	ip_free(qp);
  
-   	/* Done with all fragments. Fixup the new IP header. */
-   	iph = skb->h.iph;
+   	/* Done with all fragments. Fixup the IP header. */
    	iph->frag_off = 0;
    	iph->tot_len = htons((iph->ihl * sizeof(unsigned long)) + count);
    	skb->ip_hdr = iph;
@@ -828,6 +824,10 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 	int flags, offset;
 	int i, ihl, end;
 
+	/* Start by making room if the queues hold too much already. */
+	if (ip_frag_mem > IPFRAG_HIGH_THRESH)
+		ip_evictor();
+
 	/* Find the entry of this IP datagram in the "incomplete datagrams" queue. */
    	qp = ip_find(iph);
  
@@ -841,6 +841,7 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
  		return(skb);
    	}
    	offset <<= 3;		/* offset is in 8-byte chunks */
+   	ip_statistics.IpReasmReqds++;
  
    	/*
     	 * If the queue already existed, keep restarting its timer as long
@@ -855,6 +856,7 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 		add_timer(&qp->timer);
 	} else {
 		if ((qp = ip_create(skb, iph, dev)) == NULL) {
+			ip_statistics.IpReasmFails++;
 			skb->sk = NULL;
 			kfree_skb(skb, FREE_READ);
 			return NULL;
@@ -877,12 +879,20 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
    	 * in the chain of fragments so far.  We must know where to put
    	 * this fragment, right?
    	 */
-   	prev = NULL;
-   	for(next = qp->fragments; next != NULL; next = next->next) 
+   	if (qp->last != NULL && qp->last->offset <= offset) 
+   	{
+   		prev = qp->last;	/* the usual case: in order */
+   		next = NULL;
+   	} 
+   	else 
    	{
- 		if (next->offset > offset) 
- 			break;	/* bingo! */
- 		prev = next;
+   		prev = NULL;
+   		for(next = qp->fragments; next != NULL; next = next->next) 
+   		{
+ 			if (next->offset > offset) 
+ 				break;	/* bingo! */
+ 			prev = next;
+   		}
    	}	
  
    	/*
@@ -924,9 +934,12 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
  		  	else 
  		  		qp->fragments = next->next;
  		
- 			if (tfp->next != NULL) 
- 				next->next->prev = next->prev;
+ 			if (tfp != NULL) 
+ 				tfp->prev = next->prev;
+ 			else
+ 				qp->last = next->prev;
  			
+ 			ip_frag_mem -= next->skb->mem_len + sizeof(struct ipfrag);
  			kfree_skb(next->skb, FREE_READ);
  			kfree_s(next, sizeof(struct ipfrag));
  		}
@@ -937,6 +950,7 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
    	tfp = NULL;
    	tfp = ip_frag_create(offset, end, skb, ptr);
    	if (!tfp) {
+   		ip_statistics.IpReasmFails++;
    		skb->sk = NULL;
    		kfree_skb(skb, FREE_READ);
    		return NULL;
@@ -950,6 +964,8 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
    
    	if (next != NULL) 
    		next->prev = tfp;
+   	else
+   		qp->last = tfp;
  
    	/*
     	 * OK, so we inserted this new fragment into the chain.
@@ -960,6 +976,8 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
    	if (ip_done(qp)) 
    	{
  		skb2 = ip_glue(qp);		/* glue together the fragments */
+ 		if (skb2 != NULL)
+ 			ip_statistics.IpReasmOKs++;
  		return(skb2);
    	}
    	return(NULL);
@@ -1079,8 +1097,38 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 
 #ifdef CONFIG_IP_FORWARD
 
-/* Forward an IP datagram to its next destination. */
+/*
+ * Take one off the TTL.  Only that byte of the header changes, so the
+ * checksum is adjusted to match (RFC 1141) instead of being redone.
+ */
+static inline void
+ip_decrease_ttl(struct iphdr *iph)
+{
+  unsigned long check = iph->check;
+
+  check += htons(0x0100);
+  iph->check = check + (check >= 0xFFFF);
+  iph->ttl--;
+}
+
+/* Hand a forwarded datagram to the device at the priority its TOS asks for. */
 static void
+ip_forward_queue(struct sk_buff *skb, struct device *dev, struct iphdr *iph)
+{
+  ip_statistics.IpForwDatagrams++;
+  if(iph->tos & IPTOS_LOWDELAY)
+	dev->queue_xmit(skb, dev, SOPRI_INTERACTIVE);
+  else if(iph->tos & IPTOS_THROUGHPUT)
+	dev->queue_xmit(skb, dev, SOPRI_BACKGROUND);
+  else
+	dev->queue_xmit(skb, dev, SOPRI_NORMAL);
+}
+
+/*
+ * Forward an IP datagram to its next destination.  Returns 1 if the
+ * buffer was passed on as it stands and must not be freed by the caller.
+ */
+static int
 ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
 {
   struct device *dev2;
@@ -1098,8 +1146,20 @@ ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
   if(dev->flags&IFF_PROMISC)
   {
   	if(memcmp((char *)&skb[1],dev->dev_addr,dev->addr_len))
-  		return;
+  		return(0);
   }
+
+#ifdef CONFIG_IP_FIREWALL
+  switch(ip_fw_chk(skb->h.iph, skb->len, IP_FW_FWD)) {
+	case IP_FW_ACCEPT:
+		break;
+	case IP_FW_REJECT:
+		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_HOST_UNREACH, dev);
+		/* fall through */
+	default:
+		return(0);
+  }
+#endif
   
   /*
    * According to the RFC, we must first decrease the TTL field. If
@@ -1107,19 +1167,16 @@ ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
    * that the packet's lifetime expired.
    */
   iph = skb->h.iph;
-  iph->ttl--;
-  if (iph->ttl <= 0) {
+  if (iph->ttl <= 1) {
 	DPRINTF((DBG_IP, "\nIP: *** datagram expired: TTL=0 (ignored) ***\n"));
 	DPRINTF((DBG_IP, "    SRC = %s   ", in_ntoa(iph->saddr)));
 	DPRINTF((DBG_IP, "    DST = %s (ignored)\n", in_ntoa(iph->daddr)));
 
 	/* Tell the sender its packet died... */
 	icmp_send(skb, ICMP_TIME_EXCEEDED, ICMP_EXC_TTL, dev);
-	return;
+	return(0);
   }
-
-  /* Re-compute the IP header checksum. */
-  ip_send_check(iph);
+  ip_decrease_ttl(iph);
 
   /*
    * OK, the packet is still valid.  Fetch its destination address,
@@ -1131,7 +1188,7 @@ ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
 
 	/* Tell the sender its packet cannot be delivered... */
 	icmp_send(skb, ICMP_DEST_UNREACH, ICMP_NET_UNREACH, dev);
-	return;
+	return(0);
   }
 
 
@@ -1150,7 +1207,7 @@ ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
 
 		/* Tell the sender its packet cannot be delivered... */
 		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_HOST_UNREACH, dev);
-		return;
+		return(0);
 	}
 	if (rt->rt_gateway != 0) raddr = rt->rt_gateway;
   } else raddr = iph->daddr;
@@ -1158,52 +1215,94 @@ ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
 
 
   if (dev == dev2)
-	return;
+	return(0);
   /*
-   * We now allocate a new buffer, and copy the datagram into it.
+   * We now pass the datagram on, in the buffer it came in if we can.
    * If the indicated interface is up and running, kick it.
    */
   DPRINTF((DBG_IP, "\nIP: *** fwd %s -> ", in_ntoa(iph->saddr)));
   DPRINTF((DBG_IP, "%s (via %s), LEN=%d\n",
 			in_ntoa(raddr), dev2->name, skb->len));
 
-  if (dev2->flags & IFF_UP) {
-	skb2 = (struct sk_buff *) alloc_skb(sizeof(struct sk_buff) +
-		       dev2->hard_header_len + skb->len, GFP_ATOMIC);
+  if (!(dev2->flags & IFF_UP))
+	return(0);
+
+  /*
+   * The usual case, ethernet to ethernet: the new MAC header goes just
+   * where the old one was, and the datagram leaves in the buffer it
+   * arrived in, without being copied.
+   */
+  if (skb->h.raw == skb->data + dev2->hard_header_len &&
+      skb->fraglist == NULL && skb->len + dev2->hard_header_len <= dev2->mtu) {
+	skb->sk = NULL;
+	skb->free = 1;
+	skb->next = NULL;
+	(void) ip_send(skb, raddr, skb->len, dev2, dev2->pa_addr);
+	skb->len += dev2->hard_header_len;
+	ip_statistics.IpForwInPlace++;
+	ip_forward_queue(skb, dev2, iph);
+	return(1);
+  }
+
+  /*
+   * A driver that can gather gets the datagram as it stands, hung
+   * off a buffer holding just the new MAC header.
+   */
+  if (dev2->gather && skb->len + dev2->hard_header_len <= dev2->mtu) {
+	skb2 = alloc_skb(sizeof(struct sk_buff) + dev2->hard_header_len,
+			 GFP_ATOMIC);
 	if (skb2 == NULL) {
 		printk("\nIP: No memory available for IP forward\n");
-		return;
+		return(0);
 	}
-	ptr = skb2->data;
 	skb2->sk = NULL;
 	skb2->free = 1;
-	skb2->len = skb->len + dev2->hard_header_len;
-	skb2->mem_addr = skb2;
-	skb2->mem_len = sizeof(struct sk_buff) + skb2->len;
+	skb2->len = dev2->hard_header_len;
 	skb2->next = NULL;
-	skb2->h.raw = ptr;
+	skb2->h.raw = skb2->data;
+	skb2->tail = skb2->data + dev2->hard_header_len;
+	skb->sk = NULL;
+	skb->free = 1;
+	skb_add_frag(skb2, skb);
 
-	/* Copy the packet data into the new buffer. */
-	memcpy(ptr + dev2->hard_header_len, skb->h.raw, skb->len);
-		
-	/* Now build the MAC header. */
 	(void) ip_send(skb2, raddr, skb->len, dev2, dev2->pa_addr);
+	ip_forward_queue(skb2, dev2, iph);
+	return(1);
+  }
 
-	if(skb2->len > dev2->mtu)
-	{
-		ip_fragment(NULL,skb2,dev2, is_frag);
-		kfree_skb(skb2,FREE_WRITE);
-	}
-	else
-	{
-		if(iph->tos & IPTOS_LOWDELAY)
-			dev2->queue_xmit(skb2, dev2, SOPRI_INTERACTIVE);
-		else if(iph->tos & IPTOS_THROUGHPUT)
-			dev2->queue_xmit(skb2, dev2, SOPRI_BACKGROUND);
-		else
-			dev2->queue_xmit(skb2, dev2, SOPRI_NORMAL);
-	}
+  /*
+   * Otherwise allocate a new buffer and copy the datagram into it.
+   */
+  skb2 = (struct sk_buff *) alloc_skb(sizeof(struct sk_buff) +
+		       dev2->hard_header_len + skb->len, GFP_ATOMIC);
+  if (skb2 == NULL) {
+	printk("\nIP: No memory available for IP forward\n");
+	return(0);
   }
+  ptr = skb2->data;
+  skb2->sk = NULL;
+  skb2->free = 1;
+  skb2->len = skb->len + dev2->hard_header_len;
+  skb2->mem_addr = skb2;
+  skb2->mem_len = sizeof(struct sk_buff) + skb2->len;
+  skb2->next = NULL;
+  skb2->h.raw = ptr;
+
+  /* Copy the packet data into the new buffer. */
+  memcpy(ptr + dev2->hard_header_len, skb->h.raw, skb->len);
+		
+  /* Now build the MAC header. */
+  (void) ip_send(skb2, raddr, skb->len, dev2, dev2->pa_addr);
+
+  if(skb2->len > dev2->mtu)
+  {
+	ip_statistics.IpForwDatagrams++;
+	ip_fragment(NULL,skb2,dev2, is_frag);
+	kfree_skb(skb2,FREE_WRITE);
+  }
+  else
+	ip_forward_queue(skb2, dev2, iph);
+  return(0);
 }
 
 
@@ -1235,6 +1334,21 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 	kfree_skb(skb, FREE_WRITE);
 	return(0);
   }
+
+#ifdef CONFIG_IP_FIREWALL
+  switch(ip_fw_chk(iph, skb->len, IP_FW_IN)) {
+	case IP_FW_ACCEPT:
+		break;
+	case IP_FW_REJECT:
+		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_HOST_UNREACH, dev);
+		/* fall through */
+	default:
+		skb->sk = NULL;
+		kfree_skb(skb, FREE_WRITE);
+		return(0);
+  }
+  ip_fw_acct(iph, skb->len);
+#endif
   
   if (iph->ihl != 5) {  	/* Fast path for the typical optionless IP packet. */
       ip_print(iph);		/* Bogus, only for debugging. */
@@ -1252,7 +1366,8 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
   /* Do any IP forwarding required.  chk_addr() is expensive -- avoid it someday. */
   if ((brd = chk_addr(iph->daddr)) == 0) {
 #ifdef CONFIG_IP_FORWARD
-	ip_forward(skb, dev, is_frag);
+	if (ip_forward(skb, dev, is_frag))
+		return(0);
 #else
 	printk("Machine %x tried to use us as a forwarder to %x but we have forwarding disabled!\n",
 			iph->saddr,iph->daddr);
@@ -1288,6 +1403,14 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 
 
 
+  /* A group we haven't joined on this interface isn't for us. */
+  if (brd == IS_MULTICAST && iph->daddr != IGMP_ALL_HOSTS &&
+      !(dev->flags & IFF_LOOPBACK) && !ip_mc_member(dev, iph->daddr)) {
+	skb->sk = NULL;
+	kfree_skb(skb, FREE_WRITE);
+	return(0);
+  }
+
   if(brd==IS_INVBCAST)
   {
 /*	printk("Invalid broadcast address from %x [target %x] (Probably they have a wrong netmask)\n",
@@ -1297,11 +1420,30 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
   	return(0);
   }
   
+  hash = iph->protocol & (MAX_INET_PROTOS -1);
+
+  /*
+   * A reassembled datagram is still a chain of its fragments.  Only a
+   * protocol with a frag_handler, and no one else to share it with,
+   * can take it like that.  Everybody else gets it flattened.
+   */
+  if (skb->fraglist != NULL) {
+	for (ipprot = (struct inet_protocol *)inet_protos[hash];
+	     ipprot != NULL && ipprot->protocol != iph->protocol;
+	     ipprot = (struct inet_protocol *)ipprot->next)
+		;
+	if (ipprot == NULL || ipprot->copy || ipprot->frag_handler == NULL) {
+		skb = skb_linearize(skb, GFP_ATOMIC);
+		if (skb == NULL)
+			return(0);
+		iph = skb->h.iph;
+	}
+  }
+
   /* Point into the IP datagram, just past the header. */
 
   skb->ip_hdr = iph;
   skb->h.raw += iph->ihl*4;
-  hash = iph->protocol & (MAX_INET_PROTOS -1);
   for (ipprot = (struct inet_protocol *)inet_protos[hash];
        ipprot != NULL;
        ipprot=(struct inet_protocol *)ipprot->next)
@@ -1342,7 +1484,8 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 	* based on the datagram protocol.  We should really
 	* check the protocol handler's return values here...
 	*/
-	ipprot->handler(skb2, dev, opts_p ? &opt : 0, iph->daddr,
+	(skb2->fraglist ? ipprot->frag_handler : ipprot->handler)
+			(skb2, dev, opts_p ? &opt : 0, iph->daddr,
 			(ntohs(iph->tot_len) - (iph->ihl * 4)),
 			iph->saddr, 0, ipprot);
 
@@ -1355,7 +1498,7 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
    * ICMP reply messages get queued up for transmission...)
    */
   if (!flag) {
-	if (brd != IS_BROADCAST)
+	if (brd != IS_BROADCAST && brd != IS_MULTICAST)
 		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_PROT_UNREACH, dev);
 	skb->sk = NULL;
 	kfree_skb(skb, FREE_WRITE);
@@ -1365,6 +1508,23 @@ ip_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 }
 
 
+/*
+ * Hand a copy of an outgoing multicast back to ourselves, as if it had
+ * come in off the wire.
+ */
+static void
+ip_mc_loopback(struct device *dev, struct sk_buff *skb)
+{
+  struct sk_buff *newskb;
+
+  newskb = skb_copy(skb, GFP_ATOMIC);
+  if (newskb == NULL)
+	return;
+  newskb->dev = dev;
+  netif_rx(newskb);
+}
+
+
 /*
  * Queues a packet to be sent, and starts the transmitter
  * if necessary.  if free = 1 then we free the block after
@@ -1409,6 +1569,11 @@ ip_queue_xmit(struct sock *sk, struct device *dev,
   ip_print(iph);
   skb->next = NULL;
 
+  /* Members of the group on this host hear it too, unless told not to. */
+  if (sk != NULL && sk->ip_mc_loop && IN_MULTICAST(ntohl(iph->daddr)) &&
+      !(dev->flags & IFF_LOOPBACK) && ip_mc_member(dev, iph->daddr))
+	ip_mc_loopback(dev, skb);
+
   /* See if this is the one trashing our queue. Ross? */
   skb->magic = 1;
   if (!free) {
@@ -1434,6 +1599,15 @@ ip_queue_xmit(struct sock *sk, struct device *dev,
 	skb->sk = sk;
   }
 
+#ifdef CONFIG_IP_FIREWALL
+  /* A datagram the output chain refuses stays queued for a retransmit. */
+  if (ip_fw_chk(iph, skb->len - dev->hard_header_len, IP_FW_OUT) != IP_FW_ACCEPT) {
+	if (free) kfree_skb(skb, FREE_WRITE);
+	return;
+  }
+  ip_fw_acct(iph, skb->len - dev->hard_header_len);
+#endif
+
   /* If the indicated interface is up and running, kick it. */
   if (dev->flags & IFF_UP) {
 	if (sk != NULL) {
@@ -1492,12 +1666,18 @@ ip_do_retransmit(struct sock *sk, int all)
 
 	/* If the interface is (still) up and running, kick it. */
 	if (dev->flags & IFF_UP) {
+#ifdef CONFIG_IP_FIREWALL
+		if (ip_fw_chk(skb->ip_hdr, skb->len - dev->hard_header_len,
+			      IP_FW_OUT) != IP_FW_ACCEPT)
+			goto oops;
+#endif
 		if (sk && !skb_device_locked(skb))
 			dev->queue_xmit(skb, dev, sk->priority);
 	/*	  else dev->queue_xmit(skb, dev, SOPRI_NORMAL ); CANNOT HAVE SK=NULL HERE */
 	}
 
 oops:	retransmits++;
+	sk->retrans_segs++;
 	sk->prot->retransmits ++;
 	if (!all) break;
 
@@ -1538,6 +1718,26 @@ ip_retransmit(struct sock *sk, int all)
   reset_timer(sk, TIME_WRITE, sk->rto);
 }
 
+/*
+ *	The interface a multicast option names by its address.  INADDR_ANY
+ *	means whichever one the group is routed out of.
+ */
+
+static struct device *ip_mc_find_dev(unsigned long ifaddr, unsigned long group)
+{
+	struct device *dev;
+	struct rtable *rt;
+
+	if (ifaddr == INADDR_ANY) {
+		rt = rt_route(group, NULL);
+		return rt ? rt->rt_dev : NULL;
+	}
+	for (dev = dev_base; dev != NULL; dev = dev->next)
+		if ((dev->flags & IFF_UP) && dev->pa_addr == ifaddr)
+			return dev;
+	return NULL;
+}
+
 /*
  *	Socket option code for IP. This is the end of the line after any TCP,UDP etc options on
  *	an IP socket.
@@ -1546,6 +1746,8 @@ ip_retransmit(struct sock *sk, int all)
 int ip_setsockopt(struct sock *sk, int level, int optname, char *optval, int optlen)
 {
 	int val,err;
+	struct ip_mreq mreq;
+	struct device *dev;
 	
   	if (optval == NULL) 
   		return(-EINVAL);
@@ -1571,6 +1773,54 @@ int ip_setsockopt(struct sock *sk, int level, int optname, char *optval, int opt
 				return -EINVAL;
 			sk->ip_ttl=val;
 			return 0;
+		/* BSD passes these two as a single byte. */
+		case IP_MULTICAST_TTL:
+			if(optlen<sizeof(int))
+				val=get_fs_byte(optval);
+			if(val<0||val>255)
+				return -EINVAL;
+			sk->ip_mc_ttl=val;
+			return 0;
+		case IP_MULTICAST_LOOP:
+			if(optlen<sizeof(int))
+				val=get_fs_byte(optval);
+			sk->ip_mc_loop=(val!=0);
+			return 0;
+		case IP_MULTICAST_IF:
+			if(val==INADDR_ANY)
+			{
+				sk->ip_mc_dev=NULL;
+				return 0;
+			}
+			dev=ip_mc_find_dev(val, 0);
+			if(dev==NULL)
+				return -EADDRNOTAVAIL;
+			sk->ip_mc_dev=dev;
+			return 0;
+		case IP_ADD_MEMBERSHIP:
+		case IP_DROP_MEMBERSHIP:
+			err=verify_area(VERIFY_READ, optval, sizeof(mreq));
+			if(err)
+				return err;
+			memcpy_fromfs(&mreq, optval, sizeof(mreq));
+			dev=ip_mc_find_dev(mreq.imr_interface.s_addr, mreq.imr_multiaddr.s_addr);
+			if(dev==NULL)
+				return -ENODEV;
+			if(optname==IP_ADD_MEMBERSHIP)
+				return ip_mc_join_group(sk, dev, mreq.imr_multiaddr.s_addr);
+			return ip_mc_leave_group(sk, dev, mreq.imr_multiaddr.s_addr);
+#ifdef CONFIG_IP_FIREWALL
+		case IP_FW_APPEND:
+		case IP_FW_DELETE:
+		case IP_FW_FLUSH:
+		case IP_FW_ZERO:
+		case IP_FW_POLICY:
+			if(sk->type!=SOCK_RAW)
+				return -EOPNOTSUPP;
+			if(!suser())
+				return -EPERM;
+			return ip_fw_ctl(optname, optval, optlen);
+#endif
 		/* IP_OPTIONS and friends go here eventually */
 		default:
 			return(-ENOPROTOOPT);
@@ -1592,6 +1842,15 @@ int ip_getsockopt(struct sock *sk, int level, int optname, char *optval, int *op
 		case IP_TTL:
 			val=sk->ip_ttl;
 			break;
+		case IP_MULTICAST_TTL:
+			val=sk->ip_mc_ttl;
+			break;
+		case IP_MULTICAST_LOOP:
+			val=sk->ip_mc_loop;
+			break;
+		case IP_MULTICAST_IF:
+			val=sk->ip_mc_dev ? sk->ip_mc_dev->pa_addr : INADDR_ANY;
+			break;
 		default:
 			return(-ENOPROTOOPT);
 	}
@@ -1607,3 +1866,28 @@ int ip_getsockopt(struct sock *sk, int level, int optname, char *optval, int *op
 
   	return(0);
 }
+
+
+/*
+ * Report the MIB-II counters for /proc/net/snmp, a line of names
+ * followed by a line of values.  ReasmTimeout is the fragment lifetime
+ * in seconds, as RFC 1213 defines it, not a count.
+ */
+int snmp_get_info(char *buffer)
+{
+	return sprintf(buffer,
+		"Ip: ForwDatagrams ReasmTimeout ReasmReqds ReasmOKs ReasmFails"
+		" ForwInPlace\n"
+		"Ip: %lu %d %lu %lu %lu %lu\n"
+		"Tcp: PassiveOpens AttemptFails ListenOverflows ListenDrops"
+		" OutAcks DelayedAcks PiggyAcks\n"
+		"Tcp: %lu %lu %lu %lu %lu %lu %lu\n",
+		ip_statistics.IpForwDatagrams,
+		IP_FRAG_TIME / HZ, ip_statistics.IpReasmReqds,
+		ip_statistics.IpReasmOKs, ip_statistics.IpReasmFails,
+		ip_statistics.IpForwInPlace,
+		tcp_statistics.TcpPassiveOpens, tcp_statistics.TcpAttemptFails,
+		tcp_statistics.TcpListenOverflows, tcp_statistics.TcpListenDrops,
+		tcp_statistics.TcpOutAcks, tcp_statistics.TcpDelayedAcks,
+		tcp_statistics.TcpPiggyAcks);
+}
@@ -31,6 +31,9 @@
 #define IP_OFFSET	0x1FFF		/* "Fragment Offset" part	*/
 
 #define IP_FRAG_TIME	(30 * HZ)		/* fragment lifetime	*/
+#define IPQ_HASHSZ	64			/* reassembly hash size	*/
+#define IPFRAG_HIGH_THRESH (256*1024)		/* start evicting queues */
+#define IPFRAG_LOW_THRESH  (192*1024)		/* ... down to this	*/
 
 
 /* Describe an IP fragment. */
@@ -53,8 +56,10 @@ struct ipq	 {
   short 	maclen;		/* length of the MAC header		*/
   struct timer_list timer;	/* when will this queue expire?		*/
   struct ipfrag		*fragments;	/* linked list of received fragments	*/
-  struct ipq	*next;		/* linked list pointers			*/
+  struct ipfrag		*last;		/* and its tail, for in-order arrival	*/
+  struct ipq	*next;		/* list of all queues, oldest first	*/
   struct ipq	*prev;
+  struct ipq	*hnext;		/* hash chain				*/
   struct device *dev;		/* Device - for icmp replies */
 };
 
@@ -72,6 +77,7 @@ extern int		ip_build_header(struct sk_buff *skb,
 					struct options *opt, int len,
 					int tos,int ttl);
 extern unsigned short	ip_compute_csum(unsigned char * buff, int len);
+extern void		ip_send_check(struct iphdr *ip);
 extern int		ip_rcv(struct sk_buff *skb, struct device *dev,
 			       struct packet_type *pt);
 extern void		ip_queue_xmit(struct sock *sk,
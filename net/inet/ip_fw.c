@@ -0,0 +1,410 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		The IP packet filter and accounting rules.
+ *
+ *		A chain is a list of rules; the first that matches decides
+ *		a datagram's fate, or the chain's policy does if none do.
+ *		The accounting chain decides nothing, and counts every
+ *		rule that matches.  So that a long chain doesn't have to
+ *		be walked for every datagram, each is compiled into three
+ *		lookup lists whenever it changes: rules for one source
+ *		host, hashed on it, rules for one destination host, hashed
+ *		on that, and the rest.  A datagram only tries the two
+ *		buckets its addresses pick and the rest, and the rule
+ *		numbers say which of those matches came first.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#include <linux/config.h>
+#include <asm/segment.h>
+#include <asm/system.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/socket.h>
+#include <linux/in.h>
+#include "inet.h"
+#include "dev.h"
+#include "ip.h"
+#include "skbuff.h"
+#include "sock.h"
+#include "ip_fw.h"
+
+#ifdef CONFIG_IP_FIREWALL
+
+#define IP_FW_HSIZE	64		/* must be a power of two */
+
+/* A rule as the kernel keeps it. */
+struct ip_fw_rule {
+  struct ip_fw_rule	*next;		/* in the order they were given	*/
+  struct ip_fw_rule	*hnext;		/* on its lookup list		*/
+  int			index;		/* place in the chain		*/
+  struct ip_fw		fw;
+};
+
+struct ip_fw_chain {
+  struct ip_fw_rule	*rules;
+  unsigned short	policy;		/* IP_FW_F_ACCEPT, IP_FW_F_ICMPRPL */
+  struct ip_fw_rule	*wild;		/* neither address is one host	*/
+  struct ip_fw_rule	*shash[IP_FW_HSIZE];	/* one source host	*/
+  struct ip_fw_rule	*dhash[IP_FW_HSIZE];	/* one destination host	*/
+};
+
+static struct ip_fw_chain ip_fw_chains[IP_FW_CHAINS] = {
+  { NULL, IP_FW_F_ACCEPT },
+  { NULL, IP_FW_F_ACCEPT },
+  { NULL, IP_FW_F_ACCEPT },
+  { NULL, IP_FW_F_ACCEPT }
+};
+
+static char *ip_fw_names[IP_FW_CHAINS] = { "input", "forward", "output", "acct" };
+
+
+static inline unsigned int
+ip_fw_hash(unsigned long addr)
+{
+  addr ^= addr >> 16;
+  addr ^= addr >> 8;
+  return(addr & (IP_FW_HSIZE - 1));
+}
+
+
+/* Add a rule to the end of a lookup list, keeping them in chain order. */
+static void
+ip_fw_list_add(struct ip_fw_rule **list, struct ip_fw_rule *r)
+{
+  while (*list != NULL)
+	list = &(*list)->hnext;
+  r->hnext = NULL;
+  *list = r;
+}
+
+
+/* Rebuild the lookup lists after a change.  Called with interrupts off. */
+static void
+ip_fw_compile(struct ip_fw_chain *c)
+{
+  struct ip_fw_rule *r;
+  int index = 0;
+
+  c->wild = NULL;
+  memset(c->shash, 0, sizeof(c->shash));
+  memset(c->dhash, 0, sizeof(c->dhash));
+  for (r = c->rules; r != NULL; r = r->next) {
+	r->index = index++;
+	if (r->fw.fw_smsk.s_addr == 0xffffffff)
+		ip_fw_list_add(&c->shash[ip_fw_hash(r->fw.fw_src.s_addr)], r);
+	else if (r->fw.fw_dmsk.s_addr == 0xffffffff)
+		ip_fw_list_add(&c->dhash[ip_fw_hash(r->fw.fw_dst.s_addr)], r);
+	else
+		ip_fw_list_add(&c->wild, r);
+  }
+}
+
+
+static int
+ip_fw_match(struct ip_fw *f, struct iphdr *iph, int ports,
+	    unsigned short sport, unsigned short dport)
+{
+  if ((iph->saddr & f->fw_smsk.s_addr) != f->fw_src.s_addr ||
+      (iph->daddr & f->fw_dmsk.s_addr) != f->fw_dst.s_addr)
+	return(0);
+  switch(f->fw_flg & IP_FW_F_KIND) {
+	case IP_FW_F_ALL:
+		return(1);
+	case IP_FW_F_TCP:
+		if (iph->protocol != IPPROTO_TCP)
+			return(0);
+		break;
+	case IP_FW_F_UDP:
+		if (iph->protocol != IPPROTO_UDP)
+			return(0);
+		break;
+	case IP_FW_F_ICMP:
+		if (iph->protocol != IPPROTO_ICMP)
+			return(0);
+		break;
+  }
+  /* A later fragment has no ports, so only port-less rules can match it. */
+  if (!ports)
+	return(f->fw_sport[0] == 0 && f->fw_sport[1] == 0xffff &&
+	       f->fw_dport[0] == 0 && f->fw_dport[1] == 0xffff);
+  return(sport >= f->fw_sport[0] && sport <= f->fw_sport[1] &&
+	 dport >= f->fw_dport[0] && dport <= f->fw_dport[1]);
+}
+
+
+/*
+ * Find the ports, or ICMP type and code, of a datagram.  len is how many
+ * bytes of it, from the IP header on, we have.
+ */
+static int
+ip_fw_ports(struct iphdr *iph, int len, unsigned short *sport, unsigned short *dport)
+{
+  unsigned char *th = (unsigned char *) iph + iph->ihl * 4;
+
+  *sport = *dport = 0;
+  if (ntohs(iph->frag_off) & 0x1fff)
+	return(0);
+  switch(iph->protocol) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+		if (iph->ihl * 4 + 4 > len)
+			return(0);
+		*sport = ntohs(((unsigned short *) th)[0]);
+		*dport = ntohs(((unsigned short *) th)[1]);
+		return(1);
+	case IPPROTO_ICMP:
+		if (iph->ihl * 4 + 2 > len)
+			return(0);
+		*sport = th[0];
+		*dport = th[1];
+		return(1);
+  }
+  return(1);
+}
+
+
+/* The first rule on a list that matches and comes before limit. */
+static struct ip_fw_rule *
+ip_fw_first(struct ip_fw_rule *r, int limit, struct iphdr *iph, int ports,
+	    unsigned short sport, unsigned short dport)
+{
+  for (; r != NULL && r->index < limit; r = r->hnext) {
+	if (ip_fw_match(&r->fw, iph, ports, sport, dport))
+		return(r);
+  }
+  return(NULL);
+}
+
+
+static void
+ip_fw_count(struct ip_fw_rule *r, struct iphdr *iph, char *chain)
+{
+  r->fw.fw_pcnt++;
+  r->fw.fw_bcnt += ntohs(iph->tot_len);
+  if (r->fw.fw_flg & IP_FW_F_PRN) {
+	printk("ip_fw: %s rule %d proto %d %s", chain, r->index,
+		iph->protocol, in_ntoa(iph->saddr));
+	printk(" -> %s\n", in_ntoa(iph->daddr));
+  }
+}
+
+
+/* What the chain says about a datagram: IP_FW_ACCEPT, _BLOCK or _REJECT. */
+int
+ip_fw_chk(struct iphdr *iph, int len, int chain)
+{
+  struct ip_fw_chain *c = &ip_fw_chains[chain];
+  struct ip_fw_rule *r, *best;
+  unsigned short sport, dport, flg;
+  int ports;
+
+  if (c->rules == NULL)
+	return((c->policy & IP_FW_F_ACCEPT) ? IP_FW_ACCEPT : IP_FW_BLOCK);
+  ports = ip_fw_ports(iph, len, &sport, &dport);
+  best = ip_fw_first(c->shash[ip_fw_hash(iph->saddr)], 0x7fffffff,
+		     iph, ports, sport, dport);
+  r = ip_fw_first(c->dhash[ip_fw_hash(iph->daddr)],
+		  best ? best->index : 0x7fffffff, iph, ports, sport, dport);
+  if (r != NULL)
+	best = r;
+  r = ip_fw_first(c->wild, best ? best->index : 0x7fffffff,
+		  iph, ports, sport, dport);
+  if (r != NULL)
+	best = r;
+
+  if (best != NULL) {
+	ip_fw_count(best, iph, ip_fw_names[chain]);
+	flg = best->fw.fw_flg;
+  } else
+	flg = c->policy;
+  if (flg & IP_FW_F_ACCEPT)
+	return(IP_FW_ACCEPT);
+  return((flg & IP_FW_F_ICMPRPL) ? IP_FW_REJECT : IP_FW_BLOCK);
+}
+
+
+/* Count a datagram against every accounting rule it matches. */
+void
+ip_fw_acct(struct iphdr *iph, int len)
+{
+  struct ip_fw_chain *c = &ip_fw_chains[IP_FW_ACCT];
+  struct ip_fw_rule *r;
+  unsigned short sport, dport;
+  int ports;
+
+  if (c->rules == NULL)
+	return;
+  ports = ip_fw_ports(iph, len, &sport, &dport);
+  for (r = c->shash[ip_fw_hash(iph->saddr)]; r != NULL; r = r->hnext)
+	if (ip_fw_match(&r->fw, iph, ports, sport, dport))
+		ip_fw_count(r, iph, "acct");
+  for (r = c->dhash[ip_fw_hash(iph->daddr)]; r != NULL; r = r->hnext)
+	if (ip_fw_match(&r->fw, iph, ports, sport, dport))
+		ip_fw_count(r, iph, "acct");
+  for (r = c->wild; r != NULL; r = r->hnext)
+	if (ip_fw_match(&r->fw, iph, ports, sport, dport))
+		ip_fw_count(r, iph, "acct");
+}
+
+
+/* Put a rule from the user in the form the lookups expect. */
+static int
+ip_fw_check_rule(struct ip_fw *f)
+{
+  if (f->fw_flg & ~IP_FW_F_MASK)
+	return(-EINVAL);
+  f->fw_src.s_addr &= f->fw_smsk.s_addr;
+  f->fw_dst.s_addr &= f->fw_dmsk.s_addr;
+  if (f->fw_sport[0] == 0 && f->fw_sport[1] == 0)
+	f->fw_sport[1] = 0xffff;
+  if (f->fw_dport[0] == 0 && f->fw_dport[1] == 0)
+	f->fw_dport[1] = 0xffff;
+  if (f->fw_sport[0] > f->fw_sport[1] || f->fw_dport[0] > f->fw_dport[1])
+	return(-EINVAL);
+  f->fw_pcnt = f->fw_bcnt = 0;
+  return(0);
+}
+
+
+/* Two rules are the same if they match the same datagrams the same way. */
+static int
+ip_fw_same(struct ip_fw *a, struct ip_fw *b)
+{
+  return(a->fw_src.s_addr == b->fw_src.s_addr &&
+	 a->fw_smsk.s_addr == b->fw_smsk.s_addr &&
+	 a->fw_dst.s_addr == b->fw_dst.s_addr &&
+	 a->fw_dmsk.s_addr == b->fw_dmsk.s_addr &&
+	 a->fw_flg == b->fw_flg &&
+	 a->fw_sport[0] == b->fw_sport[0] && a->fw_sport[1] == b->fw_sport[1] &&
+	 a->fw_dport[0] == b->fw_dport[0] && a->fw_dport[1] == b->fw_dport[1]);
+}
+
+
+/* setsockopt() on a raw socket; ip_setsockopt() checks who is asking. */
+int
+ip_fw_ctl(int optname, char *optval, int optlen)
+{
+  struct ip_fwctl ctl;
+  struct ip_fw_chain *c;
+  struct ip_fw_rule *r, **rp;
+  unsigned long flags;
+  int err;
+
+  if (optlen < sizeof(ctl))
+	return(-EINVAL);
+  err = verify_area(VERIFY_READ, optval, sizeof(ctl));
+  if (err)
+	return(err);
+  memcpy_fromfs(&ctl, optval, sizeof(ctl));
+  if (ctl.fwc_chain < 0 || ctl.fwc_chain >= IP_FW_CHAINS)
+	return(-EINVAL);
+  c = &ip_fw_chains[ctl.fwc_chain];
+
+  switch(optname) {
+	case IP_FW_APPEND:
+		err = ip_fw_check_rule(&ctl.fwc_rule);
+		if (err)
+			return(err);
+		r = (struct ip_fw_rule *) kmalloc(sizeof(*r), GFP_KERNEL);
+		if (r == NULL)
+			return(-ENOMEM);
+		r->next = NULL;
+		r->fw = ctl.fwc_rule;
+		save_flags(flags);
+		cli();
+		for (rp = &c->rules; *rp != NULL; rp = &(*rp)->next)
+			;
+		*rp = r;
+		ip_fw_compile(c);
+		restore_flags(flags);
+		return(0);
+
+	case IP_FW_DELETE:
+		err = ip_fw_check_rule(&ctl.fwc_rule);
+		if (err)
+			return(err);
+		save_flags(flags);
+		cli();
+		for (rp = &c->rules; (r = *rp) != NULL; rp = &r->next) {
+			if (ip_fw_same(&r->fw, &ctl.fwc_rule)) {
+				*rp = r->next;
+				ip_fw_compile(c);
+				restore_flags(flags);
+				kfree_s(r, sizeof(*r));
+				return(0);
+			}
+		}
+		restore_flags(flags);
+		return(-ENOENT);
+
+	case IP_FW_FLUSH:
+		save_flags(flags);
+		cli();
+		r = c->rules;
+		c->rules = NULL;
+		ip_fw_compile(c);
+		restore_flags(flags);
+		while (r != NULL) {
+			struct ip_fw_rule *next = r->next;
+
+			kfree_s(r, sizeof(*r));
+			r = next;
+		}
+		return(0);
+
+	case IP_FW_ZERO:
+		save_flags(flags);
+		cli();
+		for (r = c->rules; r != NULL; r = r->next)
+			r->fw.fw_pcnt = r->fw.fw_bcnt = 0;
+		restore_flags(flags);
+		return(0);
+
+	case IP_FW_POLICY:
+		if (ctl.fwc_rule.fw_flg & ~(IP_FW_F_ACCEPT | IP_FW_F_ICMPRPL))
+			return(-EINVAL);
+		c->policy = ctl.fwc_rule.fw_flg;
+		return(0);
+  }
+  return(-ENOPROTOOPT);
+}
+
+
+/* /proc/net/ip_input and friends: the policy, then a line per rule. */
+int
+ip_fw_get_info(char *buffer, int chain)
+{
+  struct ip_fw_chain *c = &ip_fw_chains[chain];
+  struct ip_fw_rule *r;
+  unsigned long flags;
+  int len;
+
+  len = sprintf(buffer, "IP %s chain, policy %04X\n"
+	"Src/Mask          Dst/Mask          Flg  SPorts      DPorts      Pkts     Bytes\n",
+	ip_fw_names[chain], c->policy);
+  save_flags(flags);
+  cli();
+  for (r = c->rules; r != NULL && len < PAGE_SIZE - 128; r = r->next) {
+	len += sprintf(buffer + len,
+		"%08lX/%08lX %08lX/%08lX %04X %5u:%5u %5u:%5u %8lu %9lu\n",
+		r->fw.fw_src.s_addr, r->fw.fw_smsk.s_addr,
+		r->fw.fw_dst.s_addr, r->fw.fw_dmsk.s_addr,
+		r->fw.fw_flg, r->fw.fw_sport[0], r->fw.fw_sport[1],
+		r->fw.fw_dport[0], r->fw.fw_dport[1],
+		r->fw.fw_pcnt, r->fw.fw_bcnt);
+  }
+  restore_flags(flags);
+  return(len);
+}
+
+#endif	/* CONFIG_IP_FIREWALL */
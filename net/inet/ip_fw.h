@@ -0,0 +1,29 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the IP packet filter and accounting.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _IP_FW_H
+#define _IP_FW_H
+
+#include <linux/ip_fw.h>
+
+
+/* What ip_fw_chk() says about a datagram. */
+#define IP_FW_BLOCK	0		/* drop it quietly		*/
+#define IP_FW_ACCEPT	1
+#define IP_FW_REJECT	2		/* drop it and send an ICMP error */
+
+extern int	ip_fw_chk(struct iphdr *iph, int len, int chain);
+extern void	ip_fw_acct(struct iphdr *iph, int len);
+extern int	ip_fw_ctl(int optname, char *optval, int optlen);
+extern int	ip_fw_get_info(char *buffer, int chain);
+
+#endif	/* _IP_FW_H */
@@ -28,9 +28,13 @@
  */
 #include <linux/types.h>
 #include <linux/sched.h>
+#include <linux/mm.h>
 #include <linux/fcntl.h>
+#include <linux/string.h>
 #include <linux/socket.h>
 #include <linux/in.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
 #include "inet.h"
 #include "dev.h"
 #include "ip.h"
@@ -46,6 +50,29 @@
 #include "raw.h"
 
 
+#define PACKET_RING_PAGES	128	/* most pages a ring may use	*/
+
+/*
+ * What we keep per packet socket.  It hangs off sk->pair, and the
+ * packet_type has to come first as dev.c hands us that pointer.
+ */
+struct packet_opt {
+  struct packet_type	prot;
+  struct sock_filter	*filter;	/* attached program, or NULL	*/
+  int			filter_len;
+  unsigned long		*pg_vec;	/* receive ring pages, or NULL	*/
+  int			pg_vec_len;
+  int			frame_size;
+  int			frame_nr;
+  int			frames_per_page;
+  int			head;		/* next frame to fill		*/
+  int			losing;		/* dropped since the last frame	*/
+  struct tpacket_stats	stats;
+};
+
+#define PKT_OPT(sk)	((struct packet_opt *)(sk)->pair)
+
+
 static unsigned long
 min(unsigned long a, unsigned long b)
 {
@@ -54,6 +81,91 @@ min(unsigned long a, unsigned long b)
 }
 
 
+static struct tpacket_hdr *
+packet_frame(struct packet_opt *po, int n)
+{
+  return((struct tpacket_hdr *)(po->pg_vec[n / po->frames_per_page] +
+			(n % po->frames_per_page) * po->frame_size));
+}
+
+
+/*
+ * Copy a packet into the next ring frame.  If user space hasn't
+ * given that frame back yet the packet is lost, and the next one we
+ * do store is flagged so the reader knows there was a gap.
+ */
+static void
+packet_ring_put(struct sock *sk, struct sk_buff *skb, struct device *dev,
+		int len, int snaplen)
+{
+  struct packet_opt *po = PKT_OPT(sk);
+  struct tpacket_hdr *h;
+  struct sockaddr *addr;
+
+  h = packet_frame(po, po->head);
+  if (h->tp_status != TP_STATUS_KERNEL) {
+	po->stats.tp_drops++;
+	po->losing = 1;
+	return;
+  }
+  snaplen = min(snaplen, po->frame_size - TPACKET_HDRLEN);
+
+  addr = (struct sockaddr *)((unsigned char *)h + TPACKET_ALIGN(sizeof(*h)));
+  addr->sa_family = dev->type;
+  memcpy(addr->sa_data, dev->name, 14);
+  memcpy((unsigned char *)h + TPACKET_HDRLEN, skb->data, snaplen);
+
+  h->tp_len = len;
+  h->tp_snaplen = snaplen;
+  h->tp_mac = TPACKET_HDRLEN;
+  h->tp_net = TPACKET_HDRLEN + dev->hard_header_len;
+  h->tp_sec = xtime.tv_sec;
+  h->tp_usec = xtime.tv_usec;
+  /* The status goes last: once it says USER the frame is theirs. */
+  h->tp_status = TP_STATUS_USER | (po->losing ? TP_STATUS_LOSING : 0);
+  po->losing = 0;
+
+  if (++po->head == po->frame_nr) po->head = 0;
+  wake_up_interruptible(sk->sleep);
+}
+
+
+/*
+ * Called by inet_bh() before it copies the buffer for us.  Packets
+ * the filter rejects, and packets that go into the ring, are dealt
+ * with here and need no copy; only those for the receive queue go on
+ * to packet_rcv().
+ */
+static int
+packet_peek(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
+{
+  struct sock *sk;
+  struct packet_opt *po;
+  unsigned long res;
+  int len, snaplen;
+
+  sk = (struct sock *) pt->data;
+  po = PKT_OPT(sk);
+  len = skb->len + dev->hard_header_len;
+  snaplen = len;
+
+  if (po->filter != NULL) {
+	/* The program returns how much to keep; (unsigned) -1 means all. */
+	res = (unsigned) sk_run_filter(skb->data, len, po->filter, po->filter_len);
+	if (res == 0) {
+		po->stats.tp_filtered++;
+		return(0);
+	}
+	snaplen = min(res, len);
+  }
+  po->stats.tp_packets++;
+
+  if (po->pg_vec == NULL) return(1);
+  packet_ring_put(sk, skb, dev, len, snaplen);
+  return(0);
+}
+
+
 /* This should be the easiest of all, all we do is copy it into a buffer. */
 int
 packet_rcv(struct sk_buff *skb, struct device *dev,  struct packet_type *pt)
@@ -68,6 +180,7 @@ packet_rcv(struct sk_buff *skb, struct device *dev,  struct packet_type *pt)
 
   /* Charge it too the socket. */
   if (sk->rmem_alloc + skb->mem_len >= sk->rcvbuf) {
+	PKT_OPT(sk)->stats.tp_drops++;
 	skb->sk = NULL;
 	kfree_skb(skb, FREE_READ);
 	return(0);
@@ -149,13 +262,231 @@ packet_write(struct sock *sk, unsigned char *buff,
 }
 
 
+/*
+ * Set up a new receive ring, or tear down the old one.  The frames
+ * live in single pages since there is no way to get bigger blocks;
+ * whoever still has the old pages mapped keeps them until munmap.
+ */
+static int
+packet_set_ring(struct sock *sk, struct tpacket_req *req)
+{
+  struct packet_opt *po = PKT_OPT(sk);
+  unsigned long *pg_vec, *old_vec;
+  int i, fpp, nr_pages, old_len;
+
+  pg_vec = NULL;
+  fpp = nr_pages = 0;
+  if (req->tp_frame_nr) {
+	if (req->tp_frame_size < TPACKET_HDRLEN ||
+	    req->tp_frame_size > PAGE_SIZE ||
+	    (req->tp_frame_size & 15) ||
+	    (PAGE_SIZE % req->tp_frame_size))
+		return(-EINVAL);
+	fpp = PAGE_SIZE / req->tp_frame_size;
+	nr_pages = (req->tp_frame_nr + fpp - 1) / fpp;
+	if (nr_pages > PACKET_RING_PAGES) return(-EINVAL);
+
+	pg_vec = (unsigned long *) kmalloc(nr_pages * sizeof(unsigned long),
+								GFP_KERNEL);
+	if (pg_vec == NULL) return(-ENOMEM);
+	for (i = 0; i < nr_pages; i++) {
+		/* get_free_page() clears it, so every frame is TP_STATUS_KERNEL */
+		pg_vec[i] = get_free_page(GFP_KERNEL);
+		if (pg_vec[i] == 0) {
+			while (--i >= 0) free_page(pg_vec[i]);
+			kfree_s(pg_vec, nr_pages * sizeof(unsigned long));
+			return(-ENOMEM);
+		}
+	}
+  }
+
+  cli();
+  old_vec = po->pg_vec;
+  old_len = po->pg_vec_len;
+  po->pg_vec = pg_vec;
+  po->pg_vec_len = nr_pages;
+  po->frame_size = req->tp_frame_size;
+  po->frame_nr = req->tp_frame_nr;
+  po->frames_per_page = fpp;
+  po->head = 0;
+  po->losing = 0;
+  sti();
+
+  if (old_vec != NULL) {
+	for (i = 0; i < old_len; i++) free_page(old_vec[i]);
+	kfree_s(old_vec, old_len * sizeof(unsigned long));
+  }
+  return(0);
+}
+
+
+static int
+packet_set_filter(struct sock *sk, struct sock_fprog *fprog)
+{
+  struct packet_opt *po = PKT_OPT(sk);
+  struct sock_filter *filter, *old;
+  int size, err, old_len;
+
+  filter = NULL;
+  size = 0;
+  if (fprog != NULL) {
+	if (fprog->len == 0 || fprog->len > BPF_MAXINSNS) return(-EINVAL);
+	size = fprog->len * sizeof(struct sock_filter);
+	err = verify_area(VERIFY_READ, fprog->filter, size);
+	if (err) return(err);
+	filter = (struct sock_filter *) kmalloc(size, GFP_KERNEL);
+	if (filter == NULL) return(-ENOMEM);
+	memcpy_fromfs(filter, fprog->filter, size);
+	err = sk_chk_filter(filter, fprog->len);
+	if (err) {
+		kfree_s(filter, size);
+		return(err);
+	}
+  }
+
+  cli();
+  old = po->filter;
+  old_len = po->filter_len;
+  po->filter = filter;
+  po->filter_len = fprog ? fprog->len : 0;
+  sti();
+
+  if (old != NULL) kfree_s(old, old_len * sizeof(struct sock_filter));
+  return(0);
+}
+
+
+static int
+packet_setsockopt(struct sock *sk, int level, int optname,
+		  char *optval, int optlen)
+{
+  struct sock_fprog fprog;
+  struct tpacket_req req;
+  int err;
+
+  if (level != SOL_PACKET) return(-EOPNOTSUPP);
+
+  switch(optname) {
+	case PACKET_ATTACH_FILTER:
+		if (optval == NULL || optlen < sizeof(fprog)) return(-EINVAL);
+		err = verify_area(VERIFY_READ, optval, sizeof(fprog));
+		if (err) return(err);
+		memcpy_fromfs(&fprog, optval, sizeof(fprog));
+		return(packet_set_filter(sk, &fprog));
+	case PACKET_DETACH_FILTER:
+		return(packet_set_filter(sk, NULL));
+	case PACKET_RX_RING:
+		if (optval == NULL || optlen < sizeof(req)) return(-EINVAL);
+		err = verify_area(VERIFY_READ, optval, sizeof(req));
+		if (err) return(err);
+		memcpy_fromfs(&req, optval, sizeof(req));
+		return(packet_set_ring(sk, &req));
+	default:
+		return(-ENOPROTOOPT);
+  }
+}
+
+
+static int
+packet_getsockopt(struct sock *sk, int level, int optname,
+		  char *optval, int *optlen)
+{
+  struct packet_opt *po = PKT_OPT(sk);
+  struct tpacket_stats st;
+  int err;
+
+  if (level != SOL_PACKET) return(-EOPNOTSUPP);
+
+  switch(optname) {
+	case PACKET_STATISTICS:
+		err = verify_area(VERIFY_WRITE, optlen, sizeof(int));
+		if (err) return(err);
+		put_fs_long(sizeof(st), (unsigned long *) optlen);
+		err = verify_area(VERIFY_WRITE, optval, sizeof(st));
+		if (err) return(err);
+		cli();
+		st = po->stats;
+		memset(&po->stats, 0, sizeof(po->stats));
+		sti();
+		memcpy_tofs(optval, &st, sizeof(st));
+		return(0);
+	default:
+		return(-ENOPROTOOPT);
+  }
+}
+
+
+/*
+ * Map the whole receive ring.  It has to be shared, as user space
+ * hands frames back by writing their status word.
+ */
+static int
+packet_mmap(struct sock *sk, struct inode *inode, struct file *file,
+	    unsigned long addr, size_t len, int prot, unsigned long off)
+{
+  struct packet_opt *po = PKT_OPT(sk);
+  struct vm_area_struct *mpnt;
+  int i;
+
+  if (po->pg_vec == NULL) return(-EINVAL);
+  if (off != 0 || len != po->pg_vec_len * PAGE_SIZE) return(-EINVAL);
+  if (prot & PAGE_COW) return(-EINVAL);
+
+  for (i = 0; i < po->pg_vec_len; i++) {
+	if (remap_page_range(addr + i * PAGE_SIZE, po->pg_vec[i],
+							PAGE_SIZE, prot))
+		return(-EAGAIN);
+  }
+
+  /* Let the rest of the kernel know we are here, as mmap_mem() does. */
+  mpnt = (struct vm_area_struct *) kmalloc(sizeof(struct vm_area_struct), GFP_KERNEL);
+  if (mpnt == NULL) return(0);
+
+  mpnt->vm_task = current;
+  mpnt->vm_start = addr;
+  mpnt->vm_end = addr + len;
+  mpnt->vm_page_prot = prot;
+  mpnt->vm_share = NULL;
+  mpnt->vm_inode = inode;
+  inode->i_count++;
+  mpnt->vm_offset = off;
+  mpnt->vm_ops = NULL;
+  insert_vm_struct(current, mpnt);
+  merge_segments(current->mmap, NULL, NULL);
+  return(0);
+}
+
+
+/* With a ring, we are readable as soon as the last frame filled is. */
+static int
+packet_select(struct sock *sk, int sel_type, select_table *wait)
+{
+  struct packet_opt *po = PKT_OPT(sk);
+  int last;
+
+  if (sel_type != SEL_IN || po->pg_vec == NULL)
+	return(datagram_select(sk, sel_type, wait));
+
+  select_wait(sk->sleep, wait);
+  last = po->head ? po->head - 1 : po->frame_nr - 1;
+  if (packet_frame(po, last)->tp_status != TP_STATUS_KERNEL) return(1);
+  return(0);
+}
+
+
 static void
 packet_close(struct sock *sk, int timeout)
 {
+  struct packet_opt *po = PKT_OPT(sk);
+  struct tpacket_req req;
+
   sk->inuse = 1;
   sk->state = TCP_CLOSE;
-  dev_remove_pack((struct packet_type *)sk->pair);
-  kfree_s((void *)sk->pair, sizeof(struct packet_type));
+  dev_remove_pack(&po->prot);
+  packet_set_filter(sk, NULL);
+  req.tp_frame_size = req.tp_frame_nr = 0;
+  packet_set_ring(sk, &req);
+  kfree_s((void *)po, sizeof(struct packet_opt));
   sk->pair = NULL;
   release_sock(sk);
 }
@@ -164,19 +495,21 @@ packet_close(struct sock *sk, int timeout)
 static int
 packet_init(struct sock *sk)
 {
-  struct packet_type *p;
+  struct packet_opt *po;
 
-  p = (struct packet_type *) kmalloc(sizeof(*p), GFP_KERNEL);
-  if (p == NULL) return(-ENOMEM);
+  po = (struct packet_opt *) kmalloc(sizeof(*po), GFP_KERNEL);
+  if (po == NULL) return(-ENOMEM);
+  memset(po, 0, sizeof(*po));
+
+  po->prot.func = packet_rcv;
+  po->prot.peek = packet_peek;
+  po->prot.type = sk->num;
+  po->prot.data = (void *)sk;
 
-  p->func = packet_rcv;
-  p->type = sk->num;
-  p->data = (void *)sk;
-  dev_add_pack(p);
-   
   /* We need to remember this somewhere. */
-  sk->pair = (struct sock *)p;
+  sk->pair = (struct sock *)po;
 
+  dev_add_pack(&po->prot);
   return(0);
 }
 
@@ -262,12 +595,13 @@ struct proto packet_prot = {
   NULL,
   NULL,
   NULL, 
-  datagram_select,
+  packet_select,
   NULL,
   packet_init,
   NULL,
-  NULL,	/* No set/get socket options */
-  NULL,
+  packet_setsockopt,
+  packet_getsockopt,
+  packet_mmap,
   128,
   0,
   {NULL,},
@@ -65,7 +65,8 @@ get__netinfo(struct proto *pro, char *buffer, int format)
   unsigned short destp, srcp;
 
   s_array = pro->sock_array;
-  pos+=sprintf(pos, "sl  local_address rem_address   st tx_queue rx_queue tr tm->when uid\n");
+  pos+=sprintf(pos, "sl  local_address rem_address   st tx_queue rx_queue tr tm->when uid%s\n",
+	format==0?" rexmits fastrx":"");
 /*
  *	This was very pretty but didn't work when a socket is destroyed at the wrong moment
  *	(eg a syn recv socket getting a reset), or a memory timer destroy. Instead of playing
@@ -86,12 +87,18 @@ get__netinfo(struct proto *pro, char *buffer, int format)
 		timer_active = del_timer(&sp->timer);
 		if (!timer_active)
 			sp->timer.expires = 0;
-		pos+=sprintf(pos, "%2d: %08lX:%04X %08lX:%04X %02X %08lX:%08lX %02X:%08lX %08X %d\n",
+		pos+=sprintf(pos, "%2d: %08lX:%04X %08lX:%04X %02X %08lX:%08lX %02X:%08lX %08X %d",
 			i, src, srcp, dest, destp, sp->state, 
 			format==0?sp->write_seq-sp->rcv_ack_seq:sp->rmem_alloc, 
 			format==0?sp->acked_seq-sp->copied_seq:sp->wmem_alloc,
 			timer_active, sp->timer.expires, (unsigned) sp->retransmits,
 			SOCK_INODE(sp->socket)->i_uid);
+		/* TCP also gets its retransmit counters */
+		if (format==0)
+			pos+=sprintf(pos, " %lu %lu",
+				sp->retrans_segs, sp->fast_retrans);
+		*pos++='\n';
+		*pos='\0';
 		if (timer_active)
 			add_timer(&sp->timer);
 		/* Is place in buffer too rare? then abort. */
@@ -117,7 +124,11 @@ get__netinfo(struct proto *pro, char *buffer, int format)
 
 int tcp_get_info(char *buffer)
 {
-  return get__netinfo(&tcp_prot, buffer,0);
+  int len;
+
+  len = get__netinfo(&tcp_prot, buffer,0);
+  /* Then the connections that are only TIME_WAIT records now. */
+  return(len + tcp_tw_get_info(buffer + len, PAGE_SIZE - 80 - len));
 }
 
 
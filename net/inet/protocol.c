@@ -38,6 +38,7 @@
 #include "sock.h"
 #include "icmp.h"
 #include "udp.h"
+#include "igmp.h"
 
 
 static struct inet_protocol tcp_protocol = {
@@ -54,7 +55,7 @@ static struct inet_protocol tcp_protocol = {
 
 static struct inet_protocol udp_protocol = {
   udp_rcv,		/* UDP handler		*/
-  NULL,			/* Will be UDP fraglist handler */
+  udp_rcv,		/* UDP fraglist handler	*/
   udp_err,		/* UDP error control	*/
   &tcp_protocol,	/* next			*/
   IPPROTO_UDP,		/* protocol ID		*/
@@ -76,7 +77,19 @@ static struct inet_protocol icmp_protocol = {
 };
 
 
-struct inet_protocol *inet_protocol_base = &icmp_protocol;
+static struct inet_protocol igmp_protocol = {
+  igmp_rcv,		/* IGMP handler		*/
+  NULL,			/* IGMP never fragments anyway */
+  NULL,			/* IGMP error control	*/
+  &icmp_protocol,	/* next			*/
+  IPPROTO_IGMP,		/* protocol ID		*/
+  0,			/* copy			*/
+  NULL,			/* data			*/
+  "IGMP"		/* name			*/
+};
+
+
+struct inet_protocol *inet_protocol_base = &igmp_protocol;
 struct inet_protocol *inet_protos[MAX_INET_PROTOS] = {
   NULL
 };
@@ -403,6 +403,7 @@ struct proto raw_prot = {
   NULL,
   ip_setsockopt,
   ip_getsockopt,
+  NULL,
   128,
   0,
   {NULL,},
@@ -32,6 +32,7 @@
 #include <linux/sockios.h>
 #include <linux/errno.h>
 #include <linux/in.h>
+#include <linux/timer.h>
 #include "inet.h"
 #include "dev.h"
 #include "ip.h"
@@ -47,6 +48,39 @@
 static struct rtable *rt_base = NULL;
 static struct rtable *rt_loopback = NULL;
 
+/*
+ * A direct mapped cache of rt_route() answers, so a router doesn't walk
+ * the whole table for every datagram.  Any change to the table empties
+ * it.  Entries are read and written with interrupts off, so nobody sees
+ * an address paired with another address's route.
+ */
+#define RT_CACHE_SIZE	64		/* must be a power of two */
+
+static struct rt_cache {
+	unsigned long	rc_dst;
+	struct rtable	*rc_rt;
+} rt_cache[RT_CACHE_SIZE];
+static unsigned long rt_cache_gen = 0;	/* bumped by every flush */
+
+static inline unsigned int rt_hash(unsigned long daddr)
+{
+	daddr ^= daddr >> 16;
+	daddr ^= daddr >> 8;
+	return daddr & (RT_CACHE_SIZE - 1);
+}
+
+/* Also called when an interface address changes under the routes. */
+void rt_cache_flush(void)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	memset(rt_cache, 0, sizeof(rt_cache));
+	rt_cache_gen++;
+	restore_flags(flags);
+}
+
 /* Dump the contents of a routing table entry. */
 static void
 rt_print(struct rtable *rt)
@@ -75,6 +109,7 @@ static void rt_del(unsigned long dst)
 	rp = &rt_base;
 	save_flags(flags);
 	cli();
+	rt_cache_flush();
 	while((r = *rp) != NULL) {
 		if (r->rt_dst != dst) {
 			rp = &r->rt_next;
@@ -100,8 +135,9 @@ void rt_flush(struct device *dev)
 
 	DPRINTF((DBG_RT, "RT: flushing for dev 0x%08lx (%s)\n", (long)dev, dev->name));
 	rp = &rt_base;
-	cli();
 	save_flags(flags);
+	cli();
+	rt_cache_flush();
 	while ((r = *rp) != NULL) {
 		if (r->rt_dev != dev) {
 			rp = &r->rt_next;
@@ -214,6 +250,7 @@ void rt_add(short flags, unsigned long dst, unsigned long mask,
 	 */
 	save_flags(cpuflags);
 	cli();
+	rt_cache_flush();
 	/* remove old route if we are getting a duplicate. */
 	rp = &rt_base;
 	while ((r = *rp) != NULL) {
@@ -334,14 +371,14 @@ rt_get_info(char *buffer)
   pos = buffer;
 
   pos += sprintf(pos,
-		 "Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask\n");
+		 "Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask\t\tMTU\n");
   
   /* This isn't quite right -- r->rt_dst is a struct! */
   for (r = rt_base; r != NULL; r = r->rt_next) {
-        pos += sprintf(pos, "%s\t%08lX\t%08lX\t%02X\t%d\t%lu\t%d\t%08lX\n",
+        pos += sprintf(pos, "%s\t%08lX\t%08lX\t%02X\t%d\t%lu\t%d\t%08lX\t%d\n",
 		r->rt_dev->name, r->rt_dst, r->rt_gateway,
 		r->rt_flags, r->rt_refcnt, r->rt_use, r->rt_metric,
-		r->rt_mask);
+		r->rt_mask, r->rt_mtu);
   }
   return(pos - buffer);
 }
@@ -354,7 +391,19 @@ rt_get_info(char *buffer)
 struct rtable * rt_route(unsigned long daddr, struct options *opt)
 {
 	struct rtable *rt;
+	struct rt_cache *rc;
+	unsigned long flags, gen;
 
+	rc = &rt_cache[rt_hash(daddr)];
+	save_flags(flags);
+	cli();
+	if ((rt = rc->rc_rt) != NULL && rc->rc_dst == daddr) {
+		rt->rt_use++;
+		restore_flags(flags);
+		return rt;
+	}
+	gen = rt_cache_gen;
+	restore_flags(flags);
 	for (rt = rt_base; rt != NULL || early_out ; rt = rt->rt_next) {
 		if (!((rt->rt_dst ^ daddr) & rt->rt_mask))
 			break;
@@ -368,11 +417,129 @@ struct rtable * rt_route(unsigned long daddr, struct options *opt)
 			goto no_route;
 	}
 	rt->rt_use++;
+	/* Don't cache it if the table changed under us meanwhile. */
+	save_flags(flags);
+	cli();
+	if (gen == rt_cache_gen) {
+		rc->rc_dst = daddr;
+		rc->rc_rt = rt;
+	}
+	restore_flags(flags);
 	return rt;
 no_route:
 	return NULL;
 }
 
+/*
+ * The host routes made to hold a path MTU are dropped again once the
+ * MTU has expired, so ICMP, forged or not, can't grow the table for
+ * good.  A timer runs while there are any.
+ */
+static struct timer_list rt_pmtu_timer;
+static int rt_pmtu_timer_on = 0;
+
+static void rt_pmtu_ticker(unsigned long data);
+
+static void rt_pmtu_kick(void)
+{
+	if (rt_pmtu_timer_on)
+		return;
+	rt_pmtu_timer_on = 1;
+	rt_pmtu_timer.expires = RT_PMTU_TIMEOUT / 10;
+	rt_pmtu_timer.data = 0;
+	rt_pmtu_timer.function = rt_pmtu_ticker;
+	add_timer(&rt_pmtu_timer);
+}
+
+/* Drop the expired ones, and return how many are left. */
+static int rt_pmtu_reap(void)
+{
+	struct rtable *r, **rp;
+	unsigned long flags;
+	int left = 0;
+
+	save_flags(flags);
+	cli();
+	rp = &rt_base;
+	while ((r = *rp) != NULL) {
+		if (!(r->rt_flags & RTF_PMTU)) {
+			rp = &r->rt_next;
+			continue;
+		}
+		if ((long)(r->rt_mtu_expires - jiffies) > 0) {
+			left++;
+			rp = &r->rt_next;
+			continue;
+		}
+		DPRINTF((DBG_RT, "RT: path MTU to %s expired\n", in_ntoa(r->rt_dst)));
+		rt_cache_flush();
+		*rp = r->rt_next;
+		kfree_s(r, sizeof(struct rtable));
+	}
+	restore_flags(flags);
+	return left;
+}
+
+static void rt_pmtu_ticker(unsigned long data/*UNUSED*/)
+{
+	rt_pmtu_timer_on = 0;
+	if (rt_pmtu_reap())
+		rt_pmtu_kick();
+}
+
+/*
+ * Path MTU discovery (RFC 1191).  A router has told us that datagrams
+ * to daddr must be at most mtu bytes.  Keep that on a host route, made
+ * from the route in use if there isn't one, so other destinations
+ * behind the same route are not held back.
+ */
+void rt_update_pmtu(unsigned long daddr, unsigned short mtu)
+{
+	struct rtable *rt;
+
+	if (mtu < 68)
+		mtu = 68;
+	rt = rt_route(daddr, NULL);
+	if (rt == NULL || (rt->rt_dev->flags & IFF_LOOPBACK))
+		return;
+	if (mtu >= rt->rt_mtu && mtu >= rt->rt_dev->mtu)
+		return;
+	if (rt->rt_dst != daddr || rt->rt_mask != 0xffffffff) {
+		if (rt_pmtu_reap() >= RT_PMTU_MAX)
+			return;
+		rt_add(RTF_DYNAMIC | RTF_HOST | (rt->rt_flags & RTF_GATEWAY),
+			daddr, 0, rt->rt_gateway, rt->rt_dev);
+		rt = rt_route(daddr, NULL);
+		if (rt == NULL || rt->rt_dst != daddr)
+			return;
+		rt->rt_flags |= RTF_PMTU;
+		rt_pmtu_kick();
+	}
+	DPRINTF((DBG_RT, "RT: path MTU to %s is %d\n", in_ntoa(daddr), mtu));
+	rt->rt_mtu = mtu;
+	rt->rt_mtu_expires = jiffies + RT_PMTU_TIMEOUT;
+}
+
+/*
+ * The largest datagram to send to daddr.  A learnt path MTU is only
+ * believed for RT_PMTU_TIMEOUT, after which we try the device MTU
+ * again in case the path has changed.
+ */
+unsigned short rt_pmtu(unsigned long daddr)
+{
+	struct rtable *rt;
+
+	rt = rt_route(daddr, NULL);
+	if (rt == NULL)
+		return 576;
+	if (rt->rt_mtu < rt->rt_dev->mtu) {
+		if ((long)(rt->rt_mtu_expires - jiffies) > 0)
+			return rt->rt_mtu;
+		rt->rt_mtu = rt->rt_dev->mtu;
+	}
+	return rt->rt_dev->mtu;
+}
+
 static int get_old_rtent(struct old_rtentry * src, struct rtentry * rt)
 {
 	int err;
@@ -33,15 +33,23 @@ struct rtable {
   short			rt_refcnt;
   unsigned long		rt_use;
   unsigned short	rt_mss, rt_mtu;
+  unsigned long		rt_mtu_expires;	/* when a learnt rt_mtu is dropped */
   struct device		*rt_dev;
 };
 
+#define RT_PMTU_TIMEOUT	(10*60*HZ)	/* how long a path MTU is trusted */
+#define RT_PMTU_MAX	64		/* most host routes made to hold one */
+#define RTF_PMTU	0x0040		/* host route made by rt_update_pmtu */
+
 
 extern void		rt_flush(struct device *dev);
 extern void		rt_add(short flags, unsigned long addr, unsigned long mask,
 			       unsigned long gw, struct device *dev);
 extern struct rtable	*rt_route(unsigned long daddr, struct options *opt);
+extern void		rt_cache_flush(void);
 extern int		rt_get_info(char * buffer);
 extern int		rt_ioctl(unsigned int cmd, void *arg);
+extern void		rt_update_pmtu(unsigned long daddr, unsigned short mtu);
+extern unsigned short	rt_pmtu(unsigned long daddr);
 
 #endif	/* _ROUTE_H */
@@ -18,6 +18,7 @@
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/sched.h>
+#include <linux/string.h>
 #include <asm/segment.h>
 #include <asm/system.h>
 #include <linux/mm.h>
@@ -376,6 +377,8 @@ struct sk_buff *skb_peek_copy(struct sk_buff *volatile* list)
 
 void kfree_skb(struct sk_buff *skb, int rw)
 {
+	struct sk_buff *frag;
+
 	if (skb == NULL) {
 		printk("kfree_skb: skb = NULL\n");
 		return;
@@ -392,6 +395,12 @@ void kfree_skb(struct sk_buff *skb, int rw)
 	if(skb->list)
 		printk("Warning: kfree_skb passed an skb still on a list.\n");
 	skb->magic = 0;
+	while ((frag = skb->fraglist) != NULL)
+	{
+		skb->fraglist = frag->fraglist;
+		frag->fraglist = NULL;
+		kfree_skb(frag, rw);
+	}
 	if (skb->sk)
 	{
 		if(skb->sk->prot!=NULL)
@@ -445,6 +454,10 @@ struct sk_buff *alloc_skb(unsigned int size,int priority)
 	skb->mem_len=size;
 	skb->mem_addr=skb;
 	skb->fraglist=NULL;
+	skb->fraglen=0;
+	skb->tail=NULL;
+	skb->csum=0;
+	skb->csum_pending=0;
 	net_memory+=size;
 	net_skbcount++;
 	skb->magic_debug_cookie=SK_GOOD_SKB;
@@ -452,6 +465,162 @@ struct sk_buff *alloc_skb(unsigned int size,int priority)
 	return skb;
 }
 
+/*
+ *	Fraglist chains. A buffer with a fraglist holds the start of its
+ *	data itself, up to skb->tail, and the rest in a chain of further
+ *	sk_buffs linked through their own fraglist pointers, each holding
+ *	frag->len bytes at frag->h.raw. skb->len counts the whole lot and
+ *	skb->fraglen the part out on the chain. Set skb->tail before
+ *	adding the first fragment.
+ */
+
+void skb_add_frag(struct sk_buff *skb, struct sk_buff *frag)
+{
+	struct sk_buff **fp = &skb->fraglist;
+
+	IS_SKB(frag);
+	while (*fp != NULL)
+		fp = &(*fp)->fraglist;
+	*fp = frag;
+	frag->fraglist = NULL;
+	skb->fraglen += frag->len;
+	skb->len += frag->len;
+}
+
+/*
+ *	Copy len bytes starting offset bytes into skb->data, following
+ *	the fraglist if there is one. This is the gather step for
+ *	drivers that can't hand the chain to the hardware.
+ */
+
+void skb_copy_bits(struct sk_buff *skb, int offset, unsigned char *to, int len)
+{
+	struct sk_buff *frag;
+	int n;
+
+	if (skb->fraglist == NULL)
+	{
+		memcpy(to, skb->data + offset, len);
+		return;
+	}
+	n = (skb->tail - skb->data) - offset;
+	if (n > 0)
+	{
+		if (n > len)
+			n = len;
+		memcpy(to, skb->data + offset, n);
+		to += n;
+		len -= n;
+		offset = 0;
+	}
+	else
+		offset = -n;
+	for (frag = skb->fraglist; frag != NULL && len > 0; frag = frag->fraglist)
+	{
+		n = frag->len - offset;
+		if (n <= 0)
+		{
+			offset -= frag->len;
+			continue;
+		}
+		if (n > len)
+			n = len;
+		memcpy(to, frag->h.raw + offset, n);
+		to += n;
+		len -= n;
+		offset = 0;
+	}
+}
+
+/*
+ *	Make a contiguous copy of a fraglisted buffer. The old buffer is
+ *	left alone, so it may belong to a socket or sit on a queue. The
+ *	copy belongs to nobody and is freed when done.
+ */
+
+struct sk_buff *skb_flatten(struct sk_buff *skb, int priority)
+{
+	struct sk_buff *n;
+	unsigned long size;
+	int len;
+
+	IS_SKB(skb);
+	len = (skb->tail - skb->data) + skb->fraglen;
+	size = sizeof(struct sk_buff) + len;
+	n = alloc_skb(size, priority);
+	if (n == NULL)
+		return NULL;
+	memcpy(n, skb, sizeof(struct sk_buff));
+	skb_copy_bits(skb, 0, n->data, len);
+	n->h.raw = n->data + (skb->h.raw - skb->data);
+	if (skb->ip_hdr != NULL)
+		n->ip_hdr = (struct iphdr *)(n->data + ((unsigned char *)skb->ip_hdr - skb->data));
+	n->next = NULL;
+	n->prev = NULL;
+	n->link3 = NULL;
+	n->list = NULL;
+	n->sk = NULL;
+	n->mem_addr = n;
+	n->mem_len = size;
+	n->truesize = size;
+	n->fraglist = NULL;
+	n->fraglen = 0;
+	n->tail = NULL;
+	n->lock = 0;
+	n->users = 0;
+	n->free = 1;
+	return n;
+}
+
+/*
+ *	Flatten a fraglisted buffer into one new contiguous one. The old
+ *	buffer is freed, even on failure. Only for buffers that are not
+ *	charged to a socket or sitting on a queue.
+ */
+
+struct sk_buff *skb_linearize(struct sk_buff *skb, int priority)
+{
+	struct sk_buff *n;
+
+	if (skb->fraglist == NULL)
+		return skb;
+	n = skb_flatten(skb, priority);
+	kfree_skb(skb, FREE_READ);
+	return n;
+}
+
+/*
+ *	Copy a flat buffer, so that a datagram can be queued on more than
+ *	one socket.  The copy belongs to nobody and is freed when done.
+ */
+
+struct sk_buff *skb_copy(struct sk_buff *skb, int priority)
+{
+	struct sk_buff *n;
+
+	IS_SKB(skb);
+	if (skb->fraglist != NULL)
+		return NULL;
+	n = alloc_skb(skb->mem_len, priority);
+	if (n == NULL)
+		return NULL;
+	memcpy(n, skb, skb->mem_len);
+	n->h.raw = n->data + (skb->h.raw - skb->data);
+	if (skb->ip_hdr != NULL)
+		n->ip_hdr = (struct iphdr *)(n->data + ((unsigned char *)skb->ip_hdr - skb->data));
+	n->next = NULL;
+	n->prev = NULL;
+	n->link3 = NULL;
+	n->list = NULL;
+	n->sk = NULL;
+	n->mem_addr = n;
+	n->truesize = skb->mem_len;
+	n->lock = 0;
+	n->users = 0;
+	n->free = 1;
+	return n;
+}
+
 /*
  *	Free an skbuff by memory
  */
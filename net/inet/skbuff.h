@@ -63,8 +63,10 @@ struct sk_buff {
   struct iphdr		*ip_hdr;		/* For IPPROTO_RAW */
   unsigned long			mem_len;
   unsigned long 		len;
-  unsigned long			fraglen;
+  unsigned long			fraglen;	/* Bytes held on the fraglist */
   struct sk_buff		*fraglist;	/* Fragment list */
+  unsigned char			*tail;		/* End of our own data if fraglisted */
+  unsigned long			csum;		/* Partial sum: tcp data when sending, udp headers if csum_pending */
   unsigned long			truesize;
   unsigned long 		saddr;
   unsigned long 		daddr;
@@ -75,18 +77,26 @@ struct sk_buff {
 				arp;
   unsigned char			tries,lock;	/* Lock is now unused */
   unsigned short		users;		/* User count - see datagram.c (and soon seqpacket.c/stream.c) */
+  unsigned char			csum_pending;	/* Data still to be summed and verified by the reader */
   unsigned long			padding[0];
   unsigned char			data[0];
 };
 
 #define SK_WMEM_MAX	8192
 #define SK_RMEM_MAX	32767
+#define SK_MEM_LIMIT	262144		/* Most SO_SNDBUF/SO_RCVBUF will give */
 
 #define SK_FREED_SKB	0x0DE2C0DE
 #define SK_GOOD_SKB	0xDEC0DED1
 
 extern void			print_skb(struct sk_buff *);
 extern void			kfree_skb(struct sk_buff *skb, int rw);
+extern void			skb_add_frag(struct sk_buff *skb, struct sk_buff *frag);
+extern void			skb_copy_bits(struct sk_buff *skb, int offset,
+					      unsigned char *to, int len);
+extern struct sk_buff *		skb_flatten(struct sk_buff *skb, int priority);
+extern struct sk_buff *		skb_linearize(struct sk_buff *skb, int priority);
+extern struct sk_buff *		skb_copy(struct sk_buff *skb, int priority);
 extern void			skb_queue_head(struct sk_buff * volatile *list,struct sk_buff *buf);
 extern void			skb_queue_tail(struct sk_buff * volatile *list,struct sk_buff *buf);
 extern struct sk_buff *		skb_dequeue(struct sk_buff * volatile *list);
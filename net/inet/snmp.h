@@ -0,0 +1,41 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the MIB-II (RFC 1213) counters we keep,
+ *		reported through /proc/net/snmp.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _SNMP_H
+#define _SNMP_H
+
+struct ip_mib {
+  unsigned long	IpForwDatagrams;	/* datagrams we routed on	*/
+  unsigned long	IpReasmReqds;		/* fragments needing reassembly	*/
+  unsigned long	IpReasmOKs;		/* datagrams reassembled	*/
+  unsigned long	IpReasmFails;		/* timeouts, evictions, errors	*/
+  unsigned long	IpForwInPlace;		/* forwarded without a copy	*/
+};
+
+struct tcp_mib {
+  unsigned long	TcpPassiveOpens;	/* handshakes completed		*/
+  unsigned long	TcpAttemptFails;	/* half-open ones reset or timed out */
+  unsigned long	TcpListenOverflows;	/* accept queue was full	*/
+  unsigned long	TcpListenDrops;		/* SYNs not answered		*/
+  unsigned long	TcpOutAcks;		/* segments sent only to ack	*/
+  unsigned long	TcpDelayedAcks;		/* of those, sent by the delack timer */
+  unsigned long	TcpPiggyAcks;		/* held back ACKs that went out on data */
+};
+
+
+extern struct ip_mib	ip_statistics;
+extern struct tcp_mib	tcp_statistics;
+
+extern int		snmp_get_info(char *buffer);
+
+#endif	/* _SNMP_H */
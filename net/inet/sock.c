@@ -93,6 +93,7 @@
 #include "sock.h"
 #include "raw.h"
 #include "icmp.h"
+#include "igmp.h"
 
 
 int inet_debug = DBG_OFF;		/* INET module debug flag	*/
@@ -319,9 +320,11 @@ destroy_sock(struct sock *sk)
   		sk->write_space(sk);
 
   	remove_sock(sk);
+	ip_mc_drop_socket(sk);
   
   	/* Now we can no longer get new packets. */
   	delete_timer(sk);
+	del_timer(&sk->delack_timer);
 
 
 	while ((skb = tcp_dequeue_partial(sk)) != NULL) 
@@ -369,6 +372,13 @@ destroy_sock(struct sock *sk)
   	}
   	sk->rqueue = NULL;
 
+	/* Out of order data nobody will ever see. */
+	while((skb=skb_dequeue(&sk->ofo_queue))!=NULL)
+	{
+		IS_SKB(skb);
+		kfree_skb(skb, FREE_READ);
+	}
+
   /* Now we need to clean up the send head. */
   	for(skb = sk->send_head; skb != NULL; ) 
   	{
@@ -540,8 +550,8 @@ int sock_setsockopt(struct sock *sk, int level, int optname,
 			sk->broadcast=val?1:0;
 			return 0;
 		case SO_SNDBUF:
-			if(val>32767)
-				val=32767;
+			if(val>SK_MEM_LIMIT)
+				val=SK_MEM_LIMIT;
 			if(val<256)
 				val=256;
 			sk->sndbuf=val;
@@ -560,8 +570,8 @@ int sock_setsockopt(struct sock *sk, int level, int optname,
 			}
 			return 0;
 		case SO_RCVBUF:
-			if(val>32767)
-				val=32767;
+			if(val>SK_MEM_LIMIT)
+				val=SK_MEM_LIMIT;
 			if(val<256)
 				val=256;
 			sk->rcvbuf=val;
@@ -850,6 +860,16 @@ inet_create(struct socket *sock, int protocol)
   sk->mdev = 0;
   sk->backoff = 0;
   sk->packets_out = 0;
+  sk->dup_acks = 0;
+  sk->high_seq = 0;
+  sk->retrans_segs = 0;
+  sk->fast_retrans = 0;
+  sk->ts_recent = 0;
+  sk->rcv_tsecr = 0;
+  sk->snd_wscale = 0;
+  sk->rcv_wscale = 0;
+  sk->wscale_ok = 0;
+  sk->tstamp_ok = 0;
   sk->cong_window = 1; /* start with only sending one packet at a time. */
   sk->cong_count = 0;
   sk->ssthresh = 0;
@@ -880,11 +900,13 @@ inet_create(struct socket *sock, int protocol)
   /* how many packets we should send before forcing an ack. 
      if this is set to zero it is the same as sk->delay_acks = 0 */
   sk->max_ack_backlog = 0;
+  sk->syn_backlog = 0;
   sk->inuse = 0;
-  sk->delay_acks = 0;
+  sk->delay_acks = 1;	/* TCP may hold back ACKs for in order data */
   sk->wback = NULL;
   sk->wfront = NULL;
   sk->rqueue = NULL;
+  sk->ofo_queue = NULL;
   sk->mtu = 576;
   sk->prot = prot;
   sk->sleep = sock->wait;
@@ -916,6 +938,10 @@ inet_create(struct socket *sock, int protocol)
 
   sk->ip_tos=0;
   sk->ip_ttl=64;
+  sk->ip_mc_ttl=IP_DEFAULT_MULTICAST_TTL;
+  sk->ip_mc_loop=IP_DEFAULT_MULTICAST_LOOP;
+  sk->ip_mc_dev=NULL;
+  sk->ip_mc_list=NULL;
   	
   sk->state_change = def_callback1;
   sk->data_ready = def_callback2;
@@ -1016,7 +1042,7 @@ inet_bind(struct socket *sock, struct sockaddr *uaddr,
   struct sockaddr_in addr;
   struct sock *sk, *sk2;
   unsigned short snum;
-  int err;
+  int err, chk_addr_ret;
 
   sk = (struct sock *) sock->data;
   if (sk == NULL) {
@@ -1047,10 +1073,17 @@ inet_bind(struct socket *sock, struct sockaddr *uaddr,
   }
   if (snum < PROT_SOCK && !suser()) return(-EACCES);
 
-  if (addr.sin_addr.s_addr!=0 && chk_addr(addr.sin_addr.s_addr)!=IS_MYADDR)
-  	return(-EADDRNOTAVAIL);	/* Source address MUST be ours! */
+  /* Source address MUST be ours!  A group takes in datagrams sent to it. */
+  chk_addr_ret = chk_addr(addr.sin_addr.s_addr);
+  if (chk_addr_ret == IS_MULTICAST && sk->type != SOCK_DGRAM &&
+      sk->type != SOCK_RAW)
+	return(-EADDRNOTAVAIL);
+  if (addr.sin_addr.s_addr!=0 && chk_addr_ret!=IS_MYADDR && chk_addr_ret!=IS_MULTICAST)
+  	return(-EADDRNOTAVAIL);
   	
-  if (chk_addr(addr.sin_addr.s_addr) || addr.sin_addr.s_addr == 0)
+  if (chk_addr_ret == IS_MULTICAST)
+	sk->saddr = 0;			/* we send from our own address */
+  else if (chk_addr_ret || addr.sin_addr.s_addr == 0)
 					sk->saddr = addr.sin_addr.s_addr;
 
   DPRINTF((DBG_INET, "sock_array[%d] = %X:\n", snum &(SOCK_ARRAY_SIZE -1),
@@ -1075,6 +1108,7 @@ outside_loop:
 	}
 	if (sk2->num != snum) continue;		/* more than one */
 	if (sk2->saddr != sk->saddr) continue;	/* socket per slot ! -FB */
+	if (sk2->state == TCP_TIME_WAIT) continue;
 	if (!sk2->reuse) {
 		sti();
 		return(-EADDRINUSE);
@@ -1082,6 +1116,10 @@ outside_loop:
   }
   sti();
 
+  /* Closed connections still in TIME_WAIT hold the port too. */
+  if (sk->prot == &tcp_prot && !sk->reuse && tcp_tw_bound(snum, sk->saddr))
+	return(-EADDRINUSE);
+
   remove_sock(sk);
   put_sock(snum, sk);
   sk->dummy_th.source = ntohs(sk->num);
@@ -1500,6 +1538,22 @@ inet_select(struct socket *sock, int sel_type, select_table *wait )
 }
 
 
+static int
+inet_mmap(struct socket *sock, struct inode *inode, struct file *file,
+	  unsigned long addr, size_t len, int prot, unsigned long off)
+{
+  struct sock *sk;
+
+  sk = (struct sock *) sock->data;
+  if (sk == NULL) {
+	printk("Warning: sock->data = NULL: %d\n" ,__LINE__);
+	return(-EINVAL);
+  }
+  if (sk->prot->mmap == NULL) return(-ENODEV);
+  return(sk->prot->mmap(sk, inode, file, addr, len, prot, off));
+}
+
+
 static int
 inet_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 {
@@ -1630,8 +1684,14 @@ sock_rspace(struct sock *sk)
 
   if (sk != NULL) {
 	if (sk->rmem_alloc >= sk->rcvbuf-2*MIN_WINDOW) return(0);
-	amt = min((sk->rcvbuf-sk->rmem_alloc)/2-MIN_WINDOW, MAX_WINDOW);
+	amt = (sk->rcvbuf-sk->rmem_alloc)/2-MIN_WINDOW;
 	if (amt < 0) return(0);
+	/*
+	 * Only a receive buffer the user asked to be made bigger
+	 * buys a window past MAX_WINDOW.
+	 */
+	if (amt > MAX_WINDOW && sk->rcvbuf <= SK_RMEM_MAX)
+		amt = MAX_WINDOW;
 	return(amt);
   }
   return(0);
@@ -1853,6 +1913,7 @@ static struct proto_ops inet_proto_ops = {
   inet_setsockopt,
   inet_getsockopt,
   inet_fcntl,
+  inet_mmap,
 };
 
 extern unsigned long seq_offset;
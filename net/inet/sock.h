@@ -94,27 +94,35 @@ struct sock {
   struct sk_buff		*volatile back_log;
   struct sk_buff		*partial;
   struct timer_list		partial_timer;
+  struct timer_list		delack_timer;	/* sends a held back ACK */
   long				retransmits;
   struct sk_buff		*volatile wback,
 				*volatile wfront,
 				*volatile rqueue;
+  struct sk_buff		*volatile ofo_queue;	/* Out of order segments, in sequence order */
   struct proto			*prot;
   struct wait_queue		**sleep;
   unsigned long			daddr;
   unsigned long			saddr;
   unsigned short		max_unacked;
-  unsigned short		window;
+  unsigned long			window;
   unsigned short		bytes_rcv;
 /* mss is min(mtu, max_window) */
   unsigned short		mtu;       /* mss negotiated in the syn's */
   volatile unsigned short	mss;       /* current eff. mss - can change */
   volatile unsigned short	user_mss;  /* mss requested by user in ioctl */
-  volatile unsigned short	max_window;
+  volatile unsigned long	max_window;
   unsigned short		num;
   volatile unsigned short	cong_window;
   volatile unsigned short	cong_count;
   volatile unsigned short	ssthresh;
   volatile unsigned short	packets_out;
+  volatile unsigned short	dup_acks;	/* Duplicate acks seen in a row */
+  unsigned long			high_seq;	/* sent_seq when fast retransmit began */
+  unsigned long			retrans_segs;	/* Segments retransmitted */
+  unsigned long			fast_retrans;	/* Fast retransmits triggered */
+  unsigned long			ts_recent;	/* Peer timestamp to echo back */
+  unsigned long			rcv_tsecr;	/* Our timestamp the peer last echoed */
   volatile unsigned short	shutdown;
   volatile unsigned long	rtt;
   volatile unsigned long	mdev;
@@ -128,10 +136,15 @@ struct sock {
   volatile unsigned char	state;
   volatile unsigned char	ack_backlog;
   unsigned char			max_ack_backlog;
+  unsigned short		syn_backlog;	/* half-open, if listening */
   unsigned char			priority;
   unsigned char			debug;
-  unsigned short		rcvbuf;
-  unsigned short		sndbuf;
+  unsigned char			snd_wscale;	/* Shift for windows the peer sends */
+  unsigned char			rcv_wscale;	/* Shift for windows we advertise */
+  unsigned char			wscale_ok;	/* RFC1323 window scaling agreed */
+  unsigned char			tstamp_ok;	/* RFC1323 timestamps agreed */
+  unsigned long			rcvbuf;
+  unsigned long			sndbuf;
   unsigned short		type;
 #ifdef CONFIG_IPX
   ipx_address			ipx_source_addr,ipx_dest_addr;
@@ -153,6 +166,10 @@ struct sock {
 /* IP 'private area' or will be eventually */
   int				ip_ttl;		/* TTL setting */
   int				ip_tos;		/* TOS */
+  int				ip_mc_ttl;	/* multicast TTL */
+  int				ip_mc_loop;	/* loop our multicasts back */
+  struct device			*ip_mc_dev;	/* multicasts go out here */
+  struct ip_mc_socklist		*ip_mc_list;	/* groups joined */
   struct tcphdr			dummy_th;
 
   /* This part is used for the timeout functions (timer.c). */
@@ -224,6 +241,9 @@ struct proto {
   				 char *optval, int optlen);
   int			(*getsockopt)(struct sock *sk, int level, int optname,
   				char *optval, int *option);  	 
+  int			(*mmap)(struct sock *sk, struct inode *inode,
+				struct file *file, unsigned long addr,
+				size_t len, int prot, unsigned long off);
   unsigned short	max_header;
   unsigned long		retransmits;
   struct sock *		sock_array[SOCK_ARRAY_SIZE];
@@ -74,7 +74,6 @@
  *		it causes a select. Linux can - given the official select semantics I
  *		feel that _really_ its the BSD network programs that are bust (notably
  *		inetd, which hangs occasionally because of this).
- *			Add VJ Fastrecovery algorithm ?
  *			Protocol closedown badly messed up.
  *			Incompatiblity with spider ports (tcp hangs on that 
  *			socket occasionally).
@@ -99,19 +98,22 @@
 #include "ip.h"
 #include "protocol.h"
 #include "icmp.h"
+#include "route.h"
 #include "tcp.h"
 #include "skbuff.h"
 #include "sock.h"
 #include "arp.h"
+#include "snmp.h"
 #include <linux/errno.h>
 #include <linux/timer.h>
 #include <asm/system.h>
 #include <asm/segment.h>
+#include <asm/checksum.h>
 #include <linux/mm.h>
 
 #define SEQ_TICK 3
 unsigned long seq_offset;
-#define SUBNETSARELOCAL
+struct tcp_mib tcp_statistics;
 
 static __inline__ int 
 min(unsigned int a, unsigned int b)
@@ -120,6 +122,13 @@ min(unsigned int a, unsigned int b)
   return(b);
 }
 
+static __inline__ int 
+max(unsigned int a, unsigned int b)
+{
+  if (a > b) return(a);
+  return(b);
+}
+
 
 static void __print_th(struct tcphdr *th)
 {
@@ -187,6 +196,14 @@ static int tcp_select_window(struct sock *sk)
 {
 	int new_window = sk->prot->rspace(sk);
 
+/*
+ * With window scaling only multiples of 1<<rcv_wscale can be
+ * advertised, and no more than the 16 bit field will carry.
+ */
+	if (new_window > (65535 << sk->rcv_wscale))
+	  new_window = 65535 << sk->rcv_wscale;
+	new_window &= ~((1 << sk->rcv_wscale) - 1);
+
 /*
  * two things are going on here.  First, we don't ever offer a
  * window less than min(sk->mss, MAX_WINDOW/2).  This is the
@@ -202,14 +219,132 @@ static int tcp_select_window(struct sock *sk)
 	return(new_window);
 }
 
-/* Enter the time wait state. */
+/*
+ * The shift we ask the peer to apply to the windows we send: the
+ * smallest one that lets us offer half the receive buffer.
+ */
+static unsigned char tcp_select_wscale(struct sock *sk)
+{
+	unsigned long space = sk->rcvbuf / 2;
+	unsigned char wscale = 0;
+
+	while (space > 65535 && wscale < TCP_MAX_WSCALE) {
+		space >>= 1;
+		wscale++;
+	}
+	return(wscale);
+}
+
+/*
+ * Append the RFC1323 timestamp option to a header the caller has
+ * built, if both ends agreed to use them, and set doff to match.
+ * Returns the number of option bytes added.
+ */
+static int tcp_put_tstamp(struct tcphdr *th, unsigned long ts_recent)
+{
+	unsigned char *ptr;
+
+	ptr = (unsigned char *)(th + 1);
+	ptr[0] = TCPOPT_NOP;
+	ptr[1] = TCPOPT_NOP;
+	ptr[2] = TCPOPT_TIMESTAMP;
+	ptr[3] = TCPOLEN_TIMESTAMP;
+	*(unsigned long *)(ptr + 4) = htonl(jiffies);
+	*(unsigned long *)(ptr + 8) = htonl(ts_recent);
+	th->doff = (sizeof(*th) + TCPOLEN_TSTAMP_ALIGNED)/4;
+	return(TCPOLEN_TSTAMP_ALIGNED);
+}
+
+static int tcp_build_tstamp(struct sock *sk, struct tcphdr *th)
+{
+	th->doff = sizeof(*th)/4;
+	if (!sk->tstamp_ok)
+		return(0);
+	return(tcp_put_tstamp(th, sk->ts_recent));
+}
+
+/*
+ * Build the options carried by a SYN: our MSS and, if asked for,
+ * the window scale (wscale >= 0) and timestamps.  The MSS we
+ * advertise does not allow for our own options, so a caller that has
+ * already taken the timestamps off its mtu must add them back.
+ * Returns the option length.
+ */
+static int tcp_syn_options(unsigned char *ptr, unsigned short mss,
+			   int wscale, int tstamp, unsigned long ts_recent)
+{
+	unsigned char *start = ptr;
+
+	*ptr++ = TCPOPT_MSS;
+	*ptr++ = TCPOLEN_MSS;
+	*ptr++ = (mss >> 8) & 0xff;
+	*ptr++ = mss & 0xff;
+	if (wscale >= 0) {
+		*ptr++ = TCPOPT_NOP;
+		*ptr++ = TCPOPT_WINDOW;
+		*ptr++ = TCPOLEN_WINDOW;
+		*ptr++ = wscale;
+	}
+	if (tstamp) {
+		*ptr++ = TCPOPT_NOP;
+		*ptr++ = TCPOPT_NOP;
+		*ptr++ = TCPOPT_TIMESTAMP;
+		*ptr++ = TCPOLEN_TIMESTAMP;
+		*(unsigned long *)ptr = htonl(jiffies);
+		*(unsigned long *)(ptr + 4) = htonl(ts_recent);
+		ptr += 8;
+	}
+	return(ptr - start);
+}
 
+/*
+ * Pick the timestamp option out of an ordinary segment.  The peer's
+ * value is only kept for echoing if the segment starts at or before
+ * what we have acked, as RFC1323 asks.
+ */
+static void tcp_parse_tstamp(struct sock *sk, struct tcphdr *th)
+{
+	unsigned char *ptr = (unsigned char *)(th + 1);
+	int length = th->doff*4 - sizeof(struct tcphdr);
+
+	while (length >= TCPOLEN_TIMESTAMP) {
+		switch(*ptr) {
+			case TCPOPT_EOL:
+				return;
+			case TCPOPT_NOP:
+				ptr++;
+				length--;
+				continue;
+			case TCPOPT_TIMESTAMP:
+				if (ptr[1] != TCPOLEN_TIMESTAMP)
+					return;
+				if (!after(th->seq, sk->acked_seq))
+					sk->ts_recent = ntohl(*(unsigned long *)(ptr + 2));
+				sk->rcv_tsecr = ntohl(*(unsigned long *)(ptr + 6));
+				return;
+			default:
+				if (ptr[1] < 2)
+					return;
+				length -= ptr[1];
+				ptr += ptr[1];
+		}
+	}
+}
+
+static int tcp_tw_enter(struct sock *sk);
+
+/*
+ * Enter the time wait state.  A socket nobody holds any more is
+ * swapped for a TIME_WAIT record and closed straight away.
+ */
 static void tcp_time_wait(struct sock *sk)
 {
   sk->state = TCP_TIME_WAIT;
   sk->shutdown = SHUTDOWN_MASK;
   if (!sk->dead)
 	sk->state_change(sk);
+  if (sk->dead && tcp_tw_enter(sk))
+	return;
   reset_timer(sk, TIME_CLOSE, TCP_TIMEWAIT_LEN);
 }
 
@@ -231,6 +366,7 @@ tcp_retransmit(struct sock *sk, int all)
   sk->ssthresh = sk->cong_window >> 1; /* remember window where we lost */
   /* sk->ssthresh in theory can be zero.  I guess that's OK */
   sk->cong_count = 0;
+  sk->dup_acks = 0;	/* a timeout ends any fast recovery */
 
   sk->cong_window = 1;
 
@@ -239,6 +375,41 @@ tcp_retransmit(struct sock *sk, int all)
 }
 
 
+/*
+ * A router has told us (RFC 1191) that the path to our peer needs
+ * smaller datagrams, and icmp.c has noted the new MTU on the route.
+ * Size segments to it from now on.  Those already sent lose DF so
+ * that their retransmissions can be fragmented.
+ */
+static void
+tcp_pmtu_update(struct sock *sk)
+{
+  struct sk_buff *skb;
+  struct iphdr *iph;
+  int mtu, len;
+
+  mtu = rt_pmtu(sk->daddr) - HEADER_SIZE;
+  len = mtu + HEADER_SIZE;
+  if (sk->tstamp_ok)
+	mtu -= TCPOLEN_TSTAMP_ALIGNED;
+  if (mtu >= sk->mtu || mtu <= 0)
+	return;
+  sk->mtu = mtu;
+  sk->mss = min(sk->max_window, sk->mtu);
+
+  /* The queue may be changing under us if the socket is in use. */
+  if (sk->inuse)
+	return;
+  for (skb = sk->send_head; skb != NULL; skb = (struct sk_buff *) skb->link3) {
+	iph = skb->ip_hdr;
+	if (ntohs(iph->tot_len) > len && (iph->frag_off & htons(IP_DF))) {
+		iph->frag_off &= ~htons(IP_DF);
+		ip_send_check(iph);
+	}
+  }
+}
+
+
 /*
  * This routine is called by the ICMP module when it gets some
  * sort of error condition.  If err < 0 then the socket should
@@ -273,6 +444,11 @@ tcp_err(int err, unsigned char *header, unsigned long daddr,
   	return;
   }
 
+  if (err == ((ICMP_DEST_UNREACH << 8) | ICMP_FRAG_NEEDED)) {
+	tcp_pmtu_update(sk);
+	return;
+  }
+
   if ((err & 0xff00) == (ICMP_SOURCE_QUENCH << 8)) {
 	/*
 	 * FIXME:
@@ -527,61 +703,10 @@ unsigned short
 tcp_check(struct tcphdr *th, int len,
 	  unsigned long saddr, unsigned long daddr)
 {     
-  unsigned long sum;
-   
   if (saddr == 0) saddr = my_addr();
   print_th(th);
-  __asm__("\t addl %%ecx,%%ebx\n"
-	  "\t adcl %%edx,%%ebx\n"
-	  "\t adcl $0, %%ebx\n"
-	  : "=b"(sum)
-	  : "0"(daddr), "c"(saddr), "d"((ntohs(len) << 16) + IPPROTO_TCP*256)
-	  : "cx","bx","dx" );
-   
-  if (len > 3) {
-	__asm__("\tclc\n"
-		"1:\n"
-		"\t lodsl\n"
-		"\t adcl %%eax, %%ebx\n"
-		"\t loop 1b\n"
-		"\t adcl $0, %%ebx\n"
-		: "=b"(sum) , "=S"(th)
-		: "0"(sum), "c"(len/4) ,"1"(th)
-		: "ax", "cx", "bx", "si" );
-  }
-   
-  /* Convert from 32 bits to 16 bits. */
-  __asm__("\t movl %%ebx, %%ecx\n"
-	  "\t shrl $16,%%ecx\n"
-	  "\t addw %%cx, %%bx\n"
-	  "\t adcw $0, %%bx\n"
-	  : "=b"(sum)
-	  : "0"(sum)
-	  : "bx", "cx");
-   
-  /* Check for an extra word. */
-  if ((len & 2) != 0) {
-	__asm__("\t lodsw\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum), "=S"(th)
-		: "0"(sum) ,"1"(th)
-		: "si", "ax", "bx");
-  }
-   
-  /* Now check for the extra byte. */
-  if ((len & 1) != 0) {
-	__asm__("\t lodsb\n"
-		"\t movb $0,%%ah\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum)
-		: "0"(sum) ,"S"(th)
-		: "si", "ax", "bx");
-  }
-   
-  /* We only want the bottom 16 bits, but we never cleared the top 16. */
-  return((~sum) & 0xffff);
+  return(csum_tcpudp_magic(saddr, daddr, len, IPPROTO_TCP,
+			   csum_partial((unsigned char *) th, len, 0)));
 }
 
 
@@ -610,7 +735,7 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 	}
 
 	/* If we have queued a header size packet.. */
-	if (size == sizeof(struct tcphdr)) {
+	if (size == th->doff*4) {
 		/* If its got a syn or fin its notionally included in the size..*/
 		if(!th->syn && !th->fin) {
 			printk("tcp_send_skb: attempt to queue a bogon.\n");
@@ -619,8 +744,18 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 		}
 	}
   
-	/* We need to complete and send the packet. */
-	tcp_send_check(th, sk->saddr, sk->daddr, size, sk);
+	/* Carry the latest ACK: we may have been holding one back. */
+	if (th->ack)
+		th->ack_seq = htonl(sk->acked_seq);
+
+	/*
+	 * We need to complete and send the packet.  tcp_write() summed
+	 * the data as it copied it in, so only the header is left.
+	 */
+	th->check = 0;
+	th->check = csum_tcpudp_magic(sk->saddr ? sk->saddr : my_addr(),
+			sk->daddr, size, IPPROTO_TCP,
+			csum_partial((unsigned char *) th, th->doff*4, skb->csum));
 
 	skb->h.seq = ntohl(th->seq) + size - 4*th->doff;
 	if (after(skb->h.seq, sk->window_seq) ||
@@ -644,6 +779,11 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 		  reset_timer(sk, TIME_PROBE0, sk->rto);
 	} else {
 		sk->sent_seq = sk->write_seq;
+		if (sk->ack_backlog) {
+			tcp_statistics.TcpPiggyAcks++;
+			sk->ack_backlog = 0;
+			del_timer(&sk->delack_timer);
+		}
 		sk->prot->queue_xmit(sk, skb->dev, skb, 0);
 	}
 }
@@ -750,7 +890,7 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_ack: build_header failed\n");
   t1->seq = ntohl(sequence);
   t1->ack = 1;
   sk->window = tcp_select_window(sk);/*sk->prot->rspace(sk);*/
-  t1->window = ntohs(sk->window);
+  t1->window = ntohs(sk->window >> sk->rcv_wscale);
   t1->res1 = 0;
   t1->res2 = 0;
   t1->rst = 0;
@@ -762,6 +902,7 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_ack: build_header failed\n");
 	sk->ack_backlog = 0;
 	sk->bytes_rcv = 0;
 	sk->ack_timed = 0;
+	del_timer(&sk->delack_timer);
 	if (sk->send_head == NULL && sk->wfront == NULL && sk->timeout == TIME_WRITE) 
 	{
 		if(sk->keepopen)
@@ -771,10 +912,12 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_ack: build_header failed\n");
 	}
   }
   t1->ack_seq = ntohl(ack);
-  t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, daddr, sizeof(*t1)+tmp, sk);
   if (sk->debug)
   	 printk("\rtcp_ack: seq %lx ack %lx\n", sequence, ack);
+  tcp_statistics.TcpOutAcks++;
   sk->prot->queue_xmit(sk, dev, buff, 1);
 }
 
@@ -791,14 +934,12 @@ tcp_build_header(struct tcphdr *th, struct sock *sk, int push)
   th->doff = sizeof(*th)/4;
   th->ack = 1;
   th->fin = 0;
-  sk->ack_backlog = 0;
   sk->bytes_rcv = 0;
-  sk->ack_timed = 0;
   th->ack_seq = htonl(sk->acked_seq);
   sk->window = tcp_select_window(sk)/*sk->prot->rspace(sk)*/;
-  th->window = htons(sk->window);
+  th->window = htons(sk->window >> sk->rcv_wscale);
 
-  return(sizeof(*th));
+  return(sizeof(*th) + tcp_build_tstamp(sk, th));
 }
 
 /*
@@ -911,7 +1052,7 @@ tcp_write(struct sock *sk, unsigned char *from,
 
 	         /* IP header + TCP header */
 		hdrlen = ((unsigned long)skb->h.th - (unsigned long)skb->data)
-		         + sizeof(struct tcphdr);
+		         + skb->h.th->doff*4;
 
 		/* Add more stuff to the end of skb->len */
 		if (!(flags & MSG_OOB)) {
@@ -922,7 +1063,9 @@ tcp_write(struct sock *sk, unsigned char *from,
 			  copy = 0;
 			}
 	  
-			memcpy_fromfs(skb->data + skb->len, from, copy);
+			skb->csum = csum_block_add(skb->csum,
+				csum_partial_copy_fromfs(from, skb->data + skb->len, copy, 0),
+				skb->len - hdrlen);
 			skb->len += copy;
 			from += copy;
 			copied += copy;
@@ -1040,7 +1183,7 @@ tcp_write(struct sock *sk, unsigned char *from,
 		((struct tcphdr *)buff)->urg_ptr = ntohs(copy);
 	}
 	skb->len += tmp;
-	memcpy_fromfs(buff+tmp, from, copy);
+	skb->csum = csum_partial_copy_fromfs(from, buff+tmp, copy, 0);
 
 	from += copy;
 	copied += copy;
@@ -1150,15 +1293,62 @@ tcp_read_wakeup(struct sock *sk)
   t1->psh = 0;
   sk->ack_backlog = 0;
   sk->bytes_rcv = 0;
+  del_timer(&sk->delack_timer);
   sk->window = tcp_select_window(sk);/*sk->prot->rspace(sk);*/
-  t1->window = ntohs(sk->window);
+  t1->window = ntohs(sk->window >> sk->rcv_wscale);
   t1->ack_seq = ntohl(sk->acked_seq);
-  t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1)+tmp, sk);
+  tcp_statistics.TcpOutAcks++;
   sk->prot->queue_xmit(sk, dev, buff, 1);
 }
 
 
+/*
+ * The delayed ACK timer went off and no data went out to carry the
+ * ACK, so send it on its own.
+ */
+static void
+tcp_delack_timer(unsigned long data)
+{
+  struct sock *sk = (struct sock *) data;
+
+  if (!sk->ack_backlog) return;
+  if (sk->inuse || in_inet_bh()) {
+	sk->delack_timer.expires = 2;
+	add_timer(&sk->delack_timer);
+	return;
+  }
+  sk->inuse = 1;
+  tcp_statistics.TcpDelayedAcks++;
+  tcp_read_wakeup(sk);
+  release_sock(sk);
+}
+
+
+/*
+ * Hold back an ACK for up to TCP_DELACK_TIME in the hope that data
+ * going the other way can carry it.  An ACK already waiting keeps its
+ * deadline.
+ */
+static void
+tcp_delack(struct sock *sk)
+{
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  if (!del_timer(&sk->delack_timer) ||
+      sk->delack_timer.expires > TCP_DELACK_TIME)
+	sk->delack_timer.expires = TCP_DELACK_TIME;
+  sk->delack_timer.data = (unsigned long) sk;
+  sk->delack_timer.function = tcp_delack_timer;
+  add_timer(&sk->delack_timer);
+  restore_flags(flags);
+}
+
+
 /*
  * FIXME:
  * This routine frees used buffers.
@@ -1233,11 +1423,7 @@ cleanup_rbuf(struct sock *sk)
 		tcp_read_wakeup(sk);
 	} else {
 		/* Force it to send an ack soon. */
-		int was_active = del_timer(&sk->timer);
-		if (!was_active || TCP_ACK_TIME < sk->timer.expires) {
-			reset_timer(sk, TIME_WRITE, TCP_ACK_TIME);
-		} else
-			add_timer(&sk->timer);
+		tcp_delack(sk);
 	}
   }
 } 
@@ -1475,13 +1661,13 @@ tcp_shutdown(struct sock *sk, int how)
   prot =(struct proto *)sk->prot;
   th =(struct tcphdr *)&sk->dummy_th;
   release_sock(sk); /* incase the malloc sleeps. */
-  buff = prot->wmalloc(sk, MAX_RESET_SIZE,1 , GFP_KERNEL);
+  buff = prot->wmalloc(sk, MAX_FIN_SIZE,1 , GFP_KERNEL);
   if (buff == NULL) return;
   sk->inuse = 1;
 
   DPRINTF((DBG_TCP, "tcp_shutdown_send buff = %X\n", buff));
   buff->mem_addr = buff;
-  buff->mem_len = MAX_RESET_SIZE;
+  buff->mem_len = MAX_FIN_SIZE;
   buff->sk = sk;
   buff->len = sizeof(*t1);
   t1 =(struct tcphdr *) buff->data;
@@ -1512,11 +1698,13 @@ tcp_shutdown(struct sock *sk, int how)
   buff->h.seq = sk->write_seq;
   t1->ack = 1;
   t1->ack_seq = ntohl(sk->acked_seq);
-  t1->window = ntohs(sk->window=tcp_select_window(sk)/*sk->prot->rspace(sk)*/);
+  sk->window = tcp_select_window(sk)/*sk->prot->rspace(sk)*/;
+  t1->window = ntohs(sk->window >> sk->rcv_wscale);
   t1->fin = 1;
   t1->rst = 0;
-  t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1)+tmp, sk);
 
   /*
    * Can't just queue this up.
@@ -1647,89 +1835,590 @@ tcp_reset(unsigned long saddr, unsigned long daddr, struct tcphdr *th,
 }
 
 
-/*
- *	Look for tcp options. Parses everything but only knows about MSS.
- *      This routine is always called with the packet containing the SYN.
- *      However it may also be called with the ack to the SYN.  So you
- *      can't assume this is always the SYN.  It's always called after
- *      we have set up sk->mtu to our own MTU.
- */
- 
+/* What the options on a SYN said. */
+struct tcp_synopts {
+  unsigned short	mss;
+  unsigned char		wscale;
+  unsigned long		tsval;
+  unsigned long		tsecr;
+  char			mss_seen;
+  char			wscale_seen;
+  char			tstamp_seen;
+};
+
 static void
-tcp_options(struct sock *sk, struct tcphdr *th)
+tcp_syn_parse(struct tcphdr *th, struct tcp_synopts *o)
 {
   unsigned char *ptr;
   int length=(th->doff*4)-sizeof(struct tcphdr);
-  int mss_seen = 0;
-    
+
+  o->mss_seen = o->wscale_seen = o->tstamp_seen = 0;
   ptr = (unsigned char *)(th + 1);
   
   while(length>0)
   {
   	int opcode=*ptr++;
-  	int opsize=*ptr++;
+  	int opsize;
   	switch(opcode)
   	{
   		case TCPOPT_EOL:
-  			return;
-  		case TCPOPT_NOP:
-  			length-=2;
+  			length=0;
+  			continue;
+  		case TCPOPT_NOP:	/* a single byte, no length */
+  			length--;
   			continue;
   		
   		default:
-  			if(opsize<=2)	/* Avoid silly options looping forever */
-  				return;
+  			opsize=*ptr++;
+  			if(opsize<=2 || opsize>length)	/* Avoid silly options looping forever */
+  			{
+  				length=0;
+  				continue;
+  			}
   			switch(opcode)
   			{
   				case TCPOPT_MSS:
-  					if(opsize==4 && th->syn)
+  					if(opsize==TCPOLEN_MSS)
+  					{
+  						o->mss=ntohs(*(unsigned short *)ptr);
+						o->mss_seen = 1;
+  					}
+  					break;
+  				case TCPOPT_WINDOW:
+  					if(opsize==TCPOLEN_WINDOW)
   					{
-  						sk->mtu=min(sk->mtu,ntohs(*(unsigned short *)ptr));
-						mss_seen = 1;
+  						o->wscale=min(*ptr, TCP_MAX_WSCALE);
+  						o->wscale_seen = 1;
+  					}
+  					break;
+  				case TCPOPT_TIMESTAMP:
+  					if(opsize==TCPOLEN_TIMESTAMP)
+  					{
+  						o->tsval=ntohl(*(unsigned long *)ptr);
+  						o->tsecr=ntohl(*(unsigned long *)(ptr+4));
+  						o->tstamp_seen = 1;
   					}
   					break;
-  				/* Add other options here as people feel the urge to implement stuff like large windows */
   			}
   			ptr+=opsize-2;
   			length-=opsize;
   	}
   }
+}
+
+/*
+ *	Look for tcp options. Parses everything but only knows about MSS.
+ *      This routine is always called with the packet containing the SYN.
+ *      However it may also be called with the ack to the SYN.  So you
+ *      can't assume this is always the SYN.  It's always called after
+ *      we have set up sk->mtu to our own MTU.
+ */
+ 
+static void
+tcp_options(struct sock *sk, struct tcphdr *th)
+{
+  struct tcp_synopts o;
+
+  /* Only a SYN's options are looked at here. */
   if (th->syn) {
-    if (! mss_seen)
+    tcp_syn_parse(th, &o);
+    if (o.mss_seen)
+      sk->mtu=min(sk->mtu, o.mss);
+    else
       sk->mtu=min(sk->mtu, 536);  /* default MSS if none sent */
+    /* RFC1323 options are only used if both SYNs carried them */
+    sk->wscale_ok = o.wscale_seen;
+    if (o.wscale_seen)
+      sk->snd_wscale = o.wscale;
+    else
+      sk->snd_wscale = sk->rcv_wscale = 0;
+    if (o.tstamp_seen) {
+      sk->ts_recent = o.tsval;
+      sk->rcv_tsecr = o.tsecr;
+      if (! sk->tstamp_ok)
+        sk->mtu -= TCPOLEN_TSTAMP_ALIGNED;
+    }
+    sk->tstamp_ok = o.tstamp_seen;
   }
   sk->mss = min(sk->max_window, sk->mtu);
 }
 
-static inline unsigned long default_mask(unsigned long dst)
+/*
+ * The SYN queue.  A SYN to a listening socket gets an open_request
+ * here rather than a whole sock, and is only turned into a sock when
+ * the ACK for our SYN-ACK arrives.  The listener's rqueue, bounded by
+ * max_ack_backlog, then only holds connections ready to be accepted.
+ * One table serves all listeners; each keeps count of its own.  The
+ * timer changes it from a bottom half, so process context (backlog
+ * processing in release_sock) must hold interrupts off while using it.
+ */
+static struct open_request *tcp_synq_hash[TCP_SYNQ_HSIZE];
+static int tcp_synq_len = 0;
+static struct timer_list tcp_synq_timer;
+
+
+static inline int
+tcp_synq_hashfn(unsigned long raddr, unsigned short rport, unsigned short lport)
+{
+  return((raddr ^ (raddr >> 16) ^ rport ^ lport) & (TCP_SYNQ_HSIZE - 1));
+}
+
+
+/* Find the link that points at a request, or at the NULL ending its chain. */
+static struct open_request **
+tcp_synq_find(struct sock *sk, unsigned long raddr, unsigned short rport,
+	      unsigned long laddr)
+{
+  struct open_request **reqp, *req;
+
+  reqp = &tcp_synq_hash[tcp_synq_hashfn(raddr, rport, sk->dummy_th.source)];
+  while ((req = *reqp) != NULL) {
+	if (req->sk == sk && req->daddr == raddr &&
+	    req->dport == rport && req->saddr == laddr)
+		break;
+	reqp = &req->next;
+  }
+  return(reqp);
+}
+
+
+static void
+tcp_synq_unlink(struct open_request **reqp)
+{
+  struct open_request *req = *reqp;
+
+  *reqp = req->next;
+  req->sk->syn_backlog--;
+  tcp_synq_len--;
+}
+
+
+static void tcp_synq_ticker(unsigned long data);
+
+static void
+tcp_synq_kick(void)
 {
-	dst = ntohl(dst);
-	if (IN_CLASSA(dst))
-		return htonl(IN_CLASSA_NET);
-	if (IN_CLASSB(dst))
-		return htonl(IN_CLASSB_NET);
-	return htonl(IN_CLASSC_NET);
+  del_timer(&tcp_synq_timer);
+  tcp_synq_timer.expires = TCP_SYNQ_INTERVAL;
+  tcp_synq_timer.data = 0;
+  tcp_synq_timer.function = tcp_synq_ticker;
+  add_timer(&tcp_synq_timer);
 }
 
+
 /*
- * This routine handles a connection request.
- * It should make sure we haven't already responded.
- * Because of the way BSD works, we have to send a syn/ack now.
- * This also means it will be harder to close a socket which is
- * listening.
+ * Answer a SYN.  The listener pays for the buffer, and it is freed
+ * once sent: the SYN queue timer does the retransmitting.
  */
 static void
-tcp_conn_request(struct sock *sk, struct sk_buff *skb,
-		 unsigned long daddr, unsigned long saddr,
-		 struct options *opt, struct device *dev)
+tcp_send_synack(struct sock *sk, struct open_request *req)
 {
   struct sk_buff *buff;
   struct tcphdr *t1;
+  struct device *dev = NULL;
   unsigned char *ptr;
-  struct sock *newsk;
-  struct tcphdr *th;
   int tmp;
 
+  buff = sk->prot->wmalloc(sk, MAX_SYN_SIZE, 1, GFP_ATOMIC);
+  if (buff == NULL) return;
+
+  buff->mem_addr = buff;
+  buff->mem_len = MAX_SYN_SIZE;
+  buff->len = sizeof(struct tcphdr);
+  buff->sk = sk;
+  buff->free = 1;
+  t1 =(struct tcphdr *) buff->data;
+
+  /* Put in the IP header and routing stuff. */
+  tmp = sk->prot->build_header(buff, req->saddr, req->daddr, &dev,
+			       IPPROTO_TCP, NULL, MAX_SYN_SIZE, req->ip_tos, sk->ip_ttl);
+  if (tmp < 0) {
+	kfree_skb(buff, FREE_WRITE);
+	return;
+  }
+
+  buff->len += tmp;
+  t1 =(struct tcphdr *)((char *)t1 +tmp);
+
+  memset(t1, 0, sizeof(*t1));
+  t1->source = req->sport;
+  t1->dest = req->dport;
+  t1->seq = ntohl(req->snt_isn);
+  t1->ack_seq = ntohl(req->rcv_isn + 1);
+  t1->syn = 1;
+  t1->ack = 1;
+  /* The window in a SYN is never scaled. */
+  t1->window = ntohs(req->window);
+
+  /* Echo back only the RFC1323 options the peer offered. */
+  ptr =(unsigned char *)(t1+1);
+  tmp = tcp_syn_options(ptr,
+	req->mtu + (req->tstamp_ok ? TCPOLEN_TSTAMP_ALIGNED : 0),
+	req->wscale_ok ? req->rcv_wscale : -1, req->tstamp_ok, req->ts_recent);
+  t1->doff = (sizeof(*t1) + tmp)/4;
+  buff->len += tmp;
+
+  tcp_send_check(t1, req->saddr, req->daddr, sizeof(*t1)+tmp, sk);
+  sk->prot->queue_xmit(sk, dev, buff, 1);
+}
+
+
+/* Resend the SYN-ACKs that are due, and give up on hopeless ones. */
+static void
+tcp_synq_ticker(unsigned long data)
+{
+  struct open_request *req, **reqp;
+  int i;
+
+  for (i = 0; i < TCP_SYNQ_HSIZE; i++) {
+	reqp = &tcp_synq_hash[i];
+	while ((req = *reqp) != NULL) {
+		/* A listener in use may be changing the queue: next tick. */
+		if ((long)(req->expires - jiffies) > 0 || req->sk->inuse) {
+			reqp = &req->next;
+			continue;
+		}
+		if (req->retrans >= TCP_SYNACK_RETRIES) {
+			tcp_synq_unlink(reqp);
+			tcp_statistics.TcpAttemptFails++;
+			kfree_s(req, sizeof(*req));
+			continue;
+		}
+		req->retrans++;
+		req->expires = jiffies + (TCP_SYNACK_TIME << req->retrans);
+		tcp_send_synack(req->sk, req);
+		reqp = &req->next;
+	}
+  }
+  if (tcp_synq_len) tcp_synq_kick();
+}
+
+
+/* The listener is going away: forget its half-open connections. */
+static void
+tcp_synq_flush(struct sock *sk)
+{
+  struct open_request *req, **reqp;
+  int i;
+
+  cli();
+  for (i = 0; i < TCP_SYNQ_HSIZE && sk->syn_backlog; i++) {
+	reqp = &tcp_synq_hash[i];
+	while ((req = *reqp) != NULL) {
+		if (req->sk != sk) {
+			reqp = &req->next;
+			continue;
+		}
+		tcp_synq_unlink(reqp);
+		kfree_s(req, sizeof(*req));
+	}
+  }
+  sti();
+}
+
+
+
+/*
+ * TIME_WAIT records.  Once a connection in TIME_WAIT has been closed
+ * by its owner the sock goes, and a tcp_tw_bucket stands in for it
+ * until 2*MSL is up.  Segments for it are checked against this table
+ * before they can reach a listener or draw a reset.
+ */
+static struct tcp_tw_bucket *tcp_tw_hash[TCP_TW_HSIZE];
+static int tcp_tw_count = 0;
+static struct timer_list tcp_tw_timer;
+
+
+static inline int
+tcp_tw_hashfn(unsigned long raddr, unsigned short rport, unsigned short lport)
+{
+  return((raddr ^ (raddr >> 16) ^ rport ^ lport) & (TCP_TW_HSIZE - 1));
+}
+
+
+/* Find the link that points at a record, or at the NULL ending its chain. */
+static struct tcp_tw_bucket **
+tcp_tw_find(unsigned long laddr, unsigned short lport,
+	    unsigned long raddr, unsigned short rport)
+{
+  struct tcp_tw_bucket **twp, *tw;
+
+  twp = &tcp_tw_hash[tcp_tw_hashfn(raddr, rport, lport)];
+  while ((tw = *twp) != NULL) {
+	if (tw->daddr == raddr && tw->dport == rport &&
+	    tw->saddr == laddr && tw->sport == lport)
+		break;
+	twp = &tw->next;
+  }
+  return(twp);
+}
+
+
+static void
+tcp_tw_kill(struct tcp_tw_bucket **twp)
+{
+  struct tcp_tw_bucket *tw = *twp;
+
+  *twp = tw->next;
+  tcp_tw_count--;
+  kfree_s(tw, sizeof(*tw));
+}
+
+
+static void tcp_tw_ticker(unsigned long data);
+
+static void
+tcp_tw_kick(void)
+{
+  del_timer(&tcp_tw_timer);
+  tcp_tw_timer.expires = TCP_TW_INTERVAL;
+  tcp_tw_timer.data = 0;
+  tcp_tw_timer.function = tcp_tw_ticker;
+  add_timer(&tcp_tw_timer);
+}
+
+
+/* Forget the records whose 2*MSL is up. */
+static void
+tcp_tw_ticker(unsigned long data)
+{
+  struct tcp_tw_bucket *tw, **twp;
+  int i;
+
+  for (i = 0; i < TCP_TW_HSIZE; i++) {
+	twp = &tcp_tw_hash[i];
+	while ((tw = *twp) != NULL) {
+		if ((long)(tw->expires - jiffies) > 0)
+			twp = &tw->next;
+		else
+			tcp_tw_kill(twp);
+	}
+  }
+  if (tcp_tw_count) tcp_tw_kick();
+}
+
+
+/*
+ * Swap a dead socket in TIME_WAIT for a record, and close it.  If
+ * there is no memory for the record the sock just stays as it is.
+ */
+static int
+tcp_tw_enter(struct sock *sk)
+{
+  struct tcp_tw_bucket *tw, **twp;
+  unsigned long flags;
+
+  tw = (struct tcp_tw_bucket *) kmalloc(sizeof(*tw), GFP_ATOMIC);
+  if (tw == NULL) return(0);
+
+  tw->saddr = sk->saddr;
+  tw->daddr = sk->daddr;
+  tw->sport = sk->dummy_th.source;
+  tw->dport = sk->dummy_th.dest;
+  tw->snd_nxt = sk->write_seq;
+  tw->rcv_nxt = sk->acked_seq;
+  tw->ts_recent = sk->ts_recent;
+  tw->tstamp_ok = sk->tstamp_ok;
+  tw->window = sk->window >> sk->rcv_wscale;
+  tw->ip_tos = sk->ip_tos;
+  tw->ip_ttl = sk->ip_ttl;
+  tw->expires = jiffies + TCP_TIMEWAIT_LEN;
+
+  save_flags(flags);
+  cli();
+  twp = &tcp_tw_hash[tcp_tw_hashfn(tw->daddr, tw->dport, tw->sport)];
+  tw->next = *twp;
+  *twp = tw;
+  if (tcp_tw_count++ == 0)
+	tcp_tw_kick();
+  restore_flags(flags);
+
+  /* release_sock() will see it dead and closed, and destroy it. */
+  sk->state = TCP_CLOSE;
+  return(1);
+}
+
+
+/* Ack a segment for a connection we only have a record of. */
+static void
+tcp_tw_send_ack(struct tcp_tw_bucket *tw, struct device *dev, struct options *opt)
+{
+  struct sk_buff *buff;
+  struct tcphdr *t1;
+  int tmp;
+
+  buff = tcp_prot.wmalloc(NULL, MAX_ACK_SIZE, 1, GFP_ATOMIC);
+  if (buff == NULL)
+	return;
+
+  buff->mem_addr = buff;
+  buff->mem_len = MAX_ACK_SIZE;
+  buff->len = sizeof(*t1);
+  buff->sk = NULL;
+  buff->dev = dev;
+  t1 =(struct tcphdr *) buff->data;
+
+  /* Put in the IP header and routing stuff. */
+  tmp = tcp_prot.build_header(buff, tw->saddr, tw->daddr, &dev, IPPROTO_TCP,
+			      opt, MAX_ACK_SIZE, tw->ip_tos, tw->ip_ttl);
+  if (tmp < 0) {
+	buff->free = 1;
+	tcp_prot.wfree(NULL, buff->mem_addr, buff->mem_len);
+	return;
+  }
+  t1 =(struct tcphdr *)((char *)t1 +tmp);
+  buff->len += tmp;
+
+  memset(t1, 0, sizeof(*t1));
+  t1->source = tw->sport;
+  t1->dest = tw->dport;
+  t1->seq = htonl(tw->snd_nxt);
+  t1->ack_seq = htonl(tw->rcv_nxt);
+  t1->ack = 1;
+  t1->window = htons(tw->window);
+  t1->doff = sizeof(*t1)/4;
+  tmp = 0;
+  if (tw->tstamp_ok)
+	tmp = tcp_put_tstamp(t1, tw->ts_recent);
+  buff->len += tmp;
+
+  tcp_send_check(t1, tw->saddr, tw->daddr, sizeof(*t1)+tmp, NULL);
+  tcp_statistics.TcpOutAcks++;
+  tcp_prot.queue_xmit(NULL, dev, buff, 1);
+}
+
+
+/*
+ * A segment for a connection in TIME_WAIT.  A retransmitted FIN, or
+ * anything with data, gets our last ACK again.  Resets are ignored
+ * (RFC 1337).  A SYN beyond the old sequence space ends TIME_WAIT
+ * early and is passed back for the listener (RFC 1122 4.2.2.13);
+ * returns 0 then, and 1 when the segment has been dealt with.
+ */
+static int
+tcp_tw_rcv(struct tcp_tw_bucket **twp, struct sk_buff *skb,
+	   struct device *dev, struct options *opt, int len)
+{
+  struct tcp_tw_bucket *tw = *twp;
+  struct tcphdr *th = skb->h.th;
+
+  if (th->syn && !th->ack && !th->rst && after(th->seq, tw->rcv_nxt)) {
+	tcp_tw_kill(twp);
+	return(0);
+  }
+
+  if (!th->rst) {
+	if (th->fin)
+		tw->expires = jiffies + TCP_TIMEWAIT_LEN;
+	if (th->fin || th->syn || len > th->doff*4)
+		tcp_tw_send_ack(tw, dev, opt);
+  }
+  skb->sk = NULL;
+  kfree_skb(skb, FREE_READ);
+  return(1);
+}
+
+
+/*
+ * connect() to a peer we still have a TIME_WAIT record for on the
+ * same ports.  Start the new sequence space well past the old one and
+ * drop the record.
+ */
+static void
+tcp_tw_recycle(struct sock *sk)
+{
+  struct tcp_tw_bucket *tw, **twp;
+  unsigned long flags;
+
+  if (!tcp_tw_count) return;
+  save_flags(flags);
+  cli();
+  twp = &tcp_tw_hash[tcp_tw_hashfn(sk->daddr, sk->dummy_th.dest,
+				   sk->dummy_th.source)];
+  while ((tw = *twp) != NULL) {
+	if (tw->daddr == sk->daddr && tw->dport == sk->dummy_th.dest &&
+	    tw->sport == sk->dummy_th.source &&
+	    (sk->saddr == 0 || tw->saddr == sk->saddr)) {
+		if (before(sk->write_seq, tw->snd_nxt + 65535 + 2))
+			sk->write_seq = tw->snd_nxt + 65535 + 2;
+		tcp_tw_kill(twp);
+		continue;
+	}
+	twp = &tw->next;
+  }
+  restore_flags(flags);
+}
+
+
+/* Is a local port still held by a TIME_WAIT record?  For bind(). */
+int
+tcp_tw_bound(unsigned short num, unsigned long saddr)
+{
+  struct tcp_tw_bucket *tw;
+  unsigned long flags;
+  int i;
+
+  if (!tcp_tw_count) return(0);
+  save_flags(flags);
+  cli();
+  for (i = 0; i < TCP_TW_HSIZE; i++) {
+	for (tw = tcp_tw_hash[i]; tw != NULL; tw = tw->next) {
+		if (tw->sport == htons(num) &&
+		    (saddr == 0 || tw->saddr == 0 || tw->saddr == saddr)) {
+			restore_flags(flags);
+			return(1);
+		}
+	}
+  }
+  restore_flags(flags);
+  return(0);
+}
+
+
+/*
+ * The TIME_WAIT records for /proc/net/tcp, in the same format as the
+ * sockets.  Returns the length written, which stays under length.
+ */
+int
+tcp_tw_get_info(char *buffer, int length)
+{
+  struct tcp_tw_bucket *tw;
+  char *pos = buffer;
+  int i;
+
+  *pos = '\0';
+  cli();
+  for (i = 0; i < TCP_TW_HSIZE; i++) {
+	for (tw = tcp_tw_hash[i]; tw != NULL; tw = tw->next) {
+		if (pos + 128 > buffer + length)
+			goto out;
+		pos += sprintf(pos, "%2d: %08lX:%04X %08lX:%04X %02X %08lX:%08lX %02X:%08lX %08X %d %lu %lu\n",
+			i, tw->saddr, ntohs(tw->sport), tw->daddr, ntohs(tw->dport),
+			TCP_TIME_WAIT, 0UL, 0UL, 1, tw->expires - jiffies, 0, 0,
+			0UL, 0UL);
+	}
+  }
+out:
+  sti();
+  return(pos - buffer);
+}
+
+/*
+ * This routine handles a connection request.  All we keep is an
+ * open_request, and we answer with a SYN-ACK right away.  A repeat of
+ * a SYN we already know just gets the SYN-ACK again.
+ */
+static void
+tcp_conn_request(struct sock *sk, struct sk_buff *skb,
+		 unsigned long daddr, unsigned long saddr,
+		 struct options *opt, struct device *dev)
+{
+  struct open_request *req, **reqp, old;
+  struct tcp_synopts o;
+  struct tcphdr *th;
+  unsigned short mtu;
+  unsigned long flags;
+
   DPRINTF((DBG_TCP, "tcp_conn_request(sk = %X, skb = %X, daddr = %X, sadd4= %X, \n"
 	  "                  opt = %X, dev = %X)\n",
 	  sk, skb, daddr, saddr, opt, dev));
@@ -1737,43 +2426,160 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   th = skb->h.th;
 
   /* If the socket is dead, don't accept the connection. */
-  if (!sk->dead) {
-  	sk->data_ready(sk,0);
-  } else {
+  if (sk->dead) {
 	DPRINTF((DBG_TCP, "tcp_conn_request on dead socket\n"));
 	tcp_reset(daddr, saddr, th, sk->prot, opt, dev, sk->ip_tos,sk->ip_ttl);
 	kfree_skb(skb, FREE_READ);
 	return;
   }
 
+  /* A retransmitted SYN: answer it from a copy, the timer may free it. */
+  save_flags(flags);
+  cli();
+  reqp = tcp_synq_find(sk, saddr, th->source, daddr);
+  if (*reqp != NULL) {
+	old = **reqp;
+	restore_flags(flags);
+	tcp_send_synack(sk, &old);
+	kfree_skb(skb, FREE_READ);
+	return;
+  }
+  restore_flags(flags);
+
   /*
-   * Make sure we can accept more.  This will prevent a
-   * flurry of syns from eating up all our memory.
+   * Make sure we can accept more.  There is no point starting a
+   * handshake we have no room to finish, and the SYN queue is bounded
+   * so a flurry of syns can't eat up all our memory.
    */
   if (sk->ack_backlog >= sk->max_ack_backlog) {
+	tcp_statistics.TcpListenOverflows++;
+	tcp_statistics.TcpListenDrops++;
+	kfree_skb(skb, FREE_READ);
+	return;
+  }
+  if (sk->syn_backlog >= TCP_MAX_SYN_BACKLOG) {
+	tcp_statistics.TcpListenDrops++;
+	kfree_skb(skb, FREE_READ);
+	return;
+  }
+
+  req = (struct open_request *) kmalloc(sizeof(*req), GFP_ATOMIC);
+  if (req == NULL) {
+	/* just ignore the syn.  It will get retransmitted. */
+	tcp_statistics.TcpListenDrops++;
 	kfree_skb(skb, FREE_READ);
 	return;
   }
 
+  /* Swap the addresses, they are from our point of view. */
+  req->sk = sk;
+  req->saddr = daddr;
+  req->daddr = saddr;
+  req->sport = th->dest;
+  req->dport = th->source;
+  req->rcv_isn = th->seq;
+  req->snt_isn = jiffies * SEQ_TICK - seq_offset;
+  req->ip_tos = skb->ip_hdr->tos;
+  req->retrans = 0;
+  req->expires = jiffies + TCP_SYNACK_TIME;
+
+/* use whatever user asked for, or what fits the path */
+  if (sk->user_mss)
+    mtu = sk->user_mss;
+  else
+    mtu = MAX_WINDOW;
+/* but not bigger than the path MTU, as far as we know it */
+  mtu = min(mtu, min(dev->mtu, rt_pmtu(saddr)) - HEADER_SIZE);
+
+/* this will min with what arrived in the packet, as tcp_options() does */
+  tcp_syn_parse(th, &o);
+  req->mtu = min(mtu, o.mss_seen ? o.mss : 536);
+  req->wscale_ok = o.wscale_seen;
+  req->rcv_wscale = o.wscale_seen ? tcp_select_wscale(sk) : 0;
+  req->snd_wscale = o.wscale_seen ? o.wscale : 0;
+  req->tstamp_ok = o.tstamp_seen;
+  req->ts_recent = o.tstamp_seen ? o.tsval : 0;
+  if (o.tstamp_seen)
+    req->mtu -= TCPOLEN_TSTAMP_ALIGNED;
+
+  req->window = sk->prot->rspace(sk);
+  if (req->window > 65535)
+	req->window = 65535;
+
+  save_flags(flags);
+  cli();
+  reqp = tcp_synq_find(sk, saddr, th->source, daddr);
+  req->next = *reqp;
+  *reqp = req;
+  sk->syn_backlog++;
+  if (tcp_synq_len++ == 0)
+	tcp_synq_kick();
+  restore_flags(flags);
+
+  tcp_send_synack(sk, req);
+  kfree_skb(skb, FREE_READ);
+}
+
+
+/*
+ * An ACK to a listening socket.  If it completes a handshake, build
+ * the sock for the connection, queue it for accept() and let it deal
+ * with the segment itself, as that may already carry data.  Returns 0
+ * if there was no such handshake, 1 if the segment has been used.
+ */
+static int
+tcp_conn_ack(struct sock *sk, struct sk_buff *skb,
+	     unsigned long daddr, unsigned long saddr,
+	     struct options *opt, struct device *dev, unsigned short len)
+{
+  struct open_request *req, **reqp;
+  struct sk_buff *qskb;
+  struct sock *newsk;
+  struct tcphdr *th;
+  unsigned long flags;
+
+  th = skb->h.th;
+  save_flags(flags);
+  cli();
+  reqp = tcp_synq_find(sk, saddr, th->source, daddr);
+  req = *reqp;
+  if (req == NULL || ntohl(th->ack_seq) != req->snt_isn + 1) {
+	restore_flags(flags);
+	return(0);
+  }
+
+  /* No room: drop the ACK and let the peer try again. */
+  if (sk->ack_backlog >= sk->max_ack_backlog) {
+	restore_flags(flags);
+	tcp_statistics.TcpListenOverflows++;
+	kfree_skb(skb, FREE_READ);
+	return(1);
+  }
+
   /*
-   * We need to build a new sock struct.
    * It is sort of bad to have a socket without an inode attached
    * to it, but the wake_up's will just wake up the listening socket,
    * and if the listening socket is destroyed before this is taken
    * off of the queue, this will take care of it.
    */
   newsk = (struct sock *) kmalloc(sizeof(struct sock), GFP_ATOMIC);
-  if (newsk == NULL) {
-	/* just ignore the syn.  It will get retransmitted. */
+  qskb = alloc_skb(sizeof(struct sk_buff), GFP_ATOMIC);
+  if (newsk == NULL || qskb == NULL) {
+	restore_flags(flags);
+	if (newsk != NULL) kfree_s(newsk, sizeof(struct sock));
+	if (qskb != NULL) kfree_skb(qskb, FREE_READ);
 	kfree_skb(skb, FREE_READ);
-	return;
+	return(1);
   }
+  tcp_synq_unlink(reqp);
+  restore_flags(flags);
 
   DPRINTF((DBG_TCP, "newsk = %X\n", newsk));
   memcpy((void *)newsk,(void *)sk, sizeof(*newsk));
   newsk->wback = NULL;
   newsk->wfront = NULL;
   newsk->rqueue = NULL;
+  newsk->ofo_queue = NULL;
   newsk->send_head = NULL;
   newsk->send_tail = NULL;
   newsk->back_log = NULL;
@@ -1784,6 +2590,9 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   newsk->cong_window = 1;
   newsk->cong_count = 0;
   newsk->ssthresh = 0;
+  newsk->dup_acks = 0;
+  newsk->retrans_segs = 0;
+  newsk->fast_retrans = 0;
   newsk->backoff = 0;
   newsk->blog = 0;
   newsk->intr = 0;
@@ -1799,27 +2608,26 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   newsk->err = 0;
   newsk->shutdown = 0;
   newsk->ack_backlog = 0;
-  newsk->acked_seq = skb->h.th->seq+1;
-  newsk->fin_seq = skb->h.th->seq;
-  newsk->copied_seq = skb->h.th->seq;
+  newsk->syn_backlog = 0;
+  newsk->acked_seq = req->rcv_isn + 1;
+  newsk->fin_seq = req->rcv_isn;
+  newsk->copied_seq = req->rcv_isn;
   newsk->state = TCP_SYN_RECV;
   newsk->timeout = 0;
-  newsk->write_seq = jiffies * SEQ_TICK - seq_offset;
-  newsk->window_seq = newsk->write_seq;
-  newsk->rcv_ack_seq = newsk->write_seq;
+  newsk->write_seq = req->snt_isn + 1;
+  newsk->sent_seq = newsk->write_seq;
+  newsk->window_seq = req->snt_isn;
+  newsk->rcv_ack_seq = req->snt_isn;
   newsk->urg_data = 0;
   newsk->retransmits = 0;
   newsk->destroy = 0;
   newsk->timer.data = (unsigned long)newsk;
   newsk->timer.function = &net_timer;
-  newsk->dummy_th.source = skb->h.th->dest;
-  newsk->dummy_th.dest = skb->h.th->source;
-
-  /* Swap these two, they are from our point of view. */
-  newsk->daddr = saddr;
-  newsk->saddr = daddr;
+  newsk->dummy_th.source = req->sport;
+  newsk->dummy_th.dest = req->dport;
+  newsk->daddr = req->daddr;
+  newsk->saddr = req->saddr;
 
-  put_sock(newsk->num,newsk);
   newsk->dummy_th.res1 = 0;
   newsk->dummy_th.doff = 6;
   newsk->dummy_th.fin = 0;
@@ -1829,107 +2637,41 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   newsk->dummy_th.ack = 0;
   newsk->dummy_th.urg = 0;
   newsk->dummy_th.res2 = 0;
-  newsk->acked_seq = skb->h.th->seq + 1;
-  newsk->copied_seq = skb->h.th->seq;
 
   /* Grab the ttl and tos values and use them */
   newsk->ip_ttl=sk->ip_ttl;
-  newsk->ip_tos=skb->ip_hdr->tos;
-
-/* use 512 or whatever user asked for */
-/* note use of sk->user_mss, since user has no direct access to newsk */
-  if (sk->user_mss)
-    newsk->mtu = sk->user_mss;
-  else {
-#ifdef SUBNETSARELOCAL
-    if ((saddr ^ daddr) & default_mask(saddr))
-#else
-    if ((saddr ^ daddr) & dev->pa_mask)
-#endif
-      newsk->mtu = 576 - HEADER_SIZE;
-    else
-      newsk->mtu = MAX_WINDOW;
-  }
-/* but not bigger than device MTU */
-  newsk->mtu = min(newsk->mtu, dev->mtu - HEADER_SIZE);
-
-/* this will min with what arrived in the packet */
-  tcp_options(newsk,skb->h.th);
-
-  buff = newsk->prot->wmalloc(newsk, MAX_SYN_SIZE, 1, GFP_ATOMIC);
-  if (buff == NULL) {
-	sk->err = -ENOMEM;
-	newsk->dead = 1;
-	release_sock(newsk);
-	kfree_skb(skb, FREE_READ);
-	return;
-  }
-  
-  buff->mem_addr = buff;
-  buff->mem_len = MAX_SYN_SIZE;
-  buff->len = sizeof(struct tcphdr)+4;
-  buff->sk = newsk;
-  
-  t1 =(struct tcphdr *) buff->data;
-
-  /* Put in the IP header and routing stuff. */
-  tmp = sk->prot->build_header(buff, newsk->saddr, newsk->daddr, &dev,
-			       IPPROTO_TCP, NULL, MAX_SYN_SIZE,sk->ip_tos,sk->ip_ttl);
-
-  /* Something went wrong. */
-  if (tmp < 0) {
-	sk->err = tmp;
-	buff->free=1;
-	kfree_skb(buff,FREE_WRITE);
-	newsk->dead = 1;
-	release_sock(newsk);
-	skb->sk = sk;
-	kfree_skb(skb, FREE_READ);
-	return;
-  }
-
-  buff->len += tmp;
-  t1 =(struct tcphdr *)((char *)t1 +tmp);
-  
-  memcpy(t1, skb->h.th, sizeof(*t1));
-  buff->h.seq = newsk->write_seq;
-
-  /* Swap the send and the receive. */
-  t1->dest = skb->h.th->source;
-  t1->source = newsk->dummy_th.source;
-  t1->seq = ntohl(newsk->write_seq++);
-  t1->ack = 1;
-  newsk->window = tcp_select_window(newsk);/*newsk->prot->rspace(newsk);*/
-  newsk->sent_seq = newsk->write_seq;
-  t1->window = ntohs(newsk->window);
-  t1->res1 = 0;
-  t1->res2 = 0;
-  t1->rst = 0;
-  t1->urg = 0;
-  t1->psh = 0;
-  t1->syn = 1;
-  t1->ack_seq = ntohl(skb->h.th->seq+1);
-  t1->doff = sizeof(*t1)/4+1;
-
-  ptr =(unsigned char *)(t1+1);
-  ptr[0] = 2;
-  ptr[1] = 4;
-  ptr[2] = ((newsk->mtu) >> 8) & 0xff;
-  ptr[3] =(newsk->mtu) & 0xff;
-
-  tcp_send_check(t1, daddr, saddr, sizeof(*t1)+4, newsk);
-  newsk->prot->queue_xmit(newsk, dev, buff, 0);
+  newsk->ip_tos=req->ip_tos;
+  newsk->ip_mc_list=NULL;	/* the groups stay with the listener */
+
+  /* What was agreed on in the SYN and SYN-ACK. */
+  newsk->mtu = req->mtu;
+  newsk->mss = min(newsk->max_window, newsk->mtu);
+  newsk->window = req->window;
+  newsk->wscale_ok = req->wscale_ok;
+  newsk->snd_wscale = req->snd_wscale;
+  newsk->rcv_wscale = req->rcv_wscale;
+  newsk->tstamp_ok = req->tstamp_ok;
+  newsk->ts_recent = req->ts_recent;
+  kfree_s(req, sizeof(*req));
+
+  newsk->inuse = 1;
+  put_sock(newsk->num,newsk);
 
-  reset_timer(newsk, TIME_WRITE /* -1 ? FIXME ??? */, TCP_CONNECT_TIME);
-  skb->sk = newsk;
+  /* Queue it for accept(), charging the queue entry to newsk. */
+  qskb->sk = newsk;
+  qskb->len = 0;
+  qskb->free = 1;
+  newsk->rmem_alloc += qskb->mem_len;
+  skb_queue_tail(&sk->rqueue, qskb);
+  sk->ack_backlog++;
+  tcp_statistics.TcpPassiveOpens++;
+  sk->data_ready(sk,0);
 
-  /* Charge the sock_buff to newsk. */
+  /* Hand the segment to the new sock; it moves it on to ESTABLISHED. */
   sk->rmem_alloc -= skb->mem_len;
-  newsk->rmem_alloc += skb->mem_len;
-
-  skb_queue_tail(&sk->rqueue,skb);
-  sk->ack_backlog++;
-  release_sock(newsk);
+  skb->sk = newsk;
+  tcp_rcv(skb, dev, opt, daddr, len, saddr, 1, NULL);
+  return(1);
 }
 
 
@@ -1963,7 +2705,12 @@ tcp_close(struct sock *sk, int timeout)
 		printk("Clean rcv queue\n");
 	while((skb=skb_dequeue(&sk->rqueue))!=NULL)
 	{
-		if(skb->len > 0 && after(skb->h.th->seq + skb->len + 1 , sk->copied_seq))
+		/* A listener's queue holds connections nobody accepted. */
+		if (skb->sk != NULL && skb->sk != sk) {
+			skb->sk->dead = 1;
+			skb->sk->prot->close(skb->sk, 0);
+		}
+		else if(skb->len > 0 && after(skb->h.th->seq + skb->len + 1 , sk->copied_seq))
 				need_reset = 1;
 		kfree_skb(skb, FREE_READ);
 	}
@@ -1972,6 +2719,15 @@ tcp_close(struct sock *sk, int timeout)
   }
   sk->rqueue = NULL;
 
+  /* Out of order data was never readable, but it is still unread. */
+  if (skb_peek(&sk->ofo_queue) != NULL)
+  {
+	struct sk_buff *skb;
+	while((skb=skb_dequeue(&sk->ofo_queue))!=NULL)
+		kfree_skb(skb, FREE_READ);
+	need_reset = 1;
+  }
+
   /* Get rid off any half-completed packets. */
   if (sk->partial) {
 	tcp_send_partial(sk);
@@ -1991,12 +2747,13 @@ tcp_close(struct sock *sk, int timeout)
 		release_sock(sk);
 		return;	/* break causes a double release - messy */
 	case TCP_TIME_WAIT:
-		if (timeout) {
+		if (timeout || tcp_tw_enter(sk)) {
 		  sk->state = TCP_CLOSE;
 		}
 		release_sock(sk);
 		return;
 	case TCP_LISTEN:
+		tcp_synq_flush(sk);
 		sk->state = TCP_CLOSE;
 		release_sock(sk);
 		return;
@@ -2057,11 +2814,13 @@ tcp_close(struct sock *sk, int timeout)
 		/* Ack everything immediately from now on. */
 		sk->delay_acks = 0;
 		t1->ack_seq = ntohl(sk->acked_seq);
-		t1->window = ntohs(sk->window=tcp_select_window(sk)/*sk->prot->rspace(sk)*/);
+		sk->window = tcp_select_window(sk)/*sk->prot->rspace(sk)*/;
+		t1->window = ntohs(sk->window >> sk->rcv_wscale);
 		t1->fin = 1;
 		t1->rst = need_reset;
-		t1->doff = sizeof(*t1)/4;
-		tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+		tmp = tcp_build_tstamp(sk, t1);
+		buff->len += tmp;
+		tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1)+tmp, sk);
 
 		if (sk->wfront == NULL) {
 			sk->sent_seq = sk->write_seq;
@@ -2175,24 +2934,30 @@ static int
 tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 {
   unsigned long ack;
+  unsigned long window;
   int flag = 0;
   /* 
    * 1 - there was data in packet as well as ack or new data is sent or 
    *     in shutdown state
    * 2 - data from retransmit queue was acked and removed
    * 4 - window shrunk or data from retransmit queue was acked and removed
+   * 8 - partial ack during fast recovery, head of queue needs resending
    */
 
   if(sk->zapped)
 	return(1);	/* Dead, cant ack any more so why bother */
 
   ack = ntohl(th->ack_seq);
+  /* The window in a SYN is never scaled. */
+  window = ntohs(th->window);
+  if (!th->syn)
+	window <<= sk->snd_wscale;
   DPRINTF((DBG_TCP, "tcp_ack ack=%d, window=%d, "
 	  "sk->rcv_ack_seq=%d, sk->window_seq = %d\n",
-	  ack, ntohs(th->window), sk->rcv_ack_seq, sk->window_seq));
+	  ack, window, sk->rcv_ack_seq, sk->window_seq));
 
-  if (ntohs(th->window) > sk->max_window) {
-  	sk->max_window = ntohs(th->window);
+  if (window > sk->max_window) {
+  	sk->max_window = window;
 	sk->mss = min(sk->max_window, sk->mtu);
   }
 
@@ -2213,8 +2978,45 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 
   if (len != th->doff*4) flag |= 1;
 
+  /*
+   * A pure ack that neither acks new data nor moves the window is a
+   * duplicate: the other end got something beyond a hole.  After
+   * TCP_FASTRETRANS_THRESH of them resend just the segment at the head
+   * of the retransmit queue instead of waiting for the timer, and
+   * inflate the window by one for each further duplicate, as each
+   * means another segment has left the network (Jacobson's fast
+   * retransmit and fast recovery, RFC 2001).
+   */
+  if (ack == sk->rcv_ack_seq && !(flag & 1) && sk->send_head != NULL &&
+      sk->window_seq == ack + window) {
+	if (++sk->dup_acks == TCP_FASTRETRANS_THRESH) {
+		sk->ssthresh = max(sk->cong_window >> 1, 2);
+		sk->cong_window = sk->ssthresh + TCP_FASTRETRANS_THRESH;
+		sk->cong_count = 0;
+		sk->high_seq = sk->sent_seq;
+		sk->fast_retrans++;
+		ip_do_retransmit(sk, 0);
+	} else if (sk->dup_acks > TCP_FASTRETRANS_THRESH) {
+		sk->cong_window++;
+	}
+  } else if (after(ack, sk->rcv_ack_seq) &&
+	     sk->dup_acks >= TCP_FASTRETRANS_THRESH &&
+	     before(ack, sk->high_seq)) {
+	/* Partial ack: the next segment was lost too. */
+	flag |= 8;
+  } else {
+	/*
+	 * Anything else, new data acked or an ack carrying data or a
+	 * window update, breaks the run.  Leaving fast recovery, deflate
+	 * the window again.
+	 */
+	if (sk->dup_acks >= TCP_FASTRETRANS_THRESH)
+		sk->cong_window = sk->ssthresh;
+	sk->dup_acks = 0;
+  }
+
   /* See if our window has been shrunk. */
-  if (after(sk->window_seq, ack+ntohs(th->window))) {
+  if (after(sk->window_seq, ack+window)) {
 	/*
 	 * We may need to move packets from the send queue
 	 * to the write queue, if the window has been shrunk on us.
@@ -2232,7 +3034,7 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 
 	flag |= 4;
 
-	sk->window_seq = ack + ntohs(th->window);
+	sk->window_seq = ack + window;
 	cli();
 	while (skb2 != NULL) {
 		skb = skb2;
@@ -2275,10 +3077,10 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 	sk->packets_out= 0;
   }
 
-  sk->window_seq = ack + ntohs(th->window);
+  sk->window_seq = ack + window;
 
   /* We don't want too many packets out there. */
-  if (sk->timeout == TIME_WRITE && 
+  if (sk->timeout == TIME_WRITE && !sk->dup_acks &&
       sk->cong_window < 2048 && after(ack, sk->rcv_ack_seq)) {
 /* 
  * This is Jacobson's slow start and congestion avoidance. 
@@ -2390,7 +3192,10 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 		   * m stands for "measurement".
 		   */
 
-		  m = jiffies - oskb->when;  /* RTT */
+		  if (sk->rcv_tsecr)
+		    m = jiffies - sk->rcv_tsecr; /* RTT, from the echo */
+		  else
+		    m = jiffies - oskb->when;  /* RTT */
 		  m -= (sk->rtt >> 3);       /* m is now error in rtt est */
 		  sk->rtt += m;              /* rtt = 7/8 rtt + 1/8 new */
 		  if (m < 0)
@@ -2429,6 +3234,13 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 	}
   }
 
+  /*
+   * A partial ack during fast recovery means the segment now at
+   * the head was lost as well.  Resend it straight away.
+   */
+  if ((flag & 8) && sk->send_head != NULL)
+	ip_do_retransmit(sk, 0);
+
   /*
    * Maybe we can take some stuff off of the write queue,
    * and put it onto the xmit queue.
@@ -2524,15 +3336,17 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
  * It's possible that there should also be a test for TIME_WRITE, but
  * I think as long as "send_head != NULL" and "retransmit" is on, we've
  * got to be in real retransmission mode.
- *   Note that ip_do_retransmit is called with all==1.  Setting cong_window
- * back to 1 at the timeout will cause us to send 1, then 2, etc. packets.
- * As long as no further losses occur, this seems reasonable.
+ *   Receivers hold on to segments that arrive beyond a hole, so each
+ * ack during retransmission points at the next segment that really
+ * is missing, so ip_do_retransmit is called with all==0 and we resend
+ * only that one rather than the whole window.  Setting cong_window back
+ * to 1 at the timeout will cause us to send 1, then 2, etc. packets.
  */
 
-  if (((!flag) || (flag&4)) && sk->send_head != NULL &&
+  if (((!flag) || (flag&4)) && !(flag&8) && sk->send_head != NULL &&
       (((flag&2) && sk->retransmits) ||
        (sk->send_head->when + sk->rto < jiffies))) {
-	ip_do_retransmit(sk, 1);
+	ip_do_retransmit(sk, 0);
 	reset_timer(sk, TIME_WRITE, sk->rto);
       }
 
@@ -2541,6 +3355,98 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 }
 
 
+/*
+ * A segment has become contiguous with what we have already acked.
+ * Advance acked_seq past it and shrink the offered window to match.
+ */
+static void
+tcp_data_acked(struct sock *sk, struct sk_buff *skb)
+{
+  struct tcphdr *th = skb->h.th;
+  int newwindow;
+
+  if (after(th->ack_seq, sk->acked_seq)) {
+	newwindow = sk->window - (th->ack_seq - sk->acked_seq);
+	if (newwindow < 0)
+		newwindow = 0;	
+	sk->window = newwindow;
+	sk->acked_seq = th->ack_seq;
+  }
+  skb->acked = 1;
+
+  /* When we ack the fin, we turn on the RCV_SHUTDOWN flag. */
+  if (th->fin) {
+	if (!sk->dead) sk->state_change(sk);
+	sk->shutdown |= RCV_SHUTDOWN;
+  }
+}
+
+
+/*
+ * Put a segment that arrived beyond a hole onto the out of order
+ * queue, keeping it sorted by sequence number.  We search from the
+ * tail because segments after a loss usually keep arriving in order.
+ * Returns 0 if the segment duplicates one we already hold, in which
+ * case the caller still owns it.
+ */
+static int
+tcp_ofo_insert(struct sock *sk, struct sk_buff *skb)
+{
+  struct sk_buff *skb1;
+  unsigned long seq = skb->h.th->seq;
+
+  if (sk->ofo_queue == NULL) {
+	skb_queue_head(&sk->ofo_queue, skb);
+	return(1);
+  }
+  for(skb1 = sk->ofo_queue->prev; ; skb1 = (struct sk_buff *)skb1->prev) {
+	if (seq == skb1->h.th->seq) {
+		if (skb->len < skb1->len)
+			return(0);
+		skb_append(skb1, skb);
+		skb_unlink(skb1);
+		kfree_skb(skb1, FREE_READ);
+		return(1);
+	}
+	if (after(seq, skb1->h.th->seq)) {
+		skb_append(skb1, skb);
+		return(1);
+	}
+	if (skb1 == sk->ofo_queue) {
+		skb_queue_head(&sk->ofo_queue, skb);
+		return(1);
+	}
+  }
+}
+
+
+/*
+ * Move everything that is now in sequence from the out of order
+ * queue onto the receive queue.  Returns the number of segments moved.
+ */
+static int
+tcp_ofo_drain(struct sock *sk)
+{
+  struct sk_buff *skb;
+  int moved = 0;
+
+  while((skb = skb_peek(&sk->ofo_queue)) != NULL) {
+	if (after(skb->h.th->seq, sk->acked_seq))
+		break;
+	skb_unlink(skb);
+	if (!after(skb->h.th->ack_seq, sk->acked_seq)) {
+		/* Entirely covered by what we already have. */
+		kfree_skb(skb, FREE_READ);
+		continue;
+	}
+	skb_queue_tail(&sk->rqueue, skb);
+	tcp_data_acked(sk, skb);
+	moved++;
+  }
+  return(moved);
+}
+
+
 /*
  * This routine handles the data.  If there is room in the buffer,
  * it will be have already been moved into it.  If there is no
@@ -2550,9 +3456,9 @@ static int
 tcp_data(struct sk_buff *skb, struct sock *sk, 
 	 unsigned long saddr, unsigned short len)
 {
-  struct sk_buff *skb1, *skb2;
+  struct sk_buff *skb1;
   struct tcphdr *th;
-  int dup_dumped=0;
+  int in_order;
 
   th = skb->h.th;
   print_th(th);
@@ -2582,79 +3488,11 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
   }
 
   /*
-   * Now we have to walk the chain, and figure out where this one
-   * goes into it.  This is set up so that the last packet we received
-   * will be the first one we look at, that way if everything comes
-   * in order, there will be no performance loss, and if they come
-   * out of order we will be able to fit things in nicely.
+   * Segments that start at or before the next byte we expect go
+   * straight onto the tail of the receive queue, which thus only ever
+   * holds in order data.  Anything beyond a hole is parked on the out
+   * of order queue until the hole is filled, and then moved across.
    */
-
-  /* This should start at the last one, and then go around forwards. */
-  if (sk->rqueue == NULL) {
-	DPRINTF((DBG_TCP, "tcp_data: skb = %X:\n", skb));
-#ifdef OLDWAY
-	sk->rqueue = skb;
-	skb->next = skb;
-	skb->prev = skb;
-	skb->list = &sk->rqueue;
-#else
-	skb_queue_head(&sk->rqueue,skb);
-#endif		
-	skb1= NULL;
-  } else {
-	DPRINTF((DBG_TCP, "tcp_data adding to chain sk = %X:\n", sk));
-	for(skb1=sk->rqueue->prev; ; skb1 =(struct sk_buff *)skb1->prev) {
-		if(sk->debug)
-		{
-			printk("skb1=%p :", skb1);
-			printk("skb1->h.th->seq = %ld: ", skb1->h.th->seq);
-			printk("skb->h.th->seq = %ld\n",skb->h.th->seq);
-			printk("copied_seq = %ld acked_seq = %ld\n", sk->copied_seq,
-					sk->acked_seq);
-		}
-#ifdef OLD		
-		if (after(th->seq+1, skb1->h.th->seq)) {
-			skb->prev = skb1;
-			skb->next = skb1->next;
-			skb->next->prev = skb;
-			skb1->next = skb;
-			if (skb1 == sk->rqueue) sk->rqueue = skb;
-			break;
-		}
-		if (skb1->prev == sk->rqueue) {
-			skb->next= skb1;
-			skb->prev = skb1->prev;
-			skb->prev->next = skb;
-			skb1->prev = skb;
-			skb1 = NULL; /* so we know we might be able
-					to ack stuff. */
-			break;
-		}
-#else
-		if (th->seq==skb1->h.th->seq && skb->len>= skb1->len)
-		{
-			skb_append(skb1,skb);
-			skb_unlink(skb1);
-			kfree_skb(skb1,FREE_READ);
-			dup_dumped=1;
-			skb1=NULL;
-			break;
-		}
-		if (after(th->seq+1, skb1->h.th->seq))
-		{
-			skb_append(skb1,skb);
-			break;
-		}
-		if (skb1 == sk->rqueue)
-		{
-			skb_queue_head(&sk->rqueue, skb);		
-			break;
-		}
-#endif		
-	}
-	DPRINTF((DBG_TCP, "skb = %X:\n", skb));
-  }
-
   th->ack_seq = th->seq + skb->len;
   if (th->syn) th->ack_seq++;
   if (th->fin) th->ack_seq++;
@@ -2664,116 +3502,59 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
 	sk->acked_seq = sk->copied_seq;
   }
 
-  /* Now figure out if we can ack anything. */
-  if ((!dup_dumped && (skb1 == NULL || skb1->acked)) || before(th->seq, sk->acked_seq+1)) {
-      if (before(th->seq, sk->acked_seq+1)) {
-		int newwindow;
-
-		if (after(th->ack_seq, sk->acked_seq)) {
-			newwindow = sk->window -
-				       (th->ack_seq - sk->acked_seq);
-			if (newwindow < 0)
-				newwindow = 0;	
-			sk->window = newwindow;
-			sk->acked_seq = th->ack_seq;
-		}
-		skb->acked = 1;
-
-		/* When we ack the fin, we turn on the RCV_SHUTDOWN flag. */
-		if (skb->h.th->fin) {
-			if (!sk->dead) sk->state_change(sk);
-			sk->shutdown |= RCV_SHUTDOWN;
-		}
-	  
-		for(skb2 = (struct sk_buff *)skb->next;
-		    skb2 !=(struct sk_buff *) sk->rqueue;
-		    skb2 = (struct sk_buff *)skb2->next) {
-			if (before(skb2->h.th->seq, sk->acked_seq+1)) {
-				if (after(skb2->h.th->ack_seq, sk->acked_seq))
-				{
-					newwindow = sk->window -
-					 (skb2->h.th->ack_seq - sk->acked_seq);
-					if (newwindow < 0)
-						newwindow = 0;	
-					sk->window = newwindow;
-					sk->acked_seq = skb2->h.th->ack_seq;
-				}
-				skb2->acked = 1;
-
-				/*
-				 * When we ack the fin, we turn on
-				 * the RCV_SHUTDOWN flag.
-				 */
-				if (skb2->h.th->fin) {
-					sk->shutdown |= RCV_SHUTDOWN;
-					if (!sk->dead) sk->state_change(sk);
-				}
-
-				/* Force an immediate ack. */
-				sk->ack_backlog = sk->max_ack_backlog;
-			} else {
-				break;
-			}
-		}
+  in_order = !after(th->seq, sk->acked_seq);
+  if (in_order) {
+	skb_queue_tail(&sk->rqueue, skb);
+	tcp_data_acked(sk, skb);
+	sk->ack_backlog++;
 
-		/*
-		 * This also takes care of updating the window.
-		 * This if statement needs to be simplified.
-		 */
-		if (!sk->delay_acks ||
-		    sk->ack_backlog >= sk->max_ack_backlog || 
-		    sk->bytes_rcv > sk->max_unacked || th->fin) {
-/*			tcp_send_ack(sk->sent_seq, sk->acked_seq,sk,th, saddr); */
-		} else {
-			sk->ack_backlog++;
-			if(sk->debug)
-				printk("Ack queued.\n");
-			reset_timer(sk, TIME_WRITE, TCP_ACK_TIME);
-		}
+	/*
+	 * Ack straight away if this filled a hole or ends the stream,
+	 * and for every second segment (RFC 1122).  Otherwise hold the
+	 * ACK back for a little while, in case we have data to send.
+	 * The ACK also takes care of updating the window.
+	 */
+	if (tcp_ofo_drain(sk) || th->fin || !sk->delay_acks ||
+	    sk->ack_backlog >= TCP_DELACK_SEGS) {
+		tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
+	} else {
+		if(sk->debug)
+			printk("Ack queued.\n");
+		tcp_delack(sk);
 	}
+  } else if (!tcp_ofo_insert(sk, skb)) {
+	/* We already hold all of this one. */
+	tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
+	kfree_skb(skb, FREE_READ);
+	return(0);
   }
 
   /*
    * If we've missed a packet, send an ack.
    * Also start a timer to send another.
    */
-  if (!skb->acked) {
+  if (!in_order) {
 	/*
 	 * This is important.  If we don't have much room left,
 	 * we need to throw out a few packets so we have a good
 	 * window.  Note that mtu is used, not mss, because mss is really
 	 * for the send side.  He could be sending us stuff as large as mtu.
+	 * We throw away the segments furthest from the hole first, they
+	 * are the cheapest for the other end to resend.
 	 */
 	while (sk->prot->rspace(sk) < sk->mtu) {
-		skb1 = skb_peek(&sk->rqueue);
-		if (skb1 == NULL) {
-			printk("INET: tcp.c:tcp_data memory leak detected.\n");
+		skb1 = skb_peek(&sk->ofo_queue);
+		if (skb1 == NULL)
 			break;
-		}
-
-		/* Don't throw out something that has been acked. */
-		if (skb1->acked) {
+		skb1 = (struct sk_buff *)skb1->prev;
+		if (skb1 == skb)
 			break;
-		}
-		
 		skb_unlink(skb1);
-#ifdef OLDWAY		
-		if (skb1->prev == skb1) {
-			sk->rqueue = NULL;
-		} else {
-			sk->rqueue = (struct sk_buff *)skb1->prev;
-			skb1->next->prev = skb1->prev;
-			skb1->prev->next = skb1->next;
-		}
-#endif		
 		kfree_skb(skb1, FREE_READ);
 	}
 	tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
 	sk->ack_backlog++;
 	reset_timer(sk, TIME_WRITE, TCP_ACK_TIME);
-  } else {
-	/* We missed a packet.  Send an ack to try to resync things. */
-	tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
   }
 
   /* Now tell the user we may have some data. */
@@ -2977,7 +3758,8 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   DPRINTF((DBG_TCP, "TCP connect daddr=%s\n", in_ntoa(sin.sin_addr.s_addr)));
   
   /* Don't want a TCP connection going to a broadcast address */
-  if (chk_addr(sin.sin_addr.s_addr) == IS_BROADCAST) { 
+  if (chk_addr(sin.sin_addr.s_addr) == IS_BROADCAST ||
+      IN_MULTICAST(ntohl(sin.sin_addr.s_addr))) { 
 	DPRINTF((DBG_TCP, "TCP connection to broadcast address not allowed\n"));
 	return(-ENETUNREACH);
   }
@@ -2989,10 +3771,11 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   sk->inuse = 1;
   sk->daddr = sin.sin_addr.s_addr;
   sk->write_seq = jiffies * SEQ_TICK - seq_offset;
+  sk->dummy_th.dest = sin.sin_port;
+  tcp_tw_recycle(sk);
   sk->window_seq = sk->write_seq;
   sk->rcv_ack_seq = sk->write_seq -1;
   sk->err = 0;
-  sk->dummy_th.dest = sin.sin_port;
   release_sock(sk);
 
   buff = sk->prot->wmalloc(sk,MAX_SYN_SIZE,0, GFP_KERNEL);
@@ -3002,7 +3785,7 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   sk->inuse = 1;
   buff->mem_addr = buff;
   buff->mem_len = MAX_SYN_SIZE;
-  buff->len = 24;
+  buff->len = sizeof(struct tcphdr);
   buff->sk = sk;
   buff->free = 1;
   t1 = (struct tcphdr *) buff->data;
@@ -3032,32 +3815,28 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   t1->psh = 0;
   t1->syn = 1;
   t1->urg_ptr = 0;
-  t1->doff = 6;
 
-/* use 512 or whatever user asked for */
+/* use whatever user asked for, or what fits the path */
   if (sk->user_mss)
     sk->mtu = sk->user_mss;
-  else {
-#ifdef SUBNETSARELOCAL
-    if ((sk->saddr ^ sk->daddr) & default_mask(sk->saddr))
-#else
-    if ((sk->saddr ^ sk->daddr) & dev->pa_mask)
-#endif
-      sk->mtu = 576 - HEADER_SIZE;
-    else
-      sk->mtu = MAX_WINDOW;
-  }
-/* but not bigger than device MTU */
-  sk->mtu = min(sk->mtu, dev->mtu - HEADER_SIZE);
+  else
+    sk->mtu = MAX_WINDOW;
+/* but not bigger than the path MTU, as far as we know it */
+  sk->mtu = min(sk->mtu, min(dev->mtu, rt_pmtu(sk->daddr)) - HEADER_SIZE);
 
-  /* Put in the TCP options to say MTU. */
+  /*
+   * Put in the TCP options to say MTU, and offer window scaling
+   * and timestamps.  Both are dropped again if the SYN-ACK does
+   * not carry them.
+   */
+  sk->rcv_wscale = tcp_select_wscale(sk);
+  sk->tstamp_ok = 0;
   ptr = (unsigned char *)(t1+1);
-  ptr[0] = 2;
-  ptr[1] = 4;
-  ptr[2] = (sk->mtu) >> 8;
-  ptr[3] = (sk->mtu) & 0xff;
+  tmp = tcp_syn_options(ptr, sk->mtu, sk->rcv_wscale, 1, sk->ts_recent);
+  t1->doff = (sizeof(*t1) + tmp)/4;
+  buff->len += tmp;
   tcp_send_check(t1, sk->saddr, sk->daddr,
-		  sizeof(struct tcphdr) + 4, sk);
+		  sizeof(struct tcphdr) + tmp, sk);
 
   /* This must go first otherwise a really quick response will get reset. */
   sk->state = TCP_SYN_SENT;
@@ -3156,8 +3935,14 @@ tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
   }
   th = skb->h.th;
 
-  /* Find the socket. */
-  sk = get_sock(&tcp_prot, th->dest, saddr, th->source, daddr);
+  /*
+   * Find the socket.  A segment coming off a backlog, or handed on
+   * by the listener that created the sock, already knows it.
+   */
+  if (redo)
+	sk = skb->sk;
+  else
+	sk = get_sock(&tcp_prot, th->dest, saddr, th->source, daddr);
   DPRINTF((DBG_TCP, "<<\n"));
   DPRINTF((DBG_TCP, "len = %d, redo = %d, skb=%X\n", len, redo, skb));
   
@@ -3171,6 +3956,13 @@ tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
   }
 
   if (!redo) {
+	/* TCP is point to point: nothing sent to a group or a broadcast. */
+	if (chk_addr(daddr) != IS_MYADDR) {
+		skb->sk = NULL;
+		kfree_skb(skb, FREE_READ);
+		return(0);
+	}
+
 	if (tcp_check(th, len, saddr, daddr )) {
 		skb->sk = NULL;
 		DPRINTF((DBG_TCP, "packet dropped with bad checksum.\n"));
@@ -3185,6 +3977,15 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_rcv: bad checksum\n");
 
 	th->seq = ntohl(th->seq);
 
+	/* Is it for a connection that only lingers on in TIME_WAIT? */
+	if (tcp_tw_count) {
+		struct tcp_tw_bucket **twp;
+
+		twp = tcp_tw_find(daddr, th->dest, saddr, th->source);
+		if (*twp != NULL && tcp_tw_rcv(twp, skb, dev, opt, len))
+			return(0);
+	}
+
 	/* See if we know about the socket. */
 	if (sk == NULL) {
 		if (!th->rst)
@@ -3242,6 +4043,11 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_rcv: bad checksum\n");
   }
   sk->rmem_alloc += skb->mem_len;
 
+  /* Pick up the peer's timestamps before the ack is looked at. */
+  sk->rcv_tsecr = 0;
+  if (sk->tstamp_ok && !th->syn)
+	tcp_parse_tstamp(sk, th);
+
   DPRINTF((DBG_TCP, "About to do switch.\n"));
 
   /* Now deal with it. */
@@ -3369,11 +4175,30 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_rcv: not in seq\n");
 
 	case TCP_LISTEN:
 		if (th->rst) {
+			struct open_request **reqp;
+			unsigned long flags;
+
+			/* A reset for a half-open connection ends it. */
+			save_flags(flags);
+			cli();
+			reqp = tcp_synq_find(sk, saddr, th->source, daddr);
+			if (*reqp != NULL) {
+				struct open_request *req = *reqp;
+
+				tcp_synq_unlink(reqp);
+				tcp_statistics.TcpAttemptFails++;
+				kfree_s(req, sizeof(*req));
+			}
+			restore_flags(flags);
 			kfree_skb(skb, FREE_READ);
 			release_sock(sk);
 			return(0);
 		}
 		if (th->ack) {
+			if (tcp_conn_ack(sk, skb, daddr, saddr, opt, dev, len)) {
+				release_sock(sk);
+				return(0);
+			}
 			tcp_reset(daddr, saddr, th, sk->prot, opt,dev,sk->ip_tos,sk->ip_ttl);
 			kfree_skb(skb, FREE_READ);
 			release_sock(sk);
@@ -3620,9 +4445,10 @@ tcp_write_wakeup(struct sock *sk)
   t1->fin = 0;
   t1->syn = 0;
   t1->ack_seq = ntohl(sk->acked_seq);
-  t1->window = ntohs(tcp_select_window(sk)/*sk->prot->rspace(sk)*/);
-  t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+  t1->window = ntohs(tcp_select_window(sk) >> sk->rcv_wscale);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1)+tmp, sk);
 
   /* Send it and free it.
    * This will prevent the timer from automatically being restarted.
@@ -3744,6 +4570,7 @@ struct proto tcp_prot = {
   tcp_shutdown,
   tcp_setsockopt,
   tcp_getsockopt,
+  NULL,
   128,
   0,
   {NULL,},
@@ -20,9 +20,9 @@
 
 #include <linux/tcp.h>
 
-#define MAX_SYN_SIZE	44 + sizeof (struct sk_buff) + MAX_HEADER
-#define MAX_FIN_SIZE	40 + sizeof (struct sk_buff) + MAX_HEADER
-#define MAX_ACK_SIZE	40 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_SYN_SIZE	60 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_FIN_SIZE	52 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_ACK_SIZE	52 + sizeof (struct sk_buff) + MAX_HEADER
 #define MAX_RESET_SIZE	40 + sizeof (struct sk_buff) + MAX_HEADER
 #define MAX_WINDOW	4096
 #define MIN_WINDOW	2048
@@ -50,6 +50,9 @@
 #define TCP_TIMEWAIT_LEN (60*HZ) /* how long to wait to sucessfully 
 				  * close the socket, about 60 seconds	*/
 #define TCP_ACK_TIME	3000	/* time to delay before sending an ACK	*/
+#define TCP_DELACK_TIME	(HZ/5)	/* most we hold back the ACK for in
+				 * order data				*/
+#define TCP_DELACK_SEGS	2	/* segments we may leave unacked	*/
 #define TCP_DONE_TIME	250	/* maximum time to wait before actually
 				 * destroying a socket			*/
 #define TCP_WRITE_TIME	3000	/* initial time to wait for an ACK,
@@ -57,10 +60,22 @@
 #define TCP_CONNECT_TIME 2000	/* time to retransmit first SYN		*/
 #define TCP_SYN_RETRIES	5	/* number of times to retry openning a
 				 * connection 				*/
+#define TCP_SYNACK_RETRIES 5	/* times we resend a SYN-ACK before
+				 * giving up on a half-open connection	*/
+#define TCP_SYNACK_TIME	(3*HZ)	/* first wait for the ACK to a SYN-ACK,
+				 * doubled for each one resent		*/
+#define TCP_SYNQ_INTERVAL (HZ/5) /* how often the SYN queue is scanned	*/
+#define TCP_SYNQ_HSIZE	64	/* size of the SYN queue hash table	*/
+#define TCP_MAX_SYN_BACKLOG 128	/* half-open connections per listener	*/
+#define TCP_TW_HSIZE	256	/* size of the TIME_WAIT hash table	*/
+#define TCP_TW_INTERVAL	HZ	/* how often TIME_WAIT records are reaped */
 #define TCP_PROBEWAIT_LEN 100	/* time to wait between probes when
 				 * I've got something to write and
 				 * there is no window			*/
 
+#define TCP_FASTRETRANS_THRESH 3 /* duplicate acks before we resend the
+				 * segment at the head of the queue	*/
+
 #define TCP_NO_CHECK	0	/* turn to one if you want the default
 				 * to be no checksum			*/
 
@@ -73,6 +88,63 @@
 #define TCPOPT_NOP		1
 #define TCPOPT_EOL		0
 #define TCPOPT_MSS		2
+#define TCPOPT_WINDOW		3	/* RFC1323 window scale */
+#define TCPOPT_TIMESTAMP	8	/* RFC1323 timestamps */
+
+#define TCPOLEN_MSS		4
+#define TCPOLEN_WINDOW		3
+#define TCPOLEN_TIMESTAMP	10
+#define TCPOLEN_TSTAMP_ALIGNED	12	/* NOP NOP TIMESTAMP */
+
+#define TCP_MAX_WSCALE		14	/* RFC1323 limit on the shift */
+
+/*
+ * A connection that has sent a SYN to a listening socket and been
+ * answered, but has not yet acked our SYN.  This is all we keep of it
+ * until it has: the full sock is only made when that ACK arrives.
+ */
+struct open_request {
+  struct open_request	*next;		/* SYN queue hash chain		*/
+  struct sock		*sk;		/* the listener			*/
+  unsigned long		saddr;		/* our address			*/
+  unsigned long		daddr;		/* theirs			*/
+  unsigned short	sport;		/* our port, net order		*/
+  unsigned short	dport;		/* theirs, net order		*/
+  unsigned long		rcv_isn;	/* their initial sequence	*/
+  unsigned long		snt_isn;	/* ours				*/
+  unsigned long		ts_recent;	/* their SYN's timestamp	*/
+  unsigned long		window;		/* window our SYN-ACK offered	*/
+  unsigned long		expires;	/* jiffies of next SYN-ACK	*/
+  unsigned short	mtu;
+  unsigned char		snd_wscale;
+  unsigned char		rcv_wscale;
+  unsigned char		wscale_ok;
+  unsigned char		tstamp_ok;
+  unsigned char		ip_tos;
+  unsigned char		retrans;	/* SYN-ACKs resent so far	*/
+};
+
+/*
+ * A connection in TIME_WAIT whose socket has been closed.  The sock
+ * and its buffers are freed; this is enough to ack a retransmitted
+ * FIN, and to keep old duplicates from being taken for a new
+ * connection with the same addresses and ports.
+ */
+struct tcp_tw_bucket {
+  struct tcp_tw_bucket	*next;		/* TIME_WAIT hash chain		*/
+  unsigned long		saddr;		/* our address			*/
+  unsigned long		daddr;		/* theirs			*/
+  unsigned short	sport;		/* our port, net order		*/
+  unsigned short	dport;		/* theirs, net order		*/
+  unsigned long		snd_nxt;	/* one past our FIN		*/
+  unsigned long		rcv_nxt;	/* one past their FIN		*/
+  unsigned long		ts_recent;	/* their last timestamp		*/
+  unsigned long		expires;	/* jiffies when we forget it	*/
+  unsigned short	window;		/* as sent, already scaled	*/
+  unsigned char		tstamp_ok;
+  unsigned char		ip_tos;
+  unsigned char		ip_ttl;
+};
 
 /*
  * The next routines deal with comparing 32 bit unsigned ints
@@ -127,6 +199,8 @@ extern int	tcp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern void tcp_send_probe0(struct sock *sk);
 extern void tcp_enqueue_partial(struct sk_buff *, struct sock *);
 extern struct sk_buff * tcp_dequeue_partial(struct sock *);
+extern int	tcp_tw_bound(unsigned short num, unsigned long saddr);
+extern int	tcp_tw_get_info(char *buffer, int length);
 
 
 #endif	/* _TCP_H */
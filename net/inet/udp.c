@@ -44,6 +44,7 @@
  
 #include <asm/system.h>
 #include <asm/segment.h>
+#include <asm/checksum.h>
 #include <linux/types.h>
 #include <linux/sched.h>
 #include <linux/fcntl.h>
@@ -139,75 +140,65 @@ static unsigned short
 udp_check(struct udphdr *uh, int len,
 	  unsigned long saddr, unsigned long daddr)
 {
-  unsigned long sum;
-
   DPRINTF((DBG_UDP, "UDP: check(uh=%X, len = %d, saddr = %X, daddr = %X)\n",
 	   						uh, len, saddr, daddr));
 
   print_udp(uh);
+  return(csum_tcpudp_magic(saddr, daddr, len, IPPROTO_UDP,
+			   csum_partial((unsigned char *) uh, len, 0)));
+}
 
-  __asm__("\t addl %%ecx,%%ebx\n"
-	  "\t adcl %%edx,%%ebx\n"
-	  "\t adcl $0, %%ebx\n"
-	  : "=b"(sum)
-	  : "0"(daddr), "c"(saddr), "d"((ntohs(len) << 16) + IPPROTO_UDP*256)
-	  : "cx","bx","dx" );
-
-  if (len > 3) {
-	__asm__("\tclc\n"
-		"1:\n"
-		"\t lodsl\n"
-		"\t adcl %%eax, %%ebx\n"
-		"\t loop 1b\n"
-		"\t adcl $0, %%ebx\n"
-		: "=b"(sum) , "=S"(uh)
-		: "0"(sum), "c"(len/4) ,"1"(uh)
-		: "ax", "cx", "bx", "si" );
-  }
 
-  /* Convert from 32 bits to 16 bits. */
-  __asm__("\t movl %%ebx, %%ecx\n"
-	  "\t shrl $16,%%ecx\n"
-	  "\t addw %%cx, %%bx\n"
-	  "\t adcw $0, %%bx\n"
-	  : "=b"(sum)
-	  : "0"(sum)
-	  : "bx", "cx");
-
-  /* Check for an extra word. */
-  if ((len & 2) != 0) {
-	__asm__("\t lodsw\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum), "=S"(uh)
-		: "0"(sum) ,"1"(uh)
-		: "si", "ax", "bx");
-  }
+/*
+ * Checksum a datagram ip_glue() left as a chain of fragments.  All
+ * fragments but the last carry a multiple of 8 bytes, so the pieces
+ * can be summed one after the other as 16 bit words.
+ */
+static unsigned long
+udp_sum_words(unsigned char *buff, int len, unsigned long sum)
+{
+  unsigned short *p = (unsigned short *) buff;
 
-  /* Now check for the extra byte. */
-  if ((len & 1) != 0) {
-	__asm__("\t lodsb\n"
-		"\t movb $0,%%ah\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum)
-		: "0"(sum) ,"S"(uh)
-		: "si", "ax", "bx");
-  }
+  for (; len > 1; len -= 2)
+	sum += *p++;
+  if (len)
+	sum += *(unsigned char *) p;
+  return(sum);
+}
 
-  /* We only want the bottom 16 bits, but we never cleared the top 16. */
+
+static unsigned short
+udp_check_frags(struct sk_buff *skb, struct udphdr *uh, int len,
+		unsigned long saddr, unsigned long daddr)
+{
+  struct sk_buff *frag;
+  unsigned long sum;
+
+  sum = udp_sum_words((unsigned char *) uh, skb->tail - (unsigned char *) uh, 0);
+  for (frag = skb->fraglist; frag != NULL; frag = frag->fraglist)
+	sum = udp_sum_words(frag->h.raw, frag->len, sum);
+
+  /* The pseudo header. */
+  sum += (saddr & 0xffff) + (saddr >> 16);
+  sum += (daddr & 0xffff) + (daddr >> 16);
+  sum += htons(IPPROTO_UDP) + htons(len);
+
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
   return((~sum) & 0xffff);
 }
 
 
+/* Sum is the partial checksum of the data following the header. */
 static void
 udp_send_check(struct udphdr *uh, unsigned long saddr, 
-	       unsigned long daddr, int len, struct sock *sk)
+	       unsigned long daddr, int len, unsigned long sum, struct sock *sk)
 {
   uh->check = 0;
   if (sk && sk->no_check) 
   	return;
-  uh->check = udp_check(uh, len, saddr, daddr);
+  uh->check = csum_tcpudp_magic(saddr, daddr, len, IPPROTO_UDP,
+  		csum_partial((unsigned char *) uh, sizeof(*uh), sum));
   if (uh->check == 0) uh->check = 0xffff;
 }
 
@@ -221,6 +212,7 @@ udp_send(struct sock *sk, struct sockaddr_in *sin,
   struct udphdr *uh;
   unsigned char *buff;
   unsigned long saddr;
+  unsigned long sum = 0;
   int size, tmp;
   int err;
   
@@ -286,11 +278,14 @@ udp_send(struct sock *sk, struct sockaddr_in *sin,
   uh->dest = sin->sin_port;
   buff = (unsigned char *) (uh + 1);
 
-  /* Copy the user data. */
-  memcpy_fromfs(buff, from, len);
+  /* Copy the user data, summing it on the way. */
+  if (sk->no_check)
+	memcpy_fromfs(buff, from, len);
+  else
+	sum = csum_partial_copy_fromfs(from, buff, len, 0);
 
   /* Set up the UDP checksum. */
-  udp_send_check(uh, saddr, sin->sin_addr.s_addr, skb->len - tmp, sk);
+  udp_send_check(uh, saddr, sin->sin_addr.s_addr, skb->len - tmp, sum, sk);
 
   /* Send the datagram to the interface. */
   sk->prot->queue_xmit(sk, dev, skb, 1);
@@ -473,13 +468,35 @@ udp_recvfrom(struct sock *sk, unsigned char *to, int len,
   er=verify_area(VERIFY_WRITE,to,len);
   if(er)
   	return er;
+again:
   skb=skb_recv_datagram(sk,flags,noblock,&er);
   if(skb==NULL)
   	return er;
   copied = min(len, skb->len);
 
   /* FIXME : should use udp header size info value */
-  skb_copy_datagram(skb,sizeof(struct udphdr),to,copied);
+  if (skb->csum_pending) {
+	unsigned char *data = skb->h.raw + sizeof(struct udphdr);
+	unsigned long sum;
+
+	/* Finish the checksum udp_rcv() left us while copying the data. */
+	sum = csum_partial_copy_tofs(data, to, copied, skb->csum);
+	if (copied < skb->len)
+		sum = csum_block_add(sum, csum_partial(data + copied,
+					skb->len - copied, 0), copied);
+	if (csum_fold(sum)) {
+		DPRINTF((DBG_UDP, "UDP: bad checksum\n"));
+		skb_unlink(skb);
+		skb_free_datagram(skb);
+		if (noblock) {
+			release_sock(sk);
+			return(-EAGAIN);
+		}
+		goto again;
+	}
+	skb->csum_pending = 0;
+  } else
+	skb_copy_datagram(skb,sizeof(struct udphdr),to,copied);
 
   /* Copy the address. */
   if (sin) {
@@ -542,39 +559,13 @@ udp_close(struct sock *sk, int timeout)
 }
 
 
-/* All we need to do is get the socket, and then do a checksum. */
-int
-udp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
-	unsigned long daddr, unsigned short len,
-	unsigned long saddr, int redo, struct inet_protocol *protocol)
+/* Queue a checked datagram on a socket and wake up the reader. */
+static void
+udp_deliver(struct sock *sk, struct sk_buff *skb, struct device *dev,
+	    unsigned short len, unsigned long saddr, unsigned long daddr)
 {
-  struct sock *sk;
-  struct udphdr *uh;
-
-  uh = (struct udphdr *) skb->h.uh;
-  sk = get_sock(&udp_prot, uh->dest, saddr, uh->source, daddr);
-  if (sk == NULL) 
-  {
-	if (chk_addr(daddr) == IS_MYADDR) 
-	{
-		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_PORT_UNREACH, dev);
-	}
-	/*
-	 * Hmm.  We got an UDP broadcast to a port to which we
-	 * don't wanna listen.  The only thing we can do now is
-	 * to ignore the packet... -FvK
-	 */
-	skb->sk = NULL;
-	kfree_skb(skb, FREE_WRITE);
-	return(0);
-  }
-
-  if (uh->check && udp_check(uh, len, saddr, daddr)) {
-	DPRINTF((DBG_UDP, "UDP: bad checksum\n"));
-	skb->sk = NULL;
-	kfree_skb(skb, FREE_WRITE);
-	return(0);
-  }
+  struct sk_buff *frag;
+  unsigned long size;
 
   skb->sk = sk;
   skb->dev = dev;
@@ -585,30 +576,115 @@ udp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
   skb->saddr = daddr;
 
 
-  /* Charge it to the socket. */
-  if (sk->rmem_alloc + skb->mem_len >= sk->rcvbuf) 
+  /* Charge it, and any fragments chained to it, to the socket. */
+  size = skb->mem_len;
+  for (frag = skb->fraglist; frag != NULL; frag = frag->fraglist)
+	size += frag->mem_len;
+  if (sk->rmem_alloc + size >= sk->rcvbuf) 
   {
 	skb->sk = NULL;
 	kfree_skb(skb, FREE_WRITE);
 	release_sock(sk);
-	return(0);
+	return;
   }
-  sk->rmem_alloc += skb->mem_len;
+  sk->rmem_alloc += size;
+  for (frag = skb->fraglist; frag != NULL; frag = frag->fraglist)
+	frag->sk = sk;
 
   /* At this point we should print the thing out. */
   DPRINTF((DBG_UDP, "<< \n"));
-  print_udp(uh);
+  print_udp(skb->h.uh);
 
   /* Now add it to the data chain and wake things up. */
   
   skb_queue_tail(&sk->rqueue,skb);
 
-  skb->len = len - sizeof(*uh);
+  skb->len = len - sizeof(struct udphdr);
 
   if (!sk->dead) 
   	sk->data_ready(sk,skb->len);
   	
   release_sock(sk);
+}
+
+
+/* The next socket after sk that is bound to the port, for multicasts. */
+static struct sock *
+udp_mc_next(struct sock *sk, unsigned short num)
+{
+  for (sk = sk->next; sk != NULL; sk = sk->next) {
+	if (sk->num == ntohs(num) && !(sk->dead && sk->state == TCP_CLOSE))
+		return(sk);
+  }
+  return(NULL);
+}
+
+
+/* All we need to do is get the socket, and then do a checksum. */
+int
+udp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	unsigned long daddr, unsigned short len,
+	unsigned long saddr, int redo, struct inet_protocol *protocol)
+{
+  struct sock *sk, *sk2;
+  struct sk_buff *skb1;
+  struct udphdr *uh;
+
+  uh = (struct udphdr *) skb->h.uh;
+  sk = get_sock(&udp_prot, uh->dest, saddr, uh->source, daddr);
+  if (sk == NULL) 
+  {
+	if (chk_addr(daddr) == IS_MYADDR) 
+	{
+		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_PORT_UNREACH, dev);
+	}
+	/*
+	 * Hmm.  We got an UDP broadcast to a port to which we
+	 * don't wanna listen.  The only thing we can do now is
+	 * to ignore the packet... -FvK
+	 */
+	skb->sk = NULL;
+	kfree_skb(skb, FREE_WRITE);
+	return(0);
+  }
+
+  /*
+   * A chained datagram is checked now.  Otherwise only the headers are
+   * summed here and udp_recvfrom() finishes the sum while copying the
+   * data out, dropping the datagram then if it turns out to be bad.
+   */
+  if (uh->check && skb->fraglist) {
+	if (udp_check_frags(skb, uh, len, saddr, daddr)) {
+		DPRINTF((DBG_UDP, "UDP: bad checksum\n"));
+		skb->sk = NULL;
+		kfree_skb(skb, FREE_WRITE);
+		return(0);
+	}
+  } else if (uh->check) {
+	skb->csum = csum_tcpudp_nofold(saddr, daddr, len, IPPROTO_UDP,
+			csum_partial((unsigned char *) uh, sizeof(*uh), 0));
+	skb->csum_pending = 1;
+  }
+
+  /*
+   * A multicast goes to every socket on the port.  Each but the last
+   * gets a copy, which needs the datagram in one piece.
+   */
+  if (IN_MULTICAST(ntohl(daddr))) {
+	while ((sk2 = udp_mc_next(sk, uh->dest)) != NULL) {
+		if (skb->fraglist != NULL) {
+			skb = skb_linearize(skb, GFP_ATOMIC);
+			if (skb == NULL)
+				return(0);
+			uh = skb->h.uh;
+		}
+		skb1 = skb_copy(skb, GFP_ATOMIC);
+		if (skb1 != NULL)
+			udp_deliver(sk, skb1, dev, len, saddr, daddr);
+		sk = sk2;
+	}
+  }
+  udp_deliver(sk, skb, dev, len, saddr, daddr);
   return(0);
 }
 
@@ -639,6 +715,7 @@ struct proto udp_prot = {
   NULL,
   ip_setsockopt,
   ip_getsockopt,
+  NULL,
   128,
   0,
   {NULL,},
@@ -53,6 +53,8 @@ static int sock_readdir(struct inode *inode, struct file *file,
 			struct dirent *dirent, int count);
 static void sock_close(struct inode *inode, struct file *file);
 static int sock_select(struct inode *inode, struct file *file, int which, select_table *seltable);
+static int sock_mmap(struct inode *inode, struct file *file, unsigned long addr,
+		     size_t len, int prot, unsigned long off);
 static int sock_ioctl(struct inode *inode, struct file *file,
 		      unsigned int cmd, unsigned long arg);
 
@@ -64,7 +66,7 @@ static struct file_operations socket_file_ops = {
   sock_readdir,
   sock_select,
   sock_ioctl,
-  NULL,			/* mmap */
+  sock_mmap,
   NULL,			/* no special open code... */
   sock_close
 };
@@ -343,6 +345,23 @@ sock_select(struct inode *inode, struct file *file, int sel_type, select_table *
 }
 
 
+static int
+sock_mmap(struct inode *inode, struct file *file, unsigned long addr,
+	  size_t len, int prot, unsigned long off)
+{
+  struct socket *sock;
+
+  DPRINTF((net_debug, "NET: sock_mmap: inode = 0x%x\n", inode));
+  if (!(sock = socki_lookup(inode))) {
+	printk("NET: sock_mmap: can't find socket for inode!\n");
+	return(-EBADF);
+  }
+  if (sock->ops && sock->ops->mmap)
+	return(sock->ops->mmap(sock, inode, file, addr, len, prot, off));
+  return(-ENODEV);
+}
+
+
 void
 sock_close(struct inode *inode, struct file *file)
 {
@@ -44,6 +44,7 @@
 #include <linux/fs.h>
 #include <linux/ddi.h>
 #include <linux/malloc.h>
+#include <linux/mm.h>
 
 #include <asm/system.h>
 #include <asm/segment.h>
@@ -166,6 +167,50 @@ void unix_unlock(struct unix_proto_data *upd)
 	wake_up(&upd->wait);
 }
 
+
+/*
+ * Copy into and out of a socket's buffer, minding the wraparound.  The
+ * caller holds the lock and has checked the space or data is there.
+ * With user set the other end is in user space; a NULL 'to' just
+ * throws the data away.
+ */
+static void
+unix_buf_put(struct unix_proto_data *upd, char *from, int len, int user)
+{
+  int part;
+
+  while (len > 0) {
+	part = min(len, upd->buf_size - upd->bp_head);
+	if (user)
+		memcpy_fromfs(upd->buf + upd->bp_head, from, part);
+	  else
+		memcpy(upd->buf + upd->bp_head, from, part);
+	upd->bp_head = (upd->bp_head + part) & (upd->buf_size-1);
+	from += part;
+	len -= part;
+  }
+}
+
+
+static void
+unix_buf_get(struct unix_proto_data *upd, char *to, int len, int user)
+{
+  int part;
+
+  while (len > 0) {
+	part = min(len, upd->buf_size - upd->bp_tail);
+	if (to) {
+		if (user)
+			memcpy_tofs(to, upd->buf + upd->bp_tail, part);
+		  else
+			memcpy(to, upd->buf + upd->bp_tail, part);
+		to += part;
+	}
+	upd->bp_tail = (upd->bp_tail + part) & (upd->buf_size-1);
+	len -= part;
+  }
+}
+
 /* don't have to do anything. */
 static int
 unix_proto_listen(struct socket *sock, int backlog)
@@ -174,35 +219,85 @@ unix_proto_listen(struct socket *sock, int backlog)
 }
 
 
+/*
+ * SO_RCVBUF sizes the buffer our peers write into.  It is rounded up to
+ * a power of two, and only ever grows so that a writer that has already
+ * counted the space it has can't be caught out.
+ */
 static int
 unix_proto_setsockopt(struct socket *sock, int level, int optname,
 		      char *optval, int optlen)
 {
-  return(-EOPNOTSUPP);
-}
+  struct unix_proto_data *upd = UN_DATA(sock);
+  char *buf;
+  int size, avail;
+  int er;
 
+  if (level != SOL_SOCKET || optname != SO_RCVBUF)
+	return(-EOPNOTSUPP);
+  if (optlen < sizeof(int))
+	return(-EINVAL);
+  er=verify_area(VERIFY_READ, optval, sizeof(int));
+  if(er)
+  	return er;
+  avail = get_fs_long((int *) optval);
+  if (avail > UN_BUF_MAX) avail = UN_BUF_MAX;
+  for(size = PAGE_SIZE; size < avail; size <<= 1)
+	;
+  if (size <= upd->buf_size) return(0);
+  if (!(buf = (char *) vmalloc(size))) return(-ENOMEM);
 
-static int
-unix_proto_getsockopt(struct socket *sock, int level, int optname,
-		      char *optval, int *optlen)
-{
-  return(-EOPNOTSUPP);
+  unix_lock(upd);
+  if (size <= upd->buf_size) {		/* someone beat us to it */
+	unix_unlock(upd);
+	vfree(buf);
+	return(0);
+  }
+  avail = UN_BUF_AVAIL(upd);
+  unix_buf_get(upd, buf, avail, 0);
+  vfree(upd->buf);
+  upd->buf = buf;
+  upd->buf_size = size;
+  upd->bp_tail = 0;
+  upd->bp_head = avail;
+  unix_unlock(upd);
+  return(0);
 }
 
-static int
-unix_proto_sendto(struct socket *sock, void *buff, int len, int nonblock, 
-		  unsigned flags,  struct sockaddr *addr, int addr_len)
-{
-  return(-EOPNOTSUPP);
-}     
 
 static int
-unix_proto_recvfrom(struct socket *sock, void *buff, int len, int nonblock, 
-		    unsigned flags, struct sockaddr *addr, int *addr_len)
+unix_proto_getsockopt(struct socket *sock, int level, int optname,
+		      char *optval, int *optlen)
 {
-  return(-EOPNOTSUPP);
-}     
+  struct unix_proto_data *upd = UN_DATA(sock);
+  int val;
+  int er;
 
+  if (level != SOL_SOCKET)
+	return(-EOPNOTSUPP);
+  switch(optname) {
+	case SO_RCVBUF:
+		val = upd->buf_size;
+		break;
+	case SO_SNDBUF:
+		val = upd->peerupd ? upd->peerupd->buf_size : upd->buf_size;
+		break;
+	case SO_TYPE:
+		val = sock->type;
+		break;
+	default:
+		return(-EOPNOTSUPP);
+  }
+  er=verify_area(VERIFY_WRITE, optlen, sizeof(int));
+  if(er)
+  	return er;
+  put_fs_long(sizeof(int), (unsigned long *) optlen);
+  er=verify_area(VERIFY_WRITE, optval, sizeof(int));
+  if(er)
+  	return er;
+  put_fs_long(val, (unsigned long *) optval);
+  return(0);
+}
 
 static int
 unix_proto_shutdown(struct socket *sock, int how)
@@ -231,15 +326,20 @@ unix_proto_recv(struct socket *sock, void *buff, int len, int nonblock,
 }
 
 
+/*
+ * Find the socket bound to an inode.  A stream server sits unconnected
+ * waiting for clients; a datagram socket can be sent to in any state.
+ */
 static struct unix_proto_data *
 unix_data_lookup(struct sockaddr_un *sockun, int sockaddr_len,
-		 struct inode *inode)
+		 struct inode *inode, int type)
 {
   struct unix_proto_data *upd;
 
   for(upd = unix_datas; upd <= last_unix_data; ++upd) {
 	if (upd->refcnt > 0 && upd->socket &&
-	    upd->socket->state == SS_UNCONNECTED &&
+	    upd->socket->type == type &&
+	    (type == SOCK_DGRAM || upd->socket->state == SS_UNCONNECTED) &&
 	    upd->sockaddr_un.sun_family == sockun->sun_family &&
 	    upd->inode == inode) return(upd);
   }
@@ -261,6 +361,7 @@ unix_data_alloc(void)
 		upd->sockaddr_len = 0;
 		upd->sockaddr_un.sun_family = 0;
 		upd->buf = NULL;
+		upd->buf_size = 0;
 		upd->bp_head = upd->bp_tail = 0;
 		upd->inode = NULL;
 		upd->peerupd = NULL;
@@ -294,7 +395,7 @@ unix_data_deref(struct unix_proto_data *upd)
   if (upd->refcnt == 1) {
 	dprintf(1, "UNIX: data_deref: releasing data 0x%x\n", upd);
 	if (upd->buf) {
-		free_page((unsigned long)upd->buf);
+		vfree(upd->buf);
 		upd->buf = NULL;
 		upd->bp_head = upd->bp_tail = 0;
 	}
@@ -305,7 +406,7 @@ unix_data_deref(struct unix_proto_data *upd)
 
 /*
  * Upon a create, we allocate an empty protocol data,
- * and grab a page to buffer writes.
+ * and grab UN_BUF_DEFAULT bytes to buffer writes.
  */
 static int
 unix_proto_create(struct socket *sock, int protocol)
@@ -321,11 +422,13 @@ unix_proto_create(struct socket *sock, int protocol)
 	printk("UNIX: create: can't allocate buffer\n");
 	return(-ENOMEM);
   }
-  if (!(upd->buf = (char*) get_free_page(GFP_USER))) {
-	printk("UNIX: create: can't get page!\n");
+  if (!(upd->buf = (char*) vmalloc(UN_BUF_DEFAULT))) {
+	printk("UNIX: create: can't get buffer!\n");
+	upd->refcnt = 1;
 	unix_data_deref(upd);
 	return(-ENOMEM);
   }
+  upd->buf_size = UN_BUF_DEFAULT;
   upd->protocol = protocol;
   upd->socket = sock;
   UN_DATA(sock) = upd;
@@ -362,6 +465,7 @@ unix_proto_release(struct socket *sock, struct socket *peer)
   }
   UN_DATA(sock) = NULL;
   upd->socket = NULL;
+  wake_up(&upd->wait);		/* datagram writers waiting for space */
   if (upd->peerupd) unix_data_deref(upd->peerupd);
   unix_data_deref(upd);
   return(0);
@@ -432,48 +536,42 @@ unix_proto_bind(struct socket *sock, struct sockaddr *umyaddr,
 
 
 /*
- * Perform a connection. we can only connect to unix sockets
- * (I can't for the life of me find an application where that
- * wouldn't be the case!)
+ * Find the socket of the given type bound to the name in a user's
+ * sockaddr_un.  The data is returned referenced, so it stays put
+ * while the caller sleeps; unix_data_deref() it when done.
  */
 static int
-unix_proto_connect(struct socket *sock, struct sockaddr *uservaddr,
-		   int sockaddr_len, int flags)
+unix_find_peer(struct sockaddr *uservaddr, int sockaddr_len, int type,
+	       struct unix_proto_data **result)
 {
   char fname[sizeof(((struct sockaddr_un *)0)->sun_path) + 1];
   struct sockaddr_un sockun;
-  struct unix_proto_data *serv_upd;
+  struct unix_proto_data *upd;
   struct inode *inode;
   unsigned long old_fs;
   int i;
   int er;
 
-  dprintf(1, "UNIX: connect: socket 0x%x, servlen=%d\n", sock, sockaddr_len);
-
   if (sockaddr_len <= UN_PATH_OFFSET ||
       sockaddr_len > sizeof(struct sockaddr_un)) {
-	dprintf(1, "UNIX: connect: bad length %d\n", sockaddr_len);
+	dprintf(1, "UNIX: find_peer: bad length %d\n", sockaddr_len);
 	return(-EINVAL);
   }
-  if (sock->state == SS_CONNECTING) return(-EINPROGRESS);
-  if (sock->state == SS_CONNECTED) return(-EISCONN);
-
   er=verify_area(VERIFY_READ, uservaddr, sockaddr_len);
   if(er)
   	return er;
   memcpy_fromfs(&sockun, uservaddr, sockaddr_len);
   sockun.sun_path[sockaddr_len-UN_PATH_OFFSET] = '\0';
   if (sockun.sun_family != AF_UNIX) {
-	dprintf(1, "UNIX: connect: family is %d, not AF_UNIX(%d)\n",
+	dprintf(1, "UNIX: find_peer: family is %d, not AF_UNIX(%d)\n",
 	       					sockun.sun_family, AF_UNIX);
 	return(-EINVAL);
   }
 
   /*
    * Try to open the name in the filesystem - this is how we
-   * identify ourselves and our server. Note that we don't
-   * hold onto the inode that long, just enough to find our
-   * server. When we're connected, we mooch off the server.
+   * identify our peer. Note that we don't hold onto the inode
+   * that long, just enough to find the socket bound to it.
    */
   memcpy(fname, sockun.sun_path, sockaddr_len-UN_PATH_OFFSET);
   fname[sockaddr_len-UN_PATH_OFFSET] = '\0';
@@ -482,17 +580,54 @@ unix_proto_connect(struct socket *sock, struct sockaddr *uservaddr,
   i = open_namei(fname, 0, S_IFSOCK, &inode, NULL);
   set_fs(old_fs);
   if (i < 0) {
-	dprintf(1, "UNIX: connect: can't open socket %s\n", fname);
+	dprintf(1, "UNIX: find_peer: can't open socket %s\n", fname);
 	return(i);
   }
-  serv_upd = unix_data_lookup(&sockun, sockaddr_len, inode);
+  upd = unix_data_lookup(&sockun, sockaddr_len, inode, type);
+  if (upd) unix_data_ref(upd);
   iput(inode);
-  if (!serv_upd) {
-	dprintf(1, "UNIX: connect: can't locate peer %s at inode 0x%x\n",
+  if (!upd) {
+	dprintf(1, "UNIX: find_peer: can't locate peer %s at inode 0x%x\n",
 								fname, inode);
 	return(-EINVAL);
   }
-  if ((i = sock_awaitconn(sock, serv_upd->socket)) < 0) {
+  *result = upd;
+  return(0);
+}
+
+
+/*
+ * Perform a connection. we can only connect to unix sockets
+ * (I can't for the life of me find an application where that
+ * wouldn't be the case!)  A datagram socket just remembers its
+ * peer as the default destination, and may connect again later.
+ */
+static int
+unix_proto_connect(struct socket *sock, struct sockaddr *uservaddr,
+		   int sockaddr_len, int flags)
+{
+  struct unix_proto_data *serv_upd, *upd = UN_DATA(sock);
+  int i;
+
+  dprintf(1, "UNIX: connect: socket 0x%x, servlen=%d\n", sock, sockaddr_len);
+
+  if (sock->state == SS_CONNECTING) return(-EINPROGRESS);
+  if (sock->state == SS_CONNECTED) return(-EISCONN);
+
+  if ((i = unix_find_peer(uservaddr, sockaddr_len, sock->type, &serv_upd)) < 0)
+	return(i);
+  if (sock->type == SOCK_DGRAM) {
+	if (upd->peerupd) unix_data_deref(upd->peerupd);
+	upd->peerupd = serv_upd;		/* keeps the reference */
+	return(0);
+  }
+  if (!serv_upd->socket) {
+	unix_data_deref(serv_upd);
+	return(-ECONNREFUSED);
+  }
+  i = sock_awaitconn(sock, serv_upd->socket);
+  unix_data_deref(serv_upd);
+  if (i < 0) {
 	dprintf(1, "UNIX: connect: can't await connection\n");
 	return(i);
   }
@@ -575,11 +710,14 @@ unix_proto_getname(struct socket *sock, struct sockaddr *usockaddr,
 
   dprintf(1, "UNIX: getname: socket 0x%x for %s\n", sock, peer?"peer":"self");
   if (peer) {
-	if (sock->state != SS_CONNECTED) {
+	if (sock->type == SOCK_DGRAM)
+		upd = UN_DATA(sock)->peerupd;
+	  else
+		upd = (sock->state == SS_CONNECTED) ? UN_DATA(sock->conn) : NULL;
+	if (!upd) {
 		dprintf(1, "UNIX: getname: socket not connected\n");
 		return(-EINVAL);
 	}
-	upd = UN_DATA(sock->conn);
   } else
 	upd = UN_DATA(sock);
 
@@ -599,6 +737,146 @@ unix_proto_getname(struct socket *sock, struct sockaddr *usockaddr,
 }
 
 
+/*
+ * Queue a datagram on pupd, which the caller holds a reference to.
+ * Datagrams go in whole or not at all, so we wait for room for all of
+ * it.  Writers sleep on the peer data's wait queue: the reader's unlock
+ * wakes it, and so does the peer going away.
+ */
+static int
+unix_dgram_send(struct socket *sock, struct unix_proto_data *pupd,
+		char *ubuf, int size, int nonblock)
+{
+  struct unix_proto_data *upd = UN_DATA(sock);
+  struct unix_dgram hdr;
+  int er;
+
+  if (size < 0) return(-EINVAL);
+  hdr.len = size;
+  hdr.addrlen = upd->sockaddr_len;
+  if (sizeof(hdr) + hdr.addrlen + size > pupd->buf_size - 1)
+	return(-EMSGSIZE);
+  er=verify_area(VERIFY_READ, ubuf, size);
+  if(er)
+  	return er;
+
+  for(;;) {
+	if (!pupd->socket) {
+		dprintf(1, "UNIX: dgram_send: peer has gone\n");
+		return(-ECONNREFUSED);
+	}
+	unix_lock(pupd);
+	if (UN_BUF_SPACE(pupd) >= sizeof(hdr) + hdr.addrlen + size)
+		break;
+	unix_unlock(pupd);
+	dprintf(1, "UNIX: dgram_send: no space left...\n");
+	if (nonblock) return(-EAGAIN);
+	interruptible_sleep_on(&pupd->wait);
+	if (current->signal & ~current->blocked) {
+		dprintf(1, "UNIX: dgram_send: interrupted\n");
+		return(-ERESTARTSYS);
+	}
+  }
+  unix_buf_put(pupd, (char *) &hdr, sizeof(hdr), 0);
+  unix_buf_put(pupd, (char *) &upd->sockaddr_un, hdr.addrlen, 0);
+  unix_buf_put(pupd, ubuf, size, 1);
+  unix_unlock(pupd);
+  if (pupd->socket)
+	wake_up_interruptible(pupd->socket->wait);
+  return(size);
+}
+
+
+/*
+ * Take the next datagram off our buffer.  Whatever doesn't fit in the
+ * user's buffer is thrown away, as for any other datagram socket.
+ */
+static int
+unix_dgram_recv(struct socket *sock, char *ubuf, int size, int nonblock,
+		struct sockaddr *addr, int *addr_len)
+{
+  struct unix_proto_data *upd = UN_DATA(sock);
+  struct sockaddr_un sockun;
+  struct unix_dgram hdr;
+  int len, copied;
+  int er;
+
+  if (size < 0) return(-EINVAL);
+  er=verify_area(VERIFY_WRITE, ubuf, size);
+  if(er)
+  	return er;
+  if (addr_len) {
+	er=verify_area(VERIFY_WRITE, addr_len, sizeof(*addr_len));
+	if(er)
+		return er;
+	len = get_fs_long(addr_len);
+	if (len < 0) return(-EINVAL);
+	if (len) {
+		er=verify_area(VERIFY_WRITE, addr, len);
+		if(er)
+			return er;
+	}
+  }
+
+  for(;;) {
+	unix_lock(upd);
+	if (UN_BUF_AVAIL(upd))
+		break;
+	unix_unlock(upd);
+	dprintf(1, "UNIX: dgram_recv: no data available...\n");
+	if (nonblock) return(-EAGAIN);
+	interruptible_sleep_on(sock->wait);
+	if (current->signal & ~current->blocked) {
+		dprintf(1, "UNIX: dgram_recv: interrupted\n");
+		return(-ERESTARTSYS);
+	}
+  }
+  unix_buf_get(upd, (char *) &hdr, sizeof(hdr), 0);
+  unix_buf_get(upd, (char *) &sockun, hdr.addrlen, 0);
+  copied = min(size, hdr.len);
+  unix_buf_get(upd, ubuf, copied, 1);
+  unix_buf_get(upd, NULL, hdr.len - copied, 0);
+  unix_unlock(upd);
+
+  if (addr_len) {
+	len = get_fs_long(addr_len);
+	if (len > hdr.addrlen) len = hdr.addrlen;
+	if (len) memcpy_tofs(addr, &sockun, len);
+	put_fs_long(len, addr_len);
+  }
+  return(copied);
+}
+
+
+static int
+unix_proto_sendto(struct socket *sock, void *buff, int len, int nonblock, 
+		  unsigned flags,  struct sockaddr *addr, int addr_len)
+{
+  struct unix_proto_data *pupd;
+  int i;
+
+  if (sock->type != SOCK_DGRAM) return(-EOPNOTSUPP);
+  if (flags != 0) return(-EINVAL);
+  if (!addr)
+	return(unix_proto_write(sock, (char *) buff, len, nonblock));
+  if ((i = unix_find_peer(addr, addr_len, SOCK_DGRAM, &pupd)) < 0)
+	return(i);
+  i = unix_dgram_send(sock, pupd, (char *) buff, len, nonblock);
+  unix_data_deref(pupd);
+  return(i);
+}     
+
+
+static int
+unix_proto_recvfrom(struct socket *sock, void *buff, int len, int nonblock, 
+		    unsigned flags, struct sockaddr *addr, int *addr_len)
+{
+  if (sock->type != SOCK_DGRAM) return(-EOPNOTSUPP);
+  if (flags != 0) return(-EINVAL);
+  return(unix_dgram_recv(sock, (char *) buff, len, nonblock, addr, addr_len));
+}     
+
+
 /* We read from our own buf. */
 static int
 unix_proto_read(struct socket *sock, char *ubuf, int size, int nonblock)
@@ -607,6 +885,8 @@ unix_proto_read(struct socket *sock, char *ubuf, int size, int nonblock)
   int todo, avail;
   int er;
 
+  if (sock->type == SOCK_DGRAM)
+	return(unix_dgram_recv(sock, ubuf, size, nonblock, NULL, NULL));
   if ((todo = size) <= 0) return(0);
   upd = UN_DATA(sock);
   while(!(avail = UN_BUF_AVAIL(upd))) {
@@ -639,7 +919,7 @@ unix_proto_read(struct socket *sock, char *ubuf, int size, int nonblock)
 	}
 
 	if ((cando = todo) > avail) cando = avail;
-	if (cando >(part = BUF_SIZE - upd->bp_tail)) cando = part;
+	if (cando >(part = upd->buf_size - upd->bp_tail)) cando = part;
 	dprintf(1, "UNIX: read: avail=%d, todo=%d, cando=%d\n",
 	       					avail, todo, cando);
 	if((er=verify_area(VERIFY_WRITE,ubuf,cando))<0)
@@ -648,7 +928,7 @@ unix_proto_read(struct socket *sock, char *ubuf, int size, int nonblock)
 		return er;
 	}
 	memcpy_tofs(ubuf, upd->buf + upd->bp_tail, cando);
-	upd->bp_tail =(upd->bp_tail + cando) &(BUF_SIZE-1);
+	upd->bp_tail =(upd->bp_tail + cando) &(upd->buf_size-1);
 	ubuf += cando;
 	todo -= cando;
 	if (sock->state == SS_CONNECTED)
@@ -672,6 +952,10 @@ unix_proto_write(struct socket *sock, char *ubuf, int size, int nonblock)
   int todo, space;
   int er;
 
+  if (sock->type == SOCK_DGRAM) {
+	if (!(pupd = UN_DATA(sock)->peerupd)) return(-ENOTCONN);
+	return(unix_dgram_send(sock, pupd, ubuf, size, nonblock));
+  }
   if ((todo = size) <= 0) return(0);
   if (sock->state != SS_CONNECTED) {
 	dprintf(1, "UNIX: write: socket not connected\n");
@@ -724,7 +1008,7 @@ unix_proto_write(struct socket *sock, char *ubuf, int size, int nonblock)
 		return(-EPIPE);
 	}
 	if ((cando = todo) > space) cando = space;
-	if (cando >(part = BUF_SIZE - pupd->bp_head)) cando = part;
+	if (cando >(part = pupd->buf_size - pupd->bp_head)) cando = part;
 	dprintf(1, "UNIX: write: space=%d, todo=%d, cando=%d\n",
 	       					space, todo, cando);
 	er=verify_area(VERIFY_READ, ubuf, cando);
@@ -734,7 +1018,7 @@ unix_proto_write(struct socket *sock, char *ubuf, int size, int nonblock)
 		return er;
 	}
 	memcpy_fromfs(pupd->buf + pupd->bp_head, ubuf, cando);
-	pupd->bp_head =(pupd->bp_head + cando) &(BUF_SIZE-1);
+	pupd->bp_head =(pupd->bp_head + cando) &(pupd->buf_size-1);
 	ubuf += cando;
 	todo -= cando;
 	if (sock->state == SS_CONNECTED)
@@ -765,6 +1049,25 @@ unix_proto_select(struct socket *sock, int sel_type, select_table * wait)
 	return(0);
   }
 
+  /* Datagram sockets never see EOF; they can always sendto() someone. */
+  if (sock->type == SOCK_DGRAM) {
+	upd = UN_DATA(sock);
+	if (sel_type == SEL_IN) {
+		if (UN_BUF_AVAIL(upd)) return(1);
+		select_wait(sock->wait, wait);
+		return(0);
+	}
+	if (sel_type == SEL_OUT) {
+		peerupd = upd->peerupd;
+		if (!peerupd || !peerupd->socket ||
+		    UN_BUF_SPACE(peerupd) > sizeof(struct unix_dgram) + upd->sockaddr_len)
+			return(1);
+		select_wait(&peerupd->wait, wait);
+		return(0);
+	}
+	return(0);
+  }
+
   if (sel_type == SEL_IN) {
 	upd = UN_DATA(sock);
 	dprintf(1, "UNIX: select: there is%s data available\n",
@@ -812,7 +1115,21 @@ unix_proto_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 		er=verify_area(VERIFY_WRITE,(void *)arg, sizeof(unsigned long));
 		if(er)
 			return er;
-		if (UN_BUF_AVAIL(upd) || peerupd)
+		if (sock->type == SOCK_DGRAM) {
+			/* The size of the next datagram, if any. */
+			struct unix_dgram hdr;
+			int tail;
+
+			hdr.len = 0;
+			unix_lock(upd);
+			if (UN_BUF_AVAIL(upd)) {
+				tail = upd->bp_tail;
+				unix_buf_get(upd, (char *) &hdr, sizeof(hdr), 0);
+				upd->bp_tail = tail;
+			}
+			unix_unlock(upd);
+			put_fs_long(hdr.len,(unsigned long *)arg);
+		} else if (UN_BUF_AVAIL(upd) || peerupd)
 			put_fs_long(UN_BUF_AVAIL(upd),(unsigned long *)arg);
 		  else
 			put_fs_long(0,(unsigned long *)arg);
@@ -924,7 +1241,8 @@ static struct proto_ops unix_proto_ops = {
   unix_proto_shutdown,
   unix_proto_setsockopt,
   unix_proto_getsockopt,
-  NULL				/* unix_proto_fcntl	*/
+  NULL,				/* unix_proto_fcntl	*/
+  NULL				/* unix_proto_mmap	*/
 };
 
 
@@ -36,6 +36,7 @@ struct unix_proto_data {
 	struct sockaddr_un	sockaddr_un;
 	short		sockaddr_len;	/* >0 if name bound		*/
 	char		*buf;
+	int		buf_size;	/* power of 2, see below	*/
 	int		bp_head, bp_tail;
 	struct inode	*inode;
 	struct unix_proto_data	*peerupd;
@@ -56,12 +57,23 @@ extern struct unix_proto_data unix_datas[NSOCKETS];
 /*
  * Buffer size must be power of 2. buffer mgmt inspired by pipe code.
  * note that buffer contents can wraparound, and we can write one byte less
- * than full size to discern full vs empty.
+ * than full size to discern full vs empty.  Each socket starts out with
+ * UN_BUF_DEFAULT bytes, which SO_RCVBUF can raise as far as UN_BUF_MAX.
  */
-#define BUF_SIZE		PAGE_SIZE
+#define UN_BUF_DEFAULT		(4*PAGE_SIZE)
+#define UN_BUF_MAX		(32*PAGE_SIZE)
 #define UN_BUF_AVAIL(UPD)	(((UPD)->bp_head - (UPD)->bp_tail) & \
-								(BUF_SIZE-1))
-#define UN_BUF_SPACE(UPD)	((BUF_SIZE-1) - UN_BUF_AVAIL(UPD))
+							((UPD)->buf_size-1))
+#define UN_BUF_SPACE(UPD)	(((UPD)->buf_size-1) - UN_BUF_AVAIL(UPD))
+
+/*
+ * A SOCK_DGRAM socket keeps whole datagrams in the same buffer, each
+ * one this header followed by the sender's address and then the data.
+ */
+struct unix_dgram {
+	int		len;		/* bytes of data		*/
+	int		addrlen;	/* bytes of sender address	*/
+};
 
 #endif	/* _LINUX_UN_H */
 